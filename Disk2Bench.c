@@ -0,0 +1,1849 @@
+/*	Disk2Bench.c
+	Benchmarks for the Disk II Interface that run on any Linux box
+
+	latency		Runs Controller against an anonymous stand-in for PRU memory
+				and plays PRU0/PRU1 itself, timing:
+					track change		PRU0 track number -> new track staged and selected
+					sector handshake	PRU1 sectorSeq -> next sector released
+					write commit		PRU1 writeSeq -> written data in the PRU1 track buffer
+					write burst			16 sectors written back to back, 1 ms apart -> all 16 in the buffer
+
+	switch		Time-to-first-sector of a mount: "mount <image>" on Controller's control
+				socket (Disk2Control) until the new image's track 0 is in the PRU1 buffer
+				and released, the image read and encoded by the loader thread meanwhile
+
+	stream		Rotation with the per-sector release handshake against Controller -s,
+				where PRU1 streams and Controller only sees writes (one per 16 sectors):
+				sectors per second and the gap between sectors, sector time -r us
+				Both spin PRU1's 10 us SECTOR_GAP; streaming, that spin is the whole gap
+
+	encode		Sectors per second through diskEncodeNib() against diskEncodeTrack(),
+				checking the track encoder is bit-identical first; then back through
+				diskDecodeNib() against diskDecodeData(), checking both round trip
+
+	load		Image load + all 35 tracks encoded: fread or mmap and encode, against
+				mmap, hash and read the track file (Disk2TrackFile), page cache cold and warm
+				A .nib/.woz image (-f) is timed mapped whole and built by nibTrack() instead
+
+	unpack		Cold and warm load of one image raw against packed (Disk2Unpack): .po,
+				.po.gz, .2mg, and ShrinkIt LZW/1 and LZW/2 archives, each unpacked and
+				checked against the image first; -d puts them on the medium to measure
+				Before that, archives with fixed LZW codes worked out from the NuFX
+				format, not by the encoder here, must unpack to what they hold
+
+	edges		Write capture from WSIG edge timestamps (Disk2Edge): random sectors
+				turned into edge traces with jitter and a fast or slow A2 clock,
+				decoded by edgeDecode(), counting sectors that come back intact
+				-o saves one synthetic trace, -f decodes a recorded one: raw
+				little-endian uint16 PRU1 cycle counts, one per edge
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/vfs.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <zlib.h>
+
+#include "Disk2Mem.h"
+#include "Disk2Gcr.h"
+#include "Disk2Event.h"
+#include "Disk2TrackFile.h"
+#include "Disk2Nib.h"
+#include "Disk2Edge.h"
+#include "Disk2Mailbox.h"
+#include "Disk2Unpack.h"
+
+#define NUM_TRACKS			35
+#define NUM_SECTORS			16
+#define NUM_BYTES_SECTOR	256
+#define SMALL_NIBBLE_SIZE	374
+#define STARTUP_IMAGE		"Startup/BasicStartup.po"
+#define SECOND_IMAGE		"Games/Action/ABM.dsk"
+#define WAIT_TIMEOUT_NS		2000000000ULL	// give up on Controller after 2 s
+#define EVENT_FIFO			"events"		// in the bench directory
+#define CONTROL_SOCKET		"control"		// in the bench directory
+#define SECTOR_GAP_NS		10000ULL		// PRU1 waits this long before each packet
+#define BURST_WRITE_NS		1000000ULL		// write to write in a burst, an A2 takes about 11 ms
+#define DATA_NIBBLES_OFFSET	26				// in an encoded sector, see Disk2Image.h
+#define UNPACK_BENCH_FILES	5				// raw and packed copies of the image
+#define UNPACK_BENCH_CHUNK	4096			// ShrinkIt chunk
+#define UNPACK_BENCH_DELIMITER	0xDB		// ShrinkIt's usual RLE delimiter
+#define LZW_BENCH_SLOTS		8192			// hash table of LZW strings, twice the codes
+#define DECODE_ROUNDS		9				// decoders take turns, fastest round of each counts
+
+typedef struct
+{
+	unsigned int keys[LZW_BENCH_SLOTS];		// (prefix << 8 | byte) + 1, 0 = empty
+	uint16_t codes[LZW_BENCH_SLOTS];
+	unsigned int nextFree;
+	unsigned int decoderEntry;				// next entry the decoder will add
+	unsigned char first;					// 1 = the decoder takes the next code as a byte
+	int pending;							// LZW/2: string the last chunk ended with, -1 if none
+	unsigned char *out;
+	size_t length;
+	unsigned int bits, bitCount;
+} LzwState;
+
+static LzwState shrinkState;
+
+int benchLatency(int argc, char *argv[]);
+int benchSwitch(int argc, char *argv[]);
+int benchStream(int argc, char *argv[]);
+int benchEncode(int argc, char *argv[]);
+int benchLoad(int argc, char *argv[]);
+int benchLoadNib(const char *image, unsigned int n);
+int benchUnpack(int argc, char *argv[]);
+int loadRaw(const char *path);
+int loadPacked(const char *path, const unsigned char *expect);
+void makePackableImage(unsigned char *raw);
+int writePackedImages(const char *dir, const char **names, const unsigned char *raw);
+int writeNufx(const char *path, const unsigned char *raw, unsigned char format);
+int writeNufxThread(const char *path, const unsigned char *data, size_t length, unsigned char format);
+int checkKnownAnswers(const char *dir);
+size_t shrink(unsigned char *out, const unsigned char *raw, size_t size, unsigned char format);
+void lzwReset(LzwState *z);
+size_t lzwCompress(LzwState *z, unsigned char *out, const unsigned char *in, size_t n, int lzw2);
+unsigned int lzwFind(LzwState *z, unsigned int prefix, unsigned char c);
+void lzwAdd(LzwState *z, unsigned int prefix, unsigned char c, int lzw2);
+void lzwEmit(LzwState *z, unsigned int code);
+void putLe(unsigned char *p, unsigned long value, unsigned int bytes);
+int benchEdges(int argc, char *argv[]);
+int benchEdgeTrace(const char *path);
+unsigned char *loadByRead(const char *path);
+unsigned char *loadByMap(const char *path);
+int dropFromPageCache(const char *path);
+int makeBenchImages(char *dir, size_t dirLen);
+int writeBenchImage(const char *dir, const char *name, unsigned int seed);
+void readBenchTrack0(const char *dir, const char *name, unsigned char (*translateSector)(unsigned char), unsigned char *nibbles);
+void removeBenchImages(const char *dir);
+void removeTrackFiles(const char *dir);
+pid_t startController(const char *controller, PruMem *mem, const char *dir, const char *events, const char *option);
+void stopController(pid_t pid);
+int connectControl(const char *path);
+int waitFor(volatile unsigned char *adr, unsigned char value, unsigned char equal);
+int waitForTrack(unsigned char *pru, unsigned char track);
+int waitForRelease(unsigned char *pru);
+int waitForData(unsigned char *pru, unsigned char sector, const unsigned char *nibble);
+unsigned char *selectedBuffer(unsigned char *pru);
+unsigned char trackInBuffer(unsigned char *pru);
+unsigned long long cpuTicks(pid_t pid);
+void report(const char *name, unsigned long long *samples, unsigned int n);
+int compareULL(const void *a, const void *b);
+unsigned long long nowNs(void);
+
+//____________________
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "latency") == 0)
+		return benchLatency(argc - 1, argv + 1);
+	if (argc > 1 && strcmp(argv[1], "switch") == 0)
+		return benchSwitch(argc - 1, argv + 1);
+	if (argc > 1 && strcmp(argv[1], "stream") == 0)
+		return benchStream(argc - 1, argv + 1);
+	if (argc > 1 && strcmp(argv[1], "encode") == 0)
+		return benchEncode(argc - 1, argv + 1);
+	if (argc > 1 && strcmp(argv[1], "load") == 0)
+		return benchLoad(argc - 1, argv + 1);
+	if (argc > 1 && strcmp(argv[1], "unpack") == 0)
+		return benchUnpack(argc - 1, argv + 1);
+	if (argc > 1 && strcmp(argv[1], "edges") == 0)
+		return benchEdges(argc - 1, argv + 1);
+
+	printf("Usage: %s latency [-c ./Controller] [-n iterations] [-e fifo | poll]\n", argv[0]);
+	printf("       %s switch [-c ./Controller] [-n iterations] [-e fifo | poll]\n", argv[0]);
+	printf("       %s stream [-c ./Controller] [-n sectors] [-r sectorUs] [-e fifo | poll]\n", argv[0]);
+	printf("       %s encode [-n images]\n", argv[0]);
+	printf("       %s load [-f image.po] [-n iterations]\n", argv[0]);
+	printf("       %s unpack [-f image.po] [-d dir] [-n iterations]\n", argv[0]);
+	printf("       %s edges [-n sectors] [-j jitterCycles] [-o trace] | -f trace\n", argv[0]);
+	return EXIT_FAILURE;
+}
+
+//____________________
+int benchLatency(int argc, char *argv[])
+{
+	static unsigned char original[GCR_TRACK_SIZE];
+	const unsigned char *source;
+	unsigned char track, sector;
+	unsigned long long t0, *trackNs, *sectorNs, *writeNs, *burstNs, idleTicks;
+	unsigned int i, j, n, nTrack, nSector, nWrite, nBurst, bursts;
+	const char *controller, *transport;
+	char dir[64], events[96];
+	PruMem mem;
+	PruEvents pruEvents;
+	pid_t pid;
+	int opt;
+
+	controller = "./Controller";
+	transport = "fifo";
+	n = 200;
+	optind = 1;
+	while ((opt = getopt(argc, argv, "c:n:e:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'c':	controller = optarg;	break;
+			case 'n':	n = atoi(optarg);		break;
+			case 'e':	transport = optarg;		break;
+			default:	return EXIT_FAILURE;
+		}
+	}
+
+	if (pruMemOpen(&mem, PRU_MEM_ANON))
+		return EXIT_FAILURE;
+	mailboxSetEnable(mem.base, 0);				// drive enabled for the whole run
+
+	if (makeBenchImages(dir, sizeof(dir)))
+		return EXIT_FAILURE;
+	if (strcmp(transport, PRU_EVT_POLL) == 0)
+		snprintf(events, sizeof(events), "%s", PRU_EVT_POLL);
+	else
+		snprintf(events, sizeof(events), "%s/%s", dir, EVENT_FIFO);
+	if (eventOpen(&pruEvents, events, mem.base))
+		return EXIT_FAILURE;
+
+	pid = startController(controller, &mem, dir, events, NULL);
+	if (pid < 0 || waitForTrack(mem.base, 0))
+	{
+		printf("*** ERROR: Controller did not load track 0\n");
+		stopController(pid);
+		removeBenchImages(dir);
+		return EXIT_FAILURE;
+	}
+	usleep(100000);								// let Controller reach its main loop
+
+	// Idle: drive enabled, nothing moving
+	idleTicks = cpuTicks(pid);
+	sleep(1);
+	idleTicks = cpuTicks(pid) - idleTicks;
+
+	trackNs		= calloc(n, sizeof(unsigned long long));
+	sectorNs	= calloc(n, sizeof(unsigned long long));
+	writeNs		= calloc(n, sizeof(unsigned long long));
+	bursts		= n / NUM_SECTORS ? n / NUM_SECTORS : 1;
+	burstNs		= calloc(bursts, sizeof(unsigned long long));
+	nTrack = nSector = nWrite = nBurst = 0;
+
+	// Track change: step across the disk, far and near
+	track = 0;
+	for (i=0; i<n; i++)
+	{
+		track = (track + 1 + (i % 2) * 16) % NUM_TRACKS;
+		t0 = nowNs();
+		mailboxSetTrack(mem.base, 0, track);
+		eventSignal(&pruEvents, EVT_TRACK);
+		if (waitForTrack(mem.base, track))
+			break;
+		trackNs[nTrack++] = nowNs() - t0;
+	}
+
+	// Sector handshake: PRU1 holds after each sector till Controller releases the next
+	sector = 0;
+	for (i=0; i<n; i++)
+	{
+		sector = (sector + 1) % NUM_SECTORS;
+		t0 = nowNs();
+		mailboxSentSector(mem.base, 0, sector, mailboxCommand(mem.base)->bufSel[0] % TRACK_BUFS);
+		eventSignal(&pruEvents, EVT_SECTOR);
+		if (waitForRelease(mem.base))
+			break;
+		sectorNs[nSector++] = nowNs() - t0;
+	}
+
+	// Write commit: the sector just "sent" gets the data of the one 8 on, then its own back,
+	// so every write changes the track buffer
+	memcpy(original, selectedBuffer(mem.base), GCR_TRACK_SIZE);
+	for (i=0; i<n; i++)
+	{
+		sector = (sector + 1) % NUM_SECTORS;
+		source = original + (sector + (i / NUM_SECTORS % 2 ? 0 : 8)) % NUM_SECTORS * SMALL_NIBBLE_SIZE;
+		mailboxInjectWrite(mem.base, 0, source, sector);
+		t0 = nowNs();
+		mailboxSentSector(mem.base, 0, sector, mailboxCommand(mem.base)->bufSel[0] % TRACK_BUFS);
+		eventSignal(&pruEvents, EVT_SECTOR | EVT_WRITE);
+		if (waitForRelease(mem.base) || waitForData(mem.base, sector, source))
+			break;
+		writeNs[nWrite++] = nowNs() - t0;
+	}
+
+	// Write burst: a whole track written sector after sector, Controller drains as it can
+	for (i=0; i<bursts && nWrite==n; i++)
+	{
+		t0 = nowNs();
+		for (j=0; j<NUM_SECTORS; j++)
+		{
+			while (nowNs() - t0 < j * BURST_WRITE_NS)
+				sched_yield();
+			sector = (sector + 1) % NUM_SECTORS;
+			source = original + (sector + (i % 2 ? 0 : 8)) % NUM_SECTORS * SMALL_NIBBLE_SIZE;
+			mailboxInjectWrite(mem.base, 0, source, sector);
+			mailboxSentSector(mem.base, 0, sector, mailboxCommand(mem.base)->bufSel[0] % TRACK_BUFS);
+			eventSignal(&pruEvents, EVT_SECTOR | EVT_WRITE);
+			if (waitForRelease(mem.base))
+				break;
+		}
+		for (j=0; j<NUM_SECTORS; j++)
+			if (waitForData(mem.base, j, original + (j + (i % 2 ? 0 : 8)) % NUM_SECTORS * SMALL_NIBBLE_SIZE))
+				break;
+		if (j < NUM_SECTORS)
+			break;
+		burstNs[nBurst++] = nowNs() - t0;
+	}
+
+	stopController(pid);
+	eventClose(&pruEvents);
+	removeBenchImages(dir);
+	pruMemClose(&mem);
+
+	printf("--- Controller latency, %u iterations, events by %s (us)\n", n, transport);
+	report("track change", trackNs, nTrack);
+	report("sector handshake", sectorNs, nSector);
+	report("write commit", writeNs, nWrite);
+	report("write burst", burstNs, nBurst);
+	printf("  %-16s %7.1f %% CPU\n", "idle", 100.0 * idleTicks / sysconf(_SC_CLK_TCK));
+
+	free(trackNs);
+	free(sectorNs);
+	free(writeNs);
+	free(burstNs);
+	return (nTrack == n && nSector == n && nWrite == n && nBurst == bursts) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//____________________
+int benchSwitch(int argc, char *argv[])
+{
+	static unsigned char track0[2][GCR_TRACK_SIZE];
+	unsigned long long t0, start, *switchNs;
+	unsigned int i, n, nSwitch, image;
+	const char *controller, *transport;
+	char dir[64], events[96], option[96], command[96], reply[256];
+	PruMem mem;
+	pid_t pid;
+	int opt, controlFd;
+
+	controller = "./Controller";
+	transport = "fifo";
+	n = 50;
+	optind = 1;
+	while ((opt = getopt(argc, argv, "c:n:e:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'c':	controller = optarg;	break;
+			case 'n':	n = atoi(optarg);		break;
+			case 'e':	transport = optarg;		break;
+			default:	return EXIT_FAILURE;
+		}
+	}
+
+	if (pruMemOpen(&mem, PRU_MEM_ANON))
+		return EXIT_FAILURE;
+	mailboxSetEnable(mem.base, 1);				// drive idle, only image switches happen
+
+	if (makeBenchImages(dir, sizeof(dir)))
+		return EXIT_FAILURE;
+	readBenchTrack0(dir, STARTUP_IMAGE, prodosTranslateSector, track0[0]);
+	readBenchTrack0(dir, SECOND_IMAGE, dosTranslateSector, track0[1]);
+
+	if (strcmp(transport, PRU_EVT_POLL) == 0)
+		snprintf(events, sizeof(events), "%s", PRU_EVT_POLL);
+	else
+		snprintf(events, sizeof(events), "%s/%s", dir, EVENT_FIFO);
+
+	snprintf(option, sizeof(option), "-C%s/%s", dir, CONTROL_SOCKET);
+	pid = startController(controller, &mem, dir, events, option);
+	controlFd = -1;
+	if (pid < 0 || waitForTrack(mem.base, 0) || (controlFd = connectControl(option + 2)) < 0)
+	{
+		printf("*** ERROR: Controller did not load track 0 or open its control socket\n");
+		stopController(pid);
+		removeBenchImages(dir);
+		return EXIT_FAILURE;
+	}
+
+	// First sector of the new image is ready when its track 0 is selected and PRU1 is released
+	switchNs = calloc(n, sizeof(unsigned long long));
+	nSwitch = 0;
+	for (i=0; i<n; i++)
+	{
+		image = (i + 1) % 2;
+		snprintf(command, sizeof(command), "mount %s\n", image ? SECOND_IMAGE : STARTUP_IMAGE);
+		t0 = nowNs();
+		if (write(controlFd, command, strlen(command)) < 0)
+			break;
+		start = t0;
+		while (memcmp(selectedBuffer(mem.base), track0[image], GCR_TRACK_SIZE) != 0 || !mailboxReleased(mem.base))
+		{
+			sched_yield();
+			if (nowNs() - start > WAIT_TIMEOUT_NS)
+				break;
+		}
+		if (nowNs() - start > WAIT_TIMEOUT_NS)
+		{
+			printf("*** ERROR: timed out waiting for image switch\n");
+			break;
+		}
+		switchNs[nSwitch++] = nowNs() - t0;
+		if (read(controlFd, reply, sizeof(reply)) <= 0)	// "ok mounting ...", long since sent
+			break;
+		usleep(20000);							// drive settles, as between real mounts
+	}
+
+	close(controlFd);
+	stopController(pid);
+	removeBenchImages(dir);
+	pruMemClose(&mem);
+
+	printf("--- Time to first sector after a control socket mount, %u switches (us)\n", n);
+	report("image switch", switchNs, nSwitch);
+	free(switchNs);
+	return nSwitch == n ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//____________________
+int benchStream(int argc, char *argv[])
+{
+	unsigned char sector, mode, buffer, evtBits;
+	unsigned long long start, elapsed, t0, t1, *gapNs;
+	unsigned int i, n, sectorUs, nGap, writes;
+	const char *controller, *transport;
+	char dir[64], events[96];
+	PruMem mem;
+	PruEvents pruEvents;
+	pid_t pid;
+	int opt, result;
+
+	controller = "./Controller";
+	transport = "fifo";
+	n = 2000;
+	sectorUs = 100;
+	optind = 1;
+	while ((opt = getopt(argc, argv, "c:n:r:e:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'c':	controller = optarg;		break;
+			case 'n':	n = atoi(optarg);			break;
+			case 'r':	sectorUs = atoi(optarg);	break;
+			case 'e':	transport = optarg;			break;
+			default:	return EXIT_FAILURE;
+		}
+	}
+
+	gapNs = calloc(n, sizeof(unsigned long long));
+	result = EXIT_SUCCESS;
+	printf("--- Rotation, %u sectors of %u us, events by %s (us)\n", n, sectorUs, transport);
+	for (mode=0; mode<2; mode++)
+	{
+		if (pruMemOpen(&mem, PRU_MEM_ANON))
+			return EXIT_FAILURE;
+		mailboxSetEnable(mem.base, 0);
+
+		if (makeBenchImages(dir, sizeof(dir)))
+			return EXIT_FAILURE;
+		if (strcmp(transport, PRU_EVT_POLL) == 0)
+			snprintf(events, sizeof(events), "%s", PRU_EVT_POLL);
+		else
+			snprintf(events, sizeof(events), "%s/%s", dir, EVENT_FIFO);
+		if (eventOpen(&pruEvents, events, mem.base))
+			return EXIT_FAILURE;
+
+		pid = startController(controller, &mem, dir, events, mode ? "-s" : NULL);
+		if (pid < 0 || waitForTrack(mem.base, 0) || (mode && waitFor(&mailboxCommand(mem.base)->stream, 1, 1)))
+		{
+			printf("*** ERROR: Controller did not start\n");
+			stopController(pid);
+			removeBenchImages(dir);
+			return EXIT_FAILURE;
+		}
+		usleep(100000);							// let Controller reach its main loop
+
+		sector = 0;
+		nGap = writes = 0;
+		start = nowNs();
+		for (i=0; i<n; i++)
+		{
+			// Sector sent, with a write every 16th
+			sector = (sector + 1) % NUM_SECTORS;
+			buffer = mailboxCommand(mem.base)->bufSel[0] % TRACK_BUFS;
+			evtBits = mode ? 0 : EVT_SECTOR;
+			if (i % NUM_SECTORS == NUM_SECTORS - 1)
+			{
+				mailboxInjectWrite(mem.base, 0, selectedBuffer(mem.base) + sector * SMALL_NIBBLE_SIZE, sector);
+				evtBits |= EVT_WRITE;
+				writes++;
+			}
+
+			// Gap: until Controller releases the next sector, or a fixed spin when streaming
+			t0 = nowNs();
+			mailboxSentSector(mem.base, 0, sector, buffer);
+			if (evtBits)
+				eventSignal(&pruEvents, evtBits);
+			if (mode == 0 && waitForRelease(mem.base))
+				break;
+			t1 = nowNs();
+			while (nowNs() - t1 < SECTOR_GAP_NS)		// PRU1's SECTOR_GAP, in both modes
+				;
+			gapNs[nGap++] = nowNs() - t0;
+
+			// Next sector goes out
+			while (nowNs() - t0 < gapNs[nGap-1] + sectorUs * 1000ULL)
+				;
+		}
+		elapsed = nowNs() - start;
+		usleep(20000);							// last write reaches Controller
+
+		stopController(pid);
+		eventClose(&pruEvents);
+		removeBenchImages(dir);
+		pruMemClose(&mem);
+
+		printf("  %-18s %8.0f sectors/s  (%.0f at a fixed 10 us gap), %u writes\n", mode ? "streaming" : "handshake",
+			nGap * 1e9 / elapsed, 1e9 / (sectorUs * 1000.0 + SECTOR_GAP_NS), writes);
+		report(mode ? "  gap, streaming" : "  gap, handshake", gapNs, nGap);
+		if (nGap)
+			printf("  %-18s %8.1f us p99 - min\n", "  gap jitter", (gapNs[nGap * 99 / 100] - gapNs[0]) / 1000.0);
+		if (nGap != n)
+			result = EXIT_FAILURE;
+	}
+
+	free(gapNs);
+	return result;
+}
+
+//____________________
+int benchEncode(int argc, char *argv[])
+{
+	static unsigned char data[NUM_TRACKS][NUM_SECTORS][NUM_BYTES_SECTOR];
+	static unsigned char expected[NUM_TRACKS][GCR_TRACK_SIZE], actual[NUM_TRACKS][GCR_TRACK_SIZE];
+	unsigned char (*translateSector)(unsigned char);
+	unsigned char trk, sector, pattern, *nibble;
+	unsigned char decoded[NUM_BYTES_SECTOR];
+	unsigned long long t0, ns, nibNs, trackNs, scalarNs, decodeNibNs, decodeDataNs;
+	unsigned int i, j, n, round;
+	double sectors;
+	int opt;
+
+	n = 200;
+	optind = 1;
+	while ((opt = getopt(argc, argv, "n:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n':	n = atoi(optarg);	break;
+			default:	return EXIT_FAILURE;
+		}
+	}
+
+	// Bit-identical: zeros, ones, random data, both skews
+	srand(2022);
+	for (pattern=0; pattern<4; pattern++)
+	{
+		for (i=0; i<sizeof(data); i++)
+			((unsigned char *) data)[i] = pattern == 0 ? 0x00 : pattern == 1 ? 0xFF : rand();
+		translateSector = (pattern & 1) ? dosTranslateSector : prodosTranslateSector;
+
+		for (trk=0; trk<NUM_TRACKS; trk++)
+			for (sector=0; sector<NUM_SECTORS; sector++)
+				diskEncodeNib(expected[trk] + sector * GCR_NIBBLE_SIZE, data[trk][translateSector(sector)], 254, trk, sector);
+
+		for (j=0; j<2; j++)
+		{
+			memset(actual, 0, sizeof(actual));
+			for (trk=0; trk<NUM_TRACKS; trk++)
+			{
+				if (j == 0)
+					diskEncodeTrack(actual[trk], data[trk][0], translateSector, 254, trk);
+				else
+					diskEncodeTrackScalar(actual[trk], data[trk][0], translateSector, 254, trk);
+			}
+			if (memcmp(expected, actual, sizeof(expected)) != 0)
+			{
+				printf("*** ERROR: %s track encoder differs from diskEncodeNib, pattern %d\n",
+					j == 0 ? diskEncodeTrackImpl() : "scalar", pattern);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	t0 = nowNs();
+	for (i=0; i<n; i++)
+		for (trk=0; trk<NUM_TRACKS; trk++)
+			for (sector=0; sector<NUM_SECTORS; sector++)
+				diskEncodeNib(expected[trk] + sector * GCR_NIBBLE_SIZE, data[trk][prodosTranslateSector(sector)], 254, trk, sector);
+	nibNs = nowNs() - t0;
+
+	t0 = nowNs();
+	for (i=0; i<n; i++)
+		for (trk=0; trk<NUM_TRACKS; trk++)
+			diskEncodeTrackScalar(actual[trk], data[trk][0], prodosTranslateSector, 254, trk);
+	scalarNs = nowNs() - t0;
+
+	t0 = nowNs();
+	for (i=0; i<n; i++)
+		for (trk=0; trk<NUM_TRACKS; trk++)
+			diskEncodeTrack(actual[trk], data[trk][0], prodosTranslateSector, 254, trk);
+	trackNs = nowNs() - t0;
+
+	// Decoders: both give back what went in, a flipped nibble fails the checksum
+	diskGcrInit();
+	for (trk=0; trk<NUM_TRACKS; trk++)
+		for (sector=0; sector<NUM_SECTORS; sector++)
+		{
+			nibble = actual[trk] + sector * GCR_NIBBLE_SIZE;
+			if (diskDecodeNib(decoded, nibble) != 0 ||
+				memcmp(decoded, data[trk][prodosTranslateSector(sector)], NUM_BYTES_SECTOR) != 0 ||
+				diskDecodeData(decoded, nibble + GCR_DATA_OFFSET) != GCR_OK ||
+				memcmp(decoded, data[trk][prodosTranslateSector(sector)], NUM_BYTES_SECTOR) != 0)
+			{
+				printf("*** ERROR: trk= %d sector= %d does not decode to its data\n", trk, sector);
+				return EXIT_FAILURE;
+			}
+		}
+	nibble = actual[0];
+	nibble[GCR_DATA_OFFSET + 100] = translate6[untranslate6[nibble[GCR_DATA_OFFSET + 100]] ^ 0x01];
+	if (diskDecodeData(decoded, nibble + GCR_DATA_OFFSET) != GCR_BAD_CHECKSUM)
+	{
+		printf("*** ERROR: diskDecodeData missed a bad checksum\n");
+		return EXIT_FAILURE;
+	}
+	diskEncodeTrack(actual[0], data[0][0], prodosTranslateSector, 254, 0);
+
+	// One pass each was as noisy as the difference: clock ramps and preemption picked the winner
+	decodeNibNs = decodeDataNs = ~0ULL;
+	for (round=0; round<DECODE_ROUNDS; round++)
+	{
+		t0 = nowNs();
+		for (i=0; i<n; i++)
+			for (trk=0; trk<NUM_TRACKS; trk++)
+				for (sector=0; sector<NUM_SECTORS; sector++)
+					diskDecodeNib(decoded, actual[trk] + sector * GCR_NIBBLE_SIZE);
+		ns = nowNs() - t0;
+		if (ns < decodeNibNs)
+			decodeNibNs = ns;
+
+		t0 = nowNs();
+		for (i=0; i<n; i++)
+			for (trk=0; trk<NUM_TRACKS; trk++)
+				for (sector=0; sector<NUM_SECTORS; sector++)
+					diskDecodeData(decoded, actual[trk] + sector * GCR_NIBBLE_SIZE + GCR_DATA_OFFSET);
+		ns = nowNs() - t0;
+		if (ns < decodeDataNs)
+			decodeDataNs = ns;
+	}
+
+	sectors = (double) n * NUM_TRACKS * NUM_SECTORS;
+	printf("--- Encoder throughput, %u images, output bit-identical\n", n);
+	printf("  %-24s %12.0f sectors/s  %8.2f ms/image\n", "diskEncodeNib",
+		sectors * 1e9 / nibNs, nibNs / (n * 1e6));
+	printf("  %-24s %12.0f sectors/s  %8.2f ms/image  x%.2f\n", "diskEncodeTrack scalar",
+		sectors * 1e9 / scalarNs, scalarNs / (n * 1e6), (double) nibNs / scalarNs);
+	printf("  diskEncodeTrack %-8s %12.0f sectors/s  %8.2f ms/image  x%.2f\n", diskEncodeTrackImpl(),
+		sectors * 1e9 / trackNs, trackNs / (n * 1e6), (double) nibNs / trackNs);
+	printf("--- Decoder throughput, %u images, round trip checked, best of %d rounds\n", n, DECODE_ROUNDS);
+	printf("  %-24s %12.0f sectors/s  %8.2f ms/image\n", "diskDecodeNib",
+		sectors * 1e9 / decodeNibNs, decodeNibNs / (n * 1e6));
+	printf("  %-24s %12.0f sectors/s  %8.2f ms/image  x%.2f\n", "diskDecodeData",
+		sectors * 1e9 / decodeDataNs, decodeDataNs / (n * 1e6), (double) decodeNibNs / decodeDataNs);
+	return EXIT_SUCCESS;
+}
+
+//____________________
+int benchLoad(int argc, char *argv[])
+{
+	static unsigned char nibbles[NUM_TRACKS][GCR_TRACK_SIZE];
+	static const char *names[6] = { "fread cold", "mmap cold", "fread warm", "mmap warm",
+		"track file cold", "track file warm" };
+	unsigned char *raw, *tracks[NUM_TRACKS];
+	unsigned long long hash;
+	unsigned long long t0, *samples;
+	unsigned int i, n, nDone, run;
+	unsigned char trk;
+	const char *image;
+	char dir[64], path[128], trackDir[160], trackPath[256];
+	struct statfs fs;
+	int opt;
+
+	image = NULL;
+	n = 50;
+	optind = 1;
+	while ((opt = getopt(argc, argv, "f:n:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'f':	image = optarg;			break;
+			case 'n':	n = atoi(optarg);		break;
+			default:	return EXIT_FAILURE;
+		}
+	}
+
+	dir[0] = '\0';
+	if (image == NULL)
+	{
+		if (makeBenchImages(dir, sizeof(dir)))
+			return EXIT_FAILURE;
+		snprintf(path, sizeof(path), "%s/%s", dir, STARTUP_IMAGE);
+		image = path;
+	}
+
+	if (statfs(image, &fs) == 0 && fs.f_type == 0x01021994)
+		printf("  %s is on tmpfs, cold and warm are the same\n", image);
+	if (nibKind(image))
+		return benchLoadNib(image, n);
+	printf("--- Image load + encode 35 tracks, %u iterations (us)\n", n);
+
+	// Track file for the last two runs, built the way Disk2Image builds it
+	snprintf(trackDir, sizeof(trackDir), "%s.tracks", image);
+	trackFileInit(trackDir);
+	for (trk=0; trk<NUM_TRACKS; trk++)
+		tracks[trk] = nibbles[trk];
+	raw = loadByMap(image);
+	if (!raw)
+		return EXIT_FAILURE;
+	hash = trackFileHash(raw, NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR);
+	for (trk=0; trk<NUM_TRACKS; trk++)
+		diskEncodeTrack(nibbles[trk], raw + trk * NUM_SECTORS * NUM_BYTES_SECTOR, prodosTranslateSector, 254, trk);
+	munmap(raw, NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR);
+	trackFileSave(hash, TRACK_FILE_PRODOS, tracks);
+	trackFilePath(trackPath, sizeof(trackPath), hash, TRACK_FILE_PRODOS);
+
+	samples = calloc(n, sizeof(unsigned long long));
+	for (run=0; run<6; run++)
+	{
+		nDone = 0;
+		for (i=0; i<n; i++)
+		{
+			if ((run < 2 || run == 4) && dropFromPageCache(image))
+				break;
+			if (run == 4 && dropFromPageCache(trackPath))
+				break;
+
+			t0 = nowNs();
+			raw = (run & 1 || run >= 4) ? loadByMap(image) : loadByRead(image);
+			if (!raw)
+				break;
+			if (run >= 4)
+			{
+				hash = trackFileHash(raw, NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR);
+				if (trackFileLoad(hash, TRACK_FILE_PRODOS, tracks))
+				{
+					printf("*** ERROR: track file missed\n");
+					munmap(raw, NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR);
+					break;
+				}
+			}
+			else
+			{
+				for (trk=0; trk<NUM_TRACKS; trk++)
+					diskEncodeTrack(nibbles[trk], raw + trk * NUM_SECTORS * NUM_BYTES_SECTOR, prodosTranslateSector, 254, trk);
+			}
+			samples[nDone++] = nowNs() - t0;
+
+			if (run & 1 || run >= 4)				// the cache keeps the image, not timed
+				munmap(raw, NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR);
+			else
+				free(raw);
+		}
+		report(names[run], samples, nDone);
+	}
+	free(samples);
+	unlink(trackPath);
+	rmdir(trackDir);
+
+	if (dir[0])
+		removeBenchImages(dir);
+	return EXIT_SUCCESS;
+}
+
+//____________________
+int benchLoadNib(const char *image, unsigned int n)
+{
+	// .nib/.woz: whole file mapped, 35 tracks through nibTrack(), no GCR encode
+	static unsigned char track[GCR_TRACK_SIZE];
+	static const char *names[2] = { "mmap + nib cold", "mmap + nib warm" };
+	unsigned long long t0, *samples;
+	unsigned int i, nDone, run, trimmed;
+	unsigned char *image0, trk;
+	struct stat st;
+	int fd, kind;
+
+	kind = nibKind(image);
+	if (stat(image, &st) == -1)
+	{
+		printf("*** ERROR: could not open %s\n", image);
+		return EXIT_FAILURE;
+	}
+
+	printf("--- .nib/.woz load + 35 tracks, %u iterations (us)\n", n);
+	samples = calloc(n, sizeof(unsigned long long));
+	trimmed = 0;
+	for (run=0; run<2; run++)
+	{
+		nDone = 0;
+		for (i=0; i<n; i++)
+		{
+			if (run == 0 && dropFromPageCache(image))
+				break;
+
+			t0 = nowNs();
+			fd = open(image, O_RDONLY);
+			if (fd == -1)
+				break;
+			image0 = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+			close(fd);
+			if (image0 == MAP_FAILED)
+				break;
+			if (nibCheck(image0, st.st_size, kind))
+			{
+				munmap(image0, st.st_size);
+				break;
+			}
+			trimmed = 0;
+			for (trk=0; trk<NUM_TRACKS; trk++)
+				trimmed += nibTrack(track, image0, st.st_size, kind, trk);
+			samples[nDone++] = nowNs() - t0;
+			munmap(image0, st.st_size);
+		}
+		report(names[run], samples, nDone);
+	}
+	printf("  %u sync nibbles trimmed to fit the track buffers\n", trimmed);
+	free(samples);
+	return EXIT_SUCCESS;
+}
+
+//____________________
+int benchUnpack(int argc, char *argv[])
+{
+	/*	Cold and warm load of one image, raw against packed: raw is mapped and
+		encoded, as Disk2Image loads a .po without a track file; packed ones
+		are unpacked and encoded a track at a time, as Disk2Image does
+		All copies go in one directory, on the medium being measured
+	*/
+	static const char *names[UNPACK_BENCH_FILES] = { "image.po", "image.po.gz", "image.2mg", "image.sdk", "image.shk" };
+	static const char *labels[UNPACK_BENCH_FILES] = { "raw .po", "gzip", "2mg", "ShrinkIt LZW/1", "ShrinkIt LZW/2" };
+	static unsigned char raw[NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR];
+	char dir[128], path[192], label[64];
+	unsigned long long t0, *samples;
+	unsigned int i, n, nDone, file, run;
+	const char *image, *parent;
+	struct statfs fs;
+	struct stat st;
+	FILE *fd;
+	int opt;
+
+	image = NULL;
+	parent = "/tmp";
+	n = 50;
+	optind = 1;
+	while ((opt = getopt(argc, argv, "f:d:n:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'f':	image = optarg;			break;
+			case 'd':	parent = optarg;		break;
+			case 'n':	n = atoi(optarg);		break;
+			default:	return EXIT_FAILURE;
+		}
+	}
+
+	if (image)
+	{
+		fd = fopen(image, "rb");
+		if (!fd || fread(raw, 1, sizeof(raw), fd) == 0)
+		{
+			printf("*** ERROR: could not read %s\n", image);
+			return EXIT_FAILURE;
+		}
+		fclose(fd);
+	}
+	else
+		makePackableImage(raw);
+
+	snprintf(dir, sizeof(dir), "%s/disk2unpackXXXXXX", parent);
+	if (mkdtemp(dir) == NULL)
+	{
+		printf("*** ERROR: could not create a directory in %s\n", parent);
+		return EXIT_FAILURE;
+	}
+	if (checkKnownAnswers(dir) || writePackedImages(dir, names, raw))
+	{
+		removeBenchImages(dir);
+		return EXIT_FAILURE;
+	}
+	if (statfs(dir, &fs) == 0 && fs.f_type == 0x01021994)
+		printf("  %s is on tmpfs, cold and warm are the same; -d a directory on the SD card\n", dir);
+
+	printf("--- %s, %s\n", image ? image : "synthetic image, 40 % free sectors", dir);
+	for (file=0; file<UNPACK_BENCH_FILES; file++)
+	{
+		snprintf(path, sizeof(path), "%s/%s", dir, names[file]);
+		if (stat(path, &st) == -1 || (file && loadPacked(path, raw)))
+		{
+			removeBenchImages(dir);
+			return EXIT_FAILURE;
+		}
+		printf("  %-18s %7lld bytes  %5.1f %%\n", labels[file], (long long) st.st_size, st.st_size * 100.0 / sizeof(raw));
+	}
+
+	printf("--- Load + encode 35 tracks, %u iterations (us)\n", n);
+	samples = calloc(n, sizeof(unsigned long long));
+	for (run=0; run<2; run++)
+	{
+		for (file=0; file<UNPACK_BENCH_FILES; file++)
+		{
+			snprintf(path, sizeof(path), "%s/%s", dir, names[file]);
+			nDone = 0;
+			for (i=0; i<n; i++)
+			{
+				if (run == 0 && dropFromPageCache(path))
+					break;
+				t0 = nowNs();
+				if (file == 0 ? loadRaw(path) : loadPacked(path, NULL))
+					break;
+				samples[nDone++] = nowNs() - t0;
+			}
+			snprintf(label, sizeof(label), "%s %s", labels[file], run == 0 ? "cold" : "warm");
+			report(label, samples, nDone);
+		}
+	}
+	free(samples);
+	removeBenchImages(dir);
+	return EXIT_SUCCESS;
+}
+
+//____________________
+int loadRaw(const char *path)
+{
+	// Mapped and encoded, as imagePrepare() does with no track file; returns 0 on success
+	static unsigned char track[GCR_TRACK_SIZE];
+	unsigned char *raw, trk;
+
+	raw = loadByMap(path);
+	if (!raw)
+		return 1;
+	for (trk=0; trk<NUM_TRACKS; trk++)
+		diskEncodeTrack(track, raw + trk * NUM_SECTORS * NUM_BYTES_SECTOR, prodosTranslateSector, 254, trk);
+	munmap(raw, NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR);
+	return 0;
+}
+
+//____________________
+int loadPacked(const char *path, const unsigned char *expect)
+{
+	/*	Unpacked and encoded a track at a time, as imagePrepare() does
+		expect, if not NULL, is what it must unpack to; returns 0 on success
+	*/
+	static unsigned char raw[NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR], track[GCR_TRACK_SIZE];
+	unsigned char trk;
+	Unpack *unpack;
+
+	unpack = unpackOpen(path);
+	if (!unpack)
+		return 1;
+	for (trk=0; trk<NUM_TRACKS; trk++)
+	{
+		if (unpackRead(unpack, raw + trk * NUM_SECTORS * NUM_BYTES_SECTOR, NUM_SECTORS * NUM_BYTES_SECTOR) !=
+			NUM_SECTORS * NUM_BYTES_SECTOR)
+		{
+			printf("*** ERROR: %s: track %d short\n", path, trk);
+			unpackClose(unpack);
+			return 1;
+		}
+		diskEncodeTrack(track, raw + trk * NUM_SECTORS * NUM_BYTES_SECTOR, prodosTranslateSector, 254, trk);
+	}
+	unpackClose(unpack);
+
+	if (expect && memcmp(raw, expect, sizeof(raw)) != 0)
+	{
+		printf("*** ERROR: %s does not unpack to the image\n", path);
+		return 1;
+	}
+	return 0;
+}
+
+//____________________
+void makePackableImage(unsigned char *raw)
+{
+	/*	Stands in for a real disk: 40 % of sectors free (zeros), the rest
+		code-like, bytes from a small skewed set with some runs
+	*/
+	static const unsigned char common[16] = { 0x00, 0xA9, 0x8D, 0x20, 0x60, 0xAD, 0xC9, 0xD0,
+		0xF0, 0x4C, 0xA0, 0xBD, 0x85, 0xA5, 0xE8, 0xFF };
+	unsigned int sector, i, run;
+	unsigned char *data;
+
+	srand(2024);
+	memset(raw, 0, NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR);
+	for (sector=0; sector<NUM_TRACKS * NUM_SECTORS; sector++)
+	{
+		if (rand() % 10 < 4)
+			continue;
+		data = raw + sector * NUM_BYTES_SECTOR;
+		for (i=0; i<NUM_BYTES_SECTOR; i+=run)
+		{
+			run = rand() % 8 == 0 ? 1 + rand() % 12 : 1;
+			if (run > NUM_BYTES_SECTOR - i)
+				run = NUM_BYTES_SECTOR - i;
+			memset(data + i, rand() % 3 ? common[rand() % 16] : rand(), run);
+		}
+	}
+}
+
+//____________________
+int writePackedImages(const char *dir, const char **names, const unsigned char *raw)
+{
+	// raw as a .po, then gzipped, behind a 2IMG header and in NuFX disk archives, LZW/1 and LZW/2
+	unsigned char header[64];
+	char path[192];
+	gzFile gz;
+	FILE *fd;
+	int error;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, names[0]);
+	fd = fopen(path, "wb");
+	error = !fd || fwrite(raw, NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR, 1, fd) != 1;
+	if (fd)
+		fclose(fd);
+
+	snprintf(path, sizeof(path), "%s/%s", dir, names[1]);
+	gz = gzopen(path, "wb9");
+	error |= !gz || gzwrite(gz, raw, NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR) == 0;
+	if (gz)
+		gzclose(gz);
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, "2IMGDii2", 8);
+	putLe(header + 8, 64, 2);							// header size
+	putLe(header + 10, 1, 2);							// version
+	putLe(header + 12, 1, 4);							// ProDOS order
+	putLe(header + 20, NUM_TRACKS * NUM_SECTORS / 2, 4);	// blocks
+	putLe(header + 24, 64, 4);							// data offset
+	putLe(header + 28, NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR, 4);
+	snprintf(path, sizeof(path), "%s/%s", dir, names[2]);
+	fd = fopen(path, "wb");
+	error |= !fd || fwrite(header, 64, 1, fd) != 1 || fwrite(raw, NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR, 1, fd) != 1;
+	if (fd)
+		fclose(fd);
+
+	snprintf(path, sizeof(path), "%s/%s", dir, names[3]);
+	error |= writeNufx(path, raw, 2);
+	snprintf(path, sizeof(path), "%s/%s", dir, names[4]);
+	error |= writeNufx(path, raw, 3);
+
+	if (error)
+		printf("*** ERROR: could not write the images in %s\n", dir);
+	return error;
+}
+
+//____________________
+int writeNufx(const char *path, const unsigned char *raw, unsigned char format)
+{
+	/*	NuFX archive of one record, a filename thread and raw as a 280 block
+		disk image thread, thread format 2 (LZW/1) or 3 (LZW/2)
+	*/
+	unsigned char *data;
+	size_t length;
+	int error;
+
+	data = malloc(2 * NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR);
+	if (!data)
+		return 1;
+	length = shrink(data, raw, NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR, format);
+	error = writeNufxThread(path, data, length, format);
+	free(data);
+	return error;
+}
+
+//____________________
+int writeNufxThread(const char *path, const unsigned char *data, size_t length, unsigned char format)
+{
+	// The archive around length bytes of disk image thread data, already in format
+	static const unsigned char masterId[6] = { 0x4E, 0xF5, 0x46, 0xE9, 0x6C, 0xE5 };
+	static const unsigned char recordId[4] = { 0x4E, 0xF5, 0x46, 0xD8 };
+	static const char name[] = "BENCH";
+	unsigned char master[48], record[58], threads[2][16];
+	FILE *fd;
+	int error;
+
+	memset(threads, 0, sizeof(threads));
+	putLe(threads[0], 3, 2);							// filename
+	putLe(threads[0] + 8, strlen(name), 4);
+	putLe(threads[0] + 12, strlen(name), 4);
+	putLe(threads[1], 2, 2);							// data
+	putLe(threads[1] + 2, format, 2);
+	putLe(threads[1] + 4, 1, 2);						// disk image
+	putLe(threads[1] + 8, NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR, 4);
+	putLe(threads[1] + 12, length, 4);
+
+	memset(record, 0, sizeof(record));
+	memcpy(record, recordId, 4);
+	putLe(record + 6, sizeof(record), 2);				// attribute count, version 0
+	putLe(record + 10, 2, 4);							// threads
+	putLe(record + 14, 1, 2);							// ProDOS
+	record[16] = '/';
+	putLe(record + 26, NUM_TRACKS * NUM_SECTORS / 2, 4);	// blocks
+	putLe(record + 30, 512, 2);							// of bytes
+
+	memset(master, 0, sizeof(master));
+	memcpy(master, masterId, 6);
+	putLe(master + 8, 1, 4);							// records
+	putLe(master + 28, 2, 2);							// version
+	putLe(master + 38, sizeof(master) + sizeof(record) + sizeof(threads) + strlen(name) + length, 4);
+
+	fd = fopen(path, "wb");
+	error = !fd || fwrite(master, sizeof(master), 1, fd) != 1 || fwrite(record, sizeof(record), 1, fd) != 1 ||
+		fwrite(threads, sizeof(threads), 1, fd) != 1 || fwrite(name, strlen(name), 1, fd) != 1 ||
+		fwrite(data, length, 1, fd) != 1;
+	if (fd)
+		fclose(fd);
+	return error;
+}
+
+//____________________
+int checkKnownAnswers(const char *dir)
+{
+	/*	LZW/1 and LZW/2 archives whose codes were worked out by hand from the
+		NuFX format, so unpacking them checks Disk2Unpack against the format
+		rather than against shrink(); returns 0 if both hold what they should
+		Chunk 0 is "ABABABA" then zeros, RLE'd to 55 bytes:
+			41 42 41 42 41 42 41, DB 00 FF 15 times, DB 00 F8
+		LZW'd from a fresh table, 21 codes of 9 bits, low bit first:
+			41 42 101 103 DB 00 FF 105 107 106 108 10B 10A 10D 109 10F 10C 110 10E 105 F8
+		103 comes before it is defined, the K w K w K case. LZW/2 has chunk 0
+		again as chunk 1, the table carried on, 115 = 105 + 'A' added first:
+			103 102 102 111 119 113 11B 112 11D 11A F8
+		Every other chunk is zeros, RLE'd to DB 00 FF 16 times and not LZW'd
+	*/
+	static const unsigned char codes1[24] = { 0x41, 0x84, 0x04, 0x1C, 0xB8, 0x0D, 0xC0, 0xBF, 0x82, 0x07,
+		0x0D, 0x22, 0x5C, 0xA8, 0xB0, 0x61, 0xC2, 0x87, 0x0C, 0x21, 0x3A, 0x2C, 0x88, 0x0F };
+	static const unsigned char codes2[13] = { 0x03, 0x05, 0x0A, 0x8C, 0x98, 0x71, 0xE2, 0x46, 0x89, 0x1D,
+		0x35, 0xE2, 0x03 };
+	static unsigned char expect[NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR];
+	unsigned char data[2048], *o;
+	unsigned int chunk, i;
+	unsigned char format;
+	char path[192];
+	int error;
+
+	error = 0;
+	for (format=2; format<=3; format++)
+	{
+		memset(expect, 0, sizeof(expect));
+		memcpy(expect, "ABABABA", 7);
+		if (format == 3)
+			memcpy(expect + UNPACK_BENCH_CHUNK, "ABABABA", 7);
+
+		o = data;
+		if (format == 2)
+			*o++ = 0, *o++ = 0;								// CRC, not checked
+		*o++ = 254;
+		*o++ = UNPACK_BENCH_DELIMITER;
+		for (chunk=0; chunk<sizeof(expect)/UNPACK_BENCH_CHUNK; chunk++)
+		{
+			if (chunk == 0 || (chunk == 1 && format == 3))
+			{
+				*o++ = 55;
+				*o++ = format == 3 ? 0x80 : 0;
+				if (format == 2)
+					*o++ = 1;
+				else
+					*o++ = (chunk ? sizeof(codes2) : sizeof(codes1)) + 4, *o++ = 0;
+				memcpy(o, chunk ? codes2 : codes1, chunk ? sizeof(codes2) : sizeof(codes1));
+				o += chunk ? sizeof(codes2) : sizeof(codes1);
+				continue;
+			}
+			*o++ = 48;
+			*o++ = 0;
+			if (format == 2)
+				*o++ = 0;
+			for (i=0; i<16; i++)
+				*o++ = UNPACK_BENCH_DELIMITER, *o++ = 0x00, *o++ = 0xFF;
+		}
+
+		snprintf(path, sizeof(path), "%s/known.%s", dir, format == 2 ? "sdk" : "shk");
+		if (writeNufxThread(path, data, o - data, format) || loadPacked(path, expect))
+			error = 1;
+		else
+			printf("  ShrinkIt LZW/%d known answer ok\n", format - 1);
+		unlink(path);
+	}
+	return error;
+}
+
+//____________________
+size_t shrink(unsigned char *out, const unsigned char *raw, size_t size, unsigned char format)
+{
+	/*	ShrinkIt thread data for raw, see Disk2Unpack.c: each 4 KB chunk RLE'd,
+		then LZW'd; either is left out where it does not shrink the chunk
+		Returns the bytes put in out, which takes twice size
+	*/
+	static unsigned char rle[2 * UNPACK_BENCH_CHUNK], lzw[4 * UNPACK_BENCH_CHUNK];
+	unsigned char *o;
+	size_t pos, rleLength, lzwLength, i, run;
+
+	o = out;
+	if (format == 2)
+		*o++ = 0, *o++ = 0;								// CRC, not checked
+	*o++ = 254;											// volume
+	*o++ = UNPACK_BENCH_DELIMITER;
+	lzwReset(&shrinkState);
+
+	for (pos=0; pos<size; pos+=UNPACK_BENCH_CHUNK)
+	{
+		// Runs of 4 or more, and the delimiter itself, as delimiter, byte, count - 1
+		rleLength = 0;
+		for (i=pos; i<pos+UNPACK_BENCH_CHUNK; i+=run)
+		{
+			for (run=1; i+run<pos+UNPACK_BENCH_CHUNK && run<256 && raw[i + run] == raw[i]; run++)
+				;
+			if (run >= 4 || raw[i] == UNPACK_BENCH_DELIMITER)
+			{
+				rle[rleLength++] = UNPACK_BENCH_DELIMITER;
+				rle[rleLength++] = raw[i];
+				rle[rleLength++] = run - 1;
+			}
+			else
+			{
+				memset(rle + rleLength, raw[i], run);
+				rleLength += run;
+			}
+		}
+		if (rleLength >= UNPACK_BENCH_CHUNK)
+		{
+			rleLength = UNPACK_BENCH_CHUNK;
+			memcpy(rle, raw + pos, UNPACK_BENCH_CHUNK);
+		}
+
+		if (format == 2)
+			lzwReset(&shrinkState);
+		lzwLength = lzwCompress(&shrinkState, lzw, rle, rleLength, format == 3);
+		if (lzwLength >= rleLength)
+		{
+			lzwReset(&shrinkState);						// LZW/2 starts over after a chunk without LZW
+			lzwLength = 0;
+		}
+
+		*o++ = rleLength;
+		*o++ = rleLength >> 8 | (format == 3 && lzwLength ? 0x80 : 0);
+		if (format == 2)
+			*o++ = lzwLength != 0;
+		else if (lzwLength)
+		{
+			*o++ = lzwLength + 4;
+			*o++ = (lzwLength + 4) >> 8;
+		}
+		memcpy(o, lzwLength ? lzw : rle, lzwLength ? lzwLength : rleLength);
+		o += lzwLength ? lzwLength : rleLength;
+	}
+	return o - out;
+}
+
+//____________________
+void lzwReset(LzwState *z)
+{
+	memset(z->keys, 0, sizeof(z->keys));
+	z->nextFree = 0x101;
+	z->decoderEntry = 0x101;
+	z->first = 1;
+	z->pending = -1;
+}
+
+//____________________
+size_t lzwCompress(LzwState *z, unsigned char *out, const unsigned char *in, size_t n, int lzw2)
+{
+	/*	LZW codes for n bytes, starting on a byte; the width of each is the one
+		the decoder will read it at, from the table entry it will be at
+		LZW/2 carries the table into the next chunk, so the string the last
+		chunk ended with still gets its entry, from this chunk's first byte
+	*/
+	unsigned int w, code;
+	size_t i;
+
+	z->out = out;
+	z->length = 0;
+	z->bits = 0;
+	z->bitCount = 0;
+
+	if (z->pending >= 0)
+		lzwAdd(z, z->pending, in[0], lzw2);
+	w = in[0];
+	for (i=1; i<n; i++)
+	{
+		code = lzwFind(z, w, in[i]);
+		if (code)
+		{
+			w = code;
+			continue;
+		}
+		lzwEmit(z, w);
+		lzwAdd(z, w, in[i], lzw2);
+		w = in[i];
+	}
+	lzwEmit(z, w);
+	z->pending = lzw2 ? (int) w : -1;
+	if (z->bitCount)
+		z->out[z->length++] = z->bits;
+	return z->length;
+}
+
+//____________________
+unsigned int lzwFind(LzwState *z, unsigned int prefix, unsigned char c)
+{
+	// Code of prefix + c, 0 if none
+	unsigned int key, slot;
+
+	key = (prefix << 8 | c) + 1;
+	for (slot=key * 2654435761u >> 19; z->keys[slot]; slot=(slot + 1) & (LZW_BENCH_SLOTS - 1))
+		if (z->keys[slot] == key)
+			return z->codes[slot];
+	return 0;
+}
+
+//____________________
+void lzwAdd(LzwState *z, unsigned int prefix, unsigned char c, int lzw2)
+{
+	// prefix + c as the next entry; LZW/2 sends a clear code once the table is full
+	unsigned int key, slot;
+
+	if (z->nextFree == 0x1000)
+		return;
+	key = (prefix << 8 | c) + 1;
+	for (slot=key * 2654435761u >> 19; z->keys[slot]; slot=(slot + 1) & (LZW_BENCH_SLOTS - 1))
+		;
+	z->keys[slot] = key;
+	z->codes[slot] = z->nextFree++;
+
+	if (lzw2 && z->nextFree == 0x1000)
+	{
+		lzwEmit(z, 0x100);
+		memset(z->keys, 0, sizeof(z->keys));
+		z->nextFree = 0x101;
+	}
+}
+
+//____________________
+void lzwEmit(LzwState *z, unsigned int code)
+{
+	// code, low bit first, as wide as the decoder reads it; then what the decoder does with it
+	unsigned int width;
+
+	width = z->decoderEntry + 1 < 0x200 ? 9 : z->decoderEntry + 1 < 0x400 ? 10 : z->decoderEntry + 1 < 0x800 ? 11 : 12;
+	z->bits |= code << z->bitCount;
+	z->bitCount += width;
+	while (z->bitCount >= 8)
+	{
+		z->out[z->length++] = z->bits;
+		z->bits >>= 8;
+		z->bitCount -= 8;
+	}
+
+	if (code == 0x100)
+	{
+		z->decoderEntry = 0x101;
+		z->first = 1;
+	}
+	else if (z->first)
+		z->first = 0;
+	else if (z->decoderEntry < 0x1000)
+		z->decoderEntry++;
+}
+
+//____________________
+void putLe(unsigned char *p, unsigned long value, unsigned int bytes)
+{
+	while (bytes--)
+	{
+		*p++ = value;
+		value >>= 8;
+	}
+}
+
+//____________________
+int benchEdges(int argc, char *argv[])
+{
+	static const int drift[] = {-8, -4, 0, 4, 8};			// percent, A2 clock against nominal
+	unsigned char data[NUM_BYTES_SECTOR], nibble[SMALL_NIBBLE_SIZE];
+	unsigned char field[3 + 343 + 3], capture[EDGE_CAPTURE_SIZE];
+	uint16_t edges[EDGE_RING_SIZE];
+	unsigned char deltas[EDGE_RING_SIZE];
+	unsigned long long t0, ns, edgeTotal;
+	unsigned int i, j, n, jitter, cell, count, good, seed;
+	const char *tracePath, *savePath;
+	FILE *f;
+	int opt;
+
+	n = 2000;
+	jitter = 80;
+	tracePath = savePath = NULL;
+	optind = 1;
+	while ((opt = getopt(argc, argv, "n:j:f:o:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n':	n = atoi(optarg);		break;
+			case 'j':	jitter = atoi(optarg);	break;
+			case 'f':	tracePath = optarg;		break;
+			case 'o':	savePath = optarg;		break;
+			default:	return EXIT_FAILURE;
+		}
+	}
+	if (tracePath)
+		return benchEdgeTrace(tracePath);
+
+	diskGcrInit();
+	printf("--- Edge decoder, %u sectors per row, +-%u cycles (%.2f us) jitter\n", n, jitter, jitter / 200.0);
+	for (j=0; j<sizeof(drift)/sizeof(drift[0]); j++)
+	{
+		cell = EDGE_CELL_CYCLES * (100 + drift[j]) / 100;
+		seed = 2022;
+		good = 0;
+		ns = edgeTotal = 0;
+		for (i=0; i<n; i++)
+		{
+			for (count=0; count<NUM_BYTES_SECTOR; count++)
+				data[count] = rand_r(&seed);
+			diskEncodeNib(nibble, data, 254, i % NUM_TRACKS, i % NUM_SECTORS);
+			memcpy(field, nibble + 23, 3 + 343);
+			memcpy(field + 346, "\xDE\xAA\xEB", 3);
+			count = edgeSynthesize(edges, EDGE_RING_SIZE, field, sizeof(field), cell, jitter, &seed);
+			if (savePath && i == 0)
+			{
+				f = fopen(savePath, "wb");
+				if (f == NULL || fwrite(edges, sizeof(uint16_t), count, f) != count)
+					printf("*** ERROR: could not write %s\n", savePath);
+				if (f)
+					fclose(f);
+				savePath = NULL;
+			}
+
+			edgePack(deltas, edges, count);		// as PRU1 logs them
+			edgeUnpack(edges, deltas, count);
+
+			t0 = nowNs();
+			if (edgeDecode(capture, edges, count) == 0 && memcmp(capture + 1, field, sizeof(field)) == 0)
+				good++;
+			ns += nowNs() - t0;
+			edgeTotal += count;
+		}
+		printf("  cell %3u cycles (%+3d %%)  %5u/%u intact  %6.1f ns/edge  %6.1f us/sector\n",
+			cell, drift[j], good, n, (double) ns / edgeTotal, ns / (n * 1e3));
+	}
+	return EXIT_SUCCESS;
+}
+
+//____________________
+int benchEdgeTrace(const char *path)
+{
+	// Decodes one recorded trace and says what came out
+	static uint16_t edges[65536];
+	unsigned char capture[EDGE_CAPTURE_SIZE], data[NUM_BYTES_SECTOR];
+	unsigned long long t0, ns;
+	unsigned int count;
+	int framed;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (f == NULL)
+	{
+		printf("*** ERROR: could not open %s\n", path);
+		return EXIT_FAILURE;
+	}
+	count = fread(edges, sizeof(uint16_t), sizeof(edges) / sizeof(edges[0]), f);
+	fclose(f);
+
+	diskGcrInit();
+	t0 = nowNs();
+	framed = edgeDecode(capture, edges, count) == 0;
+	ns = nowNs() - t0;
+
+	printf("--- %s: %u edges, %.1f us to decode\n", path, count, ns / 1e3);
+	if (!framed)
+		printf("  not framed\n");
+	else
+		printf("  framed, sync remnant 0x%02X, epilogue %02X %02X %02X, data %s\n", capture[0],
+			capture[347], capture[348], capture[349],
+			diskDecodeData(data, capture + 4) == GCR_OK ? "checksum good" : "bad");
+	return framed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//____________________
+unsigned char *loadByRead(const char *path)
+{
+	// How Disk2Image loaded images before mmap
+	unsigned char *raw;
+	FILE *fd;
+
+	fd = fopen(path, "rb");
+	if (!fd)
+		return NULL;
+	raw = malloc(NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR);
+	if (raw && fread(raw, NUM_BYTES_SECTOR, NUM_TRACKS * NUM_SECTORS, fd) != NUM_TRACKS * NUM_SECTORS)
+		memset(raw, 0, NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR);
+	fclose(fd);
+	return raw;
+}
+
+//____________________
+unsigned char *loadByMap(const char *path)
+{
+	// How Disk2Image loads images now
+	unsigned char *raw;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+	raw = mmap(NULL, NUM_TRACKS * NUM_SECTORS * NUM_BYTES_SECTOR, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	return raw == MAP_FAILED ? NULL : raw;
+}
+
+//____________________
+int dropFromPageCache(const char *path)
+{
+	// Clean pages of path leave the page cache, no root needed
+	int fd, error;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+	{
+		printf("*** ERROR: could not open %s\n", path);
+		return 1;
+	}
+	error = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+	return error != 0;
+}
+
+//____________________
+int makeBenchImages(char *dir, size_t dirLen)
+{
+	// Temporary image directory holding two random-content images, the first is Controller's startup image
+	char path[128];
+
+	snprintf(dir, dirLen, "/tmp/disk2benchXXXXXX");
+	if (mkdtemp(dir) == NULL)
+	{
+		printf("*** ERROR: could not create bench directory\n");
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/Startup", dir);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/Games", dir);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/Games/Action", dir);
+	mkdir(path, 0755);
+
+	if (writeBenchImage(dir, STARTUP_IMAGE, 2022) || writeBenchImage(dir, SECOND_IMAGE, 1978))
+		return 1;
+	return 0;
+}
+
+//____________________
+int writeBenchImage(const char *dir, const char *name, unsigned int seed)
+{
+	unsigned char sector[NUM_BYTES_SECTOR];
+	char path[128];
+	unsigned int i, j;
+	FILE *fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = fopen(path, "wb");
+	if (!fd)
+	{
+		printf("*** ERROR: could not create %s\n", path);
+		return 1;
+	}
+
+	srand(seed);
+	for (i=0; i<NUM_TRACKS * NUM_SECTORS; i++)
+	{
+		for (j=0; j<NUM_BYTES_SECTOR; j++)
+			sector[j] = rand();
+		fwrite(sector, NUM_BYTES_SECTOR, 1, fd);
+	}
+	fclose(fd);
+	return 0;
+}
+
+//____________________
+void readBenchTrack0(const char *dir, const char *name, unsigned char (*translateSector)(unsigned char), unsigned char *nibbles)
+{
+	// What Controller should put in the PRU1 buffer for track 0 of this image
+	unsigned char data[NUM_SECTORS * NUM_BYTES_SECTOR];
+	char path[128];
+	FILE *fd;
+
+	memset(data, 0, sizeof(data));
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = fopen(path, "rb");
+	if (fd)
+	{
+		if (fread(data, sizeof(data), 1, fd) != 1)
+			printf("*** ERROR: short read of %s\n", path);
+		fclose(fd);
+	}
+	diskEncodeTrack(nibbles, data, translateSector, 254, 0);
+}
+
+//____________________
+void removeBenchImages(const char *dir)
+{
+	char path[128];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, STARTUP_IMAGE);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/%s", dir, SECOND_IMAGE);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/%s", dir, EVENT_FIFO);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/.disk2catalog", dir);
+	unlink(path);
+	removeTrackFiles(dir);
+	snprintf(path, sizeof(path), "%s/Startup", dir);
+	rmdir(path);
+	snprintf(path, sizeof(path), "%s/Games/Action", dir);
+	rmdir(path);
+	snprintf(path, sizeof(path), "%s/Games", dir);
+	rmdir(path);
+	rmdir(dir);
+}
+
+//____________________
+void removeTrackFiles(const char *dir)
+{
+	// Controller's default track file directory, dir/.disk2tracks
+	char path[128], file[400];
+	struct dirent *entry;
+	DIR *d;
+
+	snprintf(path, sizeof(path), "%s/.disk2tracks", dir);
+	d = opendir(path);
+	if (!d)
+		return;
+	while ((entry = readdir(d)) != NULL)
+	{
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+		unlink(file);
+	}
+	closedir(d);
+	rmdir(path);
+}
+
+//____________________
+pid_t startController(const char *controller, PruMem *mem, const char *dir, const char *events, const char *option)
+{
+	// option, if not NULL, is one more Controller flag
+	char memPath[32];
+	pid_t pid;
+
+	snprintf(memPath, sizeof(memPath), "/proc/self/fd/%d", mem->fd);
+
+	fflush(stdout);							// or the child flushes our buffer again
+	pid = fork();
+	if (pid == 0)
+	{
+		if (freopen("/dev/null", "w", stdout) == NULL)
+			_exit(EXIT_FAILURE);
+		execl(controller, controller, "-m", memPath, "-d", dir, "-e", events, option, (char *) NULL);
+		_exit(EXIT_FAILURE);
+	}
+	return pid;
+}
+
+//____________________
+void stopController(pid_t pid)
+{
+	if (pid <= 0)
+		return;
+	kill(pid, SIGINT);
+	waitpid(pid, NULL, 0);
+}
+
+//____________________
+int connectControl(const char *path)
+{
+	// Connects to Controller's control socket, once it listens; returns the socket or -1
+	struct sockaddr_un addr;
+	unsigned long long start;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+	start = nowNs();
+	while (nowNs() - start < WAIT_TIMEOUT_NS)
+	{
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd == -1)
+			return -1;
+		if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0)
+			return fd;
+		close(fd);
+		usleep(1000);
+	}
+	return -1;
+}
+
+//____________________
+int waitFor(volatile unsigned char *adr, unsigned char value, unsigned char equal)
+{
+	// Spin (yielding to Controller) until *adr == value (equal) or != value (!equal)
+	unsigned long long start;
+
+	start = nowNs();
+	while ((*adr == value) != equal)
+	{
+		sched_yield();
+		if (nowNs() - start > WAIT_TIMEOUT_NS)
+		{
+			printf("*** ERROR: timed out waiting on Controller\n");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//____________________
+int waitForTrack(unsigned char *pru, unsigned char track)
+{
+	// Track is loaded when the buffer selected for PRU1 carries it
+	unsigned long long start;
+
+	start = nowNs();
+	while (trackInBuffer(pru) != track)
+	{
+		sched_yield();
+		if (nowNs() - start > WAIT_TIMEOUT_NS)
+			return 1;
+	}
+	return 0;
+}
+
+//____________________
+int waitForRelease(unsigned char *pru)
+{
+	// Playing PRU1: Controller lets the next sector go
+	unsigned long long start;
+
+	start = nowNs();
+	while (!mailboxReleased(pru))
+	{
+		sched_yield();
+		if (nowNs() - start > WAIT_TIMEOUT_NS)
+		{
+			printf("*** ERROR: timed out waiting on Controller\n");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//____________________
+int waitForData(unsigned char *pru, unsigned char sector, const unsigned char *nibble)
+{
+	// Playing the A2: the data field of nibble has been written into sector of the selected buffer
+	unsigned long long start;
+
+	start = nowNs();
+	while (memcmp(selectedBuffer(pru) + sector * SMALL_NIBBLE_SIZE + DATA_NIBBLES_OFFSET,
+		nibble + DATA_NIBBLES_OFFSET, GCR_DATA_NIBBLES) != 0)
+	{
+		sched_yield();
+		if (nowNs() - start > WAIT_TIMEOUT_NS)
+		{
+			printf("*** ERROR: trk= %d sector= %d: write never reached the track buffer\n", trackInBuffer(pru), sector);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//____________________
+unsigned char *selectedBuffer(unsigned char *pru)
+{
+	// Track buffer Controller has selected for drive 1
+	return pru + TRACK_BUF_ADR(((volatile Pru1Command *) mailboxCommand(pru))->bufSel[0] % TRACK_BUFS);
+}
+
+//____________________
+unsigned char trackInBuffer(unsigned char *pru)
+{
+	// Track field of the address header in the last sector of the selected track buffer
+	volatile unsigned char *nibble;
+
+	nibble = selectedBuffer(pru) + (NUM_SECTORS - 1) * SMALL_NIBBLE_SIZE;
+	return ((nibble[10] & ~0xAA) << 1) | (nibble[11] & ~0xAA);
+}
+
+//____________________
+unsigned long long cpuTicks(pid_t pid)
+{
+	// utime + stime of pid, in clock ticks, fields 14 and 15 of /proc/pid/stat
+	unsigned long long utime, stime;
+	char path[32];
+	FILE *fd;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+	fd = fopen(path, "r");
+	if (!fd)
+		return 0;
+	if (fscanf(fd, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2)
+		utime = stime = 0;
+	fclose(fd);
+	return utime + stime;
+}
+
+//____________________
+void report(const char *name, unsigned long long *samples, unsigned int n)
+{
+	unsigned long long sum;
+	unsigned int i;
+
+	if (n == 0)
+	{
+		printf("  %-18s no samples\n", name);
+		return;
+	}
+
+	qsort(samples, n, sizeof(samples[0]), compareULL);
+	sum = 0;
+	for (i=0; i<n; i++)
+		sum += samples[i];
+
+	printf("  %-18s min %8.1f  p50 %8.1f  p90 %8.1f  p99 %8.1f  max %8.1f  mean %8.1f\n", name,
+		samples[0] / 1000.0, samples[n / 2] / 1000.0, samples[n * 9 / 10] / 1000.0,
+		samples[n * 99 / 100] / 1000.0, samples[n - 1] / 1000.0, sum / (n * 1000.0));
+}
+
+//____________________
+int compareULL(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *) a;
+	unsigned long long y = *(const unsigned long long *) b;
+
+	return (x > y) - (x < y);
+}
+
+//____________________
+unsigned long long nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
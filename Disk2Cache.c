@@ -0,0 +1,350 @@
+/*	Disk2Cache.c
+	LRU cache of raw images and encoded tracks
+	Entries live on one doubly linked LRU list (head = most recent) and in a
+	chained hash table; pinned entries (the loaded image's raw sectors) are
+	never evicted
+	An entry's data is either malloc'd (cachePut) or a file mapping (cachePutMapped)
+	Only the main thread changes the cache; chainLock covers the hash chains
+	and entry info, so cacheHeld() can look from another thread
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "Disk2Cache.h"
+
+#define NUM_BUCKETS		1024
+
+typedef struct CacheEntry
+{
+	ImageId id;
+	unsigned char track;
+	unsigned int pins;
+	size_t size;
+	unsigned char *data;
+	unsigned char mapped;					// 1 = data is an mmap, not malloc
+	unsigned int info;						// cacheSetInfo()
+	struct CacheEntry *prev, *next;			// LRU list
+	struct CacheEntry *chain;				// hash bucket
+} CacheEntry;
+
+static CacheEntry *buckets[NUM_BUCKETS];
+static CacheEntry *lruHead, *lruTail;
+static CacheStats stats;
+static pthread_mutex_t chainLock = PTHREAD_MUTEX_INITIALIZER;
+
+static CacheEntry *findEntry(const ImageId *id, unsigned char track);
+static unsigned int bucketOf(const ImageId *id, unsigned char track);
+static void lruUnlink(CacheEntry *entry);
+static void lruPushHead(CacheEntry *entry);
+static void freeEntry(CacheEntry *entry);
+static void evictFor(size_t size);
+static CacheEntry *addEntry(const ImageId *id, unsigned char track, size_t size, unsigned char *data, unsigned char mapped);
+
+//____________________
+void cacheInit(size_t budget)
+{
+	stats.budget = budget;
+}
+
+//____________________
+int cacheImageId(ImageId *id, const char *imagePath)
+{
+	// Identity from file metadata only, no data read; returns 0 on success
+	struct stat st;
+
+	if (stat(imagePath, &st) == -1)
+		return 1;
+
+	memset(id, 0, sizeof(*id));
+	id->dev		= st.st_dev;
+	id->ino		= st.st_ino;
+	id->size	= st.st_size;
+	id->mtime	= st.st_mtime;
+	return 0;
+}
+
+//____________________
+unsigned char *cacheGet(const ImageId *id, unsigned char track)
+{
+	// Data for (image, track) or NULL, counts hit/miss
+	CacheEntry *entry;
+
+	entry = findEntry(id, track);
+	if (!entry)
+	{
+		stats.misses++;
+		return NULL;
+	}
+
+	stats.hits++;
+	lruUnlink(entry);
+	lruPushHead(entry);
+	return entry->data;
+}
+
+//____________________
+int cacheHas(const ImageId *id, unsigned char track)
+{
+	// 1 if (image, track) is held; neither counted nor made more recent
+	return findEntry(id, track) != NULL;
+}
+
+//____________________
+int cacheHeld(const ImageId *id, unsigned char track, size_t *size, unsigned int *info, time_t *mtime)
+{
+	/*	Any thread: 1 if (image, track) is held, with its size, info and mtime
+		It may be evicted as soon as this returns, so cacheGet() it before use
+	*/
+	CacheEntry *entry;
+
+	pthread_mutex_lock(&chainLock);
+	entry = findEntry(id, track);
+	if (entry)
+	{
+		*size = entry->size;
+		*info = entry->info;
+		*mtime = entry->id.mtime;
+	}
+	pthread_mutex_unlock(&chainLock);
+	return entry != NULL;
+}
+
+//____________________
+unsigned char *cachePut(const ImageId *id, unsigned char track, size_t size)
+{
+	/*	Space for (image, track), for the caller to fill
+		Evicts least recently used entries to stay within budget
+	*/
+	unsigned char *data;
+
+	cacheDrop(id, track);
+	evictFor(size);
+
+	data = malloc(size);
+	if (!data)
+		return NULL;
+	if (!addEntry(id, track, size, data, 0))
+	{
+		free(data);
+		return NULL;
+	}
+	return data;
+}
+
+//____________________
+unsigned char *cachePutMapped(const ImageId *id, unsigned char track, unsigned char *data, size_t size)
+{
+	/*	Hands an mmap of size bytes to the cache, which munmaps it on eviction
+		Returns data, or NULL (mapping left to the caller)
+	*/
+	cacheDrop(id, track);
+	evictFor(size);
+
+	if (!addEntry(id, track, size, data, 1))
+		return NULL;
+	return data;
+}
+
+//____________________
+void cacheDrop(const ImageId *id, unsigned char track)
+{
+	CacheEntry *entry;
+
+	entry = findEntry(id, track);
+	if (entry)
+		freeEntry(entry);
+}
+
+//____________________
+void cacheSetInfo(const ImageId *id, unsigned char track, unsigned int info)
+{
+	// A few bits the owner keeps with (image, track), for cacheHeld()
+	CacheEntry *entry;
+
+	pthread_mutex_lock(&chainLock);
+	entry = findEntry(id, track);
+	if (entry)
+		entry->info = info;
+	pthread_mutex_unlock(&chainLock);
+}
+
+//____________________
+void cacheSetMtime(const ImageId *id, unsigned char track)
+{
+	// (image, track) now matches the file at id->mtime, after Controller wrote to it
+	CacheEntry *entry;
+
+	pthread_mutex_lock(&chainLock);
+	entry = findEntry(id, track);
+	if (entry)
+		entry->id.mtime = id->mtime;
+	pthread_mutex_unlock(&chainLock);
+}
+
+//____________________
+unsigned int cachePinned(const ImageId *id, unsigned char track)
+{
+	// Pins on (image, track), 0 if none or not held
+	CacheEntry *entry;
+
+	entry = findEntry(id, track);
+	return entry ? entry->pins : 0;
+}
+
+//____________________
+void cachePin(const ImageId *id, unsigned char track)
+{
+	CacheEntry *entry;
+
+	entry = findEntry(id, track);
+	if (entry)
+		entry->pins++;
+}
+
+//____________________
+void cacheUnpin(const ImageId *id, unsigned char track)
+{
+	CacheEntry *entry;
+
+	entry = findEntry(id, track);
+	if (entry && entry->pins)
+		entry->pins--;
+}
+
+//____________________
+void cacheGetStats(CacheStats *out)
+{
+	*out = stats;
+}
+
+//____________________
+void cachePrintStats(void)
+{
+	printf("Cache: %u entries, %zu/%zu KB, %llu hits, %llu misses, %llu evictions\n",
+		stats.entries, stats.bytes / 1024, stats.budget / 1024, stats.hits, stats.misses, stats.evictions);
+}
+
+//____________________
+static CacheEntry *findEntry(const ImageId *id, unsigned char track)
+{
+	CacheEntry *entry;
+
+	for (entry = buckets[bucketOf(id, track)]; entry; entry = entry->chain)
+	{
+		if (entry->track == track && entry->id.dev == id->dev && entry->id.ino == id->ino &&
+			entry->id.size == id->size)
+			return entry;
+	}
+	return NULL;
+}
+
+//____________________
+static unsigned int bucketOf(const ImageId *id, unsigned char track)
+{
+	unsigned long long h;
+
+	h = (unsigned long long) id->ino * 0x9E3779B97F4A7C15ULL;
+	h ^= (unsigned long long) id->dev + ((unsigned long long) id->size << 16);
+	h = (h ^ (h >> 29)) * 0xBF58476D1CE4E5B9ULL;
+	h ^= track * 0x94D049BB133111EBULL;
+	return (h ^ (h >> 32)) % NUM_BUCKETS;
+}
+
+//____________________
+static void lruUnlink(CacheEntry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		lruHead = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		lruTail = entry->prev;
+	entry->prev = entry->next = NULL;
+}
+
+//____________________
+static void lruPushHead(CacheEntry *entry)
+{
+	entry->prev = NULL;
+	entry->next = lruHead;
+	if (lruHead)
+		lruHead->prev = entry;
+	lruHead = entry;
+	if (!lruTail)
+		lruTail = entry;
+}
+
+//____________________
+static void freeEntry(CacheEntry *entry)
+{
+	CacheEntry **link;
+
+	pthread_mutex_lock(&chainLock);
+	for (link = &buckets[bucketOf(&entry->id, entry->track)]; *link; link = &(*link)->chain)
+	{
+		if (*link == entry)
+		{
+			*link = entry->chain;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&chainLock);
+	lruUnlink(entry);
+
+	stats.bytes -= entry->size;
+	stats.entries--;
+	if (entry->mapped)
+		munmap(entry->data, entry->size);
+	else
+		free(entry->data);
+	free(entry);
+}
+
+//____________________
+static CacheEntry *addEntry(const ImageId *id, unsigned char track, size_t size, unsigned char *data, unsigned char mapped)
+{
+	CacheEntry *entry;
+	unsigned int bucket;
+
+	entry = calloc(1, sizeof(CacheEntry));
+	if (!entry)
+		return NULL;
+	entry->id		= *id;
+	entry->track	= track;
+	entry->size		= size;
+	entry->data		= data;
+	entry->mapped	= mapped;
+
+	bucket = bucketOf(id, track);
+	pthread_mutex_lock(&chainLock);
+	entry->chain = buckets[bucket];
+	buckets[bucket] = entry;
+	pthread_mutex_unlock(&chainLock);
+	lruPushHead(entry);
+
+	stats.bytes += size;
+	stats.entries++;
+	return entry;
+}
+
+//____________________
+static void evictFor(size_t size)
+{
+	// Oldest unpinned entries go first; a pinned-full cache may run over budget
+	CacheEntry *entry, *prev;
+
+	for (entry = lruTail; entry && stats.bytes + size > stats.budget; entry = prev)
+	{
+		prev = entry->prev;
+		if (entry->pins)
+			continue;
+		freeEntry(entry);
+		stats.evictions++;
+	}
+}
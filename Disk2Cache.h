@@ -0,0 +1,50 @@
+/*	Disk2Cache.h
+	In-process cache of disk image data, shared by every image selected this session
+	Keyed by image file (dev/inode/size) and track; each entry keeps the mtime it
+	was cached at, which Controller's own writes move on, so one written by
+	anything else can be told apart
+	Bounded by a RAM budget, least recently used entries evicted first
+*/
+#ifndef _DISK2CACHE_H_
+#define _DISK2CACHE_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define CACHE_RAW_IMAGE		0xFF			// "track" of an image's raw sectors
+
+typedef struct
+{
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+} ImageId;
+
+typedef struct
+{
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+	size_t bytes;							// currently held
+	size_t budget;
+	unsigned int entries;
+} CacheStats;
+
+void cacheInit(size_t budget);
+int cacheImageId(ImageId *id, const char *imagePath);
+unsigned char *cacheGet(const ImageId *id, unsigned char track);
+int cacheHas(const ImageId *id, unsigned char track);
+int cacheHeld(const ImageId *id, unsigned char track, size_t *size, unsigned int *info, time_t *mtime);
+unsigned int cachePinned(const ImageId *id, unsigned char track);
+unsigned char *cachePut(const ImageId *id, unsigned char track, size_t size);
+unsigned char *cachePutMapped(const ImageId *id, unsigned char track, unsigned char *data, size_t size);
+void cacheSetInfo(const ImageId *id, unsigned char track, unsigned int info);
+void cacheSetMtime(const ImageId *id, unsigned char track);
+void cacheDrop(const ImageId *id, unsigned char track);
+void cachePin(const ImageId *id, unsigned char track);
+void cacheUnpin(const ImageId *id, unsigned char track);
+void cacheGetStats(CacheStats *stats);
+void cachePrintStats(void);
+
+#endif /* _DISK2CACHE_H_ */
@@ -0,0 +1,474 @@
+/*	Disk2Catalog.c
+	Image catalog, see Disk2Catalog.h
+	.disk2catalog layout, native byte order:
+		header		magic "D2CAT01", record count, string table bytes
+		records		CatalogRecord[count], path order
+		nameOrder	uint32[count], record numbers in file name order
+		strings		NUL terminated paths
+	Substring search is a linear pass over the paths; prefix and exact
+	lookups are binary searches
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "Disk2Catalog.h"
+
+#define CATALOG_MAGIC		"D2CAT01"
+#define MAX_DEPTH			16
+
+typedef struct
+{
+	char magic[8];
+	uint32_t count;
+	uint32_t stringBytes;
+} CatalogHeader;
+
+typedef struct
+{
+	CatalogRecord *records;
+	unsigned int count, maxCount;
+	char *strings;
+	unsigned int stringBytes, maxStringBytes;
+	unsigned int rehashed;
+} CatalogBuilder;
+
+static char catalogDir[256];
+static CatalogRecord *records;				// path order
+static unsigned int *nameOrder;				// record numbers, file name order
+static char *strings;
+static unsigned int count, stringBytes;
+static const char *sortStrings;				// for the qsort() comparators
+
+static int loadCatalog(void);
+static int saveCatalog(void);
+static void scanDir(CatalogBuilder *b, const char *rel, unsigned int depth);
+static void addImage(CatalogBuilder *b, const char *rel, const struct stat *st, unsigned char format);
+static unsigned char formatOf(const char *name);
+static int hashFile(const char *path, unsigned long long *hash);
+static unsigned int lowerBound(const char *text, int byName);
+static int comparePath(const void *a, const void *b);
+static int compareName(const void *a, const void *b);
+static int compareHash(const void *a, const void *b);
+static const char *recordName(unsigned int i);
+
+//____________________
+int catalogOpen(const char *imageDir, int rescan)
+{
+	/*	Loads imageDir's catalog, scanning the tree if there is none or rescan is set
+		A rescan rehashes only files whose size or mtime changed
+		Returns 0 if there is at least one image
+	*/
+	CatalogBuilder b;
+	unsigned int i;
+
+	snprintf(catalogDir, sizeof(catalogDir), "%s", imageDir);
+	if (loadCatalog() == 0 && !rescan)
+	{
+		printf("--- Catalog: %u images\n", count);
+		return count == 0;
+	}
+
+	memset(&b, 0, sizeof(b));
+	scanDir(&b, "", 0);
+
+	// Sort into path order, then build the name order
+	sortStrings = b.strings;
+	qsort(b.records, b.count, sizeof(CatalogRecord), comparePath);
+
+	catalogClose();
+	records		= b.records;
+	count		= b.count;
+	strings		= b.strings;
+	stringBytes	= b.stringBytes;
+	nameOrder	= malloc((count ? count : 1) * sizeof(unsigned int));
+	for (i=0; i<count; i++)
+		nameOrder[i] = i;
+	sortStrings = strings;
+	qsort(nameOrder, count, sizeof(unsigned int), compareName);
+
+	if (saveCatalog())
+		printf("*** ERROR: could not save catalog in %s\n", catalogDir);
+	printf("--- Catalog: %u images, %u read\n", count, b.rehashed);
+	catalogPrintDuplicates();
+	return count == 0;
+}
+
+//____________________
+void catalogClose(void)
+{
+	free(records);
+	free(nameOrder);
+	free(strings);
+	records = NULL;
+	nameOrder = NULL;
+	strings = NULL;
+	count = stringBytes = 0;
+}
+
+//____________________
+unsigned int catalogCount(void)
+{
+	return count;
+}
+
+//____________________
+const CatalogRecord *catalogRecord(unsigned int i)
+{
+	return i < count ? &records[i] : NULL;
+}
+
+//____________________
+const char *catalogPath(unsigned int i)
+{
+	// Relative to imageDir
+	return i < count ? strings + records[i].path : NULL;
+}
+
+//____________________
+int catalogFind(const char *path)
+{
+	// Record number of path, -1 if not in the catalog
+	unsigned int i;
+
+	i = lowerBound(path, 0);
+	if (i < count && strcasecmp(strings + records[i].path, path) == 0)
+		return i;
+	return -1;
+}
+
+//____________________
+unsigned int catalogSearch(const char *text, unsigned int *matches, unsigned int maxMatches)
+{
+	/*	Images matching text, case-insensitive, first of:
+			path starts with text		binary search
+			file name starts with text	binary search
+			path contains text			linear
+		Up to maxMatches record numbers go in matches; returns how many matched
+	*/
+	unsigned int i, n, len;
+
+	len = strlen(text);
+	n = 0;
+
+	for (i=lowerBound(text, 0); i<count && strncasecmp(strings + records[i].path, text, len) == 0; i++, n++)
+		if (n < maxMatches)
+			matches[n] = i;
+	if (n)
+		return n;
+
+	for (i=lowerBound(text, 1); i<count && strncasecmp(recordName(nameOrder[i]), text, len) == 0; i++, n++)
+		if (n < maxMatches)
+			matches[n] = nameOrder[i];
+	if (n)
+		return n;
+
+	for (i=0; i<count; i++)
+	{
+		if (strcasestr(strings + records[i].path, text))
+		{
+			if (n < maxMatches)
+				matches[n] = i;
+			n++;
+		}
+	}
+	return n;
+}
+
+//____________________
+unsigned int catalogPrintDuplicates(void)
+{
+	// Images with the same contents as an earlier one, returns how many
+	unsigned int *byHash, i, j, n;
+
+	if (count < 2)
+		return 0;
+	byHash = malloc(count * sizeof(unsigned int));
+	if (!byHash)
+		return 0;
+	for (i=0; i<count; i++)
+		byHash[i] = i;
+	qsort(byHash, count, sizeof(unsigned int), compareHash);
+
+	n = 0;
+	for (i=0; i<count; i=j)
+	{
+		for (j=i+1; j<count && records[byHash[j]].hash == records[byHash[i]].hash &&
+			records[byHash[j]].size == records[byHash[i]].size; j++)
+		{
+			if (n == 0)
+				printf("--- Duplicate images:\n");
+			printf("  %s = %s\n", strings + records[byHash[j]].path, strings + records[byHash[i]].path);
+			n++;
+		}
+	}
+	free(byHash);
+	return n;
+}
+
+//____________________
+static int loadCatalog(void)
+{
+	// Returns 0 if catalogDir has a readable catalog
+	CatalogHeader header;
+	char path[300];
+	FILE *fd;
+	int error;
+
+	snprintf(path, sizeof(path), "%s/%s", catalogDir, CATALOG_FILE);
+	fd = fopen(path, "rb");
+	if (!fd)
+		return 1;
+
+	error = 1;
+	if (fread(&header, sizeof(header), 1, fd) == 1 && memcmp(header.magic, CATALOG_MAGIC, 8) == 0)
+	{
+		catalogClose();
+		records		= malloc((header.count ? header.count : 1) * sizeof(CatalogRecord));
+		nameOrder	= malloc((header.count ? header.count : 1) * sizeof(unsigned int));
+		strings		= malloc(header.stringBytes ? header.stringBytes : 1);
+		if (records && nameOrder && strings &&
+			fread(records, sizeof(CatalogRecord), header.count, fd) == header.count &&
+			fread(nameOrder, sizeof(unsigned int), header.count, fd) == header.count &&
+			fread(strings, 1, header.stringBytes, fd) == header.stringBytes)
+		{
+			count = header.count;
+			stringBytes = header.stringBytes;
+			error = 0;
+		}
+		else
+			catalogClose();
+	}
+	fclose(fd);
+	return error;
+}
+
+//____________________
+static int saveCatalog(void)
+{
+	// Written beside, then renamed over the old one; returns 0 on success
+	CatalogHeader header;
+	char path[300], tmpPath[310];
+	FILE *fd;
+	int error;
+
+	snprintf(path, sizeof(path), "%s/%s", catalogDir, CATALOG_FILE);
+	snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+	fd = fopen(tmpPath, "wb");
+	if (!fd)
+		return 1;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CATALOG_MAGIC, 8);
+	header.count = count;
+	header.stringBytes = stringBytes;
+
+	error = fwrite(&header, sizeof(header), 1, fd) != 1 ||
+		fwrite(records, sizeof(CatalogRecord), count, fd) != count ||
+		fwrite(nameOrder, sizeof(unsigned int), count, fd) != count ||
+		fwrite(strings, 1, stringBytes, fd) != stringBytes;
+	if (fclose(fd) != 0)
+		error = 1;
+
+	if (error || rename(tmpPath, path) != 0)
+	{
+		unlink(tmpPath);
+		return 1;
+	}
+	return 0;
+}
+
+//____________________
+static void scanDir(CatalogBuilder *b, const char *rel, unsigned int depth)
+{
+	// rel is relative to catalogDir, "" for the top; dot files and directories are skipped
+	struct dirent *entry;
+	struct stat st;
+	char full[800], childRel[512];
+	unsigned char format;
+	DIR *dir;
+
+	snprintf(full, sizeof(full), "%s/%s", catalogDir, rel);
+	dir = opendir(full);
+	if (!dir)
+		return;
+
+	while ((entry = readdir(dir)) != NULL)
+	{
+		if (entry->d_name[0] == '.')
+			continue;
+		if (rel[0])
+			snprintf(childRel, sizeof(childRel), "%s/%s", rel, entry->d_name);
+		else
+			snprintf(childRel, sizeof(childRel), "%s", entry->d_name);
+		snprintf(full, sizeof(full), "%s/%s", catalogDir, childRel);
+		if (stat(full, &st) == -1)
+			continue;
+
+		if (S_ISDIR(st.st_mode))
+		{
+			if (depth < MAX_DEPTH)
+				scanDir(b, childRel, depth + 1);
+		}
+		else if (S_ISREG(st.st_mode) && (format = formatOf(entry->d_name)) != 0)
+			addImage(b, childRel, &st, format);
+	}
+	closedir(dir);
+}
+
+//____________________
+static void addImage(CatalogBuilder *b, const char *rel, const struct stat *st, unsigned char format)
+{
+	// Hash comes from the previous catalog when size and mtime have not changed
+	CatalogRecord *record;
+	unsigned int len;
+	char full[800];
+	const char *slash;
+	int old;
+	void *grown;
+
+	len = strlen(rel) + 1;
+	if (b->count == b->maxCount)
+	{
+		b->maxCount = b->maxCount ? 2 * b->maxCount : 256;
+		grown = realloc(b->records, b->maxCount * sizeof(CatalogRecord));
+		if (!grown)
+			return;
+		b->records = grown;
+	}
+	if (b->stringBytes + len > b->maxStringBytes)
+	{
+		b->maxStringBytes = b->maxStringBytes ? 2 * b->maxStringBytes + len : 16384;
+		grown = realloc(b->strings, b->maxStringBytes);
+		if (!grown)
+			return;
+		b->strings = grown;
+	}
+
+	record = &b->records[b->count];
+	memset(record, 0, sizeof(*record));
+	record->size	= st->st_size;
+	record->mtime	= st->st_mtime;
+	record->format	= format;
+	record->path	= b->stringBytes;
+	slash = strrchr(rel, '/');
+	record->name	= slash ? slash - rel + 1 : 0;
+
+	old = catalogFind(rel);
+	if (old >= 0 && records[old].size == record->size && records[old].mtime == record->mtime)
+		record->hash = records[old].hash;
+	else
+	{
+		snprintf(full, sizeof(full), "%s/%s", catalogDir, rel);
+		if (hashFile(full, &record->hash))
+			return;
+		b->rehashed++;
+	}
+
+	memcpy(b->strings + b->stringBytes, rel, len);
+	b->stringBytes += len;
+	b->count++;
+}
+
+//____________________
+static unsigned char formatOf(const char *name)
+{
+	const char *ext;
+
+	ext = strrchr(name, '.');
+	if (ext && strcmp(ext, ".dsk") == 0)
+		return CATALOG_DOS;
+	if (ext && strcmp(ext, ".po") == 0)
+		return CATALOG_PRODOS;
+	if (ext && strcmp(ext, ".nib") == 0)
+		return CATALOG_NIB;
+	if (ext && strcmp(ext, ".woz") == 0)
+		return CATALOG_WOZ;
+	if (ext && (strcmp(ext, ".gz") == 0 || strcmp(ext, ".2mg") == 0 || strcmp(ext, ".2img") == 0 ||
+		strcmp(ext, ".shk") == 0 || strcmp(ext, ".sdk") == 0))
+		return CATALOG_PACKED;
+	return 0;
+}
+
+//____________________
+static int hashFile(const char *path, unsigned long long *hash)
+{
+	// FNV-1a 64 of the whole file, returns 0 on success
+	unsigned char buffer[65536];
+	unsigned long long h;
+	size_t n, i;
+	FILE *fd;
+
+	fd = fopen(path, "rb");
+	if (!fd)
+		return 1;
+	h = 0xCBF29CE484222325ULL;
+	while ((n = fread(buffer, 1, sizeof(buffer), fd)) > 0)
+	{
+		for (i=0; i<n; i++)
+		{
+			h ^= buffer[i];
+			h *= 0x100000001B3ULL;
+		}
+	}
+	fclose(fd);
+	*hash = h;
+	return 0;
+}
+
+//____________________
+static unsigned int lowerBound(const char *text, int byName)
+{
+	// First position, in path order or name order, not before text
+	unsigned int lo, hi, mid;
+	const char *key;
+
+	lo = 0;
+	hi = count;
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		key = byName ? recordName(nameOrder[mid]) : strings + records[mid].path;
+		if (strcasecmp(key, text) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+//____________________
+static int comparePath(const void *a, const void *b)
+{
+	return strcasecmp(sortStrings + ((const CatalogRecord *) a)->path, sortStrings + ((const CatalogRecord *) b)->path);
+}
+
+//____________________
+static int compareName(const void *a, const void *b)
+{
+	return strcasecmp(recordName(*(const unsigned int *) a), recordName(*(const unsigned int *) b));
+}
+
+//____________________
+static int compareHash(const void *a, const void *b)
+{
+	unsigned long long ha, hb;
+
+	ha = records[*(const unsigned int *) a].hash;
+	hb = records[*(const unsigned int *) b].hash;
+	if (ha != hb)
+		return ha < hb ? -1 : 1;
+	return (int) *(const unsigned int *) a - (int) *(const unsigned int *) b;
+}
+
+//____________________
+static const char *recordName(unsigned int i)
+{
+	return strings + records[i].path + records[i].name;
+}
@@ -0,0 +1,40 @@
+/*	Disk2Catalog.h
+	Catalog of the disk images under imageDir, replaces a compiled-in list
+	Built by scanning the tree, kept in imageDir/.disk2catalog and reused at
+	startup; a rescan only reads files whose size or mtime changed
+	Records are in path order (case-insensitive), with a second order by file name,
+	so exact and prefix lookups are binary searches
+*/
+#ifndef _DISK2CATALOG_H_
+#define _DISK2CATALOG_H_
+
+#define CATALOG_FILE		".disk2catalog"
+
+// Image formats
+#define CATALOG_DOS			1				// .dsk, DOS 3.3 sector order
+#define CATALOG_PRODOS		2				// .po, ProDOS sector order
+#define CATALOG_NIB			3				// .nib, 6656 nibbles per track
+#define CATALOG_WOZ			4				// .woz, bitstream per track
+#define CATALOG_PACKED		5				// .gz, .2mg, .shk, .sdk, any of the above inside
+
+typedef struct
+{
+	unsigned long long hash;				// FNV-1a 64 of the file contents
+	long long mtime;
+	unsigned int size;
+	unsigned int path;						// offset of path, relative to imageDir, in string table
+	unsigned short name;					// offset of file name within path
+	unsigned char format;					// CATALOG_
+	unsigned char unused;
+} CatalogRecord;
+
+int catalogOpen(const char *imageDir, int rescan);
+void catalogClose(void);
+unsigned int catalogCount(void);
+const CatalogRecord *catalogRecord(unsigned int i);
+const char *catalogPath(unsigned int i);
+int catalogFind(const char *path);
+unsigned int catalogSearch(const char *text, unsigned int *matches, unsigned int maxMatches);
+unsigned int catalogPrintDuplicates(void);
+
+#endif /* _DISK2CATALOG_H_ */
@@ -0,0 +1,347 @@
+/*	Disk2Control.c
+	Control socket commands, see Disk2Control.h
+	Each reply is built whole, then sent in one go without waiting
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "Disk2Control.h"
+#include "Disk2Catalog.h"
+#include "Disk2Image.h"
+#include "Disk2Loader.h"
+#include "Disk2Journal.h"
+#include "Disk2Metrics.h"
+
+#define LIST_DEFAULT	20
+
+typedef struct
+{
+	int fd;									// -1 = free
+	unsigned int length;					// of the line so far
+	char line[CONTROL_LINE];
+} Client;
+
+static Client clients[CONTROL_CLIENTS];
+static int listenFd = -1;
+static char socketPath[108];
+static const char *imageDir;
+static PruEvents *pruEvents;
+
+static void serve(Client *client);
+static void dropClient(Client *client);
+static void command(int fd, char *line);
+static void list(FILE *out, const char *args);
+static void search(FILE *out, const char *args);
+static void mount(FILE *out, const char *args);
+static void eject(FILE *out, const char *args);
+static void stats(FILE *out);
+static int driveArg(const char **args, unsigned char alone);
+
+//____________________
+int controlOpen(const char *path, const char *dir, PruEvents *events)
+{
+	/*	Listens on path, replacing a socket left there; NULL for no control socket
+		Returns 0, or 1 if the socket cannot be set up
+	*/
+	struct sockaddr_un addr;
+	unsigned int i;
+
+	for (i=0; i<CONTROL_CLIENTS; i++)
+		clients[i].fd = -1;
+	imageDir = dir;
+	pruEvents = events;
+	if (path == NULL)
+		return 0;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		printf("*** ERROR: control socket path too long: %s\n", path);
+		return 1;
+	}
+	strcpy(addr.sun_path, path);
+	snprintf(socketPath, sizeof(socketPath), "%s", path);
+	unlink(socketPath);						// left by a Controller that did not exit cleanly
+
+	listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listenFd == -1 || bind(listenFd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(listenFd, 4) == -1 ||
+		eventWatch(pruEvents, listenFd))
+	{
+		perror("*** ERROR: control socket");
+		if (listenFd != -1)
+			close(listenFd);
+		listenFd = -1;
+		return 1;
+	}
+	return 0;
+}
+
+//____________________
+void controlClose(void)
+{
+	unsigned int i;
+
+	for (i=0; i<CONTROL_CLIENTS; i++)
+		dropClient(&clients[i]);
+	if (listenFd != -1)
+	{
+		eventUnwatch(pruEvents, listenFd);
+		close(listenFd);
+		unlink(socketPath);
+		listenFd = -1;
+	}
+}
+
+//____________________
+void controlPoll(void)
+{
+	// New connections, then commands any connection has sent in full
+	unsigned int i;
+	int fd;
+
+	if (listenFd == -1)
+		return;
+
+	while ((fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+	{
+		for (i=0; i<CONTROL_CLIENTS && clients[i].fd != -1; i++)
+			;
+		if (i == CONTROL_CLIENTS || eventWatch(pruEvents, fd))
+		{
+			send(fd, "error busy\n", 11, MSG_DONTWAIT | MSG_NOSIGNAL);
+			close(fd);
+			continue;
+		}
+		clients[i].fd = fd;
+		clients[i].length = 0;
+	}
+
+	for (i=0; i<CONTROL_CLIENTS; i++)
+		if (clients[i].fd != -1)
+			serve(&clients[i]);
+}
+
+//____________________
+static void serve(Client *client)
+{
+	/*	Reads what client has sent and carries out each whole line
+		At end of file a last line without its newline counts too
+	*/
+	char *end;
+	ssize_t n;
+
+	while (1)
+	{
+		n = recv(client->fd, client->line + client->length, CONTROL_LINE - 1 - client->length, 0);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (n <= 0)
+		{
+			if (client->length)
+			{
+				client->line[client->length] = '\0';
+				command(client->fd, client->line);
+			}
+			dropClient(client);
+			return;
+		}
+
+		client->length += n;
+		client->line[client->length] = '\0';
+		while ((end = strchr(client->line, '\n')) != NULL)
+		{
+			*end = '\0';
+			command(client->fd, client->line);
+			client->length -= end + 1 - client->line;
+			memmove(client->line, end + 1, client->length + 1);
+		}
+		if (client->length == CONTROL_LINE - 1)
+		{
+			send(client->fd, "error line too long\n", 20, MSG_DONTWAIT | MSG_NOSIGNAL);
+			client->length = 0;
+		}
+	}
+}
+
+//____________________
+static void dropClient(Client *client)
+{
+	if (client->fd == -1)
+		return;
+	eventUnwatch(pruEvents, client->fd);
+	close(client->fd);
+	client->fd = -1;
+}
+
+//____________________
+static void command(int fd, char *line)
+{
+	// One command line, its reply to fd
+	char *text, *args, *cr;
+	size_t size;
+	FILE *out;
+
+	cr = strchr(line, '\r');
+	if (cr)
+		*cr = '\0';
+	while (*line == ' ')
+		line++;
+	args = line + strcspn(line, " ");
+	if (*args)
+		*args++ = '\0';
+	while (*args == ' ')
+		args++;
+	if (*line == '\0')
+		return;
+
+	out = open_memstream(&text, &size);
+	if (!out)
+		return;
+	if (strcmp(line, "list") == 0)
+		list(out, args);
+	else if (strcmp(line, "search") == 0)
+		search(out, args);
+	else if (strcmp(line, "mount") == 0)
+		mount(out, args);
+	else if (strcmp(line, "eject") == 0)
+		eject(out, args);
+	else if (strcmp(line, "stats") == 0)
+		stats(out);
+	else if (strcmp(line, "flush") == 0)
+	{
+		journalFlush();
+		fprintf(out, "ok\n");
+	}
+	else
+		fprintf(out, "error unknown command %s, try list, search, mount, eject, stats or flush\n", line);
+	fclose(out);
+
+	send(fd, text, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+	free(text);
+}
+
+//____________________
+static void list(FILE *out, const char *args)
+{
+	unsigned int i, first, n;
+
+	first = 0;
+	n = LIST_DEFAULT;
+	sscanf(args, "%u %u", &first, &n);
+	if (n > CONTROL_LISTED)
+		n = CONTROL_LISTED;
+	for (i=first; i<catalogCount() && i-first<n; i++)
+		fprintf(out, "[%u] %s\n", i, catalogPath(i));
+	fprintf(out, "ok %u images\n", catalogCount());
+}
+
+//____________________
+static void search(FILE *out, const char *args)
+{
+	unsigned int i, n, matches[CONTROL_LISTED];
+
+	if (*args == '\0')
+	{
+		fprintf(out, "error search for what\n");
+		return;
+	}
+	n = catalogSearch(args, matches, CONTROL_LISTED);
+	for (i=0; i<n && i<CONTROL_LISTED; i++)
+		fprintf(out, "[%u] %s\n", matches[i], catalogPath(matches[i]));
+	if (n > CONTROL_LISTED)
+		fprintf(out, "... %u more\n", n - CONTROL_LISTED);
+	fprintf(out, "ok %u matches\n", n);
+}
+
+//____________________
+static void mount(FILE *out, const char *args)
+{
+	// Catalog number, exact path, or the one image a search finds
+	unsigned int i, n, matches[CONTROL_LISTED];
+	char path[512];
+	int drive, image;
+
+	drive = driveArg(&args, 0);
+	if (*args == '\0')
+	{
+		fprintf(out, "error mount what\n");
+		return;
+	}
+
+	if (strspn(args, "0123456789") == strlen(args))
+		image = (unsigned int) atoi(args) < catalogCount() ? atoi(args) : -1;
+	else if ((image = catalogFind(args)) < 0)
+	{
+		n = catalogSearch(args, matches, CONTROL_LISTED);
+		if (n == 1)
+			image = matches[0];
+		else if (n > 1)
+		{
+			for (i=0; i<n && i<CONTROL_LISTED; i++)
+				fprintf(out, "[%u] %s\n", matches[i], catalogPath(matches[i]));
+			fprintf(out, "error %u images match, mount one by number\n", n);
+			return;
+		}
+	}
+	if (image < 0)
+	{
+		fprintf(out, "error no image %s\n", args);
+		return;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", imageDir, catalogPath(image));
+	if (loaderRequest(drive, path, catalogPath(image)))
+		fprintf(out, "error loader queue full\n");
+	else
+		fprintf(out, "ok mounting [%d] %s in drive %d\n", image, catalogPath(image), drive + 1);
+}
+
+//____________________
+static void eject(FILE *out, const char *args)
+{
+	int drive;
+
+	drive = driveArg(&args, 1);
+	if (loaderRequest(drive, NULL, NULL))
+		fprintf(out, "error loader queue full\n");
+	else
+		fprintf(out, "ok ejecting drive %d\n", drive + 1);
+}
+
+//____________________
+static void stats(FILE *out)
+{
+	unsigned char drive;
+	const char *path;
+
+	for (drive=0; drive<NUM_DRIVES; drive++)
+	{
+		path = imageLoadedPath(drive);
+		fprintf(out, "drive %d: %s\n", drive + 1, path[0] ? path : "(empty)");
+	}
+	metricsWrite(out, pruEvents);
+	fprintf(out, "ok\n");
+}
+
+//____________________
+static int driveArg(const char **args, unsigned char alone)
+{
+	/*	Leading 1 or 2 followed by more, or alone if it may be, is a drive:
+		moves args past it; returns drive 0 or 1, 0 if none is given
+	*/
+	const char *s = *args;
+
+	if ((s[0] == '1' || s[0] == '2') && ((s[1] == ' ' && s[1 + strspn(s + 1, " ")]) || (alone && s[1] == '\0')))
+	{
+		*args = s + 1 + strspn(s + 1, " ");
+		return s[0] - '1';
+	}
+	return 0;
+}
@@ -0,0 +1,30 @@
+/*	Disk2Control.h
+	Control socket, ./Controller -C <path>: a unix stream socket taking one
+	command a line, e.g. echo "mount 2 Choplifter" | socat - UNIX-CONNECT:<path>
+		list [first [count]]		catalog entries as "[n] path", 20 from 0 unless given
+		search <text>				entries text finds, see catalogSearch()
+		mount [1|2] <n | text>		entry n, or the one entry text finds, into drive 1 or 2
+		eject [1|2]
+		stats						what each drive holds, then the metrics JSON
+		flush						writes the journal holds go to the image files now
+	Drive 1 if not given; each reply ends with a line "ok" or "error <why>"
+	A mount is only queued here, Disk2Loader reads and encodes the image and
+	the main loop puts it in the drive; "ok" says it is queued
+	Runs in the main loop and never blocks: the sockets are non-blocking
+	and eventWatch()ed, a command is carried out once its line is in, and
+	a reply the socket cannot take is cut short
+*/
+#ifndef _DISK2CONTROL_H_
+#define _DISK2CONTROL_H_
+
+#include "Disk2Event.h"
+
+#define CONTROL_CLIENTS		4				// connections at once
+#define CONTROL_LINE		256				// longest command
+#define CONTROL_LISTED		60				// most entries one list or search shows
+
+int controlOpen(const char *path, const char *imageDir, PruEvents *events);
+void controlClose(void);
+void controlPoll(void);
+
+#endif /* _DISK2CONTROL_H_ */
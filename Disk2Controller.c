@@ -2,284 +2,282 @@
 	Apple Disk II Interface Controller
 	PRU0 handles phase signals to determine track
 	PRU1 handles sending and receiving data on a sector-by-sector basis
+	Two drives, each with its own image, head position and track buffer
 	04/2022
 */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
-#include <sys/mman.h>
+
+#include "Disk2Mem.h"
+#include "Disk2Gcr.h"
+#include "Disk2Image.h"
+#include "Disk2Cache.h"
+#include "Disk2Upload.h"
+#include "Disk2Event.h"
+#include "Disk2Journal.h"
+#include "Disk2Catalog.h"
+#include "Disk2TrackFile.h"
+#include "Disk2Edge.h"
+#include "Disk2Mailbox.h"
+#include "Disk2Metrics.h"
+#include "Disk2Prefetch.h"
+#include "Disk2Loader.h"
+#include "Disk2Control.h"
 
 #define VERBOSE	0							// 1 = display track number
+#define EVENT_TIMEOUT_MS	100				// look at PRU memory at least this often
+#define MOUNT_POLL_MS		1				// that often while a mount waits for its first sector, or a track for a buffer
+#define NO_TRACK			0xFF			// loadedTrk of a drive whose track is still to be staged
+#define MOUNT_WAIT_NS		2000000000ULL	// first sector not timed if later than this, drive not enabled
 
 void myShutdown(int sig);
-void changeImage(int sig);
-void loadDiskImage(const char *imageName);
-void saveDiskImage(const char *imageName);
-void diskEncodeNib(unsigned char *nibble, unsigned char *data, unsigned char vol, unsigned char trk, unsigned char sec);
-unsigned char dosTranslateSector(unsigned char sector);
-unsigned char prodosTranslateSector(unsigned char sector);
-unsigned char diskDecodeNib(unsigned char *data, unsigned char *nibble);
-unsigned char decodeNibByte(unsigned char *nibInt, unsigned char *nibData);
-unsigned char computeDataChecksum(unsigned char *nibble);
-
-// PRU Memory Locations
-#define PRU_ADDR			0x4A300000		// Start of PRU memory Page 163 am335x TRM
-#define PRU_LEN				0x80000			// Length of PRU memory
-#define PRU1_DRAM			0x02000
-
-// First 0x200 bytes of both PRUs RAM are STACK & HEAP
-
-// PRU0 Memory Locations:
-#define PRU0_TRK_NUM_ADDR	0x0300
-
-// PRU1 Memory Locations:
-#define TRACK_DATA_ADR		0x0300		// address of track start
-#define ENABLE_ADR			0x1B00		// EN- state
-#define SECTOR_ADR			0x1B01		// current sector number
-#define WRITE_ADR			0x1B02		// 1 = write occurred
-#define CONT_INT_ADR		0x1B07		// Controller interrupt, 1 = stop
-#define WRITE_DATA_ADR		0x1C00		// address of first write byte
-
-// Someday might move everything to shared memory
-//#define PRU_SHAREDMEM	0x10000				// Offset to shared memory
-//unsigned int *prusharedMem_32int_ptr;		// Points to the start of shared memory
-
-// PRU0:
-static unsigned char *pru0RAMptr;			// start of PRU0 memory
-static unsigned char *pru0TrackPtr;			// track number commanded by A2
+void requestStatus(int sig);
+void requestMetrics(int sig);
+void printStatus(void);
+void loadDiskImage(unsigned char drive, const char *imageName);
+void mountImages(void);
+void mountedImage(unsigned char drive, const char *imageName);
+void firstSector(const MailboxNews *news, unsigned long long wokeNs);
+void saveDiskImage(unsigned char drive, const char *imageName);
+int stageTrack(unsigned char drive, unsigned char trk);
+void drainWrites(const MailboxNews *news, unsigned long long wokeNs);
+void commitWrite(unsigned char drive, unsigned char trk, unsigned char sector, const uint16_t *edges,
+	unsigned int count);
+
+// PRU memory layout is in Disk2Mem.h, PRU status and commands go through Disk2Mailbox
 
 // PRU1:
-static unsigned char *pru1RAMptr;			// start of PRU1 memory
-static unsigned char *pru1TrackDataPtr;		// Controller puts loaded track data (starting) here
-static unsigned char *pru1EnPtr;			// EN-
-static unsigned char *pru1SectorPtr;		// last sector sent to A2
-static unsigned char *pru1WritePtr;			// 1 = write occurred
-static unsigned char *pru1InterruptPtr;		// set by Controller, 1 = stop sending to A2
-static unsigned char *pru1WriteDataPtr;		// first byte of data written by A2
-
-static unsigned char running;							// to allow graceful quit
-unsigned char track = 0;
-unsigned char loadedTrk = 0;
-
-const unsigned int NUM_TRACKS = 35;
-const unsigned int NUM_SECTORS_PER_TRACK = 16;
-const unsigned int NUM_BYTES_PER_SECTOR = 256;			// these are only data bytes
-const unsigned int SMALL_NIBBLE_SIZE = 374;				// one encoded sector, sync + address + data, bytes
-const unsigned int NUM_ENCODED_BYTES_PER_TRACK = 5984;	// 16 * 374
-const unsigned int SECTOR_DATA_OFFSET = 26;				// location of first data byte, 0-based
-
-// First image is loaded at startup
-const char *theImages[] =
-{
-	"Startup/BasicStartup.po",					// ProDOS 2.0.3
-
-	"Games/Action/ABM.dsk",
-	"Games/Action/AcidTrip.dsk",
-	"Games/Action/AE_Back.dsk",
-	"Games/Action/AE_Front.dsk",
-	"Games/Action/ae1.dsk",
-	"Games/Action/ae2.dsk",
-	"Games/Action/Aeronaut.dsk",
-	"Games/Action/Airheart.dsk",
-	"Games/Action/Alcazar.dsk",
-	"Games/Action/Alf.dsk",
-	"Games/Action/AlienPlus.dsk",
-	"Games/Action/AlienRain.dsk",
-	"Games/Action/ALIENS1.dsk",
-	"Games/Action/ALIENS2.dsk",
-	"Games/Action/AntiISDA_Warrior.dsk",
-	"Games/Action/Aplcidsp.dsk",
-	"Games/Action/AppleBowling.dsk",
-	"Games/Action/ApplePanic_Joystick.dsk",
-	"Games/Action/ApplePanic.dsk",
-	"Games/Action/ApplePanicPlus.dsk",
-	"Games/Action/ArcaseBootCamp.dsk",
-	"Games/Action/ArcadeInsanity.dsk",
-	"Games/Action/ArticFox.dsk",
-	"Games/Action/ArdyTheAardvark.dsk",
-	"Games/Action/Argos.dsk",
-	"Games/Action/Arkanoi2.dsk",
-	"Games/Action/arkanoid.dsk",
-	"Games/Action/arkedit.dsk",
-	"Games/Action/Artesians.dsk",
-	"Games/Action/Asteroid.dsk",
-	"Games/Action/Asteroids_nm_h5.dsk",
-	"Games/Action/Aztec.dsk",
-	"Games/Action/Aztec_alt.dsk",
-	"Games/Action/Aztec.dsk",
-
-
-	"BLANK.po"
-};
-
-//				[NUM_TRACKS][NUM_SECTORS_PER_TRACK][SMALL_NIBBLE_SIZE]
-unsigned char theImage[35][16][374];
-unsigned char loadedImageName[64];
+static unsigned char *pru1RAMptr;			// start of PRU1 memory, for the edge ring
 
-//____________________
-const unsigned char translate6[64] =
-{
-	0x96, 0x97, 0x9A, 0x9B, 0x9D, 0x9E, 0x9F, 0xA6,
-	0xA7, 0xAB, 0xAC, 0xAD, 0xAE, 0xAF, 0xB2, 0xB3,
-	0xB4, 0xB5, 0xB6, 0xB7, 0xB9, 0xBA, 0xBB, 0xBC,
-	0xBD, 0xBE, 0xBF, 0xCB, 0xCD, 0xCE, 0xCF, 0xD3,
-	0xD6, 0xD7, 0xD9, 0xDA, 0xDB, 0xDC, 0xDD, 0xDE,
-	0xDF, 0xE5, 0xE6, 0xE7, 0xE9, 0xEA, 0xEB, 0xEC,
-	0xED, 0xEE, 0xEF, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6,
-	0xF7, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF
-};
-
-unsigned char untranslate6[256];
+// Track buffers, Controller stages track data there, PRU1 sends from there: see Disk2Upload.c
+
+static PruEvents pruEvents;					// PRU0/PRU1 wake us up through these
+
+static volatile sig_atomic_t running;					// to allow graceful quit
+static volatile sig_atomic_t statusRequested;			// ^Z
+static const char *imageDir = "/root/DiskImages/Small";	// -d, root of the image catalog
+static unsigned int cacheMB = 16;						// -c, RAM budget for images and tracks
+static unsigned int flushMs = 1000;						// -j, A2 writes reach the image file this often
+static const char *trackDir = NULL;						// -t, encoded track files, default imageDir/.disk2tracks
+static unsigned char streaming = 0;						// -s, PRU1 rotates without the sector handshake
+static const char *drive2Image = NULL;					// -2, catalog image in drive 2, default none
+static const char *metricsTarget = NULL;				// -M, file or unix:socket for metrics dumps
+static const char *controlPath = NULL;					// -C, control socket, see Disk2Control.h
+unsigned char loadedTrk[NUM_DRIVES];					// track each drive's buffer holds
+static unsigned long long mountNs[NUM_DRIVES];			// mount request awaiting its first sector, 0 = none
+static unsigned char stageWaiting;						// a drive's track is waiting for a free buffer
+
+// Loaded at startup if the catalog has it, else the catalog's first image
+#define STARTUP_IMAGE		"Startup/BasicStartup.po"
+
+// Images themselves are in Disk2Image.c
+char loadedImageName[NUM_DRIVES][256];
 
 //____________________
 int main(int argc, char *argv[])
 {
-	unsigned char sector, lastSectorSent, prevSector, checksum, writeByte;
-	unsigned int i, j, k, offset, trkCnt, writeByteCnt, sectorIndex;
-//	unsigned char tempSector[SMALL_NIBBLE_SIZE];
+	MailboxNews news;
+	unsigned int trkCnt;
+	unsigned char drive, track;
+	unsigned long long wokeNs, lastSectorNs;
 
 	unsigned char *pru;		// start of PRU memory
-	int	fd;
-
-	fd = open("/dev/mem", O_RDWR | O_SYNC);
-	if (fd == -1)
+	const char *backing;	// /dev/mem unless running against Sim or Bench
+	const char *events;		// see Disk2Event.h, default follows backing
+	char defaultEvents[256], defaultTracks[256];
+	PruMem pruMem;
+	int opt, rescan, startup, second;
+
+	backing = PRU_MEM_DEVMEM;
+	events = NULL;
+	rescan = 0;
+	while ((opt = getopt(argc, argv, "m:d:c:e:j:t:2:M:C:rs")) != -1)
 	{
-		printf("*** ERROR: could not open /dev/mem.\n");
-		return EXIT_FAILURE;
+		switch (opt)
+		{
+			case 'm':	backing = optarg;			break;
+			case 'd':	imageDir = optarg;			break;
+			case 'c':	cacheMB = atoi(optarg);		break;
+			case 'e':	events = optarg;			break;
+			case 'j':	flushMs = atoi(optarg);		break;
+			case 't':	trackDir = optarg;			break;
+			case '2':	drive2Image = optarg;		break;
+			case 'M':	metricsTarget = optarg;		break;
+			case 'C':	controlPath = optarg;		break;
+			case 'r':	rescan = 1;					break;
+			case 's':	streaming = 1;				break;
+			default:
+				printf("Usage: %s [-m /dev/mem | anon | memfile] [-d imageDir] [-c cacheMB] [-e /dev/uioN | poll | fifo] [-j flushMs] [-t trackDir | none] [-2 image] [-M file | unix:socket] [-C socket] [-r] [-s]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
 	}
-	pru = mmap(0, PRU_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, PRU_ADDR);
-	if (pru == MAP_FAILED)
-	{
-		printf("*** ERROR: could not map memory.\n");
+
+	if (pruMemOpen(&pruMem, backing))
 		return EXIT_FAILURE;
+	pru = pruMem.base;
+
+	if (events == NULL)
+	{
+		eventDefaultSpec(defaultEvents, sizeof(defaultEvents), backing);
+		events = defaultEvents;
 	}
-	close(fd);
+	if (eventOpen(&pruEvents, events, pru))
+		return EXIT_FAILURE;
 
 	// Set memory pointers
-	// PRU 0
-	pru0RAMptr		= pru;
-	pru0TrackPtr	= pru0RAMptr + PRU0_TRK_NUM_ADDR;
+	// PRU 0 and 1 status blocks, PRU1 commands
+	mailboxInit(pru);
 
 	// PRU 1
 	pru1RAMptr			= pru + PRU1_DRAM;
-	pru1TrackDataPtr	= pru1RAMptr + TRACK_DATA_ADR;
-	pru1EnPtr			= pru1RAMptr + ENABLE_ADR;
-	pru1SectorPtr		= pru1RAMptr + SECTOR_ADR;
-	pru1WritePtr		= pru1RAMptr + WRITE_ADR;
-	pru1InterruptPtr	= pru1RAMptr + CONT_INT_ADR;
-	pru1WriteDataPtr	= pru1RAMptr + WRITE_DATA_ADR;
 
-	// Load disk image (into theImage and PRU 1)
-	loadDiskImage(theImages[0]);					// first image in list
+	// Track buffers
+	uploadInit(pru);
+	prefetchInit();
 
-	// Set up untranslate6 table
-	for (i=0; i<NUM_BYTES_PER_SECTOR; i++)			// fill with FFs to detect when we are out of range
-		untranslate6[i] = 0xFF;
+	diskGcrInit();									// GCR tables
+	cacheInit((size_t) cacheMB << 20);
+	if (trackDir == NULL)
+	{
+		snprintf(defaultTracks, sizeof(defaultTracks), "%s/.disk2tracks", imageDir);
+		trackDir = defaultTracks;
+	}
+	trackFileInit(strcmp(trackDir, "none") == 0 ? NULL : trackDir);
+	if (journalStart(flushMs))
+		return EXIT_FAILURE;
+	if (metricsOpen(metricsTarget))					// from here on image loads are timed
+		return EXIT_FAILURE;
 
-	for (i=0; i<0x40; i++)							// inverse of translate6 table
-		untranslate6[translate6[i]] = i;
+	// Image library, -r to pick up added or changed images
+	if (catalogOpen(imageDir, rescan))
+	{
+		printf("*** ERROR: no disk images in %s\n", imageDir);
+		return EXIT_FAILURE;
+	}
+
+	// Load disk images (into Disk2Image and PRU 1), drive 2 empty unless -2
+	startup = catalogFind(STARTUP_IMAGE);
+	loadDiskImage(0, catalogPath(startup >= 0 ? startup : 0));
+	second = drive2Image ? catalogFind(drive2Image) : -1;
+	if (second >= 0)
+		loadDiskImage(1, catalogPath(second));
+	else
+	{
+		if (drive2Image)
+			printf("*** %s is not in the catalog, drive 2 is empty\n", drive2Image);
+		loadedTrk[1] = stageTrack(1, 0) ? NO_TRACK : 0;
+	}
+
+	// From here images are mounted through the control socket, loaded off the main loop
+	if (loaderStart() || eventWatch(&pruEvents, loaderFd()) || controlOpen(controlPath, imageDir, &pruEvents))
+		return EXIT_FAILURE;
 
 	(void) signal(SIGINT,  myShutdown);				// ^c = graceful shutdown
-	(void) signal(SIGTSTP, changeImage);			// ^z = cycle through images
+	(void) signal(SIGTSTP, requestStatus);			// ^z = drives and counters
+	(void) signal(SIGUSR1, requestMetrics);			// metrics to the -M file
+	(void) signal(SIGPIPE, SIG_IGN);				// a socket client that went away is not fatal
 
 	printf("\n--- Disk II IF running\n");
 	printf("====================\n");
-	printf("  <ctrl>-z to change image or save\n");
+	if (controlPath)
+		printf("  images: echo help | socat - UNIX-CONNECT:%s\n", controlPath);
+	printf("  <ctrl>-z for status\n");
 	printf("  <ctrl>-c to quit\n");
 	printf("--------------------\n");
 
 	running = 1;
 	trkCnt = 0;
-	prevSector = 0;
+	lastSectorNs = 0;
+	mailboxStream(streaming);						// from here PRU1 needs us only for writes
 	do
 	{
-		usleep(10);
-
-		// OK because PRU0 only updates track when drive enabled
-		track = *pru0TrackPtr;
-		if (track != loadedTrk)					// has A2 moved disk head?
+		eventWait(&pruEvents, mountNs[0] || mountNs[1] || stageWaiting ? MOUNT_POLL_MS : EVENT_TIMEOUT_MS);	// sleep till a PRU has news
+		wokeNs = metricsNowNs();
+		metricsWakeup();
+		imageWriteDone();							// sectors the journal writer is done with
+		mailboxPoll(&news);							// one look at both PRUs, whatever woke us
+
+		// OK because PRU0 only updates track of the drive enabled
+		stageWaiting = 0;
+		for (drive=0; drive<NUM_DRIVES; drive++)
 		{
-			*pru1InterruptPtr = 1;				// pause sending while changing track
-
-			// Copy new track to PRU
-			for (sector=0; sector<NUM_SECTORS_PER_TRACK; sector++)
+			track = news.pru0.track[drive];
+			if (track != loadedTrk[drive])		// has A2 moved disk head?
 			{
-				offset = sector * SMALL_NIBBLE_SIZE;
-				for (i=0; i<SMALL_NIBBLE_SIZE; i++)
-					*(pru1TrackDataPtr + offset + i) = theImage[track][sector][i];
-			}
-			*pru1InterruptPtr = 0;				// turn sending back on
+				// PRU1 keeps sending the old track while the new one is staged; no buffer free, next wakeup
+				if (stageTrack(drive, track))
+				{
+					stageWaiting = 1;
+					continue;
+				}
+				metricsSince(METRIC_TRACK_LOAD, wokeNs);
 
-			loadedTrk = track;
-			if (VERBOSE)
-			{
-				printf("%d\t", loadedTrk);
-//				printf("0x%X\t", loadedTrk);
-				trkCnt++;						// for display
-				if (trkCnt % 8 == 0)
-					printf("\n");
+				loadedTrk[drive] = track;
+				if (VERBOSE)
+				{
+					printf("%d:%d\t", drive + 1, loadedTrk[drive]);
+					trkCnt++;					// for display
+					if (trkCnt % 8 == 0)
+						printf("\n");
+				}
 			}
 		}
 
-		if (*pru1EnPtr == 0)					// is drive enabled?
-		{
-			lastSectorSent = *pru1SectorPtr;
+		// Head stepped: next track the way it is going into the spare buffer
+		if (news.steps)
+			prefetchStep(&news.pru0);
 
-			// A2 has enabled drive, EN- = 0
-			if (lastSectorSent != prevSector)	// PRU finished sending sector
+		// Handshake: PRU1 sent a sector and holds till we let the next one go
+		if (news.sectors)
+		{
+			if (!streaming)
 			{
-				prevSector = lastSectorSent;
-
-				// But first, did a write occur during last sector?
-				if (*pru1WritePtr == 1)
-				{
-					// Write occurred during this sector
-					// Expecting 342 data bytes + 1 checksum byte + [DE AA EB]
-
-					// Gross write integrity check: Is epilogue in expected location?
-					if (*(pru1WriteDataPtr+347) != 0xDE ||
-						*(pru1WriteDataPtr+348) != 0xAA ||
-						*(pru1WriteDataPtr+349) != 0xEB)
-						printf("*** BAD write epilogue\n");
-
-					// Copy sector from PRU write buffer to theImage[] and PRU track buffer
-					sectorIndex = prevSector * 374;			// first sync byte of sector
-					for (i=4, j=SECTOR_DATA_OFFSET, k=0; i<347; i++, j++, k++)
-					{
-						writeByte = *(pru1WriteDataPtr + i);
-						theImage[loadedTrk][prevSector][j] = writeByte;
-						*(pru1TrackDataPtr + sectorIndex + j) = writeByte;
-
-//						tempSector[k] = writeByte;
-					}
-
-					// Debug - yet another checksum thought
-//					checksum = computeDataChecksum(tempSector);
-//					if (checksum != *(pru1WriteDataPtr + 346))
-//						printf("*** BAD checksum: 0x%X 0x%X\n", checksum, *(pru1WriteDataPtr + 346));
-
-					*pru1WritePtr = 0;		// turn off write flag
-				}
-
-				// enable sector
-				*pru1InterruptPtr = 0;					// enable next sector
-				usleep(10);								// short sleep to let PRU continue
-				*pru1InterruptPtr = 1;					// PRU 1 stops before sending next sector
+				mailboxRelease();
+				metricsSince(METRIC_SECTOR_HANDOFF, wokeNs);
 			}
+			if (lastSectorNs)
+				metricsRecord(METRIC_SECTOR_INTERVAL, wokeNs - lastSectorNs);
+			lastSectorNs = wokeNs;
+			firstSector(&news, wokeNs);
 		}
-	} while (running);
 
-	printf("---Shutting down...\n");
+		// Writes stay in PRU1's slots and edge ring meanwhile, so they need not hold it up
+		if (news.writes)
+			drainWrites(&news, wokeNs);
+
+		// Safe boundary: this wakeup's sectors are released and writes are in, so
+		// nothing PRU1 is doing refers to an image a mount replaces
+		controlPoll();
+		mountImages();
 
-	// Debug
-//	for (i=0; i<360; i++)
-//		printf("%d\t0x%X\n", i, *(pru1WriteDataPtr + i));
+		metricsPoll(&pruEvents);					// dumps asked for by SIGUSR1 or the socket
+		if (statusRequested)
+			printStatus();
+	} while (running);
 
-	if (munmap(pru, PRU_LEN))
-		printf("*** ERROR: munmap failed at Shutdown\n");
+	printf("---Shutting down...\n");
+	mailboxStream(0);								// PRU1 waits for releases again
+	controlClose();
+	loaderStop();
+	journalStop();									// last writes to the image file
+	imageWriteDone();
+	catalogClose();
+	cachePrintStats();
+	trackFilePrintStats();
+	uploadPrintStats();
+	prefetchPrintStats();
+	edgePrintStats();
+	printf("Events: %llu wakeups, %llu timeouts\n", pruEvents.wakeups, pruEvents.timeouts);
+	mailboxPrintStats();
+	journalPrintStats();
+	loaderPrintStats();
+	metricsClose(&pruEvents);
+	eventClose(&pruEvents);
+
+	pruMemClose(&pruMem);
 
 	return EXIT_SUCCESS;
 }
@@ -294,394 +292,248 @@ void myShutdown(int sig)
 }
 
 //____________________
-void changeImage(int sig)
+void requestMetrics(int sig)
 {
-	// ctrl-Z
-	unsigned int i, selection;
-	size_t numImages, length;
-	char saveName[32];
-
-	printf("\n\n");
-	printf("Loaded image: %s\n", loadedImageName);
-	numImages = sizeof(theImages) / sizeof(theImages[0]);
-
-	printf("========== ========== ========== ========== ========== ==========\n");
-	for (i=0; i<numImages; i++)
-	{
-		printf("[%d] %s", i, theImages[i]);
-		if (i%3 == 2)
-			printf("\n");
-		else
-			printf("\t");
-	}
-	printf("\n========== ========== ========== ========== ========== ==========\n");
-
-//	printf("Save loaded image? Enter name (???.po or ???.dsk) or <CR>: ");
-//	fgets(saveName, 32, stdin);
-//	fgets(saveName, 32, stdin);		// do it again since can't flush stdin???
-
-//	length = strlen(saveName) - 1;	// points to last char in saveName
-//	if (saveName[length] == '\n')
-//		saveName[length] = '\0';
-
-//	if (length > 5)
-//		saveDiskImage(saveName);
-
-	printf("Select image to load: ");
-	scanf("%d", &selection);
-//	if (selection > numImages-1)
-//	{
-//		printf("Current image: %s\n", loadedImageName);
-//		return;
-//	}
-    if (selection < numImages)
-	    loadDiskImage(theImages[selection]);
-    else
-        printf("*** Bad image number\n");
+	// SIGUSR1, the main loop writes the dump
+	metricsRequest();
 }
 
 //____________________
-void loadDiskImage(const char *imageName)
+void requestStatus(int sig)
 {
-	/*	Loads disk image into theImage
-		Accounts for sector interleaving
-	*/
-	unsigned char trk, sector, translatedSector;
-	unsigned char tempBuff[NUM_TRACKS][NUM_SECTORS_PER_TRACK][NUM_BYTES_PER_SECTOR];
-	char imagePath[128];
-	unsigned int i, offset;
-	char *ext;
-	size_t numElements;
-	FILE *fd;
-
-	printf("\n  --- %s ---\n", imageName);
-	sprintf(imagePath, "/root/DiskImages/Small/%s", imageName);
-	fd = fopen(imagePath, "rb");
-	if (!fd)
-	{
-		printf("\n*** Problem opening disk image\n");
-		return;
-	}
-
-	// Read file into tempBuff, no format/alignment adjustments yet
-	for (trk=0; trk<NUM_TRACKS; trk++)
-	{
-		for (sector=0; sector<NUM_SECTORS_PER_TRACK; sector++)
-		{
-			numElements = fread(tempBuff[trk][sector], NUM_BYTES_PER_SECTOR, 1, fd);
-			if (numElements != 1)
-				printf("\n*** numElements= %zu (expecting 1)\n", numElements);
-		}
-	}
-	fclose(fd);
-
-	// Now rearrange and add synch, checksum, etc, into theImage
-	ext = strrchr(imagePath, '.');		// get file extension
-	for (trk=0; trk<NUM_TRACKS; trk++)
-	{
-		for (sector=0; sector<NUM_SECTORS_PER_TRACK; sector++)
-		{
-			// Assume we are only dealing with .dsk and .po files
-			if (strcmp(ext, ".dsk") == 0)
-				translatedSector = dosTranslateSector(sector);
-			else
-				translatedSector = prodosTranslateSector(sector);
-
-			diskEncodeNib(theImage[trk][sector], tempBuff[trk][translatedSector], 254, trk, sector);
-		}
-	}
-
-	strcpy(loadedImageName, imageName);
-
-	// Load track 0 into PRU1 data ram
-	*pru1InterruptPtr = 1;					// pause PRU1 while changing track
-
-	for (sector=0; sector<NUM_SECTORS_PER_TRACK; sector++)
-	{
-		offset = sector * SMALL_NIBBLE_SIZE;
-		for (i=0; i<SMALL_NIBBLE_SIZE; i++)
-			*(pru1TrackDataPtr + offset + i) = theImage[0][sector][i];
-	}
-	*pru1InterruptPtr = 0;
-
-	track = 0;
-	loadedTrk = 0;
+	// ctrl-Z, the main loop prints it; images change through the control socket
+	statusRequested = 1;
 }
 
 //____________________
-void diskEncodeNib(unsigned char *nibble, unsigned char *data, unsigned char vol, unsigned char trk, unsigned char sec)
+void printStatus(void)
 {
-	// Converts 256 byte file sector to 374 byte disk sector
-	unsigned int checksum, oldValue, xorValue, i;
-
-	static const unsigned char syncStream[]		= {0xFF, 0x3F, 0xCF, 0xF3, 0xFC};
-	static const unsigned char addrPrologue[]	= {0xD5, 0xAA, 0x96};
-	static const unsigned char dataPrologue[]	= {0xD5, 0xAA, 0xAD};
-	static const unsigned char epilogue1[]		= {0xDE, 0xAA, 0xEB};
-	static const unsigned char epilogue2[]		= {0xDE, 0xAA, 0xEB, 0x00, 0x00};
-	unsigned char *nibByte;
+	unsigned char drive;
 
-	// Set up header values
-	checksum = vol ^ trk ^ sec;
-
-	nibByte = memset(nibble, 0xFF, SMALL_NIBBLE_SIZE);
-	memcpy(nibByte, syncStream, 5);			nibByte += 5;
-	memcpy(nibByte, addrPrologue, 3);		nibByte += 3;
-
-	*nibByte++	= (vol >> 1) | 0xAA;
-	*nibByte++	= vol | 0xAA;
-
-	*nibByte++	= (trk >> 1) | 0xAA;
-	*nibByte++	= trk | 0xAA;
+	statusRequested = 0;
+	printf("\n\n");
+	for (drive=0; drive<NUM_DRIVES; drive++)
+		printf("Drive %d: %s\n", drive + 1, loadedImageName[drive][0] ? loadedImageName[drive] : "(empty)");
+	cachePrintStats();
+	trackFilePrintStats();
+	uploadPrintStats();
+	prefetchPrintStats();
+	edgePrintStats();
+	printf("Events: %llu wakeups, %llu timeouts\n", pruEvents.wakeups, pruEvents.timeouts);
+	mailboxPrintStats();
+	journalPrintStats();
+	loaderPrintStats();
+	printf("%u images, mount one with ./Controller -C <socket>, see Disk2Control.h\n", catalogCount());
+}
 
-	*nibByte++	= (sec >> 1) | 0xAA;
-	*nibByte++	= sec | 0xAA;
+//____________________
+void loadDiskImage(unsigned char drive, const char *imageName)
+{
+	/*	Loads disk image into drive in Disk2Image and its track 0 into a PRU1 buffer,
+		here and now; at startup only, mounts after that go through Disk2Loader
+	*/
+	char imagePath[256];
 
-	*nibByte++	= (checksum >> 1) | 0xAA;
-	*nibByte++	= (checksum) | 0xAA;
+	printf("\n  --- %d: %s ---\n", drive + 1, imageName);
+	snprintf(imagePath, sizeof(imagePath), "%s/%s", imageDir, imageName);
+	if (imageLoad(drive, imagePath))
+		return;
+	mountedImage(drive, imageName);
+}
 
-	memcpy(nibByte, epilogue1, 3);			nibByte += 3;
-	memcpy(nibByte, syncStream+1, 4);		nibByte += 4;
-	memcpy(nibByte, dataPrologue, 3);		nibByte += 3;
+//____________________
+void mountImages(void)
+{
+	/*	Mounts the loader has ready, read and encoded: each is installed in its
+		drive and its track 0 staged; the time from the request is recorded,
+		and timing to the first sector PRU1 sends of it starts
+		One the loader found cached but the cache has let go since goes back
+		to the loader, to be read
+	*/
+	unsigned char drive;
+	Mount *mount;
+	int installed;
 
-	xorValue = 0;
-	for (i=0; i<342; i++)
+	for (drive=0; drive<NUM_DRIVES; drive++)
 	{
-		if (i >= 0x56)
+		mount = loaderTake(drive);
+		if (!mount)
+			continue;
+
+		if (mount->eject)
 		{
-			// 6 bit
-			oldValue = data[i - 0x56];
-			oldValue = oldValue >> 2;
+			printf("\n  --- %d: ejected ---\n", drive + 1);
+			imageEject(drive);
+			mountedImage(drive, "");
 		}
 		else
 		{
-			// 3 * 2 bit
-			oldValue = 0;
-			oldValue |= (data[i + 0x00] & 0x01) << 1;
-			oldValue |= (data[i + 0x00] & 0x02) >> 1;
-			oldValue |= (data[i + 0x56] & 0x01) << 3;
-			oldValue |= (data[i + 0x56] & 0x02) << 1;
-			if (i + 0xAC < NUM_BYTES_PER_SECTOR)
+			installed = imageInstall(drive, &mount->image);
+			if (installed == 0)
 			{
-				oldValue |= (data[i + 0xAC] & 0x01) << 5;
-				oldValue |= (data[i + 0xAC] & 0x02) << 3;
+				printf("\n  --- %d: %s ---\n", drive + 1, mount->name);
+				mountedImage(drive, mount->name);
+				metricsSince(METRIC_MOUNT_LOAD, mount->requestNs);
+				mountNs[drive] = mount->requestNs;
 			}
+			else if (installed == 2 && loaderRequest(drive, mount->image.path, mount->name))
+				printf("*** Could not load %s again\n", mount->image.path);
 		}
-		xorValue ^= oldValue;
-		*nibByte++ = translate6[xorValue & 0x3F];
-		xorValue = oldValue;
+		loaderDone(mount);
 	}
-	*nibByte++ = translate6[xorValue & 0x3F];
-
-	memcpy(nibByte, epilogue2, 5);
 }
 
 //____________________
-unsigned char dosTranslateSector(unsigned char sector)
+void mountedImage(unsigned char drive, const char *imageName)
 {
-	// DOS order (*.dsk)
-	static const unsigned char skewing[] =
-	{
-		0x00, 0x07, 0x0E, 0x06, 0x0D, 0x05, 0x0C, 0x04,
-		0x0B, 0x03, 0x0A, 0x02, 0x09, 0x01, 0x08, 0x0F
-	};
-	return skewing[sector];
-}
+	// drive has another image, "" for none: stage its track 0, PRU1 picks it up at the next sector if drive is enabled
+	unsigned long long start;
 
-//____________________
-unsigned char prodosTranslateSector(unsigned char sector)
-{
-	// ProDOS order (*.po)
-	static const unsigned char skewing[] =
+	snprintf(loadedImageName[drive], sizeof(loadedImageName[drive]), "%s", imageName);
+
+	prefetchDrop(drive);
+	start = metricsNowNs();
+	if (stageTrack(drive, 0))
 	{
-		0x00, 0x08, 0x01, 0x09, 0x02, 0x0A, 0x03, 0x0B,
-		0x04, 0x0C, 0x05, 0x0D, 0x06, 0x0E, 0x07, 0x0F
-	};
-	return skewing[sector];
+		loadedTrk[drive] = NO_TRACK;			// staged from the main loop once a buffer is free
+		stageWaiting = 1;
+		mailboxRelease();
+		return;
+	}
+	metricsSince(METRIC_LOAD_UPLOAD, start);
+	mailboxRelease();
+
+	loadedTrk[drive] = 0;
 }
 
 //____________________
-void saveDiskImage(const char *fileName)
+void firstSector(const MailboxNews *news, unsigned long long wokeNs)
 {
-	/*	Saves disk image to /root/DiskImages/Small/Saved/fileName in format that can be loaded
-		Inverse of loadDiskImage()
-		Will overwrite existing file!
-		Accounts for sector interleaving
+	/*	Time to first sector of a mounted image: PRU1 has sent for the drive
+		from the buffer now selected for it, which holds the new image
+		Given up on if the A2 does not enable the drive soon enough
 	*/
-	unsigned char trk, sector, unTranslatedSector, resp;
-	unsigned char tempBuff[NUM_TRACKS][NUM_SECTORS_PER_TRACK][NUM_BYTES_PER_SECTOR];
-	unsigned char unTranslateSector_DOS[16], unTranslateSector_ProDOS[16];
-	char imagePath[128];
-	unsigned int i;
-	char *ext;
-	FILE *fd;
-
-	// Set up unTranslateSector tables
-	for (i=0; i<16; i++)
-	{
-		unTranslateSector_DOS[dosTranslateSector(i)] = i;
-		unTranslateSector_ProDOS[prodosTranslateSector(i)] = i;
-	}
+	unsigned char drive;
 
-	// Decode image into tempBuff, accounting for sector interleaving
-	sprintf(imagePath, "/root/DiskImages/Small/Saved/%s", fileName);
-	ext = strrchr(imagePath, '.');				// get file extension
-	for (trk=0; trk<NUM_TRACKS; trk++)
+	for (drive=0; drive<NUM_DRIVES; drive++)
 	{
-		for (sector=0; sector<NUM_SECTORS_PER_TRACK; sector++)
+		if (!mountNs[drive])
+			continue;
+		if (news->pru1.drive == drive && news->pru1.buffer == mailboxSelected(drive))
 		{
-			// Assume we are only dealing with .dsk and .po files
-			if (strcmp(ext, ".dsk") == 0)
-				unTranslatedSector = unTranslateSector_DOS[sector];
-			else
-				unTranslatedSector = unTranslateSector_ProDOS[sector];
-
-			resp = diskDecodeNib(tempBuff[trk][sector], theImage[trk][unTranslatedSector]);
-			if (resp == 1)		// decode error occurred
-			{
-				printf("\n***   trk= %d sector= %d\n", trk, sector);
-				return;
-			}
+			metricsRecord(METRIC_MOUNT_SECTOR, wokeNs - mountNs[drive]);
+			mountNs[drive] = 0;
 		}
+		else if (wokeNs - mountNs[drive] > MOUNT_WAIT_NS)
+			mountNs[drive] = 0;
 	}
-
-	// Set up save path and open file
-	printf("\n--- Saving: %s ---\n", fileName);
-	fd = fopen(imagePath, "wb");
-	if (!fd)
-	{
-		printf("\n*** Problem opening file for save\n");
-		return;
-	}
-
-	// Copy image from tempBuff to /root/DiskImages/imageName
-	for (trk=0; trk<NUM_TRACKS; trk++)
-	{
-		for (sector=0; sector<NUM_SECTORS_PER_TRACK; sector++)
-			fwrite(tempBuff[trk][sector], NUM_BYTES_PER_SECTOR, 1, fd);
-	}
-	fclose(fd);
 }
 
 //____________________
-unsigned char diskDecodeNib(unsigned char *data, unsigned char *nibble)
+void saveDiskImage(unsigned char drive, const char *fileName)
 {
-	// Converts 374 byte disk sector to 256 byte file sector
-	unsigned char readVolume, readTrack, readSector, readChecksum;
-	unsigned char b, xorValue, newValue;
-	unsigned int i;
-
-	// Pick apart volume/track/sector info and checksum - sanity checks?
-	if (decodeNibByte(&readVolume, &nibble[8]))
-	{
-		printf("\n*** diskDecodeNib: Failed to decode volume\n");
-		return 1;
-	}
-
-	if (decodeNibByte(&readTrack, &nibble[10]))
-	{
-		printf("\n*** diskDecodeNib: Failed to decode track\n");
-		return 1;
-	}
+	// Saves drive's disk image to imageDir/Saved/fileName, see imageSave()
+	char imagePath[256];
 
-	if (decodeNibByte(&readSector, &nibble[12]))
-	{
-		printf("\n*** diskDecodeNib: Failed to decode sector\n");
-		return 1;
-	}
-
-	if (decodeNibByte(&readChecksum, &nibble[14]))
-	{
-		printf("\n*** diskDecodeNib: Failed to decode checksum\n");
-		return 1;
-	}
+	snprintf(imagePath, sizeof(imagePath), "%s/Saved/%s", imageDir, fileName);
+	printf("\n--- Saving: %s ---\n", fileName);
+	imageSave(drive, imagePath);
+}
 
-	if (readChecksum != (readVolume ^ readTrack ^ readSector))
-	{
-		printf("\n*** diskDecodeNib: Failed address checksum\n");
-		return 1;
-	}
+//____________________
+void drainWrites(const MailboxNews *news, unsigned long long wokeNs)
+{
+	/*	Writes PRU1 captured since the last poll, oldest first, each from its
+		slot; the journal writer checks what they decode to
+		One that PRU1 has already reused the slot or edges of is counted missed
+		Commit latency is timed from wokeNs, when the wakeup that saw them began
+	*/
+	static uint16_t edges[EDGE_RING_SIZE];
+	unsigned int i, count;
+	uint32_t writeSeq;
+	WriteSlot slot;
 
-	// Decode nibble core
-	xorValue = 0;
-	for (i=0; i<342; i++)
+	for (i=0; i<news->writes; i++)
 	{
-		b = untranslate6[nibble[i+26]];		// first data
-		if (b == 0xFF)
-		{
-			printf("\n*** diskDecodeNib: Out of range in untranslate6: %d\n", nibble[i+26]);
-			return 1;
-		}
-
-		newValue = b ^ xorValue;
-
-		if (i >= 0x56)
+		writeSeq = news->pru1.writeSeq - news->writes + 1 + i;
+		if (mailboxWriteSlot(writeSeq, &slot))
+			continue;
+		count = edgeCopy(edges, pru1RAMptr, slot.ringStart, slot.edgeCount);
+		if (count && mailboxEdgesStill(slot.edgeStart))
 		{
-			// 6 bit
-			data[i - 0x56] |= (newValue << 2);
+			commitWrite(slot.drive & 1, slot.track, slot.sector, edges, count);
+			metricsSince(METRIC_WRITE_COMMIT, wokeNs);
 		}
-		else
-		{
-			// 3 * 2 bit
-			data[i + 0x00] = ((newValue >> 1) & 0x01) | ((newValue << 1) & 0x02);
-			data[i + 0x56] = ((newValue >> 3) & 0x01) | ((newValue >> 1) & 0x02);
-			if (i + 0xAC < NUM_BYTES_PER_SECTOR)
-				data[i + 0xAC] = ((newValue >> 5) & 0x01) | ((newValue >> 3) & 0x02);
-		}
-		xorValue = newValue;
 	}
-	return 0;
 }
 
 //____________________
-unsigned char decodeNibByte(unsigned char *nibInt, unsigned char *nibData)
+void commitWrite(unsigned char drive, unsigned char trk, unsigned char sector, const uint16_t *edges,
+	unsigned int count)
 {
-	if ((nibData[0] & 0xAA) != 0xAA)
-		return 1;
+	// Written sector into drive's image, and its PRU track buffer if that holds trk, or the spare if that does
+	unsigned char capture[EDGE_CAPTURE_SIZE];	// data field rebuilt from the edges
+	unsigned int length;
+	int index;									// where the write landed in the track, -1 = nowhere
+	int ahead;
 
-	if ((nibData[1] & 0xAA) != 0xAA)
-		return 1;
+	if (edgeDecode(capture, edges, count) != 0)
+	{
+		printf("*** trk= %d sector= %d: write not framed\n", trk, sector);
+		return;
+	}
 
-	*nibInt  = (nibData[0] & ~0xAA) << 1;
-	*nibInt |= (nibData[1] & ~0xAA) << 0;
-	return 0;
+	index = imageWriteSector(drive, trk, sector, capture, &length);
+	if (index >= 0 && trk == loadedTrk[drive])
+		uploadRange(mailboxSelected(drive), index, imageTrack(drive, trk) + index, length);
+	ahead = prefetchHolding(drive, trk);
+	if (index >= 0 && ahead >= 0)
+		uploadRange(ahead, index, imageTrack(drive, trk) + index, length);
 }
 
 //____________________
-unsigned char computeDataChecksum(unsigned char *nibble)
+int stageTrack(unsigned char drive, unsigned char trk)
 {
-	// Converts 342 data bytes to 256 bytes & returns checksum (0 if error)
-	unsigned char b, xorValue, newValue;
-	unsigned int i;
-
-	char data[NUM_BYTES_PER_SECTOR];
+	/*	Uploads trk of drive's image into a track buffer PRU1 is not sending,
+		then selects it for drive; PRU1 switches at its next sector boundary,
+		or when the A2 next enables drive. Each drive's selection holds its
+		track, the third buffer is spare, and Disk2Prefetch may have put trk
+		there already, leaving only the select
+		If PRU1 is sending for drive, first make sure it will stay on the buffer
+		it is sending now: if a previous flip is still pending PRU1 may take it
+		while we look, so repeat until the buffer it acknowledges is the one we
+		selected. The spare is then free
+		If it is sending for the other drive, drive's selection may be the
+		next buffer PRU1 sends, as soon as the A2 enables drive, so it is
+		never written: trk goes into the spare and is selected, as above
+		Returns 0, or 1 if no buffer is free, the other drive's flip pending
+		with the spare still going out; PRU1 takes it within a sector, and the
+		caller stages trk again then, drive sending its old track meanwhile
+	*/
+	const unsigned char *trackData;
+	unsigned char sendDrive;
+	unsigned long long start;
+	int sending, buffer;
 
-	xorValue = 0;
-	for (i=0; i<342; i++)
+	sending = mailboxSending(&sendDrive);
+	while (sending >= 0 && sendDrive == drive && sending != mailboxSelected(drive))
 	{
-		b = untranslate6[nibble[i]];		// first data
-		if (b == 0xFF)
-		{
-			printf("\n*** ComputeDataChecksum: Out of range in untranslate6: %d\n", nibble[i]);
-			return 0;
-		}
+		mailboxSelect(drive, sending);
+		sending = mailboxSending(&sendDrive);
+	}
 
-		newValue = b ^ xorValue;
+	buffer = prefetchSpare(drive, trk, sending);
+	if (buffer < 0)
+		return 1;
 
-		if (i >= 0x56)
-		{
-			// 6 bit
-			data[i - 0x56] |= (newValue << 2);
-		}
-		else
-		{
-			// 3 * 2 bit
-			data[i + 0x00] = ((newValue >> 1) & 0x01) | ((newValue << 1) & 0x02);
-			data[i + 0x56] = ((newValue >> 3) & 0x01) | ((newValue >> 1) & 0x02);
-			if (i + 0xAC < NUM_BYTES_PER_SECTOR)
-				data[i + 0xAC] = ((newValue >> 5) & 0x01) | ((newValue >> 3) & 0x02);
-		}
-		xorValue = newValue;
+	if (!prefetchTake(drive, trk, buffer))
+	{
+		trackData = imageTrack(drive, trk);		// encodes track if first visit
+		start = metricsNowNs();
+		uploadTrack(buffer, trackData);			// only words that differ
+		metricsSince(METRIC_TRACK_UPLOAD, start);
 	}
-	return xorValue;
+
+	mailboxSelect(drive, buffer);
+	return 0;
 }
@@ -0,0 +1,259 @@
+/*	Disk2Edge.c
+	Bit-cell recovery and byte framing of PRU1's WSIG edge ring, see Disk2Edge.h
+	Also builds edge traces from bytes, for Sim, Bench and recorded-trace tests
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Disk2Edge.h"
+#include "Disk2Mem.h"
+
+#define CELL_SHIFT		4				// cell length kept in 1/16 cycles
+#define CELL_MIN		((EDGE_CELL_CYCLES * 3 / 4) << CELL_SHIFT)
+#define CELL_MAX		((EDGE_CELL_CYCLES * 5 / 4) << CELL_SHIFT)
+#define INJECT_JITTER	40				// cycles, Sim and Bench
+
+static EdgeStats stats;					// main thread only
+
+static void ringRead(unsigned char *out, const volatile unsigned char *ring, unsigned int from, unsigned int n);
+static int jiggle(unsigned int jitter, unsigned int *seed);
+
+//____________________
+unsigned int edgeCopy(uint16_t *edges, const unsigned char *pru1, unsigned int start, unsigned int count)
+{
+	/*	Copies count edges out of the ring from byte start as timestamps,
+		returns count or 0 if the ring could not hold them
+	*/
+	const volatile unsigned char *ring = pru1 + EDGE_RING_ADR;
+	unsigned char deltas[EDGE_RING_SIZE];
+	unsigned int first;
+
+	if (count > EDGE_RING_SIZE || start >= EDGE_RING_SIZE)
+	{
+		stats.overflows++;
+		return 0;
+	}
+
+	first = EDGE_RING_SIZE - start;
+	if (first > count)
+		first = count;
+	ringRead(deltas, ring, start, first);
+	ringRead(deltas + first, ring, 0, count - first);
+	edgeUnpack(edges, deltas, count);
+	return count;
+}
+
+//____________________
+void edgePack(unsigned char *deltas, const uint16_t *edges, unsigned int count)
+{
+	/*	Timestamps into the ring's form, the way PRU1 makes it: each delta is
+		taken from where the deltas before add up to, so truncation does not build up
+	*/
+	uint16_t last;
+	unsigned int i, delta;
+
+	last = 0;
+	for (i=0; i<count; i++)
+	{
+		delta = (uint16_t) (edges[i] - last) >> EDGE_UNIT_SHIFT;
+		deltas[i] = delta > 255 ? 255 : delta;
+		last += deltas[i] << EDGE_UNIT_SHIFT;
+	}
+}
+
+//____________________
+void edgeUnpack(uint16_t *edges, const unsigned char *deltas, unsigned int count)
+{
+	uint16_t now;
+	unsigned int i;
+
+	now = 0;
+	for (i=0; i<count; i++)
+	{
+		now += deltas[i] << EDGE_UNIT_SHIFT;
+		edges[i] = now;
+	}
+}
+
+//____________________
+int edgeDecode(unsigned char *capture, const uint16_t *edges, unsigned int count)
+{
+	/*	Rebuilds the data field from count edge timestamps
+		A software PLL keeps where the last 1 bit should have been and the cell
+		length: each edge is rounded to a whole number of cells from there, then
+		pulls the phase 1/4 and the cell length 1/64 of the way to it, so edge
+		jitter averages out and a fast or slow A2 (within +-25 %) is followed
+		Returns 0 if D5 AA AD and the EDGE_CAPTURE_SIZE - 4 bytes after it were
+		framed, else 1 with the rest of capture zeroed
+		An edge less than half a cell after the one before is a glitch and skipped
+	*/
+	unsigned long long now, lastEdge, bitTime;
+	unsigned int i, bit, cell, cells, reg, length, last;
+	long long error;
+
+	memset(capture, 0, EDGE_CAPTURE_SIZE);
+	cell = EDGE_CELL_CYCLES << CELL_SHIFT;
+	reg = 0;
+	length = 0;								// bytes in capture, 0 until D5 AA AD
+	last = 0;								// last 4 bytes framed, newest in the low byte
+	now = lastEdge = 0;						// cycles since the first edge
+	bitTime = 0;							// where the last 1 bit should have been, 1/16 cycles
+
+	for (i=1; i<count && length<EDGE_CAPTURE_SIZE; i++)
+	{
+		now += (uint16_t) (edges[i] - edges[i-1]);
+		if (((now - lastEdge) << CELL_SHIFT) < cell / 2)
+			continue;
+		lastEdge = now;
+
+		cells = ((now << CELL_SHIFT) - bitTime + cell / 2) / cell;
+		if (cells == 0)
+			cells = 1;
+		if (cells > EDGE_MAX_CELLS)
+		{
+			cells = EDGE_MAX_CELLS;
+			bitTime = now << CELL_SHIFT;	// lost lock, start over here
+		}
+		else
+		{
+			bitTime += cells * cell;
+			error = (long long) (now << CELL_SHIFT) - (long long) bitTime;
+			bitTime += error / 4;
+			cell += error / (64 * (long long) cells);
+			if (cell < CELL_MIN)
+				cell = CELL_MIN;
+			else if (cell > CELL_MAX)
+				cell = CELL_MAX;
+		}
+
+		// cells - 1 zeros, then a 1; zeros into an empty register are sync
+		for (bit=cells; bit>0 && length<EDGE_CAPTURE_SIZE; bit--)
+		{
+			reg = (reg << 1) | (bit == 1);
+			if (reg < 0x80)
+				continue;
+
+			last = (last << 8) | reg;
+			if (length)
+				capture[length++] = reg;
+			else if ((last & 0xFFFFFF) == 0xD5AAAD)
+			{
+				capture[0] = last >> 24;
+				capture[1] = 0xD5;
+				capture[2] = 0xAA;
+				capture[3] = 0xAD;
+				length = 4;
+			}
+			reg = 0;
+		}
+	}
+
+	stats.writes++;
+	stats.edges += count;
+	if (length < EDGE_CAPTURE_SIZE)
+	{
+		stats.notFramed++;
+		return 1;
+	}
+	return 0;
+}
+
+//____________________
+unsigned int edgeSynthesize(uint16_t *edges, unsigned int max, const unsigned char *bytes, unsigned int n,
+	unsigned int cellCycles, unsigned int jitter, unsigned int *seed)
+{
+	/*	Edge trace of EDGE_SYNC_BYTES 10 bit sync bytes then n bytes, msb first,
+		one edge per 1 bit, each edge moved by up to +-jitter cycles
+		cellCycles other than EDGE_CELL_CYCLES stands in for a fast or slow A2
+		Returns the number of edges, at most max
+	*/
+	unsigned long long t;
+	unsigned int i, count;
+	int bit;
+
+	t = 1000;
+	count = 0;
+	for (i=0; i<EDGE_SYNC_BYTES; i++)
+		for (bit=9; bit>=0; bit--, t+=cellCycles)
+			if (bit >= 2 && count < max)
+				edges[count++] = t + jiggle(jitter, seed);
+
+	for (i=0; i<n; i++)
+		for (bit=7; bit>=0; bit--, t+=cellCycles)
+			if (((bytes[i] >> bit) & 1) && count < max)
+				edges[count++] = t + jiggle(jitter, seed);
+	return count;
+}
+
+//____________________
+unsigned int edgeInject(unsigned char *pru1, const unsigned char *nibble, unsigned int *position)
+{
+	/*	Plays PRU1 for a write of the data field of nibble, an encoded sector:
+		edges go into the ring from byte *position on, which is moved past them
+		Returns the number of edges; publishing them is up to the caller
+	*/
+	static unsigned int seed = 2022;
+	unsigned char field[3 + 343 + 3];
+	uint16_t edges[EDGE_RING_SIZE];
+	unsigned char deltas[EDGE_RING_SIZE];
+	unsigned char *ring = pru1 + EDGE_RING_ADR;
+	unsigned int count, i;
+
+	memcpy(field, nibble + 23, 3 + 343);
+	memcpy(field + 346, "\xDE\xAA\xEB", 3);
+	count = edgeSynthesize(edges, EDGE_RING_SIZE, field, sizeof(field), EDGE_CELL_CYCLES, INJECT_JITTER, &seed);
+	edgePack(deltas, edges, count);
+
+	for (i=0; i<count; i++)
+	{
+		ring[*position] = deltas[i];
+		if (++*position == EDGE_RING_SIZE)
+			*position = 0;
+	}
+	return count;
+}
+
+//____________________
+void edgeGetStats(EdgeStats *out)
+{
+	*out = stats;
+}
+
+//____________________
+void edgePrintStats(void)
+{
+	printf("Edges: %llu writes, %llu edges", stats.writes, stats.edges);
+	if (stats.notFramed || stats.overflows)
+		printf(", %llu not framed, %llu overflows", stats.notFramed, stats.overflows);
+	printf("\n");
+}
+
+//____________________
+static void ringRead(unsigned char *out, const volatile unsigned char *ring, unsigned int from, unsigned int n)
+{
+	/*	n bytes of the ring from byte from, up to its end: aligned 32-bit loads,
+		single bytes either side; memcpy may load unaligned or several words
+		at once, which PRU RAM mapped from /dev/mem need not take
+	*/
+	uint32_t word;
+
+	for (; n && (from & 3); n--)
+		*out++ = ring[from++];
+	for (; n >= 4; n -= 4, from += 4, out += 4)
+	{
+		word = *(const volatile uint32_t *) (ring + from);
+		memcpy(out, &word, 4);
+	}
+	for (; n; n--)
+		*out++ = ring[from++];
+}
+
+//____________________
+static int jiggle(unsigned int jitter, unsigned int *seed)
+{
+	// Uniform in -jitter..jitter
+	if (jitter == 0)
+		return 0;
+	return (int) (rand_r(seed) % (2 * jitter + 1)) - (int) jitter;
+}
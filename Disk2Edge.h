@@ -0,0 +1,41 @@
+/*	Disk2Edge.h
+	A2 writes, rebuilt on the host from WSIG edge timestamps
+	PRU1 logs the time since the edge before, in 16ths of its cycle counter
+	(200 MHz) as one byte, at every WSIG edge into a ring in its data RAM, see
+	Disk2Mem.h; edgeCopy() turns them back into 16 bit timestamps. Each edge
+	is a 1 bit and the time to the next edge says how many 0 bits come in between
+	edgeDecode() recovers bit cells with a tracking cell length, frames bytes
+	the way the Disk II shift register does (a byte is done once its msb is 1,
+	so sync zeros drop out) and lays the data field out as PRU1 used to:
+		[0] sync remnant, [1..3] D5 AA AD, [4..346] data, [347..349] DE AA EB
+*/
+#ifndef _DISK2EDGE_H_
+#define _DISK2EDGE_H_
+
+#include <stdint.h>
+
+#define EDGE_CELL_CYCLES	800			// 4 us bit cell at 200 MHz
+#define EDGE_MAX_CELLS		8			// longer gaps count as 7 zeros and a 1
+#define EDGE_CAPTURE_SIZE	350			// one framed data field
+#define EDGE_SYNC_BYTES		5			// 10 bit sync bytes the A2 writes before D5 AA AD
+
+typedef struct
+{
+	unsigned long long writes;			// traces decoded
+	unsigned long long edges;
+	unsigned long long notFramed;		// no D5 AA AD, or trace ended before DE AA EB
+	unsigned long long overflows;		// more edges than the ring holds, not decoded
+} EdgeStats;
+
+unsigned int edgeCopy(uint16_t *edges, const unsigned char *pru1, unsigned int start, unsigned int count);
+void edgePack(unsigned char *deltas, const uint16_t *edges, unsigned int count);
+void edgeUnpack(uint16_t *edges, const unsigned char *deltas, unsigned int count);
+int edgeDecode(unsigned char *capture, const uint16_t *edges, unsigned int count);
+unsigned int edgeSynthesize(uint16_t *edges, unsigned int max, const unsigned char *bytes, unsigned int n,
+	unsigned int cellCycles, unsigned int jitter, unsigned int *seed);
+unsigned int edgeInject(unsigned char *pru1, const unsigned char *nibble, unsigned int *position);
+
+void edgeGetStats(EdgeStats *stats);
+void edgePrintStats(void);
+
+#endif /* _DISK2EDGE_H_ */
@@ -0,0 +1,772 @@
+/*	Disk2Emu.c
+	Runs Disk2Pru0.c and Disk2Pru1.c on the host, on a virtual 200 MHz cycle
+	clock, for timing that can be checked without a BeagleBone, see Disk2Emu.h
+		./Emu							200 ms: head steps 4 half tracks, PRU1 sends track 0
+		./Emu -W 20						and the A2 writes a sector 20 ms in
+		./Emu -W 20 -d -6 -j 80			A2 clock 6 % fast, edges +-80 cycles off
+		./Emu -W 20 -f <trace>			writes a recorded trace, uint16 cycle counts
+		./Emu -D						write decoded at A2 clocks -12 % to +12 %, -W ms on
+		./Emu -o <file>					RDAT edges, events, sectors, tracks, writes by cycle
+		./Emu -g <file>					the same, checked against a golden trace
+		./Emu -G 10						10 us glitch on the next phase halfway through each step
+		./Emu -t ms -c cycles -r us -S -s steps -p us -m <memfile>
+	Both firmwares run as coroutines; the one behind on the clock runs till
+	an access takes it past the other, so they see each other's memory in
+	time order and a run comes out the same every time
+	Stand-ins: the A2 enables drive 1, steps the head from half track 0 one
+	half track every -p us from 2 ms on, then lets go of the phases, and
+	writes when asked; Controller fills track buffer 0 with track 0 and
+	releases each sector -r us after it is sent, or lets PRU1 stream (-S)
+	A recorded trace needs the firmware to match, so record one (-o) before
+	touching the delays and thresholds and check against it (-g) after
+	-m <memfile> leaves memory behind for ./Trace -m, stamped in cycles
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+
+#include "Disk2Emu.h"
+#include "Disk2Mem.h"
+#include "Disk2Mailbox.h"
+#include "Disk2Gcr.h"
+#include "Disk2Edge.h"
+
+#define CYCLES_US			200				// 200 MHz
+#define STACK_SIZE			(256 * 1024)
+#define VIEW_DRAM			0x2000			// each PRU's data RAM
+#define VIEW_SHARED			0x3000			// shared RAM, 12 KB
+#define STEP_START_US		2000			// first head step
+#define MAX_EDGES			65536
+#define PACKET_BITS			(GCR_NIBBLE_SIZE * 8)
+#define FIELD_SIZE			(3 + GCR_DATA_NIBBLES + 3)	// D5 AA AD, data, DE AA EB
+
+// R30 and R31 bits, see the firmwares
+#define R31_UNWRITTEN		(1u << 31)		// in what we leave in R31, a firmware write clears it
+#define PRU0_EN2			(1 << 7)
+#define PRU1_EN2			(1 << 11)
+#define PRU1_WREQ			(1 << 4)
+#define PRU1_WSIG			(1 << 6)
+#define PRU1_RDAT			(1 << 7)
+
+typedef struct
+{
+	ucontext_t ctx;
+	unsigned long long now;					// cycles
+	uint32_t r30, r31, lastR30;
+	unsigned char done;
+} Pru;
+
+typedef struct
+{
+	unsigned long long endCycles;
+	unsigned int access;					// cycles an access to a stand-in costs
+	unsigned int releaseCycles;				// Controller's sector handshake
+	unsigned char stream;
+	unsigned int steps, stepCycles;			// head steps
+	unsigned int glitchCycles;				// on the next phase halfway through each, 0 = none
+	long long writeAt;						// cycle WREQ- goes low, -1 = no write
+	int drift;								// A2 clock against nominal, percent
+	unsigned int jitter;					// WSIG edges moved up to this many cycles
+	const char *edgePath;					// recorded trace instead of a synthesized one
+	unsigned char untilWrite;				// run ends 1 ms after the write
+} Run;
+
+typedef struct
+{
+	unsigned long long n;
+	double min, max, sum;
+} Summary;
+
+typedef struct
+{
+	unsigned int driven, logged, missed;	// missed = edges before HandleWrite() looked
+	int maxError;							// cycles, logged edge to edge against driven
+	const char *result;
+} WriteResult;
+
+int pru0Main(int argc, char *argv[]);
+int pru1Main(int argc, char *argv[]);
+
+int mapViews(int fd);
+int emulate(void);
+int makeWaveform(void);
+void runPru0(void);
+void runPru1(void);
+void step(unsigned int cycles);
+void observe(unsigned char n);
+uint32_t inputs(unsigned char n, unsigned long long t);
+void rdatChanged(unsigned long long t, unsigned char level);
+void sectorSent(unsigned long long t);
+void trackChanged(unsigned long long t);
+void writeCaptured(unsigned long long t);
+void emit(const char *format, ...);
+void add(Summary *s, double value);
+void printSummary(const char *name, const Summary *s, const char *unit);
+
+EmuCfg emuCfg;
+EmuIntc emuIntc;
+
+static Run run;
+static Pru prus[2];
+static unsigned char current;				// PRU running now
+static ucontext_t scheduler;
+static unsigned char *stacks[2];
+static unsigned char *pruBase;				// PRU memory, Disk2Mem.h layout
+static volatile Pru0Status *pru0Status;
+static volatile Pru1Status *pru1Status;
+
+static EmuIep iep;
+static EmuCtrl ctrl;
+static uint32_t iepLast, cycleLast;			// what the last access left, anything else was written
+static unsigned long long iepBase, cycleBase, iepAt, cycleAt;
+
+// A2 stand-in's write
+static uint16_t edges16[MAX_EDGES];
+static unsigned long long driven[MAX_EDGES];
+static unsigned int drivenCount, cellCycles;
+static unsigned long long wreqHighAt;
+static unsigned char field[FIELD_SIZE], haveField;
+
+// Controller stand-in
+static unsigned long long releaseAt;		// 0 = nothing to release
+static uint32_t seenTrackSeq, seenSectorSeq, seenWriteSeq;
+
+// What came out
+static unsigned long long pulses[PACKET_BITS], fallAt, lastPulse;
+static unsigned int pulseCount;
+static unsigned char haveFall, haveLastPulse, writeInSector, writeInLast;
+static Summary bitCell, pulseWidth, bitJitter, sectorGap, trackLatency;
+static unsigned int sectorsChecked, sectorsWrong;
+static WriteResult written;
+
+static FILE *out, *golden;
+static unsigned long long lineNo, mismatch;
+
+//____________________
+int main(int argc, char *argv[])
+{
+	const char *backing, *outPath, *goldenPath;
+	char line[128];
+	unsigned char sweep;
+	unsigned long long ms;
+	long long writeAt;
+	PruMem pruMem;
+	int opt, fd, drift, status;
+
+	memset(&run, 0, sizeof(run));
+	ms = 200;
+	run.access = EMU_ACCESS_CYCLES;
+	run.releaseCycles = 30 * CYCLES_US;
+	run.steps = 4;
+	run.stepCycles = 3000 * CYCLES_US;
+	run.writeAt = -1;
+	run.jitter = 80;
+	backing = PRU_MEM_ANON;
+	outPath = goldenPath = NULL;
+	sweep = 0;
+	while ((opt = getopt(argc, argv, "t:c:r:Ss:p:G:W:d:j:f:Do:g:m:")) != -1)
+	{
+		switch (opt)
+		{
+			case 't':	ms = atoi(optarg);								break;
+			case 'c':	run.access = atoi(optarg);						break;
+			case 'r':	run.releaseCycles = atoi(optarg) * CYCLES_US;	break;
+			case 'S':	run.stream = 1;									break;
+			case 's':	run.steps = atoi(optarg);						break;
+			case 'p':	run.stepCycles = atoi(optarg) * CYCLES_US;		break;
+			case 'G':	run.glitchCycles = atoi(optarg) * CYCLES_US;	break;
+			case 'W':	run.writeAt = atoi(optarg) * 1000LL * CYCLES_US;	break;
+			case 'd':	run.drift = atoi(optarg);						break;
+			case 'j':	run.jitter = atoi(optarg);						break;
+			case 'f':	run.edgePath = optarg;							break;
+			case 'D':	sweep = 1;										break;
+			case 'o':	outPath = optarg;								break;
+			case 'g':	goldenPath = optarg;							break;
+			case 'm':	backing = optarg;								break;
+			default:
+				printf("Usage: %s [-t ms] [-c cycles] [-r us | -S] [-s steps] [-p us] [-G us] [-W ms [-d %%] [-j cycles] [-f trace]] [-D]\n"
+					"	[-o trace | -g golden] [-m memfile]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	run.endCycles = ms * 1000 * CYCLES_US;
+	if (run.stepCycles == 0)
+		run.stepCycles = CYCLES_US;
+	if ((run.edgePath || sweep) && run.writeAt < 0)
+		run.writeAt = 20000LL * CYCLES_US;
+
+	if (strcmp(backing, PRU_MEM_DEVMEM) == 0)
+	{
+		printf("*** Emu runs on a stand-in, not /dev/mem\n");
+		return EXIT_FAILURE;
+	}
+	if (pruMemOpen(&pruMem, backing))
+		return EXIT_FAILURE;
+	fd = pruMem.fd != -1 ? pruMem.fd : open(backing, O_RDWR);
+	if (fd == -1 || mapViews(fd))
+		return EXIT_FAILURE;
+	pruBase = pruMem.base;
+	pru0Status = (volatile Pru0Status *) (pruBase + PRU0_STATUS_ADR);
+	pru1Status = (volatile Pru1Status *) (pruBase + PRU1_DRAM + PRU1_STATUS_ADR);
+	stacks[0] = malloc(STACK_SIZE);
+	stacks[1] = malloc(STACK_SIZE);
+
+	if (outPath && (out = fopen(outPath, "w")) == NULL)
+	{
+		printf("*** ERROR: could not write %s\n", outPath);
+		return EXIT_FAILURE;
+	}
+	if (goldenPath && (golden = fopen(goldenPath, "r")) == NULL)
+	{
+		printf("*** ERROR: could not open %s\n", goldenPath);
+		return EXIT_FAILURE;
+	}
+	diskGcrInit();
+
+	status = EXIT_SUCCESS;
+	if (sweep)
+	{
+		// Each row's write starts 2.5 us later, so WREQ- is seen at a different point in a byte
+		run.untilWrite = 1;
+		writeAt = run.writeAt;
+		printf("--- Emu, write decoded against A2 clock, %u cycles an access, +-%u cycles jitter\n", run.access, run.jitter);
+		for (drift=-12; drift<=12; drift+=2)
+		{
+			run.drift = drift;
+			run.writeAt = writeAt + (drift + 12) * 250;
+			if (emulate())
+				return EXIT_FAILURE;
+			printf("  cell %3u cycles (%+3d %%)  %5u edges  %3u before HandleWrite  error up to %3d cycles  %s\n",
+				cellCycles, drift, written.driven, written.missed, written.maxError, written.result);
+		}
+	}
+	else
+	{
+		if (emulate())
+			return EXIT_FAILURE;
+		printf("--- Emu, %.1f ms of PRU time, %u cycles an access, %s\n", run.endCycles / (1000.0 * CYCLES_US), run.access,
+			run.stream ? "streaming" : "sector handshake");
+		printSummary("bit cell", &bitCell, "us");
+		printSummary("RDAT pulse", &pulseWidth, "us");
+		printSummary("bit jitter", &bitJitter, "us");
+		printSummary("sector gap", &sectorGap, "us");
+		printSummary("track change", &trackLatency, "us");
+		printf("  %u packets checked bit for bit, %u wrong\n", sectorsChecked, sectorsWrong);
+		if (written.result)
+			printf("  write: %u edges at %u cycles a cell, %u logged, %u before HandleWrite, error up to %d cycles (%.1f %% of a cell), %s\n",
+				written.driven, cellCycles, written.logged, written.missed, written.maxError, 100.0 * written.maxError / cellCycles, written.result);
+		if (sectorsWrong)
+			status = EXIT_FAILURE;
+	}
+
+	if (golden)
+	{
+		if (!mismatch && fgets(line, sizeof(line), golden) != NULL)
+		{
+			mismatch = lineNo + 1;
+			printf("*** golden trace goes on past line %llu\n", lineNo);
+		}
+		printf("%s golden trace %s\n", mismatch ? "***" : "---", mismatch ? "differs" : "matches");
+		if (mismatch)
+			status = EXIT_FAILURE;
+		fclose(golden);
+	}
+	if (out)
+		fclose(out);
+	pruMemClose(&pruMem);
+	return status;
+}
+
+//____________________
+int mapViews(int fd)
+{
+	/*	Each PRU's local address space at its PRU_LOCAL: its own data RAM at 0,
+		the other's at 0x2000, shared RAM at 0x10000, all the one PRU memory
+	*/
+	unsigned long local;
+	off_t own, other;
+	unsigned char n;
+
+	for (n=0; n<2; n++)
+	{
+		local = n ? EMU_PRU1_LOCAL : EMU_PRU0_LOCAL;
+		own = n ? PRU1_DRAM : 0;
+		other = n ? 0 : PRU1_DRAM;
+		if (mmap((void *) local, VIEW_DRAM, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, own) != (void *) local
+			|| mmap((void *) (local + VIEW_DRAM), VIEW_DRAM, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, other)
+				!= (void *) (local + VIEW_DRAM)
+			|| mmap((void *) (local + PRU_SHAREDMEM), VIEW_SHARED, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd,
+				PRU_SHAREDMEM) != (void *) (local + PRU_SHAREDMEM))
+		{
+			printf("*** ERROR: could not map PRU%d's memory at 0x%lX\n", n, local);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//____________________
+int emulate(void)
+{
+	/*	One run from reset to run.endCycles, both PRUs' clocks
+		Returns 0, or 1 if the write's waveform could not be had
+	*/
+	static unsigned char data[GCR_SECTORS_PER_TRACK * GCR_BYTES_PER_SECTOR];
+	unsigned int seed, i;
+
+	memset(prus, 0, sizeof(prus));
+	memset(&iep, 0, sizeof(iep));
+	memset(&ctrl, 0, sizeof(ctrl));
+	iepLast = cycleLast = 0;
+	iepBase = cycleBase = iepAt = cycleAt = 0;
+	memset(pruBase, 0, 2 * VIEW_DRAM);
+	memset(pruBase + PRU_SHAREDMEM, 0, VIEW_SHARED);
+	fallAt = lastPulse = 0;
+	pulseCount = 0;
+	haveFall = haveLastPulse = writeInSector = writeInLast = 0;
+	memset(&bitCell, 0, sizeof(Summary));
+	memset(&pulseWidth, 0, sizeof(Summary));
+	memset(&bitJitter, 0, sizeof(Summary));
+	memset(&sectorGap, 0, sizeof(Summary));
+	memset(&trackLatency, 0, sizeof(Summary));
+	sectorsChecked = sectorsWrong = 0;
+	memset(&written, 0, sizeof(written));
+
+	if (makeWaveform())
+		return 1;
+	if (run.untilWrite && drivenCount)
+		run.endCycles = wreqHighAt + 1000 * CYCLES_US;
+
+	// Controller: track 0 in buffer 0, selected for both drives
+	seed = 2022;
+	for (i=0; i<sizeof(data); i++)
+		data[i] = rand_r(&seed);
+	diskEncodeTrack(pruBase + TRACK_BUF_ADR(0), data, dosTranslateSector, 254, 0);
+	mailboxInit(pruBase);
+	mailboxStream(run.stream);
+	releaseAt = run.stream ? 0 : run.releaseCycles;
+	seenTrackSeq = seenSectorSeq = seenWriteSeq = 0;
+
+	emit("# Emu t=%llu c=%u r=%u S=%u s=%u p=%u G=%u W=%lld d=%d j=%u f=%s\n", run.endCycles, run.access, run.releaseCycles,
+		run.stream, run.steps, run.stepCycles, run.glitchCycles, run.writeAt, run.drift, run.jitter,
+		run.edgePath ? run.edgePath : "-");
+
+	for (i=0; i<2; i++)
+	{
+		prus[i].r31 = R31_UNWRITTEN;
+		getcontext(&prus[i].ctx);
+		prus[i].ctx.uc_stack.ss_sp = stacks[i];
+		prus[i].ctx.uc_stack.ss_size = STACK_SIZE;
+		prus[i].ctx.uc_link = &scheduler;
+		makecontext(&prus[i].ctx, i ? runPru1 : runPru0, 0);
+	}
+
+	// Whichever is behind runs, PRU0 first on a tie
+	while (!prus[0].done || !prus[1].done)
+	{
+		current = prus[0].done || (!prus[1].done && prus[1].now < prus[0].now);
+		swapcontext(&scheduler, &prus[current].ctx);
+	}
+	return 0;
+}
+
+//____________________
+int makeWaveform(void)
+{
+	/*	WSIG edges of the A2's write, as cycles from reset, synthesized from a
+		sector of track 0 or read from -f; sets when WREQ- goes back to 1
+		Returns 0, or 1 if the trace could not be read
+	*/
+	unsigned char sector[GCR_BYTES_PER_SECTOR], nibble[GCR_NIBBLE_SIZE];
+	unsigned int seed, i;
+	FILE *f;
+
+	drivenCount = 0;
+	haveField = 0;
+	cellCycles = EDGE_CELL_CYCLES * (100 + run.drift) / 100;
+	if (run.writeAt < 0)
+		return 0;
+
+	if (run.edgePath)
+	{
+		f = fopen(run.edgePath, "rb");
+		if (f == NULL)
+		{
+			printf("*** ERROR: could not open %s\n", run.edgePath);
+			return 1;
+		}
+		drivenCount = fread(edges16, sizeof(uint16_t), MAX_EDGES, f);
+		fclose(f);
+	}
+	else
+	{
+		seed = 2020 + run.drift;
+		for (i=0; i<sizeof(sector); i++)
+			sector[i] = rand_r(&seed);
+		diskEncodeNib(nibble, sector, 254, 0, 5);
+		memcpy(field, nibble + 23, 3 + GCR_DATA_NIBBLES);
+		memcpy(field + 3 + GCR_DATA_NIBBLES, "\xDE\xAA\xEB", 3);
+		haveField = 1;
+		drivenCount = edgeSynthesize(edges16, MAX_EDGES, field, sizeof(field), cellCycles, run.jitter, &seed);
+	}
+	if (drivenCount == 0)
+		return 0;
+
+	driven[0] = run.writeAt + edges16[0];
+	for (i=1; i<drivenCount; i++)
+		driven[i] = driven[i-1] + (uint16_t) (edges16[i] - edges16[i-1]);
+	wreqHighAt = driven[drivenCount - 1] + 2 * cellCycles;
+	return 0;
+}
+
+//____________________
+void runPru0(void)
+{
+	pru0Main(0, NULL);
+}
+
+//____________________
+void runPru1(void)
+{
+	pru1Main(0, NULL);
+}
+
+//____________________
+volatile uint32_t *emuR30(void)
+{
+	step(run.access);
+	return &prus[current].r30;
+}
+
+//____________________
+volatile uint32_t *emuR31(void)
+{
+	step(run.access);
+	prus[current].r31 = inputs(current, prus[current].now) | R31_UNWRITTEN;
+	return &prus[current].r31;
+}
+
+//____________________
+void emuDelay(uint32_t cycles)
+{
+	step(cycles);
+}
+
+//____________________
+volatile EmuIep *emuIep(void)
+{
+	// A value other than the one left here was written, the count goes on from it
+	step(run.access);
+	if (iep.TMR_CNT != iepLast)
+		iepBase = iepAt - iep.TMR_CNT;
+	iepAt = prus[current].now;
+	iep.TMR_CNT = iepLast = iepAt - iepBase;
+	return &iep;
+}
+
+//____________________
+volatile EmuCtrl *emuCtrl(void)
+{
+	step(run.access);
+	if (ctrl.CYCLE != cycleLast)
+		cycleBase = cycleAt - ctrl.CYCLE;
+	cycleAt = prus[current].now;
+	ctrl.CYCLE = cycleLast = cycleAt - cycleBase;
+	return &ctrl;
+}
+
+//____________________
+void step(unsigned int cycles)
+{
+	/*	Every stand-in access: takes in what the firmware did since the last
+		one, moves its clock on, and lets the other PRU run once this one is
+		ahead of it; at the end of the run it stops here for good
+	*/
+	Pru *pru = &prus[current];
+
+	observe(current);
+	pru->now += cycles;
+	if (pru->now >= run.endCycles)
+	{
+		pru->done = 1;
+		swapcontext(&pru->ctx, &scheduler);
+	}
+	else if (!prus[!current].done && pru->now > prus[!current].now)
+		swapcontext(&pru->ctx, &scheduler);
+}
+
+//____________________
+void observe(unsigned char n)
+{
+	// Outputs, events and status blocks PRU n changed, and Controller's release if it is due
+	Pru *pru = &prus[n];
+
+	if (n == 0)
+	{
+		if (pru0Status->trackSeq != seenTrackSeq)
+		{
+			seenTrackSeq = pru0Status->trackSeq;
+			trackChanged(pru->now);
+		}
+	}
+	else
+	{
+		if ((pru->r30 ^ pru->lastR30) & PRU1_RDAT)
+			rdatChanged(pru->now, (pru->r30 & PRU1_RDAT) != 0);
+		pru->lastR30 = pru->r30;
+
+		if (pru1Status->writeSeq != seenWriteSeq)
+		{
+			seenWriteSeq = pru1Status->writeSeq;
+			writeCaptured(pru->now);
+		}
+		if (pru1Status->sectorSeq != seenSectorSeq)
+		{
+			seenSectorSeq = pru1Status->sectorSeq;
+			sectorSent(pru->now);
+		}
+		if (releaseAt && pru->now >= releaseAt)
+		{
+			mailboxRelease();
+			releaseAt = 0;
+		}
+	}
+
+	if ((pru->r31 & R31_UNWRITTEN) == 0)
+	{
+		emit("%llu PRU%d event %d\n", pru->now, n, 16 + (pru->r31 & 0x0F));
+		pru->r31 |= R31_UNWRITTEN;
+	}
+}
+
+//____________________
+uint32_t inputs(unsigned char n, unsigned long long t)
+{
+	/*	R31 as the A2 drives it at cycle t: drive 1 enabled throughout
+		PRU0, phases: half track k has phase k % 4 on, all off after the last step;
+		a glitch turns on the next one for -G us halfway through a step
+		PRU1, WREQ- low for the write, WSIG toggling at each of its edges
+	*/
+	unsigned long long k, into;
+	unsigned int low, high, mid, phases;
+
+	if (n == 0)
+	{
+		if (t < STEP_START_US * CYCLES_US)
+			return PRU0_EN2 | 0x01;
+		k = (t - STEP_START_US * CYCLES_US) / run.stepCycles + 1;
+		into = (t - STEP_START_US * CYCLES_US) % run.stepCycles;
+		phases = k > run.steps ? 0 : 1 << (k % 4);
+		if (k <= run.steps && into >= run.stepCycles / 2 && into < run.stepCycles / 2 + run.glitchCycles)
+			phases |= 1 << ((k + 1) % 4);
+		return PRU0_EN2 | phases;
+	}
+
+	if (drivenCount == 0 || t < (unsigned long long) run.writeAt || t >= wreqHighAt)
+		return PRU1_EN2 | PRU1_WREQ;
+
+	low = 0;									// edges at or before t
+	high = drivenCount;
+	while (low < high)
+	{
+		mid = (low + high) / 2;
+		if (driven[mid] <= t)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return PRU1_EN2 | (low & 1 ? PRU1_WSIG : 0);
+}
+
+//____________________
+void rdatChanged(unsigned long long t, unsigned char level)
+{
+	// A pulse is RDAT low, one per 1 bit
+	emit("%llu RDAT %d\n", t, level);
+	if (level == 0)
+	{
+		fallAt = t;
+		haveFall = 1;
+		if (pulseCount < PACKET_BITS)
+			pulses[pulseCount++] = t;
+	}
+	else if (haveFall)
+		add(&pulseWidth, (double) (t - fallAt) / CYCLES_US);
+}
+
+//____________________
+void sectorSent(unsigned long long t)
+{
+	/*	PRU1 says a packet is done: its pulses should be its 1 bits, one cell
+		apart times the bits between; a write cut it short, so no checking then
+		Controller releases the next one -r us later
+	*/
+	static unsigned int positions[PACKET_BITS];
+	const unsigned char *packet;
+	unsigned int bits, ones, i;
+	double cell, error, worst;
+	int bit;
+
+	emit("%llu SECTOR %d buffer %d pulses %u\n", t, pru1Status->sector, pru1Status->buffer, pulseCount);
+
+	if (!writeInSector && pulseCount > 1)
+	{
+		packet = pruBase + TRACK_BUF_ADR(pru1Status->buffer % TRACK_BUFS) + pru1Status->sector * GCR_NIBBLE_SIZE;
+		bits = ones = 0;
+		for (i=0; i<GCR_NIBBLE_SIZE && packet[i]; i++)
+			for (bit=7; bit>=0; bit--, bits++)
+				if ((packet[i] >> bit) & 1)
+					positions[ones++] = bits;
+
+		sectorsChecked++;
+		if (ones != pulseCount)
+			sectorsWrong++;
+		else
+		{
+			cell = (double) (pulses[ones - 1] - pulses[0]) / (positions[ones - 1] - positions[0]);
+			worst = 0;
+			for (i=1; i<ones; i++)
+			{
+				error = (double) (pulses[i] - pulses[0]) - (positions[i] - positions[0]) * cell;
+				if (error < 0)
+					error = -error;
+				if (error > worst)
+					worst = error;
+			}
+			add(&bitCell, cell / CYCLES_US);
+			add(&bitJitter, worst / CYCLES_US);
+		}
+	}
+	if (pulseCount && haveLastPulse && !writeInSector && !writeInLast)
+		add(&sectorGap, (double) (pulses[0] - lastPulse) / CYCLES_US);
+	if (pulseCount)
+	{
+		lastPulse = pulses[pulseCount - 1];
+		haveLastPulse = 1;
+	}
+	writeInLast = writeInSector;
+	writeInSector = 0;
+	pulseCount = 0;
+
+	if (!run.stream)
+		releaseAt = t + run.releaseCycles;
+}
+
+//____________________
+void trackChanged(unsigned long long t)
+{
+	// Time from the phase change that moved the head
+	unsigned long long start, k;
+	unsigned char drive;
+
+	drive = pru0Status->drive & 1;
+	emit("%llu TRACK drive %d track %d\n", t, drive + 1, pru0Status->track[drive]);
+
+	start = STEP_START_US * CYCLES_US;
+	if (run.steps && t >= start)
+	{
+		k = (t - start) / run.stepCycles;
+		if (k >= run.steps)
+			k = run.steps;
+		add(&trackLatency, (double) (t - start - k * run.stepCycles) / CYCLES_US);
+	}
+}
+
+//____________________
+void writeCaptured(unsigned long long t)
+{
+	/*	Decodes what PRU1 logged the way Controller does, and holds each logged
+		edge to edge time against the driven one; edges before HandleWrite()
+		looked are missing, the rest line up from there
+	*/
+	static uint16_t edges[EDGE_RING_SIZE];
+	unsigned char capture[EDGE_CAPTURE_SIZE], data[GCR_BYTES_PER_SECTOR];
+	unsigned int count, i;
+	WriteSlot slot;
+	int error;
+
+	writeInSector = 1;
+	if (mailboxWriteSlot(pru1Status->writeSeq, &slot))
+		return;
+	count = edgeCopy(edges, pruBase + PRU1_DRAM, slot.ringStart, slot.edgeCount);
+	emit("%llu WRITE sector %d edges %u\n", t, slot.sector, count);
+
+	written.driven = drivenCount;
+	written.logged = count;
+	written.missed = 0;						// HandleWrite() restarted the cycle counter at cycleBase
+	while (written.missed < drivenCount && driven[written.missed] < cycleBase)
+		written.missed++;
+	written.maxError = 0;
+	for (i=1; i<count && written.missed + i < drivenCount; i++)
+	{
+		error = (int) (uint16_t) (edges[i] - edges[i-1]) - (int) (driven[written.missed + i] - driven[written.missed + i - 1]);
+		if (error < 0)
+			error = -error;
+		if (error > written.maxError)
+			written.maxError = error;
+	}
+
+	if (edgeDecode(capture, edges, count))
+		written.result = "not framed";
+	else if (haveField)
+		written.result = memcmp(capture + 1, field, sizeof(field)) == 0 ? "intact" : "differs";
+	else
+		written.result = diskDecodeData(data, capture + 4) == GCR_OK ? "checksum good" : "bad checksum";
+}
+
+//____________________
+void emit(const char *format, ...)
+{
+	// One line of the trace, to -o and held against -g; the first difference is reported
+	char line[128], expected[128];
+	va_list args;
+
+	if (out == NULL && golden == NULL)
+		return;
+	va_start(args, format);
+	vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+
+	if (out)
+		fputs(line, out);
+	if (golden && !mismatch)
+	{
+		lineNo++;
+		if (fgets(expected, sizeof(expected), golden) == NULL)
+		{
+			mismatch = lineNo;
+			printf("*** golden trace ends before line %llu: %s", lineNo, line);
+		}
+		else if (strcmp(line, expected) != 0)
+		{
+			mismatch = lineNo;
+			printf("*** line %llu, golden: %s                now:    %s", lineNo, expected, line);
+		}
+	}
+}
+
+//____________________
+void add(Summary *s, double value)
+{
+	if (s->n == 0 || value < s->min)
+		s->min = value;
+	if (s->n == 0 || value > s->max)
+		s->max = value;
+	s->sum += value;
+	s->n++;
+}
+
+//____________________
+void printSummary(const char *name, const Summary *s, const char *unit)
+{
+	if (s->n == 0)
+		printf("  %-14s none\n", name);
+	else
+		printf("  %-14s %6llu  min %10.3f  mean %10.3f  max %10.3f %s\n", name, s->n, s->min, s->sum / s->n, s->max, unit);
+}
@@ -0,0 +1,75 @@
+/*	Disk2Emu.h
+	Host build of Disk2Pru0.c and Disk2Pru1.c, run by Disk2Emu.c
+	Compiled with -DPRU_EMU=0 or -DPRU_EMU=1, a firmware gets this in place of
+	the TI headers, with stand-ins for all it touches:
+		__R30				outputs, changes recorded at the cycle they happen
+		__R31				inputs from the A2 stand-in at the cycle it is read;
+							a write raises the event, as on the PRU
+		__delay_cycles(n)	moves this PRU's clock on n cycles, exactly
+		CT_IEP.TMR_CNT		the virtual clock, one count a cycle, both PRUs
+		PRU1_CTRL.CYCLE		same, from where it was last set
+		CT_CFG, CT_INTC		written and forgotten
+	Each access to one of them also costs EMU_ACCESS_CYCLES (-c), standing in
+	for the instructions around it; nothing else the C does takes time
+	PRU_LOCAL is where its local address space starts: its data RAM, the other
+	PRU's at 0x2000, shared RAM at 0x10000, which Disk2Emu.c maps there
+*/
+#ifndef _DISK2EMU_H_
+#define _DISK2EMU_H_
+
+#include <stdint.h>
+
+#define EMU_PRU0_LOCAL		0x40000000UL	// PRU0's address space, as a host address
+#define EMU_PRU1_LOCAL		0x50000000UL
+#define EMU_ACCESS_CYCLES	4				// default -c
+
+typedef struct
+{
+	struct { uint32_t STANDBY_INIT : 1; } SYSCFG_bit;
+} EmuCfg;
+
+typedef struct
+{
+	struct { uint32_t CH_MAP_16 : 8, CH_MAP_17 : 8, CH_MAP_18 : 8; } CMR4_bit;
+	struct { uint32_t HINT_MAP_2 : 8; } HMR0_bit;
+	uint32_t SICR, EISR, HIEISR, GER;
+} EmuIntc;
+
+typedef struct
+{
+	struct { uint32_t CNT_EN : 1, DEFAULT_INC : 4; } TMR_GLB_CFG_bit;
+	uint32_t TMR_CNT;
+} EmuIep;
+
+typedef struct
+{
+	struct { uint32_t CTR_EN : 1; } CTRL_bit;
+	uint32_t CYCLE;
+} EmuCtrl;
+
+extern EmuCfg emuCfg;
+extern EmuIntc emuIntc;
+
+volatile uint32_t *emuR30(void);
+volatile uint32_t *emuR31(void);
+void emuDelay(uint32_t cycles);
+volatile EmuIep *emuIep(void);
+volatile EmuCtrl *emuCtrl(void);
+
+#ifdef PRU_EMU
+#if PRU_EMU == 0
+#define PRU_LOCAL			EMU_PRU0_LOCAL
+#else
+#define PRU_LOCAL			EMU_PRU1_LOCAL
+#endif
+
+#define __R30				(*emuR30())
+#define __R31				(*emuR31())
+#define __delay_cycles(n)	emuDelay(n)
+#define CT_CFG				emuCfg
+#define CT_INTC				emuIntc
+#define CT_IEP				(*emuIep())
+#define PRU1_CTRL			(*emuCtrl())
+#endif
+
+#endif /* _DISK2EMU_H_ */
@@ -0,0 +1,184 @@
+/*	Disk2Event.c
+	Blocking wait for PRU events, see Disk2Event.h
+	UIO: read() returns the interrupt count, the INTC status register says
+	which system events fired; clear those, then write 1 to re-arm the interrupt
+	FIFO: Sim or Bench write event bits, Controller reads whatever is queued
+*/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+
+#include "Disk2Event.h"
+#include "Disk2Mem.h"
+
+//____________________
+void eventDefaultSpec(char *spec, size_t len, const char *backing)
+{
+	// Real PRUs use UIO, a file backing gets a FIFO next to it, anon has no one to signal
+	if (backing == NULL || strcmp(backing, PRU_MEM_DEVMEM) == 0)
+		snprintf(spec, len, "%s", PRU_EVT_UIO);
+	else if (strcmp(backing, PRU_MEM_ANON) == 0 || strncmp(backing, "/proc/", 6) == 0)
+		snprintf(spec, len, "%s", PRU_EVT_POLL);
+	else
+		snprintf(spec, len, "%s.evt", backing);
+}
+
+//____________________
+int eventOpen(PruEvents *ev, const char *spec, unsigned char *pru)
+{
+	/*	Returns 0 on success
+		A missing UIO device is not an error: Controller falls back to polling
+	*/
+	struct epoll_event epEvent;
+	unsigned int enable;
+
+	memset(ev, 0, sizeof(*ev));
+	ev->kind = EVT_KIND_POLL;
+	ev->fd = -1;
+	ev->epfd = -1;
+
+	if (strcmp(spec, PRU_EVT_POLL) == 0)
+		return 0;
+
+	if (strncmp(spec, "/dev/uio", 8) == 0)
+	{
+		ev->fd = open(spec, O_RDWR);
+		if (ev->fd == -1)
+		{
+			printf("--- No %s, polling PRU memory instead\n", spec);
+			return 0;
+		}
+		ev->kind = EVT_KIND_UIO;
+		ev->secr0 = (volatile unsigned int *) (pru + PRU_INTC + INTC_SECR0);
+		*ev->secr0 = EVT_ALL << PRU_EVT_FIRST;		// forget anything from before we started
+		enable = 1;
+		if (write(ev->fd, &enable, sizeof(enable)) != sizeof(enable))
+			printf("*** ERROR: could not enable %s interrupt\n", spec);
+	}
+	else
+	{
+		// O_RDWR so the FIFO never reports hang-up while the other side is away
+		if (mkfifo(spec, 0644) == -1 && errno != EEXIST)
+		{
+			printf("*** ERROR: could not create %s\n", spec);
+			return 1;
+		}
+		ev->fd = open(spec, O_RDWR | O_NONBLOCK);
+		if (ev->fd == -1)
+		{
+			printf("*** ERROR: could not open %s\n", spec);
+			return 1;
+		}
+		ev->kind = EVT_KIND_FIFO;
+	}
+
+	ev->epfd = epoll_create1(0);
+	epEvent.events = EPOLLIN;
+	epEvent.data.fd = ev->fd;
+	if (ev->epfd == -1 || epoll_ctl(ev->epfd, EPOLL_CTL_ADD, ev->fd, &epEvent) == -1)
+	{
+		printf("*** ERROR: could not wait on %s\n", spec);
+		eventClose(ev);
+		return 1;
+	}
+	return 0;
+}
+
+//____________________
+int eventWait(PruEvents *ev, int timeoutMs)
+{
+	/*	Sleeps until a PRU event, timeoutMs or a signal
+		Returns event bits, 0 if none
+	*/
+	struct epoll_event epEvent;
+	unsigned char fifo[64];
+	unsigned int count, status, events;
+	ssize_t i, n;
+
+	if (ev->kind == EVT_KIND_POLL)
+	{
+		usleep(10);
+		ev->wakeups++;
+		return EVT_ALL;
+	}
+
+	if (epoll_wait(ev->epfd, &epEvent, 1, timeoutMs) != 1)
+	{
+		ev->timeouts++;
+		return 0;								// timed out or interrupted by a signal
+	}
+	if (epEvent.data.fd != ev->fd)
+	{
+		ev->wakeups++;
+		return EVT_HOST;						// PRU events still pending show up next time
+	}
+
+	events = 0;
+	if (ev->kind == EVT_KIND_UIO)
+	{
+		if (read(ev->fd, &count, sizeof(count)) != sizeof(count))
+			return 0;
+		status = *ev->secr0;
+		*ev->secr0 = status & (EVT_ALL << PRU_EVT_FIRST);	// clear before re-arming
+		count = 1;
+		if (write(ev->fd, &count, sizeof(count)) != sizeof(count))
+			printf("*** ERROR: could not re-enable PRU interrupt\n");
+		events = (status >> PRU_EVT_FIRST) & EVT_ALL;
+		if (events == 0)
+			events = EVT_ALL;					// not ours to explain, look at everything
+	}
+	else
+	{
+		while ((n = read(ev->fd, fifo, sizeof(fifo))) > 0)
+			for (i=0; i<n; i++)
+				events |= fifo[i];
+		events &= EVT_ALL;
+	}
+
+	ev->wakeups++;
+	return events;
+}
+
+//____________________
+void eventSignal(PruEvents *ev, unsigned char events)
+{
+	// Stand-in side of the FIFO; a full FIFO already has Controller's attention
+	if (ev->kind == EVT_KIND_FIFO && write(ev->fd, &events, 1) != 1 && errno != EAGAIN)
+		printf("*** ERROR: could not signal event\n");
+}
+
+//____________________
+int eventWatch(PruEvents *ev, int fd)
+{
+	// fd being readable wakes eventWait() too, returns 0 on success; polling needs nothing
+	struct epoll_event epEvent;
+
+	if (ev->epfd == -1)
+		return 0;
+	epEvent.events = EPOLLIN;
+	epEvent.data.fd = fd;
+	return epoll_ctl(ev->epfd, EPOLL_CTL_ADD, fd, &epEvent) == -1;
+}
+
+//____________________
+void eventUnwatch(PruEvents *ev, int fd)
+{
+	if (ev->epfd != -1)
+		epoll_ctl(ev->epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+//____________________
+void eventClose(PruEvents *ev)
+{
+	if (ev->epfd != -1)
+		close(ev->epfd);
+	if (ev->fd != -1)
+		close(ev->fd);
+	ev->epfd = -1;
+	ev->fd = -1;
+	ev->kind = EVT_KIND_POLL;
+}
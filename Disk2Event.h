@@ -0,0 +1,53 @@
+/*	Disk2Event.h
+	PRU -> Controller events, so Controller can sleep until PRU0 or PRU1 has news
+	Transports:
+		/dev/uioN		real PRUs, PRUSS INTC host interrupt 2 (evtout0) through UIO
+		poll			no events, wait is usleep(10) as before
+		<path>			named FIFO shared with Sim or Bench, one byte of event bits per event
+	Events only wake Controller up: it still reads PRU memory to see what changed
+	Descriptors Controller serves itself, such as the control socket, can be
+	added with eventWatch() so they wake it too; polling just looks at them
+*/
+#ifndef _DISK2EVENT_H_
+#define _DISK2EVENT_H_
+
+#include <stddef.h>
+
+// Event bits, PRU system event in ()
+#define EVT_TRACK			0x01		// PRU0: head stepped, or track number changed (16)
+#define EVT_SECTOR			0x02		// PRU1: sector sent (17)
+#define EVT_WRITE			0x04		// PRU1: write captured (18)
+#define EVT_ALL				(EVT_TRACK | EVT_SECTOR | EVT_WRITE)
+#define EVT_HOST			0x80		// not a PRU: a descriptor eventWatch() added is ready
+
+#define PRU_EVT_UIO			"/dev/uio0"
+#define PRU_EVT_POLL		"poll"
+
+// PRU INTC, offset from start of PRU memory, am335x TRM 4.5
+#define PRU_INTC			0x20000
+#define INTC_SECR0			0x0280		// system event status, write 1 to clear
+#define PRU_EVT_FIRST		16			// EVT_TRACK, later events follow in bit order
+
+typedef struct
+{
+	int kind;							// EVT_KIND_
+	int fd;								// UIO device or FIFO, -1 for poll
+	int epfd;
+	volatile unsigned int *secr0;		// UIO: INTC status register in mapped PRU memory
+	unsigned long long wakeups;			// eventWait() returns with events
+	unsigned long long timeouts;		// eventWait() returns without
+} PruEvents;
+
+#define EVT_KIND_POLL		0
+#define EVT_KIND_UIO		1
+#define EVT_KIND_FIFO		2
+
+void eventDefaultSpec(char *spec, size_t len, const char *backing);
+int eventOpen(PruEvents *ev, const char *spec, unsigned char *pru);
+int eventWait(PruEvents *ev, int timeoutMs);
+void eventSignal(PruEvents *ev, unsigned char events);
+int eventWatch(PruEvents *ev, int fd);
+void eventUnwatch(PruEvents *ev, int fd);
+void eventClose(PruEvents *ev);
+
+#endif /* _DISK2EVENT_H_ */
@@ -0,0 +1,554 @@
+/*	Disk2Gcr.c
+	6-and-2 GCR encoding and decoding
+	diskEncodeNib() is the original sector-at-a-time routine
+	diskEncodeTrack() does a track per call from precomputed 2-bit fragment tables,
+		vectorized with NEON (BBB) or SSSE3 (x86 build hosts) when available,
+		otherwise the scalar table-driven version
+*/
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GCR_NEON	1
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define GCR_SSSE3	1
+#endif
+
+#include "Disk2Gcr.h"
+
+#define TWO_BIT_COUNT		0x56			// 86 bytes of 2-bit fragments
+
+typedef void (*EncodeDataFn)(unsigned char *out, const unsigned char *data);
+
+static void buildTables(void);
+static void encodeTrack(unsigned char *nibbles, const unsigned char *trackData,
+	unsigned char (*translateSector)(unsigned char), unsigned char vol, unsigned char trk, EncodeDataFn encodeData);
+static void encodeDataScalar(unsigned char *out, const unsigned char *data);
+#if defined(GCR_NEON) || defined(GCR_SSSE3)
+static void encodeDataSimd(unsigned char *out, const unsigned char *data);
+#endif
+
+//____________________
+const unsigned char translate6[64] =
+{
+	0x96, 0x97, 0x9A, 0x9B, 0x9D, 0x9E, 0x9F, 0xA6,
+	0xA7, 0xAB, 0xAC, 0xAD, 0xAE, 0xAF, 0xB2, 0xB3,
+	0xB4, 0xB5, 0xB6, 0xB7, 0xB9, 0xBA, 0xBB, 0xBC,
+	0xBD, 0xBE, 0xBF, 0xCB, 0xCD, 0xCE, 0xCF, 0xD3,
+	0xD6, 0xD7, 0xD9, 0xDA, 0xDB, 0xDC, 0xDD, 0xDE,
+	0xDF, 0xE5, 0xE6, 0xE7, 0xE9, 0xEA, 0xEB, 0xEC,
+	0xED, 0xEE, 0xEF, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6,
+	0xF7, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF
+};
+
+static const unsigned char syncStream[]		= {0xFF, 0x3F, 0xCF, 0xF3, 0xFC};
+static const unsigned char addrPrologue[]	= {0xD5, 0xAA, 0x96};
+static const unsigned char dataPrologue[]	= {0xD5, 0xAA, 0xAD};
+static const unsigned char epilogue1[]		= {0xDE, 0xAA, 0xEB};
+static const unsigned char epilogue2[]		= {0xDE, 0xAA, 0xEB, 0x00, 0x00};
+
+unsigned char untranslate6[256];
+
+// 2-bit fragment of a data byte (bits 0 and 1 swapped), pre-shifted for each of its 3 slots
+static unsigned char frag0[256], frag1[256], frag2[256];
+static unsigned char tablesReady;
+
+//____________________
+void diskEncodeNib(unsigned char *nibble, unsigned char *data, unsigned char vol, unsigned char trk, unsigned char sec)
+{
+	// Converts 256 byte file sector to 374 byte disk sector
+	unsigned int checksum, oldValue, xorValue, i;
+	unsigned char *nibByte;
+
+	// Set up header values
+	checksum = vol ^ trk ^ sec;
+
+	nibByte = memset(nibble, 0xFF, GCR_NIBBLE_SIZE);
+	memcpy(nibByte, syncStream, 5);			nibByte += 5;
+	memcpy(nibByte, addrPrologue, 3);		nibByte += 3;
+
+	*nibByte++	= (vol >> 1) | 0xAA;
+	*nibByte++	= vol | 0xAA;
+
+	*nibByte++	= (trk >> 1) | 0xAA;
+	*nibByte++	= trk | 0xAA;
+
+	*nibByte++	= (sec >> 1) | 0xAA;
+	*nibByte++	= sec | 0xAA;
+
+	*nibByte++	= (checksum >> 1) | 0xAA;
+	*nibByte++	= (checksum) | 0xAA;
+
+	memcpy(nibByte, epilogue1, 3);			nibByte += 3;
+	memcpy(nibByte, syncStream+1, 4);		nibByte += 4;
+	memcpy(nibByte, dataPrologue, 3);		nibByte += 3;
+
+	xorValue = 0;
+	for (i=0; i<342; i++)
+	{
+		if (i >= 0x56)
+		{
+			// 6 bit
+			oldValue = data[i - 0x56];
+			oldValue = oldValue >> 2;
+		}
+		else
+		{
+			// 3 * 2 bit
+			oldValue = 0;
+			oldValue |= (data[i + 0x00] & 0x01) << 1;
+			oldValue |= (data[i + 0x00] & 0x02) >> 1;
+			oldValue |= (data[i + 0x56] & 0x01) << 3;
+			oldValue |= (data[i + 0x56] & 0x02) << 1;
+			if (i + 0xAC < GCR_BYTES_PER_SECTOR)
+			{
+				oldValue |= (data[i + 0xAC] & 0x01) << 5;
+				oldValue |= (data[i + 0xAC] & 0x02) << 3;
+			}
+		}
+		xorValue ^= oldValue;
+		*nibByte++ = translate6[xorValue & 0x3F];
+		xorValue = oldValue;
+	}
+	*nibByte++ = translate6[xorValue & 0x3F];
+
+	memcpy(nibByte, epilogue2, 5);
+}
+
+//____________________
+void diskEncodeTrack(unsigned char *nibbles, const unsigned char *trackData,
+	unsigned char (*translateSector)(unsigned char), unsigned char vol, unsigned char trk)
+{
+#if defined(GCR_NEON) || defined(GCR_SSSE3)
+	encodeTrack(nibbles, trackData, translateSector, vol, trk, encodeDataSimd);
+#else
+	encodeTrack(nibbles, trackData, translateSector, vol, trk, encodeDataScalar);
+#endif
+}
+
+//____________________
+void diskEncodeTrackScalar(unsigned char *nibbles, const unsigned char *trackData,
+	unsigned char (*translateSector)(unsigned char), unsigned char vol, unsigned char trk)
+{
+	encodeTrack(nibbles, trackData, translateSector, vol, trk, encodeDataScalar);
+}
+
+//____________________
+void diskGcrInit(void)
+{
+	unsigned int i;
+
+	// Set up untranslate6 table
+	for (i=0; i<256; i++)					// fill with FFs to detect when we are out of range
+		untranslate6[i] = 0xFF;
+
+	for (i=0; i<0x40; i++)					// inverse of translate6 table
+		untranslate6[translate6[i]] = i;
+
+	buildTables();
+}
+
+//____________________
+const char *diskEncodeTrackImpl(void)
+{
+#if defined(GCR_NEON)
+	return "neon";
+#elif defined(GCR_SSSE3)
+	return "ssse3";
+#else
+	return "scalar";
+#endif
+}
+
+//____________________
+static void buildTables(void)
+{
+	unsigned int i, f;
+
+	for (i=0; i<256; i++)
+	{
+		f = ((i & 0x01) << 1) | ((i & 0x02) >> 1);
+		frag0[i] = f;
+		frag1[i] = f << 2;
+		frag2[i] = f << 4;
+	}
+	tablesReady = 1;
+}
+
+//____________________
+static void encodeTrack(unsigned char *nibbles, const unsigned char *trackData,
+	unsigned char (*translateSector)(unsigned char), unsigned char vol, unsigned char trk, EncodeDataFn encodeData)
+{
+	// Address field is the same for the whole track except sector and checksum
+	unsigned char header[GCR_DATA_OFFSET];
+	unsigned char sec, checksum, *nibble;
+
+	if (!tablesReady)
+		buildTables();
+
+	memcpy(header, syncStream, 5);
+	memcpy(header + 5, addrPrologue, 3);
+	header[8]	= (vol >> 1) | 0xAA;
+	header[9]	= vol | 0xAA;
+	header[10]	= (trk >> 1) | 0xAA;
+	header[11]	= trk | 0xAA;
+	memcpy(header + 16, epilogue1, 3);
+	memcpy(header + 19, syncStream+1, 4);
+	memcpy(header + 23, dataPrologue, 3);
+
+	for (sec=0; sec<GCR_SECTORS_PER_TRACK; sec++)
+	{
+		nibble = nibbles + sec * GCR_NIBBLE_SIZE;
+		checksum = vol ^ trk ^ sec;
+
+		memcpy(nibble, header, GCR_DATA_OFFSET);
+		nibble[12]	= (sec >> 1) | 0xAA;
+		nibble[13]	= sec | 0xAA;
+		nibble[14]	= (checksum >> 1) | 0xAA;
+		nibble[15]	= checksum | 0xAA;
+
+		encodeData(nibble + GCR_DATA_OFFSET, trackData + translateSector(sec) * GCR_BYTES_PER_SECTOR);
+		memcpy(nibble + GCR_DATA_OFFSET + GCR_DATA_NIBBLES, epilogue2, 5);
+	}
+}
+
+//____________________
+static void encodeDataScalar(unsigned char *out, const unsigned char *data)
+{
+	// 342 data nibbles + checksum, each nibble is the xor of adjacent 6-bit values
+	unsigned char value, prev;
+	unsigned int i;
+
+	prev = 0;
+	for (i=0; i<0x54; i++)
+	{
+		value = frag0[data[i]] | frag1[data[i + 0x56]] | frag2[data[i + 0xAC]];
+		out[i] = translate6[value ^ prev];
+		prev = value;
+	}
+	for (; i<TWO_BIT_COUNT; i++)			// last two have no third fragment
+	{
+		value = frag0[data[i]] | frag1[data[i + 0x56]];
+		out[i] = translate6[value ^ prev];
+		prev = value;
+	}
+	for (i=0; i<GCR_BYTES_PER_SECTOR; i++)
+	{
+		value = data[i] >> 2;
+		out[TWO_BIT_COUNT + i] = translate6[value ^ prev];
+		prev = value;
+	}
+	out[342] = translate6[prev];
+}
+
+#if defined(GCR_NEON) || defined(GCR_SSSE3)
+//____________________
+static void encodeDataSimd(unsigned char *out, const unsigned char *data)
+{
+	/*	Same as encodeDataScalar(), 16 lanes at a time:
+			values[0..85]		2-bit fragments of data[i], data[i+86], data[i+172]
+			values[86..341]		data[i] >> 2
+			out[i]				translate6[values[i] ^ values[i-1]], values[-1] = values[342] = 0
+		pad holds data followed by zeros so the third fragment reads past 256 harmlessly
+	*/
+	unsigned char pad[272] __attribute__((aligned(16)));
+	unsigned char buff[16 + 352] __attribute__((aligned(16)));
+	unsigned char xlated[352] __attribute__((aligned(16)));
+	unsigned char *values;
+	unsigned int k;
+
+	memcpy(pad, data, GCR_BYTES_PER_SECTOR);
+	memset(pad + GCR_BYTES_PER_SECTOR, 0, sizeof(pad) - GCR_BYTES_PER_SECTOR);
+	memset(buff, 0, 16);
+	values = buff + 16;
+
+#if defined(GCR_NEON)
+	{
+		const uint8x16_t one = vdupq_n_u8(0x01), two = vdupq_n_u8(0x02), low6 = vdupq_n_u8(0x3F);
+		uint8x16_t d, f, v, x;
+
+		for (k=0; k<6; k++)					// 96 >= 86 fragments
+		{
+			d = vld1q_u8(pad + 16*k);
+			v = vorrq_u8(vandq_u8(vshlq_n_u8(d, 1), two), vandq_u8(vshrq_n_u8(d, 1), one));
+			d = vld1q_u8(pad + 0x56 + 16*k);
+			f = vorrq_u8(vandq_u8(vshlq_n_u8(d, 1), two), vandq_u8(vshrq_n_u8(d, 1), one));
+			v = vorrq_u8(v, vshlq_n_u8(f, 2));
+			d = vld1q_u8(pad + 0xAC + 16*k);
+			f = vorrq_u8(vandq_u8(vshlq_n_u8(d, 1), two), vandq_u8(vshrq_n_u8(d, 1), one));
+			v = vorrq_u8(v, vshlq_n_u8(f, 4));
+			vst1q_u8(values + 16*k, v);
+		}
+		for (k=0; k<16; k++)
+			vst1q_u8(values + TWO_BIT_COUNT + 16*k, vandq_u8(vshrq_n_u8(vld1q_u8(pad + 16*k), 2), low6));
+		memset(values + 342, 0, 352 - 342);
+
+#if defined(__aarch64__)
+		{
+			uint8x16x4_t table = vld1q_u8_x4(translate6);
+
+			for (k=0; k<22; k++)
+			{
+				x = veorq_u8(vld1q_u8(values + 16*k), vld1q_u8(values + 16*k - 1));
+				vst1q_u8(xlated + 16*k, vqtbl4q_u8(table, x));
+			}
+		}
+#else
+		{
+			// ARMv7 table lookups are 8 lanes wide and 32 entries deep
+			uint8x8x4_t tableLo, tableHi;
+			uint8x8_t lo, hi, r;
+			const uint8x8_t thirtyTwo = vdup_n_u8(32);
+
+			tableLo.val[0] = vld1_u8(translate6 +  0);
+			tableLo.val[1] = vld1_u8(translate6 +  8);
+			tableLo.val[2] = vld1_u8(translate6 + 16);
+			tableLo.val[3] = vld1_u8(translate6 + 24);
+			tableHi.val[0] = vld1_u8(translate6 + 32);
+			tableHi.val[1] = vld1_u8(translate6 + 40);
+			tableHi.val[2] = vld1_u8(translate6 + 48);
+			tableHi.val[3] = vld1_u8(translate6 + 56);
+
+			for (k=0; k<22; k++)
+			{
+				x = veorq_u8(vld1q_u8(values + 16*k), vld1q_u8(values + 16*k - 1));
+				lo = vget_low_u8(x);
+				hi = vget_high_u8(x);
+				r = vtbx4_u8(vtbl4_u8(tableLo, lo), tableHi, vsub_u8(lo, thirtyTwo));
+				vst1_u8(xlated + 16*k, r);
+				r = vtbx4_u8(vtbl4_u8(tableLo, hi), tableHi, vsub_u8(hi, thirtyTwo));
+				vst1_u8(xlated + 16*k + 8, r);
+			}
+		}
+#endif
+	}
+#else
+	{
+		const __m128i one = _mm_set1_epi8(0x01), two = _mm_set1_epi8(0x02), low6 = _mm_set1_epi8(0x3F);
+		const __m128i quarter = _mm_set1_epi8(0x30);
+		__m128i table[4], d, f, v, x, r, hit;
+		unsigned int q;
+
+		for (q=0; q<4; q++)
+			table[q] = _mm_loadu_si128((const __m128i *) (translate6 + 16*q));
+
+		for (k=0; k<6; k++)					// 96 >= 86 fragments
+		{
+			d = _mm_load_si128((const __m128i *) (pad + 16*k));
+			v = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(d, 1), two), _mm_and_si128(_mm_srli_epi16(d, 1), one));
+			d = _mm_loadu_si128((const __m128i *) (pad + 0x56 + 16*k));
+			f = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(d, 1), two), _mm_and_si128(_mm_srli_epi16(d, 1), one));
+			v = _mm_or_si128(v, _mm_slli_epi16(f, 2));
+			d = _mm_loadu_si128((const __m128i *) (pad + 0xAC + 16*k));
+			f = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(d, 1), two), _mm_and_si128(_mm_srli_epi16(d, 1), one));
+			v = _mm_or_si128(v, _mm_slli_epi16(f, 4));
+			_mm_store_si128((__m128i *) (values + 16*k), v);
+		}
+		for (k=0; k<16; k++)
+		{
+			d = _mm_load_si128((const __m128i *) (pad + 16*k));
+			_mm_storeu_si128((__m128i *) (values + TWO_BIT_COUNT + 16*k), _mm_and_si128(_mm_srli_epi16(d, 2), low6));
+		}
+		memset(values + 342, 0, 352 - 342);
+
+		// 64 entry lookup as four 16 entry shuffles, each kept where bits 4-5 select it
+		for (k=0; k<22; k++)
+		{
+			x = _mm_xor_si128(_mm_load_si128((const __m128i *) (values + 16*k)),
+				_mm_loadu_si128((const __m128i *) (values + 16*k - 1)));
+			r = _mm_setzero_si128();
+			for (q=0; q<4; q++)
+			{
+				hit = _mm_cmpeq_epi8(_mm_and_si128(x, quarter), _mm_set1_epi8(q << 4));
+				r = _mm_or_si128(r, _mm_and_si128(hit, _mm_shuffle_epi8(table[q], x)));
+			}
+			_mm_store_si128((__m128i *) (xlated + 16*k), r);
+		}
+	}
+#endif
+
+	memcpy(out, xlated, GCR_DATA_NIBBLES);
+}
+#endif
+
+//____________________
+unsigned char dosTranslateSector(unsigned char sector)
+{
+	// DOS order (*.dsk)
+	static const unsigned char skewing[] =
+	{
+		0x00, 0x07, 0x0E, 0x06, 0x0D, 0x05, 0x0C, 0x04,
+		0x0B, 0x03, 0x0A, 0x02, 0x09, 0x01, 0x08, 0x0F
+	};
+	return skewing[sector];
+}
+
+//____________________
+unsigned char prodosTranslateSector(unsigned char sector)
+{
+	// ProDOS order (*.po)
+	static const unsigned char skewing[] =
+	{
+		0x00, 0x08, 0x01, 0x09, 0x02, 0x0A, 0x03, 0x0B,
+		0x04, 0x0C, 0x05, 0x0D, 0x06, 0x0E, 0x07, 0x0F
+	};
+	return skewing[sector];
+}
+
+//____________________
+unsigned char diskDecodeNib(unsigned char *data, unsigned char *nibble)
+{
+	// Converts 374 byte disk sector to 256 byte file sector
+	unsigned char readVolume, readTrack, readSector, readChecksum;
+	unsigned char b, xorValue, newValue;
+	unsigned int i;
+
+	// Pick apart volume/track/sector info and checksum - sanity checks?
+	if (decodeNibByte(&readVolume, &nibble[8]))
+	{
+		printf("\n*** diskDecodeNib: Failed to decode volume\n");
+		return 1;
+	}
+
+	if (decodeNibByte(&readTrack, &nibble[10]))
+	{
+		printf("\n*** diskDecodeNib: Failed to decode track\n");
+		return 1;
+	}
+
+	if (decodeNibByte(&readSector, &nibble[12]))
+	{
+		printf("\n*** diskDecodeNib: Failed to decode sector\n");
+		return 1;
+	}
+
+	if (decodeNibByte(&readChecksum, &nibble[14]))
+	{
+		printf("\n*** diskDecodeNib: Failed to decode checksum\n");
+		return 1;
+	}
+
+	if (readChecksum != (readVolume ^ readTrack ^ readSector))
+	{
+		printf("\n*** diskDecodeNib: Failed address checksum\n");
+		return 1;
+	}
+
+	// Decode nibble core
+	xorValue = 0;
+	for (i=0; i<342; i++)
+	{
+		b = untranslate6[nibble[i+26]];		// first data
+		if (b == 0xFF)
+		{
+			printf("\n*** diskDecodeNib: Out of range in untranslate6: %d\n", nibble[i+26]);
+			return 1;
+		}
+
+		newValue = b ^ xorValue;
+
+		if (i >= 0x56)
+		{
+			// 6 bit
+			data[i - 0x56] |= (newValue << 2);
+		}
+		else
+		{
+			// 3 * 2 bit
+			data[i + 0x00] = ((newValue >> 1) & 0x01) | ((newValue << 1) & 0x02);
+			data[i + 0x56] = ((newValue >> 3) & 0x01) | ((newValue >> 1) & 0x02);
+			if (i + 0xAC < GCR_BYTES_PER_SECTOR)
+				data[i + 0xAC] = ((newValue >> 5) & 0x01) | ((newValue >> 3) & 0x02);
+		}
+		xorValue = newValue;
+	}
+	return 0;
+}
+
+//____________________
+int diskDecodeData(unsigned char *data, const unsigned char *dataNibbles)
+{
+	/*	Undoes the running XOR of all 343 nibbles first, so the last value is 0
+		when the checksum is good, then assembles the bytes without branches
+		untranslate6 is 0xFF for a bad nibble, valid values never set bit 7
+	*/
+	static const unsigned char swap2[4] = {0, 2, 1, 3};
+	unsigned char value[GCR_DATA_NIBBLES];
+	unsigned char b, xorValue, bad;
+	unsigned int i;
+
+	xorValue = bad = 0;
+	for (i=0; i<GCR_DATA_NIBBLES; i++)
+	{
+		b = untranslate6[dataNibbles[i]];
+		bad |= b;
+		xorValue ^= b;
+		value[i] = xorValue;
+	}
+	if (bad & 0x80)
+		return GCR_BAD_NIBBLE;
+
+	for (i=0; i<0x56; i++)
+		data[i + 0x00] = (value[i + 0x56] << 2) | swap2[value[i] & 0x03];
+	for (i=0; i<0x56; i++)
+		data[i + 0x56] = (value[i + 0xAC] << 2) | swap2[(value[i] >> 2) & 0x03];
+	for (i=0; i<0x54; i++)
+		data[i + 0xAC] = (value[i + 0x102] << 2) | swap2[(value[i] >> 4) & 0x03];
+
+	return value[GCR_DATA_NIBBLES-1] == 0 ? GCR_OK : GCR_BAD_CHECKSUM;
+}
+
+//____________________
+unsigned char decodeNibByte(unsigned char *nibInt, unsigned char *nibData)
+{
+	if ((nibData[0] & 0xAA) != 0xAA)
+		return 1;
+
+	if ((nibData[1] & 0xAA) != 0xAA)
+		return 1;
+
+	*nibInt  = (nibData[0] & ~0xAA) << 1;
+	*nibInt |= (nibData[1] & ~0xAA) << 0;
+	return 0;
+}
+
+//____________________
+unsigned char computeDataChecksum(unsigned char *nibble)
+{
+	// Converts 342 data bytes to 256 bytes & returns checksum (0 if error)
+	unsigned char b, xorValue, newValue;
+	unsigned int i;
+
+	char data[GCR_BYTES_PER_SECTOR];
+
+	xorValue = 0;
+	for (i=0; i<342; i++)
+	{
+		b = untranslate6[nibble[i]];		// first data
+		if (b == 0xFF)
+		{
+			printf("\n*** ComputeDataChecksum: Out of range in untranslate6: %d\n", nibble[i]);
+			return 0;
+		}
+
+		newValue = b ^ xorValue;
+
+		if (i >= 0x56)
+		{
+			// 6 bit
+			data[i - 0x56] |= (newValue << 2);
+		}
+		else
+		{
+			// 3 * 2 bit
+			data[i + 0x00] = ((newValue >> 1) & 0x01) | ((newValue << 1) & 0x02);
+			data[i + 0x56] = ((newValue >> 3) & 0x01) | ((newValue >> 1) & 0x02);
+			if (i + 0xAC < GCR_BYTES_PER_SECTOR)
+				data[i + 0xAC] = ((newValue >> 5) & 0x01) | ((newValue >> 3) & 0x02);
+		}
+		xorValue = newValue;
+	}
+	return xorValue;
+}
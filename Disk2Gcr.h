@@ -0,0 +1,49 @@
+/*	Disk2Gcr.h
+	6-and-2 GCR encoding of 256 byte file sectors into 374 byte disk sectors, and back
+*/
+#ifndef _DISK2GCR_H_
+#define _DISK2GCR_H_
+
+#define GCR_SECTORS_PER_TRACK	16
+#define GCR_BYTES_PER_SECTOR	256			// data bytes only
+#define GCR_NIBBLE_SIZE			374			// one encoded sector, sync + address + data, bytes
+#define GCR_TRACK_SIZE			5984		// 16 * 374
+#define GCR_DATA_OFFSET			26			// first data nibble within an encoded sector
+#define GCR_ENCODER_VERSION		1			// bump when encoded output changes, invalidates track files
+#define GCR_DATA_NIBBLES		343			// 342 data + checksum
+
+// diskDecodeData() results
+#define GCR_OK					0
+#define GCR_BAD_NIBBLE			1			// not a valid 6-and-2 nibble
+#define GCR_BAD_CHECKSUM		2
+
+extern const unsigned char translate6[64];
+extern unsigned char untranslate6[256];
+
+void diskGcrInit(void);
+
+void diskEncodeNib(unsigned char *nibble, unsigned char *data, unsigned char vol, unsigned char trk, unsigned char sec);
+
+/*	Encodes a whole track: trackData holds 16 file sectors in file order,
+	translateSector maps disk sector to file sector (DOS or ProDOS skew)
+	Output is bit-identical to 16 diskEncodeNib() calls
+*/
+void diskEncodeTrack(unsigned char *nibbles, const unsigned char *trackData,
+	unsigned char (*translateSector)(unsigned char), unsigned char vol, unsigned char trk);
+void diskEncodeTrackScalar(unsigned char *nibbles, const unsigned char *trackData,
+	unsigned char (*translateSector)(unsigned char), unsigned char vol, unsigned char trk);
+const char *diskEncodeTrackImpl(void);
+
+unsigned char diskDecodeNib(unsigned char *data, unsigned char *nibble);
+
+/*	Table-driven, branch-free decode of one data field, dataNibbles is the 343
+	nibbles after D5 AA AD; checks the data checksum, prints nothing
+*/
+int diskDecodeData(unsigned char *data, const unsigned char *dataNibbles);
+unsigned char decodeNibByte(unsigned char *nibInt, unsigned char *nibData);
+unsigned char computeDataChecksum(unsigned char *nibble);
+
+unsigned char dosTranslateSector(unsigned char sector);
+unsigned char prodosTranslateSector(unsigned char sector);
+
+#endif /* _DISK2GCR_H_ */
@@ -0,0 +1,687 @@
+/*	Disk2Image.c
+	Disk images loaded in the drives, one context per drive
+	Raw sectors and encoded tracks live in Disk2Cache, so an image selected
+	earlier this session comes back without reading or encoding it again
+	A load is in two halves: imagePrepare() looks for the image in the cache,
+	and only if it is not there maps the file (MAP_PRIVATE, so writes stay in
+	RAM until the journal puts them in the file) and gets all 35 encoded
+	tracks from Disk2TrackFile, or encodes them and saves the file; it
+	touches nothing shared, so Disk2Loader runs it off the main loop;
+	imageInstall() then hands them to the cache, keeping what it already
+	has of the image, and puts the image in the drive. With no track files,
+	and for a track the cache has since evicted, imageTrack() encodes it
+	from the mapped pages when asked
+	Sectors the A2 writes go to the image file through Disk2Journal; until the
+	writer hands the decoded sector back, its encoded track and the raw image
+	stay pinned, so neither can be rebuilt from stale data
+	.nib and .woz images are mapped whole and their tracks built by Disk2Nib;
+	writes to them only patch the track in RAM, which then stays pinned
+	Packed images are unpacked into anonymous memory a track at a time, each
+	track encoded as soon as it is in; writes to them stay in RAM too
+	Both drives share the one cache and its budget; a drive with no image
+	gives a blank track
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "Disk2Image.h"
+#include "Disk2Gcr.h"
+#include "Disk2Cache.h"
+#include "Disk2Journal.h"
+#include "Disk2TrackFile.h"
+#include "Disk2Nib.h"
+#include "Disk2Unpack.h"
+#include "Disk2Metrics.h"
+
+#define RAW_IMAGE_SIZE	(NUM_TRACKS * NUM_SECTORS_PER_TRACK * NUM_BYTES_PER_SECTOR)
+
+#define INFO_KIND		0x0F			// cacheSetInfo() of a raw image: NIB_KIND_
+#define INFO_DOS		0x10			// DOS 3.3 sector order
+#define INFO_PACKED		0x20
+
+typedef struct
+{
+	ImageId loadedId;									// identity of the loaded image
+	char loadedPath[256];								// where its writes go
+	unsigned char imageLoaded;							// 1 = loadedId is valid
+	//		[NUM_TRACKS][NUM_SECTORS_PER_TRACK][NUM_BYTES_PER_SECTOR], file order, pinned in cache
+	unsigned char (*rawImage)[NUM_SECTORS_PER_TRACK][NUM_BYTES_PER_SECTOR];
+	unsigned char (*translateSector)(unsigned char);	// skew of the loaded image
+	unsigned char nibImageKind;							// NIB_KIND_, 0 = sector image
+	unsigned char *nibImage;							// whole .nib/.woz file, pinned in cache
+	size_t nibSize;
+	unsigned char packed;								// 1 = no file to write back to
+	unsigned char ramWritten;							// 1 = told the user its writes are not saved
+} DriveImage;
+
+static DriveImage drives[NUM_DRIVES];
+static unsigned char blankTrack[NUM_ENCODED_BYTES_PER_TRACK];	// no disk in the drive
+static unsigned char scratchTrack[NUM_ENCODED_BYTES_PER_TRACK];	// last track the cache had no memory for
+static ImageId scratchId;
+static int scratchTrk = -1;
+
+static int sameFile(const ImageId *a, const ImageId *b);
+static void dropImage(const ImageId *id);
+static int dosOrder(const char *imagePath);
+static unsigned char *mapImage(const char *imagePath, size_t size);
+static unsigned char *readImage(const char *imagePath);
+static unsigned char *anonImage(size_t size);
+static unsigned long long unpackImage(ImageLoad *load);
+static int unpackTracks(ImageLoad *load, Unpack *unpack, unsigned long long *encodeNs);
+static unsigned long long prepareTracks(ImageLoad *load);
+
+//____________________
+int imageLoad(unsigned char drive, const char *imagePath)
+{
+	// Puts imagePath in drive here and now, returns 0 on success
+	ImageLoad load;
+
+	if (imagePrepare(&load, imagePath))
+		return 1;
+	return imageInstall(drive, &load);
+}
+
+//____________________
+int imagePrepare(ImageLoad *load, const char *imagePath)
+{
+	/*	Reads imagePath and encodes all its tracks into load, returns 0 on success
+		Touches nothing the main thread uses, so the loader thread can run it:
+		an image the cache holds is neither read nor encoded, load->raw is left
+		NULL; otherwise the file is mapped (MAP_POPULATE, read in here) or read;
+		tracks come from the track file, or are encoded here and saved to one
+		A crash journal left for the image is replayed into it first
+	*/
+	unsigned long long start, encodeNs;
+	unsigned int info;
+	time_t mtime;
+
+	memset(load, 0, sizeof(*load));
+	start = metricsNowNs();
+	snprintf(load->path, sizeof(load->path), "%s", imagePath);
+
+	if (!unpackKind(imagePath))
+		journalRecover(imagePath);		// writes a crash left in the journal, packed images have none
+
+	if (cacheImageId(&load->id, imagePath))
+	{
+		printf("\n*** Problem opening disk image\n");
+		return 1;
+	}
+
+	// Selected earlier this session and not evicted yet, e.g. the other side of a disk;
+	// Controller's own writes move the cached mtime on with the file's
+	if (cacheHeld(&load->id, CACHE_RAW_IMAGE, &load->rawSize, &info, &mtime) && mtime == load->id.mtime)
+	{
+		load->kind = info & INFO_KIND;
+		load->skew = info & INFO_DOS ? dosTranslateSector : prodosTranslateSector;
+		load->packed = (info & INFO_PACKED) != 0;
+		load->ioNs = metricsNowNs() - start;
+		return 0;
+	}
+
+	if (unpackKind(imagePath))
+	{
+		encodeNs = unpackImage(load);
+		if (!load->raw)
+			return 1;
+		load->encodeNs = encodeNs;
+		load->ioNs = metricsNowNs() - start - encodeNs;
+		return 0;
+	}
+
+	// Assume we are only dealing with .dsk and .po files
+	load->skew = dosOrder(imagePath) ? dosTranslateSector : prodosTranslateSector;
+
+	// Short files are read and zero filled, mapping past end of file would fault
+	load->kind = nibKind(imagePath);
+	if (load->kind || load->id.size >= RAW_IMAGE_SIZE)
+	{
+		load->rawSize = load->kind ? load->id.size : RAW_IMAGE_SIZE;
+		load->raw = mapImage(imagePath, load->rawSize);
+	}
+	else
+	{
+		load->rawSize = RAW_IMAGE_SIZE;
+		load->raw = readImage(imagePath);
+	}
+	if (!load->raw)
+		return 1;
+	if (load->kind && nibCheck(load->raw, load->rawSize, load->kind))
+	{
+		imageDiscard(load);
+		return 1;
+	}
+
+	encodeNs = prepareTracks(load);
+	load->encodeNs = encodeNs;
+	load->ioNs = metricsNowNs() - start - encodeNs;
+	return 0;
+}
+
+//____________________
+int imageInstall(unsigned char drive, ImageLoad *load)
+{
+	/*	Puts a prepared image in drive, main thread; load's mapping and tracks
+		pass to the cache, or are dropped where the cache already has them:
+		the other drive may have the image, with writes the file has not yet
+		Both drives then share its tracks, there is only ever one copy
+		A file written by something other than Controller since it was cached
+		replaces the cached copy, unless a drive has that in use
+		Returns 0, 1 if the cache cannot take it, or 2 if imagePrepare() found
+		it in the cache and it has been evicted since, to be prepared again;
+		load is empty either way
+	*/
+	DriveImage *d = &drives[drive];
+	unsigned char *raw, *trackData;
+	unsigned char trk;
+	unsigned int info;
+	size_t size;
+	time_t mtime;
+
+	imageWriteDone();							// flushed writes have moved the cached mtime on
+	if (load->raw && cacheHeld(&load->id, CACHE_RAW_IMAGE, &size, &info, &mtime) && mtime != load->id.mtime)
+	{
+		if (cachePinned(&load->id, CACHE_RAW_IMAGE))
+		{
+			printf("*** %s changed on disk while in use, keeping the copy in RAM\n", load->path);
+			free(load->tracks);					// encoded from the file, not the copy
+			load->tracks = NULL;
+		}
+		else
+			dropImage(&load->id);
+	}
+
+	raw = cacheGet(&load->id, CACHE_RAW_IMAGE);
+	if (raw)
+	{
+		if (load->raw)
+			munmap(load->raw, load->rawSize);
+	}
+	else if (!load->raw)
+	{
+		imageDiscard(load);
+		return 2;
+	}
+	else if (!(raw = cachePutMapped(&load->id, CACHE_RAW_IMAGE, load->raw, load->rawSize)))
+	{
+		printf("\n*** Out of memory for disk image\n");
+		imageDiscard(load);
+		return 1;
+	}
+	else
+		cacheSetInfo(&load->id, CACHE_RAW_IMAGE, load->kind | (load->skew == dosTranslateSector ? INFO_DOS : 0) |
+			(load->packed ? INFO_PACKED : 0));
+	load->raw = NULL;
+
+	// Keep raw sectors of the loaded image from being evicted
+	cachePin(&load->id, CACHE_RAW_IMAGE);
+	if (d->imageLoaded)
+		cacheUnpin(&d->loadedId, CACHE_RAW_IMAGE);
+	d->loadedId = load->id;
+	snprintf(d->loadedPath, sizeof(d->loadedPath), "%s", load->path);
+	d->imageLoaded = 1;
+	d->rawImage = (void *) raw;
+	d->translateSector = load->skew;
+	d->nibImageKind = load->kind;
+	d->nibImage = raw;
+	d->nibSize = load->rawSize;
+	d->packed = load->packed;
+	d->ramWritten = 0;
+
+	// Tracks the cache has may hold writes; one it cannot fit is encoded when asked for
+	for (trk=0; load->tracks && trk<NUM_TRACKS; trk++)
+	{
+		if (cacheHas(&load->id, trk))
+			continue;
+		trackData = cachePut(&load->id, trk, NUM_ENCODED_BYTES_PER_TRACK);
+		if (!trackData)
+			break;
+		memcpy(trackData, load->tracks + trk * NUM_ENCODED_BYTES_PER_TRACK, NUM_ENCODED_BYTES_PER_TRACK);
+	}
+
+	if (load->encodeNs)
+		metricsRecord(METRIC_LOAD_ENCODE, load->encodeNs);
+	metricsRecord(METRIC_LOAD_IO, load->ioNs);
+	imageDiscard(load);
+	return 0;
+}
+
+//____________________
+void imageDiscard(ImageLoad *load)
+{
+	// Frees what imagePrepare() put in load and imageInstall() did not take
+	if (load->raw)
+		munmap(load->raw, load->rawSize);
+	free(load->tracks);
+	load->raw = NULL;
+	load->tracks = NULL;
+}
+
+//____________________
+void imageEject(unsigned char drive)
+{
+	// No disk in drive, its tracks stay cached for a while
+	DriveImage *d = &drives[drive];
+
+	if (d->imageLoaded)
+		cacheUnpin(&d->loadedId, CACHE_RAW_IMAGE);
+	d->imageLoaded = 0;
+	d->loadedPath[0] = '\0';
+}
+
+//____________________
+unsigned char *imageTrack(unsigned char drive, unsigned char trk)
+{
+	/*	Encoded track of drive's image, NUM_ENCODED_BYTES_PER_TRACK bytes, encoding it now if needed
+		Valid until the next imageTrack() call may evict it
+		No image: 16 packets of sync nibbles, the A2 finds no address field
+		If the cache cannot take the track it is encoded into scratchTrack,
+		which keeps it, and the writes patched into it, till another track
+		needs it; the drive keeps going
+	*/
+	DriveImage *d = &drives[drive];
+	unsigned char *trackData;
+	unsigned char packet;
+	unsigned long long start;
+
+	if (!d->imageLoaded)
+	{
+		if (blankTrack[0] == 0)
+			for (packet=0; packet<NUM_SECTORS_PER_TRACK; packet++)
+				memset(blankTrack + packet * SMALL_NIBBLE_SIZE, 0xFF, SMALL_NIBBLE_SIZE - 1);
+		return blankTrack;
+	}
+
+	trackData = cacheGet(&d->loadedId, trk);
+	if (!trackData)
+	{
+		start = metricsNowNs();
+		trackData = cachePut(&d->loadedId, trk, NUM_ENCODED_BYTES_PER_TRACK);
+		if (!trackData)
+		{
+			if (scratchTrk == trk && sameFile(&scratchId, &d->loadedId))
+				return scratchTrack;
+			printf("\n*** Out of memory for track %d, not cached\n", trk);
+			trackData = scratchTrack;
+			scratchId = d->loadedId;
+			scratchTrk = trk;
+		}
+		if (d->nibImageKind)
+			nibTrack(trackData, d->nibImage, d->nibSize, d->nibImageKind, trk);
+		else
+			diskEncodeTrack(trackData, d->rawImage[trk][0], d->translateSector, 254, trk);
+		metricsSince(METRIC_TRACK_ENCODE, start);
+	}
+	return trackData;
+}
+
+//____________________
+const char *imageLoadedPath(unsigned char drive)
+{
+	// File of drive's image, "" if none
+	return drives[drive].imageLoaded ? drives[drive].loadedPath : "";
+}
+
+//____________________
+int imageTrackReady(unsigned char drive, unsigned char trk)
+{
+	// 1 if imageTrack() would give trk of drive's image without encoding it
+	DriveImage *d = &drives[drive];
+
+	return !d->imageLoaded || cacheHas(&d->loadedId, trk);
+}
+
+//____________________
+int imageWriteSector(unsigned char drive, unsigned char trk, unsigned char sector, const unsigned char *capture,
+	unsigned int *length)
+{
+	/*	A2 wrote to sector (packet) of trk in drive, capture is PRU1's write buffer copy
+		with the 343 data nibbles (342 + checksum) at [4]
+		Patches the encoded track as written and hands the capture to the journal
+		writer, which verifies it; imageWriteDone() puts good sectors into the raw image
+		If the journal cannot take it, decodes here and the write stays in RAM only
+		Returns the offset in the track of the patched nibbles and their length
+		there, which is 343 but for .nib/.woz fields split over two packets; -1 if none
+	*/
+	DriveImage *d = &drives[drive];
+	unsigned char data[NUM_BYTES_PER_SECTOR];
+	unsigned char *nibble, *raw;
+	int offset;
+
+	if (!d->imageLoaded)
+	{
+		printf("*** Drive %d has no disk, write to trk= %d dropped\n", drive + 1, trk);
+		return -1;
+	}
+
+	if (d->nibImageKind)
+	{
+		offset = nibWriteData(imageTrack(drive, trk), sector, capture + 4, length);
+		if (offset < 0)
+		{
+			printf("*** trk= %d packet= %d: written data field not found\n", trk, sector);
+			return offset;
+		}
+		cachePin(&d->loadedId, trk);			// the patched track is the write's only copy, for the session
+		if (!d->ramWritten)
+			printf("*** Writes to .nib/.woz images are kept in RAM only\n");
+		d->ramWritten = 1;
+		return offset;
+	}
+
+	offset = sector * SMALL_NIBBLE_SIZE + SECTOR_DATA_OFFSET;
+	*length = GCR_DATA_NIBBLES;
+	nibble = imageTrack(drive, trk) + sector * SMALL_NIBBLE_SIZE;
+	memcpy(nibble + SECTOR_DATA_OFFSET, capture + 4, GCR_DATA_NIBBLES);
+
+	raw = d->rawImage[trk][d->translateSector(sector)];
+	if (!d->packed && journalWrite(d->loadedPath, &d->loadedId, trk, sector, d->translateSector(sector), raw,
+		capture) == 0)
+	{
+		cachePin(&d->loadedId, trk);
+		cachePin(&d->loadedId, CACHE_RAW_IMAGE);
+		return offset;
+	}
+
+	if (!d->packed)
+		printf("*** Journal full, trk= %d sector= %d not saved to file\n", trk, sector);
+	else if (!d->ramWritten)
+		printf("*** Writes to .gz/.2mg/.shk images are kept in RAM only\n");
+	d->ramWritten = 1;
+	if (diskDecodeData(data, capture + 4) == GCR_OK)
+		memcpy(raw, data, NUM_BYTES_PER_SECTOR);
+	else
+		printf("***   trk= %d sector= %d not decoded\n", trk, sector);
+	return offset;
+}
+
+//____________________
+void imageWriteDone(void)
+{
+	/*	Sectors the journal writer has decoded and saved, into their raw images
+		The file's new mtime goes to the cache and the drives, so the image is
+		still the one cached copy when it is mounted again
+	*/
+	JournalDone done;
+	unsigned char drive;
+
+	while (journalDone(&done))
+	{
+		if (done.ok)
+			memcpy(done.raw, done.data, NUM_BYTES_PER_SECTOR);
+		if (done.mtime)
+		{
+			done.id.mtime = done.mtime;
+			cacheSetMtime(&done.id, CACHE_RAW_IMAGE);
+			for (drive=0; drive<NUM_DRIVES; drive++)
+			{
+				if (drives[drive].imageLoaded && sameFile(&drives[drive].loadedId, &done.id))
+					drives[drive].loadedId.mtime = done.mtime;
+			}
+		}
+		cacheUnpin(&done.id, done.trk);
+		cacheUnpin(&done.id, CACHE_RAW_IMAGE);
+	}
+}
+
+//____________________
+int imageSave(unsigned char drive, const char *imagePath)
+{
+	/*	Saves drive's disk image to imagePath in format that can be loaded
+		Inverse of imageLoad(); raw sectors already hold every write
+		Will overwrite existing file!
+		Accounts for sector interleaving
+	*/
+	DriveImage *d = &drives[drive];
+	unsigned char trk, sector;
+	unsigned char unTranslateSector[NUM_SECTORS_PER_TRACK];
+	unsigned char (*saveTranslateSector)(unsigned char);
+	FILE *fd;
+
+	if (!d->imageLoaded)
+		return 1;
+	if (d->nibImageKind)
+	{
+		printf("\n*** .nib/.woz images have no sectors to save\n");
+		return 1;
+	}
+	imageWriteDone();							// writes still with the journal are not in rawImage yet
+
+	// Set up unTranslateSector table for the format being saved
+	saveTranslateSector = dosOrder(imagePath) ? dosTranslateSector : prodosTranslateSector;
+	for (sector=0; sector<NUM_SECTORS_PER_TRACK; sector++)
+		unTranslateSector[saveTranslateSector(sector)] = sector;
+
+	fd = fopen(imagePath, "wb");
+	if (!fd)
+	{
+		printf("\n*** Problem opening file for save\n");
+		return 1;
+	}
+
+	// rawImage is in the loaded image's order, which may not be the saved one
+	if (saveTranslateSector == d->translateSector)
+		fwrite(d->rawImage, RAW_IMAGE_SIZE, 1, fd);
+	else
+	{
+		for (trk=0; trk<NUM_TRACKS; trk++)
+		{
+			for (sector=0; sector<NUM_SECTORS_PER_TRACK; sector++)
+				fwrite(d->rawImage[trk][d->translateSector(unTranslateSector[sector])], NUM_BYTES_PER_SECTOR, 1, fd);
+		}
+	}
+	fclose(fd);
+	return 0;
+}
+
+//____________________
+static int sameFile(const ImageId *a, const ImageId *b)
+{
+	// 1 if a and b are the same image file, whatever their mtimes; the cache's key
+	return a->dev == b->dev && a->ino == b->ino && a->size == b->size;
+}
+
+//____________________
+static void dropImage(const ImageId *id)
+{
+	// Every track and the raw image of id out of the cache, the file changed under them
+	unsigned char trk;
+
+	for (trk=0; trk<NUM_TRACKS; trk++)
+		cacheDrop(id, trk);
+	cacheDrop(id, CACHE_RAW_IMAGE);
+	if (sameFile(&scratchId, id))
+		scratchTrk = -1;
+}
+
+//____________________
+static int dosOrder(const char *imagePath)
+{
+	// 1 for a .dsk, DOS 3.3 sector order; anything else is taken to be ProDOS order
+	char *ext;
+
+	ext = strrchr(imagePath, '.');		// get file extension
+	return ext && strcmp(ext, ".dsk") == 0;
+}
+
+//____________________
+static unsigned char *mapImage(const char *imagePath, size_t size)
+{
+	// Private, prefaulted mapping of size bytes of the image file
+	unsigned char *raw;
+	int fd;
+
+	fd = open(imagePath, O_RDONLY);
+	if (fd == -1)
+	{
+		printf("\n*** Problem opening disk image\n");
+		return NULL;
+	}
+	raw = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (raw == MAP_FAILED)
+	{
+		printf("\n*** Problem mapping disk image\n");
+		return NULL;
+	}
+	return raw;
+}
+
+//____________________
+static unsigned char *readImage(const char *imagePath)
+{
+	// Image file shorter than 35 tracks, missing sectors are zeros; anonymous mapping, as mapImage()
+	unsigned char *raw;
+	size_t numElements;
+	FILE *fd;
+
+	fd = fopen(imagePath, "rb");
+	if (!fd)
+	{
+		printf("\n*** Problem opening disk image\n");
+		return NULL;
+	}
+
+	raw = anonImage(RAW_IMAGE_SIZE);
+	if (!raw)
+	{
+		fclose(fd);
+		return NULL;
+	}
+
+	numElements = fread(raw, NUM_BYTES_PER_SECTOR, NUM_TRACKS * NUM_SECTORS_PER_TRACK, fd);
+	if (numElements != NUM_TRACKS * NUM_SECTORS_PER_TRACK)
+		printf("\n*** numElements= %zu (expecting %d)\n", numElements, NUM_TRACKS * NUM_SECTORS_PER_TRACK);
+	fclose(fd);
+	return raw;
+}
+
+//____________________
+static unsigned char *anonImage(size_t size)
+{
+	// Zeroed anonymous mapping for an image read in, the cache munmaps it like a file mapping
+	unsigned char *raw;
+
+	raw = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == MAP_FAILED)
+	{
+		printf("\n*** Out of memory for disk image\n");
+		return NULL;
+	}
+	return raw;
+}
+
+//____________________
+static unsigned long long unpackImage(ImageLoad *load)
+{
+	/*	Packed image into load: sector images a track at a time, each encoded
+		while it is still in the CPU cache, before the next is unpacked; .nib
+		and .woz whole, then built by prepareTracks()
+		No track file: it is larger than the packed image, reading it would
+		cost more than the encode saves
+		Returns the time spent encoding, ns; load->raw is NULL on failure
+	*/
+	unsigned long long encodeNs;
+	Unpack *unpack;
+	int failed;
+
+	unpack = unpackOpen(load->path);
+	if (!unpack)
+		return 0;
+	load->packed = 1;
+	load->kind = nibKind(unpackName(unpack));
+	load->skew = dosOrder(unpackName(unpack)) ? dosTranslateSector : prodosTranslateSector;
+	load->rawSize = load->kind ? unpackSize(unpack) : RAW_IMAGE_SIZE;
+	load->raw = anonImage(load->rawSize);
+
+	encodeNs = 0;
+	if (!load->raw)
+		failed = 1;
+	else if (load->kind)
+		failed = unpackRead(unpack, load->raw, load->rawSize) != (long) load->rawSize ||
+			nibCheck(load->raw, load->rawSize, load->kind);
+	else
+		failed = unpackTracks(load, unpack, &encodeNs);
+	unpackClose(unpack);
+
+	if (failed)
+	{
+		printf("\n*** Problem unpacking disk image\n");
+		imageDiscard(load);
+		return 0;
+	}
+	return load->kind ? prepareTracks(load) : encodeNs;
+}
+
+//____________________
+static int unpackTracks(ImageLoad *load, Unpack *unpack, unsigned long long *encodeNs)
+{
+	/*	Sector image tracks, unpacked and encoded one by one; a short image is
+		zero filled, as readImage() does, and no buffer leaves the encoding to
+		imageTrack(), as in prepareTracks(). Returns 0 on success
+	*/
+	unsigned char *trackRaw;
+	unsigned long long start;
+	unsigned char trk;
+
+	load->tracks = malloc(NUM_TRACKS * NUM_ENCODED_BYTES_PER_TRACK);
+	for (trk=0; trk<NUM_TRACKS; trk++)
+	{
+		trackRaw = load->raw + trk * NUM_SECTORS_PER_TRACK * NUM_BYTES_PER_SECTOR;
+		if (unpackRead(unpack, trackRaw, NUM_SECTORS_PER_TRACK * NUM_BYTES_PER_SECTOR) < 0)
+			return 1;
+		if (!load->tracks)
+			continue;
+		start = metricsNowNs();
+		diskEncodeTrack(load->tracks + trk * NUM_ENCODED_BYTES_PER_TRACK, trackRaw, load->skew, 254, trk);
+		*encodeNs += metricsNowNs() - start;
+	}
+	return 0;
+}
+
+//____________________
+static unsigned long long prepareTracks(ImageLoad *load)
+{
+	/*	All 35 encoded tracks of load into one buffer: for sector images from
+		the track file for these contents or, when there is none or it is
+		stale, encoded here and saved for next time; .nib/.woz tracks are built
+		Returns the time spent encoding, ns; with track files off, or no
+		buffer, no tracks, and imageTrack() encodes them as asked for
+	*/
+	unsigned char *tracks[NUM_TRACKS];
+	unsigned long long hash, encodeNs;
+	unsigned char trk, kind;
+
+	if (!trackFileEnabled())
+		return 0;
+	load->tracks = malloc(NUM_TRACKS * NUM_ENCODED_BYTES_PER_TRACK);
+	if (!load->tracks)
+		return 0;
+	for (trk=0; trk<NUM_TRACKS; trk++)
+		tracks[trk] = load->tracks + trk * NUM_ENCODED_BYTES_PER_TRACK;
+
+	if (load->kind)
+	{
+		encodeNs = metricsNowNs();
+		for (trk=0; trk<NUM_TRACKS; trk++)
+			nibTrack(tracks[trk], load->raw, load->rawSize, load->kind, trk);
+		return metricsNowNs() - encodeNs;
+	}
+
+	kind = load->skew == dosTranslateSector ? TRACK_FILE_DOS : TRACK_FILE_PRODOS;
+	hash = trackFileHash(load->raw, RAW_IMAGE_SIZE);
+	if (trackFileLoad(hash, kind, tracks) == 0)
+		return 0;
+
+	encodeNs = metricsNowNs();
+	for (trk=0; trk<NUM_TRACKS; trk++)
+		diskEncodeTrack(tracks[trk], load->raw + trk * NUM_SECTORS_PER_TRACK * NUM_BYTES_PER_SECTOR,
+			load->skew, 254, trk);
+	encodeNs = metricsNowNs() - encodeNs;
+	trackFileSave(hash, kind, tracks);
+	return encodeNs;
+}
@@ -0,0 +1,49 @@
+/*	Disk2Image.h
+	The disk image in each drive: raw 256 byte sectors as read from the .dsk/.po
+	file, and each track's 6-and-2 encoding, made the first time the track is asked for
+	Both are held in Disk2Cache, one pool and budget for both drives
+	.nib/.woz images are held whole, their tracks come from Disk2Nib
+	Packed images (.gz, .2mg, .shk) are unpacked into RAM, see Disk2Unpack.h
+	Drives are 0 and 1, the A2's drive 1 and 2
+*/
+#ifndef _DISK2IMAGE_H_
+#define _DISK2IMAGE_H_
+
+#include "Disk2Cache.h"
+
+#define NUM_TRACKS					35
+#define NUM_SECTORS_PER_TRACK		16
+#define NUM_BYTES_PER_SECTOR		256		// these are only data bytes
+#define SMALL_NIBBLE_SIZE			374		// one encoded sector, sync + address + data, bytes
+#define NUM_ENCODED_BYTES_PER_TRACK	5984	// 16 * 374
+#define SECTOR_DATA_OFFSET			26		// location of first data byte, 0-based
+#define NUM_DRIVES					2
+
+typedef struct
+{
+	char path[256];
+	ImageId id;
+	unsigned char *raw;						// mapping, 35 tracks of sectors or the whole .nib/.woz file; NULL = in the cache
+	size_t rawSize;
+	unsigned char *tracks;					// NUM_TRACKS encoded, NULL = encoded as asked for
+	unsigned char (*skew)(unsigned char);
+	unsigned char kind;						// NIB_KIND_, 0 = sector image
+	unsigned char packed;					// 1 = from a .gz/.2mg/.shk, see Disk2Unpack.h
+	unsigned long long ioNs;				// reading it, track file included
+	unsigned long long encodeNs;
+} ImageLoad;
+
+int imageLoad(unsigned char drive, const char *imagePath);
+int imagePrepare(ImageLoad *load, const char *imagePath);
+int imageInstall(unsigned char drive, ImageLoad *load);
+void imageDiscard(ImageLoad *load);
+void imageEject(unsigned char drive);
+const char *imageLoadedPath(unsigned char drive);
+unsigned char *imageTrack(unsigned char drive, unsigned char trk);
+int imageTrackReady(unsigned char drive, unsigned char trk);
+int imageWriteSector(unsigned char drive, unsigned char trk, unsigned char sector, const unsigned char *capture,
+	unsigned int *length);
+void imageWriteDone(void);
+int imageSave(unsigned char drive, const char *imagePath);
+
+#endif /* _DISK2IMAGE_H_ */
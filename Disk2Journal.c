@@ -0,0 +1,460 @@
+/*	Disk2Journal.c
+	Writer thread behind journalWrite(), see Disk2Journal.h
+	slots[] is one ring with three counters:
+		head		next slot journalWrite() fills			(main thread)
+		flushed		slots before it are decoded and on disk	(writer)
+		tail		slots before it were handed back		(main thread, journalDone())
+	The main thread only ever waits for lock, which nobody holds across I/O
+	Journal record: magic, track, file sector, checksum, 256 data bytes
+	Captured write: [0] sync remnant, [1..3] D5 AA AD, [4..346] data, [347..349] DE AA EB
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "Disk2Journal.h"
+#include "Disk2Gcr.h"
+
+#define JOURNAL_MAGIC	0x524A3244		// "D2JR"
+#define JOURNAL_EXT		".jnl"
+
+typedef struct
+{
+	char path[256];						// image file
+	ImageId id;
+	unsigned char trk;
+	unsigned char sector;				// disk order, as in the address field
+	unsigned char fileSector;
+	unsigned char *raw;
+	unsigned char capture[JOURNAL_CAPTURE];
+	unsigned char ok;
+	unsigned char data[GCR_BYTES_PER_SECTOR];
+	time_t mtime;						// of the image file once flushed, 0 = not written
+} JournalSlot;
+
+typedef struct
+{
+	uint32_t magic;
+	uint8_t trk;
+	uint8_t fileSector;
+	uint8_t unused[2];
+	uint32_t sum;
+	uint8_t data[GCR_BYTES_PER_SECTOR];
+} JournalRecord;
+
+static JournalSlot slots[JOURNAL_SLOTS];
+static unsigned int head, flushed, tail;		// free running, slot is n % JOURNAL_SLOTS
+static unsigned char started, stopping, flushNow;
+static unsigned int flushMs;
+static JournalStats stats;						// under lock
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t ioLock = PTHREAD_MUTEX_INITIALIZER;	// journal and image files
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_t writer;
+
+static void *writerThread(void *arg);
+static void flushBatch(unsigned int first, unsigned int end);
+static int verifySlot(JournalSlot *slot);
+static int flushImage(unsigned int first, unsigned int end);
+static uint32_t recordSum(const JournalRecord *record);
+static unsigned long long nowNs(void);
+
+//____________________
+int journalStart(unsigned int ms)
+{
+	// Starts the writer thread, returns 0 on success
+	pthread_condattr_t attr;
+
+	flushMs = ms;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&wake, &attr);
+	pthread_condattr_destroy(&attr);
+
+	stopping = 0;
+	if (pthread_create(&writer, NULL, writerThread, NULL) != 0)
+	{
+		printf("*** ERROR: could not start journal writer\n");
+		return 1;
+	}
+	started = 1;
+	return 0;
+}
+
+//____________________
+void journalStop(void)
+{
+	// Flushes everything queued, then stops the writer; journalDone() still returns the rest
+	if (!started)
+		return;
+
+	pthread_mutex_lock(&lock);
+	stopping = 1;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+
+	pthread_join(writer, NULL);
+	started = 0;
+}
+
+//____________________
+void journalFlush(void)
+{
+	// What is queued goes to the image files now, not at the end of the flush interval
+	pthread_mutex_lock(&lock);
+	flushNow = flushed != head;				// nothing queued, the next write waits as usual
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+}
+
+//____________________
+int journalWrite(const char *imagePath, const ImageId *id, unsigned char trk, unsigned char sector,
+	unsigned char fileSector, unsigned char *raw, const unsigned char *capture)
+{
+	/*	Queues one write as captured by PRU1; nothing is checked here
+		raw must stay put until journalDone() returns it
+		Returns 0 if queued, 1 if not (queue full or no writer), never waits
+	*/
+	JournalSlot *slot;
+
+	pthread_mutex_lock(&lock);
+	if (!started || stopping || head - tail == JOURNAL_SLOTS)
+	{
+		stats.dropped++;
+		pthread_mutex_unlock(&lock);
+		return 1;
+	}
+
+	slot = &slots[head % JOURNAL_SLOTS];
+	snprintf(slot->path, sizeof(slot->path), "%s", imagePath);
+	slot->id			= *id;
+	slot->trk			= trk;
+	slot->sector		= sector;
+	slot->fileSector	= fileSector;
+	slot->raw			= raw;
+	slot->mtime			= 0;
+	memcpy(slot->capture, capture, JOURNAL_CAPTURE);
+
+	head++;
+	stats.queued++;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+//____________________
+int journalDone(JournalDone *done)
+{
+	// Next sector the writer has finished with, returns 0 if none
+	JournalSlot *slot;
+
+	pthread_mutex_lock(&lock);
+	if (tail == flushed)
+	{
+		pthread_mutex_unlock(&lock);
+		return 0;
+	}
+
+	slot = &slots[tail % JOURNAL_SLOTS];
+	done->id			= slot->id;
+	done->trk			= slot->trk;
+	done->fileSector	= slot->fileSector;
+	done->raw			= slot->raw;
+	done->ok			= slot->ok;
+	done->mtime			= slot->mtime;
+	memcpy(done->data, slot->data, sizeof(done->data));
+	tail++;
+	pthread_mutex_unlock(&lock);
+	return 1;
+}
+
+//____________________
+int journalRecover(const char *imagePath)
+{
+	/*	Replays a journal left behind by a crash into imagePath
+		Stops at the first torn or corrupt record; returns number of sectors replayed
+	*/
+	JournalRecord record;
+	char journalPath[268];
+	unsigned int count;
+	off_t offset;
+	int jfd, ifd;
+
+	snprintf(journalPath, sizeof(journalPath), "%s%s", imagePath, JOURNAL_EXT);
+
+	pthread_mutex_lock(&ioLock);
+	jfd = open(journalPath, O_RDONLY);
+	if (jfd == -1)
+	{
+		pthread_mutex_unlock(&ioLock);
+		return 0;
+	}
+
+	count = 0;
+	ifd = open(imagePath, O_WRONLY);
+	if (ifd == -1)
+		printf("*** ERROR: could not open %s to replay journal\n", imagePath);
+	else
+	{
+		while (read(jfd, &record, sizeof(record)) == sizeof(record))
+		{
+			if (record.magic != JOURNAL_MAGIC || record.sum != recordSum(&record) ||
+				record.trk >= 35 || record.fileSector >= GCR_SECTORS_PER_TRACK)
+				break;
+			offset = ((off_t) record.trk * GCR_SECTORS_PER_TRACK + record.fileSector) * GCR_BYTES_PER_SECTOR;
+			if (pwrite(ifd, record.data, GCR_BYTES_PER_SECTOR, offset) != GCR_BYTES_PER_SECTOR)
+				break;
+			count++;
+		}
+		if (fsync(ifd) == 0)
+			unlink(journalPath);
+		close(ifd);
+	}
+	close(jfd);
+	pthread_mutex_unlock(&ioLock);
+
+	if (count)
+		printf("--- Replayed %u sectors from %s\n", count, journalPath);
+	return count;
+}
+
+//____________________
+void journalGetStats(JournalStats *out)
+{
+	pthread_mutex_lock(&lock);
+	*out = stats;
+	out->pending = head - tail;
+	pthread_mutex_unlock(&lock);
+}
+
+//____________________
+void journalPrintStats(void)
+{
+	JournalStats s;
+
+	journalGetStats(&s);
+	printf("Journal: %llu sectors queued, %llu written, %u pending, %llu batches, %llu fsyncs, max batch %.1f ms",
+		s.queued, s.written, s.pending, s.batches, s.fsyncs, s.maxBatchNs / 1e6);
+	if (s.dropped || s.ioErrors)
+		printf(", %llu dropped, %llu I/O errors", s.dropped, s.ioErrors);
+	printf("\n");
+	if (s.writeErrors)
+		printf("Write errors: %llu (%llu framing, %llu data)\n", s.writeErrors, s.badFraming, s.badData);
+}
+
+//____________________
+static void *writerThread(void *arg)
+{
+	// Waits for a first sector, gives the A2 one flush interval to write more, then flushes them all
+	struct timespec deadline;
+	unsigned int first, end;
+
+	pthread_mutex_lock(&lock);
+	while (1)
+	{
+		while (!stopping && flushed == head)
+			pthread_cond_wait(&wake, &lock);
+		if (flushed == head)
+			break;								// stopping, nothing left
+
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += flushMs / 1000;
+		deadline.tv_nsec += (flushMs % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		while (!stopping && !flushNow && pthread_cond_timedwait(&wake, &lock, &deadline) != ETIMEDOUT)
+			;
+
+		flushNow = 0;
+		first = flushed;
+		end = head;
+		pthread_mutex_unlock(&lock);
+
+		flushBatch(first, end);
+
+		pthread_mutex_lock(&lock);
+		flushed = end;
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+//____________________
+static void flushBatch(unsigned int first, unsigned int end)
+{
+	// Verifies and decodes slots [first, end), then writes the good ones out one image file at a time
+	unsigned long long start, elapsed;
+	unsigned int i, next, written, fsyncs, errors;
+	unsigned int bad[3];
+	int count, result;
+
+	start = nowNs();
+	memset(bad, 0, sizeof(bad));
+	for (i=first; i!=end; i++)
+	{
+		result = verifySlot(&slots[i % JOURNAL_SLOTS]);
+		bad[result]++;
+		if (result)
+			printf("*** Write error, trk= %d sector= %d: bad %s\n", slots[i % JOURNAL_SLOTS].trk,
+				slots[i % JOURNAL_SLOTS].sector, result == 1 ? "framing" : "data");
+	}
+
+	pthread_mutex_lock(&ioLock);
+	written = fsyncs = errors = 0;
+	for (i=first; i!=end; i=next)
+	{
+		// Run of slots for the same image
+		for (next=i+1; next!=end; next++)
+			if (strcmp(slots[next % JOURNAL_SLOTS].path, slots[i % JOURNAL_SLOTS].path) != 0)
+				break;
+		count = flushImage(i, next);
+		if (count < 0)
+			errors++;
+		else
+		{
+			written += count;
+			fsyncs += 2;
+		}
+	}
+	pthread_mutex_unlock(&ioLock);
+	elapsed = nowNs() - start;
+
+	pthread_mutex_lock(&lock);
+	stats.batches++;
+	stats.badFraming += bad[1];
+	stats.badData += bad[2];
+	stats.writeErrors += bad[1] + bad[2];
+	stats.written += written;
+	stats.fsyncs += fsyncs;
+	stats.ioErrors += errors;
+	if (elapsed > stats.maxBatchNs)
+		stats.maxBatchNs = elapsed;
+	pthread_mutex_unlock(&lock);
+}
+
+//____________________
+static int verifySlot(JournalSlot *slot)
+{
+	/*	Returns 0 if the write is good and decoded into slot->data, else 1 framing, 2 data
+		The address field is not checked: PRU1 captures only the data field, and
+		the trk/sector it is stamped with are what the address field was made from
+	*/
+	const unsigned char *capture = slot->capture;
+
+	slot->ok = 0;
+	if (capture[1] != 0xD5 || capture[2] != 0xAA || capture[3] != 0xAD ||
+		capture[347] != 0xDE || capture[348] != 0xAA || capture[349] != 0xEB)
+		return 1;
+
+	if (diskDecodeData(slot->data, capture + 4) != GCR_OK)
+		return 2;
+
+	slot->ok = 1;
+	return 0;
+}
+
+//____________________
+static int flushImage(unsigned int first, unsigned int end)
+{
+	/*	Slots [first, end) all belong to one image file
+		Journal first (append + fsync), then the sectors in place (+ fsync),
+		then the journal is no longer needed
+		Returns number of sectors written, -1 on error
+	*/
+	JournalSlot *slot;
+	JournalRecord record;
+	char journalPath[268];
+	struct stat st;
+	unsigned int i;
+	off_t offset;
+	int jfd, ifd, error, count;
+
+	snprintf(journalPath, sizeof(journalPath), "%s%s", slots[first % JOURNAL_SLOTS].path, JOURNAL_EXT);
+	jfd = open(journalPath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	ifd = open(slots[first % JOURNAL_SLOTS].path, O_WRONLY);
+	if (jfd == -1 || ifd == -1)
+	{
+		printf("*** ERROR: could not open %s for write-back\n", slots[first % JOURNAL_SLOTS].path);
+		if (jfd != -1)
+			close(jfd);
+		if (ifd != -1)
+			close(ifd);
+		return -1;
+	}
+
+	error = count = 0;
+	memset(&record, 0, sizeof(record));
+	record.magic = JOURNAL_MAGIC;
+	for (i=first; i!=end && !error; i++)
+	{
+		slot = &slots[i % JOURNAL_SLOTS];
+		if (!slot->ok)
+			continue;
+		record.trk = slot->trk;
+		record.fileSector = slot->fileSector;
+		memcpy(record.data, slot->data, GCR_BYTES_PER_SECTOR);
+		record.sum = recordSum(&record);
+		if (write(jfd, &record, sizeof(record)) != sizeof(record))
+			error = 1;
+	}
+	if (!error && fsync(jfd) == -1)
+		error = 1;
+	close(jfd);
+
+	for (i=first; i!=end && !error; i++)
+	{
+		slot = &slots[i % JOURNAL_SLOTS];
+		if (!slot->ok)
+			continue;
+		offset = ((off_t) slot->trk * GCR_SECTORS_PER_TRACK + slot->fileSector) * GCR_BYTES_PER_SECTOR;
+		if (pwrite(ifd, slot->data, GCR_BYTES_PER_SECTOR, offset) != GCR_BYTES_PER_SECTOR)
+			error = 1;
+		count++;
+	}
+	if (!error && fsync(ifd) == -1)
+		error = 1;
+	if (!error && fstat(ifd, &st) == 0)
+	{
+		for (i=first; i!=end; i++)
+			slots[i % JOURNAL_SLOTS].mtime = st.st_mtime;	// the cache follows the file, see imageWriteDone()
+	}
+	close(ifd);
+
+	if (error)
+	{
+		printf("*** ERROR: write-back to %s failed, journal kept\n", slots[first % JOURNAL_SLOTS].path);
+		return -1;
+	}
+	unlink(journalPath);
+	return count;
+}
+
+//____________________
+static uint32_t recordSum(const JournalRecord *record)
+{
+	uint32_t sum;
+	unsigned int i;
+
+	sum = record->magic + (record->trk << 8) + record->fileSector;
+	for (i=0; i<GCR_BYTES_PER_SECTOR; i++)
+		sum = sum * 31 + record->data[i];
+	return sum;
+}
+
+//____________________
+static unsigned long long nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
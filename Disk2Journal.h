@@ -0,0 +1,55 @@
+/*	Disk2Journal.h
+	Write-back of sectors the A2 writes, off the main loop
+	Controller queues each write as PRU1 captured it; a writer thread checks
+	the prologue and epilogue, decodes the data field and its checksum,
+	appends the good ones to <image>.jnl, fsyncs once per batch and then
+	checkpoints them into the image file in place; bad writes are only counted
+	Decoded sectors come back to the main thread through journalDone()
+	A crash loses at most one flush interval; a leftover journal is replayed
+	by journalRecover() the next time the image is loaded
+*/
+#ifndef _DISK2JOURNAL_H_
+#define _DISK2JOURNAL_H_
+
+#include "Disk2Cache.h"
+
+#define JOURNAL_SLOTS		256			// sectors queued or waiting for journalDone()
+#define JOURNAL_CAPTURE		350			// framed write, see EDGE_CAPTURE_SIZE
+
+typedef struct
+{
+	ImageId id;							// image and track to unpin
+	unsigned char trk;
+	unsigned char fileSector;			// sector in file order
+	unsigned char *raw;					// where the decoded sector goes, pinned by caller
+	unsigned char ok;					// 1 = verified and decoded, data valid
+	unsigned char data[256];
+	time_t mtime;						// image file's once written, 0 = not written
+} JournalDone;
+
+typedef struct
+{
+	unsigned long long queued;			// sectors accepted by journalWrite()
+	unsigned long long dropped;			// refused, queue full or no writer
+	unsigned long long writeErrors;		// sum of the next two, not journaled
+	unsigned long long badFraming;		// prologue or epilogue not where expected
+	unsigned long long badData;			// bad nibble or data checksum
+	unsigned long long written;			// sectors checkpointed into image files
+	unsigned long long batches;
+	unsigned long long fsyncs;
+	unsigned long long ioErrors;
+	unsigned long long maxBatchNs;		// decode + journal + checkpoint, one batch
+	unsigned int pending;				// queued, not yet returned by journalDone()
+} JournalStats;
+
+int journalStart(unsigned int flushMs);
+void journalStop(void);
+void journalFlush(void);
+int journalWrite(const char *imagePath, const ImageId *id, unsigned char trk, unsigned char sector,
+	unsigned char fileSector, unsigned char *raw, const unsigned char *capture);
+int journalDone(JournalDone *done);
+int journalRecover(const char *imagePath);
+void journalGetStats(JournalStats *stats);
+void journalPrintStats(void);
+
+#endif /* _DISK2JOURNAL_H_ */
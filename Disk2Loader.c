@@ -0,0 +1,225 @@
+/*	Disk2Loader.c
+	Loader thread and the per drive slots it publishes mounts in, see Disk2Loader.h
+	Requests wait in a small queue under a lock; a published Mount belongs
+	to the slot till the main loop swaps it out, so the two sides never
+	touch the same one
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "Disk2Loader.h"
+#include "Disk2Metrics.h"
+
+typedef struct
+{
+	unsigned char drive;
+	unsigned char eject;
+	char path[256];
+	char name[256];
+	unsigned long long requestNs;
+} Request;
+
+static Request queue[LOADER_QUEUE];
+static unsigned int head, tail;				// free running, request is n % LOADER_QUEUE
+static unsigned char started, stopping;
+static Mount *ready[NUM_DRIVES];			// published, not yet taken; atomic swaps only
+static int readyFd = -1;					// eventfd, readable when something was published
+static LoaderStats stats;					// under lock
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_t loader;
+
+static void *loaderThread(void *arg);
+static void publish(Mount *mount);
+
+//____________________
+int loaderStart(void)
+{
+	// Starts the loader thread, returns 0 on success
+	readyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (readyFd == -1)
+	{
+		printf("*** ERROR: could not create loader eventfd\n");
+		return 1;
+	}
+
+	head = tail = 0;
+	stopping = 0;
+	memset(&stats, 0, sizeof(stats));
+	if (pthread_create(&loader, NULL, loaderThread, NULL) != 0)
+	{
+		printf("*** ERROR: could not start image loader\n");
+		close(readyFd);
+		readyFd = -1;
+		return 1;
+	}
+	started = 1;
+	return 0;
+}
+
+//____________________
+void loaderStop(void)
+{
+	// Finishes the mount in hand, drops those still queued or not taken
+	unsigned char drive;
+
+	if (!started)
+		return;
+
+	pthread_mutex_lock(&lock);
+	stopping = 1;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+	pthread_join(loader, NULL);
+	started = 0;
+
+	for (drive=0; drive<NUM_DRIVES; drive++)
+		loaderDone(__atomic_exchange_n(&ready[drive], NULL, __ATOMIC_ACQ_REL));
+	close(readyFd);
+	readyFd = -1;
+}
+
+//____________________
+int loaderRequest(unsigned char drive, const char *imagePath, const char *name)
+{
+	/*	Queues imagePath for drive, NULL to eject; name is what to call it
+		Returns 0, or 1 if the queue is full
+	*/
+	Request *request;
+
+	pthread_mutex_lock(&lock);
+	stats.requested++;
+	if (!started || head - tail == LOADER_QUEUE)
+	{
+		stats.refused++;
+		pthread_mutex_unlock(&lock);
+		return 1;
+	}
+
+	request = &queue[head % LOADER_QUEUE];
+	request->drive = drive;
+	request->eject = imagePath == NULL;
+	snprintf(request->path, sizeof(request->path), "%s", imagePath ? imagePath : "");
+	snprintf(request->name, sizeof(request->name), "%s", name ? name : "");
+	request->requestNs = metricsNowNs();
+	head++;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+//____________________
+Mount *loaderTake(unsigned char drive)
+{
+	// Main thread: the mount published for drive, or NULL; hand it back to loaderDone()
+	uint64_t count;
+
+	// Clears the eventfd; fails with EAGAIN when nothing was published since the last look
+	if (readyFd != -1)
+		(void) read(readyFd, &count, sizeof(count));
+	return __atomic_exchange_n(&ready[drive], NULL, __ATOMIC_ACQ_REL);
+}
+
+//____________________
+void loaderDone(Mount *mount)
+{
+	// Frees mount and whatever of its image was not installed
+	if (!mount)
+		return;
+	imageDiscard(&mount->image);
+	free(mount);
+}
+
+//____________________
+int loaderFd(void)
+{
+	return readyFd;
+}
+
+//____________________
+void loaderGetStats(LoaderStats *out)
+{
+	pthread_mutex_lock(&lock);
+	*out = stats;
+	pthread_mutex_unlock(&lock);
+}
+
+//____________________
+void loaderPrintStats(void)
+{
+	LoaderStats s;
+
+	loaderGetStats(&s);
+	printf("Loader: %llu mounts, %llu loaded, %llu failed, %llu replaced, %llu refused, max %.1f ms\n",
+		s.requested, s.loaded, s.failed, s.replaced, s.refused, s.maxNs / 1e6);
+}
+
+//____________________
+static void *loaderThread(void *arg)
+{
+	// One request at a time, in the order they came
+	Request request;
+	Mount *mount;
+
+	pthread_mutex_lock(&lock);
+	while (1)
+	{
+		while (!stopping && tail == head)
+			pthread_cond_wait(&wake, &lock);
+		if (stopping)
+			break;
+
+		request = queue[tail % LOADER_QUEUE];
+		tail++;
+		pthread_mutex_unlock(&lock);
+
+		mount = calloc(1, sizeof(Mount));
+		if (mount)
+		{
+			mount->drive = request.drive;
+			mount->eject = request.eject;
+			snprintf(mount->name, sizeof(mount->name), "%s", request.name);
+			mount->requestNs = request.requestNs;
+			if (!request.eject && imagePrepare(&mount->image, request.path))
+			{
+				printf("*** Could not load %s\n", request.path);
+				free(mount);
+				mount = NULL;
+			}
+		}
+
+		pthread_mutex_lock(&lock);
+		if (mount)
+			publish(mount);
+		else
+			stats.failed++;
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+//____________________
+static void publish(Mount *mount)
+{
+	// Under lock: mount into its drive's slot, replacing one not taken yet, and wake the main loop
+	uint64_t one = 1;
+	Mount *old;
+
+	mount->readyNs = metricsNowNs();
+	stats.loaded++;
+	if (mount->readyNs - mount->requestNs > stats.maxNs)
+		stats.maxNs = mount->readyNs - mount->requestNs;
+
+	old = __atomic_exchange_n(&ready[mount->drive], mount, __ATOMIC_ACQ_REL);
+	if (old)
+	{
+		stats.replaced++;
+		loaderDone(old);
+	}
+	if (write(readyFd, &one, sizeof(one)) != sizeof(one))
+		printf("*** ERROR: could not wake the main loop\n");
+}
@@ -0,0 +1,50 @@
+/*	Disk2Loader.h
+	Image mounts off the main loop
+	loaderRequest() queues a mount; the loader thread reads and encodes the
+	image (imagePrepare() in Disk2Image.c), or just finds it in the cache,
+	and publishes it in its drive's slot with one atomic pointer swap, then
+	makes loaderFd() readable. The main loop takes it with another swap, at
+	a point of its choosing, and installs it; the drive keeps sending the
+	old image till then
+	A mount the main loop has not taken yet is replaced by a later one for
+	the same drive, an eject is a mount of nothing
+	Once Controller runs, the loader thread is the only user of
+	Disk2TrackFile; its counters are read unlocked, for display only
+*/
+#ifndef _DISK2LOADER_H_
+#define _DISK2LOADER_H_
+
+#include "Disk2Image.h"
+
+#define LOADER_QUEUE		8				// mounts waiting for the loader thread
+
+typedef struct
+{
+	unsigned char drive;
+	unsigned char eject;					// 1 = no image, image is empty
+	char name[256];							// as asked for, for display
+	unsigned long long requestNs;			// metricsNowNs() at loaderRequest()
+	unsigned long long readyNs;				// when published
+	ImageLoad image;
+} Mount;
+
+typedef struct
+{
+	unsigned long long requested;
+	unsigned long long loaded;				// published
+	unsigned long long failed;				// image could not be read
+	unsigned long long replaced;			// published, then replaced before it was taken
+	unsigned long long refused;				// queue full
+	unsigned long long maxNs;				// request to published, longest
+} LoaderStats;
+
+int loaderStart(void);
+void loaderStop(void);
+int loaderRequest(unsigned char drive, const char *imagePath, const char *name);
+Mount *loaderTake(unsigned char drive);
+void loaderDone(Mount *mount);
+int loaderFd(void);
+void loaderGetStats(LoaderStats *stats);
+void loaderPrintStats(void);
+
+#endif /* _DISK2LOADER_H_ */
@@ -0,0 +1,360 @@
+/*	Disk2Mailbox.c
+	Seqlocked PRU status blocks and the PRU1 command block, see Disk2Mailbox.h
+	Controller side reads and counts; the stand-in side below writes the way
+	Disk2Pru0.c and Disk2Pru1.c do, for Sim and Bench
+*/
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "Disk2Mailbox.h"
+#include "Disk2Mem.h"
+#include "Disk2Edge.h"
+#include "Disk2Trace.h"
+
+#define MAX_RETRIES		100000			// a PRU stopped mid-update, take the copy anyway
+
+static volatile Pru0Status *pru0Status;
+static volatile Pru1Status *pru1Status;
+static volatile Pru1Command *pru1Command;
+static volatile WriteSlot *writeSlots;
+
+static uint32_t seenTrackSeq, seenStepSeq, seenSectorSeq, seenWriteSeq;	// as of the last mailboxPoll()
+static unsigned char streamOn;
+static MailboxStats stats;					// main thread only
+
+static void readStatus(void *copy, const volatile void *status, size_t size);
+static void copyWords(void *copy, const volatile void *from, size_t size);
+static void beginUpdate(volatile uint32_t *seq);
+static void endUpdate(volatile uint32_t *seq);
+
+//____________________
+void mailboxInit(unsigned char *pru)
+{
+	// Whatever the PRUs counted before Controller started is not news
+	Pru0Status pru0;
+	Pru1Status pru1;
+
+	pru0Status	= (volatile Pru0Status *) (pru + PRU0_STATUS_ADR);
+	pru1Status	= (volatile Pru1Status *) (pru + PRU1_DRAM + PRU1_STATUS_ADR);
+	pru1Command	= (volatile Pru1Command *) (pru + PRU1_DRAM + PRU1_COMMAND_ADR);
+	writeSlots	= (volatile WriteSlot *) (pru + PRU1_DRAM + WRITE_SLOT_ADR);
+
+	readStatus(&pru0, pru0Status, sizeof(pru0));
+	readStatus(&pru1, pru1Status, sizeof(pru1));
+	seenTrackSeq	= pru0.trackSeq;
+	seenStepSeq		= pru0.stepSeq;
+	seenSectorSeq	= pru1.sectorSeq;
+	seenWriteSeq	= pru1.writeSeq;
+	memset(&stats, 0, sizeof(stats));
+}
+
+//____________________
+void mailboxPoll(MailboxNews *news)
+{
+	// One consistent copy of each status block, and how far each counter moved
+	readStatus(&news->pru0, pru0Status, sizeof(news->pru0));
+	readStatus(&news->pru1, pru1Status, sizeof(news->pru1));
+
+	news->tracks	= news->pru0.trackSeq - seenTrackSeq;
+	news->steps		= news->pru0.stepSeq - seenStepSeq;
+	news->sectors	= news->pru1.sectorSeq - seenSectorSeq;
+	news->writes	= news->pru1.writeSeq - seenWriteSeq;
+	seenTrackSeq	= news->pru0.trackSeq;
+	seenStepSeq		= news->pru0.stepSeq;
+	seenSectorSeq	= news->pru1.sectorSeq;
+	seenWriteSeq	= news->pru1.writeSeq;
+
+	stats.polls++;
+	stats.trackChanges += news->tracks;
+	stats.sectors += news->sectors;
+	stats.writes += news->writes;
+	if (news->tracks > 1)
+		stats.missedTracks += news->tracks - 1;
+	if (news->sectors > 1 && !streamOn)
+		stats.missedSectors += news->sectors - 1;
+}
+
+//____________________
+void mailboxRelease(void)
+{
+	// Lets PRU1 send one more sector after the last it sent; doing it twice does nothing more
+	Pru1Status pru1;
+
+	readStatus(&pru1, pru1Status, sizeof(pru1));
+	pru1Command->releaseSeq = pru1.sectorSeq + 1;
+}
+
+//____________________
+void mailboxStream(unsigned char on)
+{
+	streamOn = on;
+	pru1Command->stream = on;
+}
+
+//____________________
+void mailboxSelect(unsigned char drive, unsigned char buffer)
+{
+	pru1Command->bufSel[drive] = buffer;
+}
+
+//____________________
+unsigned char mailboxSelected(unsigned char drive)
+{
+	return pru1Command->bufSel[drive] % TRACK_BUFS;
+}
+
+//____________________
+int mailboxSending(unsigned char *drive)
+{
+	/*	Track buffer PRU1 is sending now and the drive it is for, fresh rather
+		than as of the last poll; -1 if the A2 has no drive enabled
+	*/
+	Pru1Status pru1;
+
+	readStatus(&pru1, pru1Status, sizeof(pru1));
+	*drive = pru1.drive & 1;
+	return pru1.enable ? -1 : pru1.buffer % TRACK_BUFS;
+}
+
+//____________________
+int mailboxWriteSlot(uint32_t writeSeq, WriteSlot *slot)
+{
+	/*	Copies the slot of write writeSeq, one mailboxPoll() has reported
+		Returns 0, or 1 if WRITE_SLOTS later writes have taken its slot since
+	*/
+	__sync_synchronize();					// after the poll's read of writeSeq
+	copyWords(slot, &writeSlots[writeSeq % WRITE_SLOTS], sizeof(*slot));
+	__sync_synchronize();
+	if (slot->writeSeq == writeSeq && writeSlots[writeSeq % WRITE_SLOTS].writeSeq == writeSeq)
+		return 0;
+
+	stats.missedWrites++;
+	return 1;
+}
+
+//____________________
+int mailboxEdgesStill(uint32_t edgeStart)
+{
+	/*	After copying edges that began at edgeStart: 1 if PRU1 has not come
+		round the ring to them yet, else 0 and the write counts as missed
+		The edge at edgeTotal may already be in, so it counts as taken
+	*/
+	__sync_synchronize();
+	if (pru1Status->edgeTotal - edgeStart < EDGE_RING_SIZE)
+		return 1;
+
+	stats.missedWrites++;
+	return 0;
+}
+
+//____________________
+void mailboxGetStats(MailboxStats *out)
+{
+	*out = stats;
+}
+
+//____________________
+void mailboxPrintStats(void)
+{
+	printf("Mailbox: %llu polls, %llu track changes, %llu sectors, %llu writes", stats.polls,
+		stats.trackChanges, stats.sectors, stats.writes);
+	if (stats.missedTracks || stats.missedSectors || stats.missedWrites)
+		printf(", missed %llu tracks %llu sectors %llu writes", stats.missedTracks, stats.missedSectors, stats.missedWrites);
+	if (stats.retries)
+		printf(", %llu retries", stats.retries);
+	printf("\n");
+}
+
+//____________________
+void mailboxSetTrack(unsigned char *pru, unsigned char drive, unsigned char track)
+{
+	/*	PRU0 stand-in: the A2 moved the head of drive, two half tracks a track
+		Steps are stamped from the clock, in IEP counts as Sim stamps traces
+	*/
+	volatile Pru0Status *status = mailboxPru0(pru);
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	beginUpdate(&status->seq);
+	status->direction[drive] = track * 2 > status->halfTrack[drive] ? 1 : -1;
+	status->halfTrack[drive] = track * 2;
+	status->stepStamp[drive] = (ts.tv_sec * 1000000000ULL + ts.tv_nsec) / (1000000000 / TRACE_HZ);
+	status->stepSeq++;
+	status->track[drive] = track;
+	status->drive = drive;
+	status->trackSeq++;
+	endUpdate(&status->seq);
+}
+
+//____________________
+void mailboxSetStep(unsigned char *pru, unsigned char drive, unsigned char halfTrack)
+{
+	/*	PRU0 stand-in: one half track step of drive's head, to halfTrack
+		Its track moves on only when that becomes halfTrack / 2, as on PRU0
+	*/
+	volatile Pru0Status *status = mailboxPru0(pru);
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	beginUpdate(&status->seq);
+	status->direction[drive] = halfTrack > status->halfTrack[drive] ? 1 : -1;
+	status->halfTrack[drive] = halfTrack;
+	status->stepStamp[drive] = (ts.tv_sec * 1000000000ULL + ts.tv_nsec) / (1000000000 / TRACE_HZ);
+	status->stepSeq++;
+	if (status->track[drive] != halfTrack >> 1)
+	{
+		status->track[drive] = halfTrack >> 1;
+		status->drive = drive;
+		status->trackSeq++;
+	}
+	endUpdate(&status->seq);
+}
+
+//____________________
+void mailboxSetEnable(unsigned char *pru, unsigned char enable)
+{
+	// PRU1 stand-in: 0 = a drive enabled; also finishes an update a killed stand-in left open
+	volatile Pru1Status *status = mailboxPru1(pru);
+
+	if (status->seq & 1)
+		status->seq++;
+	beginUpdate(&status->seq);
+	status->enable = enable;
+	endUpdate(&status->seq);
+
+	if (mailboxPru0(pru)->seq & 1)
+		mailboxPru0(pru)->seq++;
+}
+
+//____________________
+void mailboxSentSector(unsigned char *pru, unsigned char drive, unsigned char sector, unsigned char buffer)
+{
+	// PRU1 stand-in: sector went out of buffer for drive
+	volatile Pru1Status *status = mailboxPru1(pru);
+
+	beginUpdate(&status->seq);
+	status->sector = sector;
+	status->buffer = buffer;
+	status->drive = drive;
+	status->sectorSeq++;
+	endUpdate(&status->seq);
+}
+
+//____________________
+void mailboxInjectWrite(unsigned char *pru, unsigned char drive, const unsigned char *nibble, unsigned char sector)
+{
+	// PRU1 stand-in: the A2 rewrote the data field of nibble, an encoded sector, while sector of drive went out
+	volatile Pru1Status *status = mailboxPru1(pru);
+	static unsigned int ringPos;				// PRU1 keeps its own, so does the stand-in
+	volatile WriteSlot *slot;
+	unsigned int count, position;
+	uint32_t start;
+
+	start = status->edgeTotal;
+	position = ringPos;
+	count = edgeInject(pru + PRU1_DRAM, nibble, &ringPos);
+	__sync_synchronize();
+	status->edgeTotal = start + count;
+
+	slot = &mailboxSlots(pru)[(status->writeSeq + 1) % WRITE_SLOTS];
+	slot->writeSeq = status->writeSeq + 1;
+	slot->edgeStart = start;
+	slot->edgeCount = count;
+	slot->ringStart = position;
+	slot->track = mailboxPru0(pru)->track[drive];
+	slot->sector = sector;
+	slot->drive = drive;
+
+	beginUpdate(&status->seq);
+	status->writeSeq++;
+	endUpdate(&status->seq);
+}
+
+//____________________
+int mailboxReleased(unsigned char *pru)
+{
+	// PRU1 stand-in: 1 if Controller lets the next sector go
+	volatile Pru1Status *status = mailboxPru1(pru);
+	volatile Pru1Command *command = mailboxCommand(pru);
+
+	return command->stream == 1 || (int32_t) (command->releaseSeq - status->sectorSeq) > 0;
+}
+
+//____________________
+Pru0Status *mailboxPru0(unsigned char *pru)
+{
+	return (Pru0Status *) (pru + PRU0_STATUS_ADR);
+}
+
+//____________________
+Pru1Status *mailboxPru1(unsigned char *pru)
+{
+	return (Pru1Status *) (pru + PRU1_DRAM + PRU1_STATUS_ADR);
+}
+
+//____________________
+Pru1Command *mailboxCommand(unsigned char *pru)
+{
+	return (Pru1Command *) (pru + PRU1_DRAM + PRU1_COMMAND_ADR);
+}
+
+//____________________
+WriteSlot *mailboxSlots(unsigned char *pru)
+{
+	return (WriteSlot *) (pru + PRU1_DRAM + WRITE_SLOT_ADR);
+}
+
+//____________________
+static void readStatus(void *copy, const volatile void *status, size_t size)
+{
+	// Copies a status block whose first word is its seq, again until no update overlapped it
+	const volatile uint32_t *seq = (const volatile uint32_t *) status;
+	unsigned int tries;
+	uint32_t before;
+
+	for (tries=0; tries<MAX_RETRIES; tries++)
+	{
+		before = *seq;
+		__sync_synchronize();
+		if ((before & 1) == 0)
+		{
+			copyWords(copy, status, size);
+			__sync_synchronize();
+			if (*seq == before)
+				return;
+		}
+		stats.retries++;
+	}
+	copyWords(copy, status, size);
+}
+
+//____________________
+static void copyWords(void *copy, const volatile void *from, size_t size)
+{
+	/*	Copies a block of PRU memory a 32 bit word at a time and in order, where
+		memcpy() on a cast-away-volatile pointer may be merged, widened or moved
+		past the seq reads either side; size is a multiple of 4, as the status
+		blocks and WriteSlot are
+	*/
+	const volatile uint32_t *in = (const volatile uint32_t *) from;
+	uint32_t *out = (uint32_t *) copy;
+	size_t i;
+
+	for (i=0; i<size/4; i++)
+		out[i] = in[i];
+}
+
+//____________________
+static void beginUpdate(volatile uint32_t *seq)
+{
+	(*seq)++;								// odd, readers wait
+	__sync_synchronize();
+}
+
+//____________________
+static void endUpdate(volatile uint32_t *seq)
+{
+	__sync_synchronize();
+	(*seq)++;								// even, fields are consistent again
+}
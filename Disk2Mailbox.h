@@ -0,0 +1,120 @@
+/*	Disk2Mailbox.h
+	Controller <-> PRU state, as sequence counters in seqlocked status blocks
+	Each PRU is the only writer of its status block: it makes seq odd, updates
+	the fields, makes seq even again, so a copy taken between two reads of the
+	same even seq is consistent. Events are counted, not flagged: Controller
+	keeps the counters it saw last, so nothing has to be cleared, a sector or
+	track that comes round again still counts, and a jump of more than one
+	says how many it missed
+	Controller -> PRU1 is a command block Controller alone writes; PRU1 sends
+	while sectorSeq is behind releaseSeq, so the per-sector handshake is one
+	store of sectorSeq + 1 and repeating it is harmless
+	Each write PRU1 captures gets a WriteSlot, slot writeSeq % WRITE_SLOTS,
+	stamped with the track PRU0 had and the sector PRU1 was sending; its
+	edges stay in the edge ring till PRU1 comes round to them again, so
+	back-to-back writes are drained in a batch while PRU1 carries on
+	PRU0 also publishes every half track step, with its direction and the IEP
+	count of the phase edge that made it, so Controller can act on a seek
+	before the head has settled, or even reached the next track
+	Two drives: PRU0 keeps a head position for each, PRU1 sends for the one
+	EN1- or EN2- enables from the buffer bufSel[drive], so switching drives
+	needs nothing from Controller; drives are 0 and 1
+	Layouts are naturally aligned, so PRU and ARM compilers agree on them;
+	Disk2Pru0.c and Disk2Pru1.c carry copies
+*/
+#ifndef _DISK2MAILBOX_H_
+#define _DISK2MAILBOX_H_
+
+#include <stdint.h>
+
+typedef struct
+{
+	uint32_t seq;						// odd while PRU0 is updating
+	uint32_t trackSeq;					// track changes so far, either drive
+	uint8_t track[2];					// track commanded by A2, per drive
+	uint8_t drive;						// drive last enabled
+	uint8_t unused;
+	uint8_t halfTrack[2];				// head position, 0 to 69, per drive
+	int8_t direction[2];				// of the last step, 1 = in, -1 = out, 0 = none yet
+	uint32_t stepSeq;					// half track steps so far, either drive
+	uint32_t stepStamp[2];				// IEP count of the phase edge of the last step
+} Pru0Status;
+
+typedef struct
+{
+	uint32_t seq;						// odd while PRU1 is updating
+	uint32_t sectorSeq;					// sectors sent so far
+	uint32_t writeSeq;					// writes captured so far, the last one's slot is complete
+	uint32_t edgeTotal;					// edges logged so far, moves on every edge outside the seqlock
+	uint8_t sector;						// last sector sent
+	uint8_t enable;						// 0 = A2 has a drive enabled
+	uint8_t buffer;						// track buffer being sent, 0 to TRACK_BUFS - 1
+	uint8_t drive;						// drive it is sent for, with buffer at the sector boundary
+} Pru1Status;
+
+typedef struct
+{
+	uint32_t writeSeq;					// which write this slot holds now
+	uint32_t edgeStart;					// edgeTotal when it began
+	uint16_t edgeCount;					// stops at 0xFFFF
+	uint16_t ringStart;					// edge ring byte of its first edge
+	uint8_t track;						// PRU0's track for drive
+	uint8_t sector;						// sector PRU1 was sending
+	uint8_t drive;						// drive written to
+	uint8_t unused;
+} WriteSlot;
+
+typedef struct
+{
+	uint32_t releaseSeq;				// PRU1 may send while sectorSeq is behind this
+	uint8_t bufSel[2];					// per drive, track buffer PRU1 should send, picked up at sector boundary
+	uint8_t stream;						// 1 = PRU1 rotates without releaseSeq
+	uint8_t unused;
+} Pru1Command;
+
+typedef struct
+{
+	Pru0Status pru0;					// consistent copies, taken by mailboxPoll()
+	Pru1Status pru1;
+	unsigned int tracks;				// counters moved on since the last mailboxPoll()
+	unsigned int steps;
+	unsigned int sectors;
+	unsigned int writes;
+} MailboxNews;
+
+typedef struct
+{
+	unsigned long long polls;
+	unsigned long long trackChanges, sectors, writes;
+	unsigned long long missedTracks;	// head positions that came and went between polls
+	unsigned long long missedSectors;	// handshake only, sectors sent past a release
+	unsigned long long missedWrites;	// slots or edges reused before Controller got to them
+	unsigned long long retries;			// status copies taken again, PRU was mid-update
+} MailboxStats;
+
+// Controller
+void mailboxInit(unsigned char *pru);
+void mailboxPoll(MailboxNews *news);
+void mailboxRelease(void);
+void mailboxStream(unsigned char on);
+void mailboxSelect(unsigned char drive, unsigned char buffer);
+unsigned char mailboxSelected(unsigned char drive);
+int mailboxSending(unsigned char *drive);
+int mailboxWriteSlot(uint32_t writeSeq, WriteSlot *slot);
+int mailboxEdgesStill(uint32_t edgeStart);
+void mailboxGetStats(MailboxStats *stats);
+void mailboxPrintStats(void);
+
+// PRU stand-ins, Sim and Bench
+void mailboxSetTrack(unsigned char *pru, unsigned char drive, unsigned char track);
+void mailboxSetStep(unsigned char *pru, unsigned char drive, unsigned char halfTrack);
+void mailboxSetEnable(unsigned char *pru, unsigned char enable);
+void mailboxSentSector(unsigned char *pru, unsigned char drive, unsigned char sector, unsigned char buffer);
+void mailboxInjectWrite(unsigned char *pru, unsigned char drive, const unsigned char *nibble, unsigned char sector);
+int mailboxReleased(unsigned char *pru);
+Pru0Status *mailboxPru0(unsigned char *pru);
+Pru1Status *mailboxPru1(unsigned char *pru);
+Pru1Command *mailboxCommand(unsigned char *pru);
+WriteSlot *mailboxSlots(unsigned char *pru);
+
+#endif /* _DISK2MAILBOX_H_ */
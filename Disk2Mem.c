@@ -0,0 +1,86 @@
+/*	Disk2Mem.c
+	Maps PRU memory for Controller and host-side tools
+	Real PRUs live at PRU_ADDR in /dev/mem; anything else is a stand-in
+	with the same layout, driven by Sim or Bench instead of PRU0/PRU1
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Disk2Mem.h"
+
+//____________________
+int pruMemOpen(PruMem *mem, const char *backing)
+{
+	/*	Returns 0 on success
+		Stand-in backings are created and sized as needed
+	*/
+	struct stat st;
+	off_t offset;
+	int fd;
+
+	mem->base = NULL;
+	mem->fd = -1;
+
+	if (backing == NULL || strcmp(backing, PRU_MEM_DEVMEM) == 0)
+	{
+		fd = open(PRU_MEM_DEVMEM, O_RDWR | O_SYNC);
+		offset = PRU_ADDR;
+	}
+	else if (strcmp(backing, PRU_MEM_ANON) == 0)
+	{
+		fd = memfd_create("disk2pru", 0);		// no CLOEXEC, children may map it too
+		offset = 0;
+	}
+	else
+	{
+		fd = open(backing, O_RDWR | O_CREAT, 0644);
+		offset = 0;
+	}
+
+	if (fd == -1)
+	{
+		printf("*** ERROR: could not open %s.\n", backing ? backing : PRU_MEM_DEVMEM);
+		return 1;
+	}
+
+	if (offset == 0)
+	{
+		if (fstat(fd, &st) == -1 || (st.st_size < PRU_LEN && ftruncate(fd, PRU_LEN) == -1))
+		{
+			printf("*** ERROR: could not size %s.\n", backing);
+			close(fd);
+			return 1;
+		}
+	}
+
+	mem->base = mmap(0, PRU_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+	if (mem->base == MAP_FAILED)
+	{
+		printf("*** ERROR: could not map memory.\n");
+		mem->base = NULL;
+		close(fd);
+		return 1;
+	}
+
+	if (backing != NULL && strcmp(backing, PRU_MEM_ANON) == 0)
+		mem->fd = fd;
+	else
+		close(fd);
+	return 0;
+}
+
+//____________________
+void pruMemClose(PruMem *mem)
+{
+	if (mem->base && munmap(mem->base, PRU_LEN))
+		printf("*** ERROR: munmap failed\n");
+	if (mem->fd != -1)
+		close(mem->fd);
+	mem->base = NULL;
+	mem->fd = -1;
+}
@@ -0,0 +1,59 @@
+/*	Disk2Mem.h
+	PRU memory layout shared by Controller and host-side tools
+	Backends that provide that memory:
+		/dev/mem		real PRUs, physical address PRU_ADDR
+		anon			anonymous memfd, inherited by child processes
+		<path>			file-backed shared mapping, e.g. /dev/shm/disk2.mem
+*/
+#ifndef _DISK2MEM_H_
+#define _DISK2MEM_H_
+
+#include <stddef.h>
+
+// PRU Memory Locations
+#define PRU_ADDR			0x4A300000		// Start of PRU memory Page 163 am335x TRM
+#define PRU_LEN				0x80000			// Length of PRU memory
+#define PRU1_DRAM			0x02000
+
+// First 0x200 bytes of both PRUs RAM are STACK & HEAP
+
+// PRU0 Memory Locations:
+#define PRU0_STATUS_ADR		0x0300		// Pru0Status, see Disk2Mailbox.h
+#define PRU0_TRACK_BUF_ADR	0x0400		// third track buffer, PRU1 sees it at 0x2400
+#define PRU0_TRACE_ADR		0x1B80		// TraceRing, see Disk2Trace.h
+
+// PRU1 Memory Locations:
+#define PRU1_STATUS_ADR		0x1B00		// Pru1Status, PRU1 -> Controller
+#define PRU1_COMMAND_ADR	0x1B20		// Pru1Command, Controller -> PRU1
+#define WRITE_SLOT_ADR		0x1B40		// WRITE_SLOTS WriteSlots of 16 bytes, one per captured write; 0x80 reserved to 0x1BC0, 8 slots
+#define WRITE_SLOTS			2			// writes Controller can fall behind by: data fields the edge ring holds
+#define PRU1_TRACE_ADR		0x1BC0		// TraceRing, up to the end of PRU1's RAM
+
+// WSIG edge ring: cycles since the edge before, in EDGE_UNIT_CYCLES, see Disk2Edge.h
+#define EDGE_RING_ADR		0x0400		// above PRU1's stack, heap and globals
+#define EDGE_RING_SIZE		5632		// bytes, all PRU1's RAM has free; a data field is about 2000 edges
+#define EDGE_UNIT_SHIFT		4			// 16 cycles a unit, 255 = 5 bit cells or more
+
+// Track buffers: one holds each drive's track, the third is spare for staging,
+// so PRU1 sends one while Controller stages another
+// 0 and 1 in shared RAM, same offset from the start of PRU memory and in PRU1's
+// local address space; 2 in PRU0 data RAM
+// 16 packets of up to 374 bytes each ended by 0x00; an empty packet ends the track
+#define PRU_SHAREDMEM		0x10000		// Offset to shared memory
+#define TRACK_BUF_SIZE		5984		// 16 * 374
+#define TRACK_BUFS			3
+#define TRACK_BUF_ADR(n)	((n) == 2 ? PRU0_TRACK_BUF_ADR : PRU_SHAREDMEM + (n) * TRACK_BUF_SIZE)
+
+#define PRU_MEM_DEVMEM		"/dev/mem"
+#define PRU_MEM_ANON		"anon"
+
+typedef struct
+{
+	unsigned char *base;		// start of PRU memory (PRU0 data RAM)
+	int fd;						// memfd kept open for anon backing, else -1
+} PruMem;
+
+int pruMemOpen(PruMem *mem, const char *backing);
+void pruMemClose(PruMem *mem);
+
+#endif /* _DISK2MEM_H_ */
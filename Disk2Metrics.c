@@ -0,0 +1,443 @@
+/*	Disk2Metrics.c
+	Latency histograms and counter dumps, see Disk2Metrics.h
+	Dump targets:
+		<path>			SIGUSR1 (metricsRequest()) and exit write the file, through
+						<path>.tmp and a rename so a reader never sees half of one
+		unix:<path>		listening socket, every connection gets one dump, then EOF
+	Both are served from the main loop by metricsPoll(), which runs at least
+	every EVENT_TIMEOUT_MS, so a dump never holds up a PRU; a socket reader
+	slower than that has the rest of its dump sent on later polls
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "Disk2Metrics.h"
+#include "Disk2Mailbox.h"
+#include "Disk2Cache.h"
+#include "Disk2Upload.h"
+#include "Disk2Edge.h"
+#include "Disk2Journal.h"
+#include "Disk2TrackFile.h"
+#include "Disk2Prefetch.h"
+#include "Disk2Loader.h"
+
+#define SUB_BITS		5					// 32 exact values, then 16 buckets per power of 2
+#define SUB_HALF		(1 << (SUB_BITS - 1))
+#define NUM_BUCKETS		((64 - SUB_BITS) * SUB_HALF + 2 * SUB_HALF)
+#define SOCKET_PREFIX	"unix:"
+#define METRICS_CLIENTS	4					// socket readers part way through a dump
+
+typedef struct
+{
+	unsigned long long count, sum, min, max;
+	unsigned long long buckets[NUM_BUCKETS];
+} Histogram;
+
+typedef struct
+{
+	int fd;									// -1 = free
+	char *text;								// the dump, taken when it connected
+	size_t size, done;
+} Client;
+
+static const char *metricNames[NUM_METRICS] =
+{
+	"trackLoadNs", "trackUploadNs", "trackEncodeNs", "sectorHandoffNs", "sectorIntervalNs",
+	"writeCommitNs", "loadIoNs", "loadEncodeNs", "loadUploadNs", "wakeupsPerS",
+	"mountLoadNs", "mountFirstSectorNs"
+};
+
+static Histogram histograms[NUM_METRICS];
+static unsigned long long startNs;
+static unsigned long long secondNs;			// start of the second wakeups are counted in
+static unsigned long long wakeups;			// so far in it
+static char dumpPath[256];					// file, or socket path
+static int listenFd = -1;					// unix: target
+static Client clients[METRICS_CLIENTS];
+static volatile sig_atomic_t requested;
+
+static unsigned int bucketOf(unsigned long long value);
+static unsigned long long bucketLow(unsigned int bucket);
+static unsigned long long percentile(const Histogram *h, double fraction);
+static int dumpFile(const PruEvents *events);
+static int dumpText(const PruEvents *events, char **text, size_t *size);
+static int sendMore(Client *client);
+
+//____________________
+int metricsOpen(const char *spec)
+{
+	/*	Starts the clock and sets where dumps go, spec NULL for nowhere
+		Returns 0, or 1 if the socket cannot be set up
+	*/
+	struct sockaddr_un addr;
+
+	unsigned int i;
+
+	memset(histograms, 0, sizeof(histograms));
+	for (i=0; i<METRICS_CLIENTS; i++)
+		clients[i].fd = -1;
+	startNs = secondNs = metricsNowNs();
+	wakeups = 0;
+	dumpPath[0] = '\0';
+	if (spec == NULL)
+		return 0;
+
+	if (strncmp(spec, SOCKET_PREFIX, strlen(SOCKET_PREFIX)) != 0)
+	{
+		snprintf(dumpPath, sizeof(dumpPath), "%s", spec);
+		return 0;
+	}
+
+	snprintf(dumpPath, sizeof(dumpPath), "%s", spec + strlen(SOCKET_PREFIX));
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(dumpPath) >= sizeof(addr.sun_path))
+	{
+		printf("*** ERROR: metrics socket path too long: %s\n", dumpPath);
+		return 1;
+	}
+	strcpy(addr.sun_path, dumpPath);
+	unlink(dumpPath);						// left by a Controller that did not exit cleanly
+
+	listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listenFd == -1 || bind(listenFd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(listenFd, 4) == -1)
+	{
+		perror("*** ERROR: metrics socket");
+		if (listenFd != -1)
+			close(listenFd);
+		listenFd = -1;
+		return 1;
+	}
+	return 0;
+}
+
+//____________________
+void metricsClose(const PruEvents *events)
+{
+	// Last dump to a file target; a socket target goes away, with dumps not yet sent
+	unsigned int i;
+
+	if (listenFd == -1 && dumpPath[0])
+		dumpFile(events);
+	if (listenFd != -1)
+	{
+		for (i=0; i<METRICS_CLIENTS; i++)
+		{
+			if (clients[i].fd != -1)
+			{
+				close(clients[i].fd);
+				free(clients[i].text);
+				clients[i].fd = -1;
+			}
+		}
+		close(listenFd);
+		unlink(dumpPath);
+		listenFd = -1;
+	}
+	dumpPath[0] = '\0';
+}
+
+//____________________
+unsigned long long metricsNowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//____________________
+void metricsRecord(unsigned int metric, unsigned long long value)
+{
+	Histogram *h = &histograms[metric];
+
+	if (h->count == 0 || value < h->min)
+		h->min = value;
+	if (value > h->max)
+		h->max = value;
+	h->count++;
+	h->sum += value;
+	h->buckets[bucketOf(value)]++;
+}
+
+//____________________
+void metricsSince(unsigned int metric, unsigned long long start)
+{
+	metricsRecord(metric, metricsNowNs() - start);
+}
+
+//____________________
+void metricsWakeup(void)
+{
+	// One main loop wakeup; a second's count goes in once the second is over
+	unsigned long long now;
+
+	now = metricsNowNs();
+	while (now - secondNs >= 1000000000ULL)
+	{
+		metricsRecord(METRIC_WAKEUPS, wakeups);
+		wakeups = 0;
+		secondNs += 1000000000ULL;
+	}
+	wakeups++;
+}
+
+//____________________
+void metricsRequest(void)
+{
+	// Safe in a signal handler, metricsPoll() does the dump
+	requested = 1;
+}
+
+//____________________
+void metricsPoll(const PruEvents *events)
+{
+	/*	Dumps asked for since the last call, and the rest of those a socket
+		reader has not taken yet; nothing here waits on a reader
+	*/
+	Client client;
+	unsigned int i;
+
+	if (requested && listenFd == -1 && dumpPath[0])
+		dumpFile(events);
+	requested = 0;
+
+	if (listenFd == -1)
+		return;
+	for (i=0; i<METRICS_CLIENTS; i++)
+	{
+		if (clients[i].fd != -1 && sendMore(&clients[i]))
+		{
+			close(clients[i].fd);
+			free(clients[i].text);
+			clients[i].fd = -1;
+		}
+	}
+
+	while ((client.fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+	{
+		// A slot first, so a reader turned away gets EOF and not half a dump
+		for (i=0; i<METRICS_CLIENTS && clients[i].fd != -1; i++)
+			;
+		if (i == METRICS_CLIENTS)
+		{
+			printf("*** Metrics socket: %d readers waiting, dump dropped\n", METRICS_CLIENTS);
+			close(client.fd);
+			continue;
+		}
+		client.done = 0;
+		if (dumpText(events, &client.text, &client.size))
+		{
+			close(client.fd);
+			continue;
+		}
+		if (sendMore(&client) == 0)
+		{
+			clients[i] = client;
+			continue;
+		}
+		close(client.fd);
+		free(client.text);
+	}
+}
+
+//____________________
+int metricsDump(int fd, const PruEvents *events)
+{
+	// JSON object of all counters and histograms to fd, returns 0 if it all went
+	char *text;
+	size_t size, done;
+	ssize_t n;
+
+	if (dumpText(events, &text, &size))
+		return 1;
+	for (done=0; done<size; done+=n)
+	{
+		n = write(fd, text + done, size - done);
+		if (n <= 0)
+			break;
+	}
+	free(text);
+	return done < size;
+}
+
+//____________________
+static int dumpText(const PruEvents *events, char **text, size_t *size)
+{
+	// The JSON object in memory, for the caller to free; returns 0, 1 if out of memory
+	FILE *out;
+
+	out = open_memstream(text, size);
+	if (!out)
+		return 1;
+	metricsWrite(out, events);
+	fclose(out);
+	return 0;
+}
+
+//____________________
+static int sendMore(Client *client)
+{
+	/*	As much of client's dump as its socket takes without waiting
+		Returns 0 while some is left, 1 once it is all sent or the reader has gone
+	*/
+	ssize_t n;
+
+	while (client->done < client->size)
+	{
+		n = send(client->fd, client->text + client->done, client->size - client->done, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (n <= 0)
+			return 1;
+		client->done += n;
+	}
+	return 1;
+}
+
+//____________________
+static int dumpFile(const PruEvents *events)
+{
+	char tmpPath[sizeof(dumpPath) + 8];
+	int fd, result;
+
+	snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", dumpPath);
+	fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+	{
+		printf("*** Cannot write metrics to %s\n", tmpPath);
+		return 1;
+	}
+	result = metricsDump(fd, events);
+	close(fd);
+	if (result == 0 && rename(tmpPath, dumpPath) == 0)
+		return 0;
+	printf("*** Cannot write metrics to %s\n", dumpPath);
+	unlink(tmpPath);
+	return 1;
+}
+
+//____________________
+void metricsWrite(FILE *out, const PruEvents *events)
+{
+	// All counters and histograms as one JSON object, and a newline
+	MailboxStats mailbox;
+	CacheStats cache;
+	UploadStats upload;
+	EdgeStats edge;
+	JournalStats journal;
+	TrackFileStats trackFile;
+	PrefetchStats prefetch;
+	LoaderStats loader;
+	const Histogram *h;
+	unsigned int i, b, listed;
+
+	mailboxGetStats(&mailbox);
+	cacheGetStats(&cache);
+	uploadGetStats(&upload);
+	edgeGetStats(&edge);
+	journalGetStats(&journal);
+	trackFileGetStats(&trackFile);
+	prefetchGetStats(&prefetch);
+	loaderGetStats(&loader);
+
+	fprintf(out, "{\"uptimeS\": %.3f, \"counters\": {", (metricsNowNs() - startNs) / 1e9);
+	fprintf(out, "\"events.wakeups\": %llu, \"events.timeouts\": %llu, ", events->wakeups, events->timeouts);
+	fprintf(out, "\"mailbox.polls\": %llu, \"mailbox.trackChanges\": %llu, \"mailbox.sectors\": %llu, "
+		"\"mailbox.writes\": %llu, \"mailbox.missedTracks\": %llu, \"mailbox.missedSectors\": %llu, "
+		"\"mailbox.missedWrites\": %llu, \"mailbox.retries\": %llu, ", mailbox.polls, mailbox.trackChanges,
+		mailbox.sectors, mailbox.writes, mailbox.missedTracks, mailbox.missedSectors, mailbox.missedWrites,
+		mailbox.retries);
+	fprintf(out, "\"cache.hits\": %llu, \"cache.misses\": %llu, \"cache.evictions\": %llu, \"cache.bytes\": %zu, "
+		"\"cache.budget\": %zu, \"cache.entries\": %u, ", cache.hits, cache.misses, cache.evictions, cache.bytes,
+		cache.budget, cache.entries);
+	fprintf(out, "\"upload.tracks\": %llu, \"upload.bytes\": %llu, \"upload.skipped\": %llu, "
+		"\"upload.patchBytes\": %llu, ", upload.uploads, upload.bytes, upload.skipped, upload.patchBytes);
+	fprintf(out, "\"prefetch.steps\": %llu, \"prefetch.tracks\": %llu, \"prefetch.hits\": %llu, "
+		"\"prefetch.misses\": %llu, \"prefetch.wasted\": %llu, \"prefetch.warmed\": %llu, \"prefetch.noSpare\": %llu, "
+		"\"prefetch.ns\": %llu, \"prefetch.wastedNs\": %llu, ", prefetch.steps, prefetch.prefetches, prefetch.hits,
+		prefetch.misses, prefetch.wasted, prefetch.warmed, prefetch.noSpare, prefetch.ns, prefetch.wastedNs);
+	fprintf(out, "\"loader.requested\": %llu, \"loader.loaded\": %llu, \"loader.failed\": %llu, "
+		"\"loader.replaced\": %llu, \"loader.refused\": %llu, \"loader.maxNs\": %llu, ", loader.requested,
+		loader.loaded, loader.failed, loader.replaced, loader.refused, loader.maxNs);
+	fprintf(out, "\"edges.writes\": %llu, \"edges.edges\": %llu, \"edges.notFramed\": %llu, "
+		"\"edges.overflows\": %llu, ", edge.writes, edge.edges, edge.notFramed, edge.overflows);
+	fprintf(out, "\"journal.queued\": %llu, \"journal.dropped\": %llu, \"journal.writeErrors\": %llu, "
+		"\"journal.written\": %llu, \"journal.batches\": %llu, \"journal.fsyncs\": %llu, \"journal.ioErrors\": %llu, "
+		"\"journal.pending\": %u, ", journal.queued, journal.dropped, journal.writeErrors, journal.written,
+		journal.batches, journal.fsyncs, journal.ioErrors, journal.pending);
+	fprintf(out, "\"trackFile.hits\": %llu, \"trackFile.misses\": %llu, \"trackFile.stale\": %llu, "
+		"\"trackFile.saved\": %llu, \"trackFile.pruned\": %llu}, ", trackFile.hits, trackFile.misses, trackFile.stale,
+		trackFile.saved, trackFile.pruned);
+
+	fprintf(out, "\"histograms\": {");
+	for (i=0; i<NUM_METRICS; i++)
+	{
+		h = &histograms[i];
+		fprintf(out, "%s\"%s\": {\"count\": %llu, \"min\": %llu, \"max\": %llu, \"mean\": %llu, "
+			"\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"buckets\": [", i ? ", " : "",
+			metricNames[i], h->count, h->min, h->max, h->count ? h->sum / h->count : 0, percentile(h, 0.5),
+			percentile(h, 0.9), percentile(h, 0.99), percentile(h, 0.999));
+		listed = 0;
+		for (b=0; b<NUM_BUCKETS; b++)
+			if (h->buckets[b])
+				fprintf(out, "%s[%llu, %llu]", listed++ ? ", " : "", bucketLow(b), h->buckets[b]);
+		fprintf(out, "]}");
+	}
+	fprintf(out, "}}\n");
+}
+
+//____________________
+static unsigned int bucketOf(unsigned long long value)
+{
+	// Exact below 2 * SUB_HALF, then SUB_HALF buckets for each power of 2
+	unsigned int shift;
+
+	if (value < 2 * SUB_HALF)
+		return value;
+	shift = 63 - __builtin_clzll(value) - (SUB_BITS - 1);
+	return shift * SUB_HALF + (value >> shift);
+}
+
+//____________________
+static unsigned long long bucketLow(unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket < 2 * SUB_HALF)
+		return bucket;
+	shift = bucket / SUB_HALF - 1;
+	return (unsigned long long) (bucket % SUB_HALF + SUB_HALF) << shift;
+}
+
+//____________________
+static unsigned long long percentile(const Histogram *h, double fraction)
+{
+	// Highest value in the bucket the fraction falls in, but no more than max
+	unsigned long long seen, want, high;
+	unsigned int b;
+
+	if (h->count == 0)
+		return 0;
+	want = (unsigned long long) (fraction * h->count + 0.5);
+	if (want == 0)
+		want = 1;
+	seen = 0;
+	for (b=0; b<NUM_BUCKETS; b++)
+	{
+		seen += h->buckets[b];
+		if (seen >= want)
+			break;
+	}
+	high = b + 1 < NUM_BUCKETS ? bucketLow(b + 1) - 1 : h->max;
+	return high < h->max ? high : h->max;
+}
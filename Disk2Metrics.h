@@ -0,0 +1,45 @@
+/*	Disk2Metrics.h
+	Controller's always-on latency histograms and counters
+	Histograms are log-linear, HDR style: exact below 32, then 16 buckets per
+	power of 2, so any value is within 1/16 (6 %) of its bucket, in a fixed
+	table recording writes one count into; no allocation, no locks, main thread only
+	metricsDump() writes them with every module's counters as one JSON object:
+		{"uptimeS": .., "counters": {"mailbox.sectors": .., ..},
+		 "histograms": {"trackLoadNs": {"count": .., "min": .., "max": .., "mean": ..,
+			"p50": .., "p90": .., "p99": .., "p999": .., "buckets": [[low, count], ..]}, ..}}
+	Buckets listed are the ones with counts, low is the smallest value they hold
+*/
+#ifndef _DISK2METRICS_H_
+#define _DISK2METRICS_H_
+
+#include <stdio.h>
+
+#include "Disk2Event.h"
+
+// Histograms, ns unless named otherwise
+#define METRIC_TRACK_LOAD		0		// wakeup with a track change -> new track selected for PRU1
+#define METRIC_TRACK_UPLOAD		1		// uploadTrack() of one track
+#define METRIC_TRACK_ENCODE		2		// encoding one track when the A2 first asks for it
+#define METRIC_SECTOR_HANDOFF	3		// wakeup with a sector sent -> next one released
+#define METRIC_SECTOR_INTERVAL	4		// between wakeups that see sectors sent
+#define METRIC_WRITE_COMMIT		5		// wakeup with a write captured -> in the image and track buffer
+#define METRIC_LOAD_IO			6		// image load: map or read, track file, all but encoding
+#define METRIC_LOAD_ENCODE		7		// image load: encoding 35 tracks, track file miss only
+#define METRIC_LOAD_UPLOAD		8		// image load: track 0 to PRU1
+#define METRIC_WAKEUPS			9		// main loop wakeups in each second, a count
+#define METRIC_MOUNT_LOAD		10		// control socket mount -> image in the drive, track 0 staged
+#define METRIC_MOUNT_SECTOR		11		// control socket mount -> first sector of it sent
+#define NUM_METRICS				12
+
+int metricsOpen(const char *spec);
+void metricsClose(const PruEvents *events);
+unsigned long long metricsNowNs(void);
+void metricsRecord(unsigned int metric, unsigned long long value);
+void metricsSince(unsigned int metric, unsigned long long startNs);
+void metricsWakeup(void);
+void metricsRequest(void);
+void metricsPoll(const PruEvents *events);
+int metricsDump(int fd, const PruEvents *events);
+void metricsWrite(FILE *out, const PruEvents *events);
+
+#endif /* _DISK2METRICS_H_ */
@@ -0,0 +1,456 @@
+/*	Disk2Nib.c
+	.nib and .woz tracks into PRU1 track buffers, see Disk2Nib.h
+	The track's bits are framed the way the Disk II reads them (zeros, then
+	8 bits starting with a 1), so packets start and end on whole nibbles and
+	the zeros PRU1 adds between packets never break framing; packets end
+	inside a sync gap when one is close
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "Disk2Nib.h"
+#include "Disk2Gcr.h"
+
+#define NUM_TRACKS			35
+#define NUM_PACKETS			GCR_SECTORS_PER_TRACK
+#define PACKET_SIZE			GCR_NIBBLE_SIZE
+#define PACKET_BITS			((PACKET_SIZE - 1) * 8)		// last byte is the 0x00 end of packet
+#define MAX_NIBBLES			8192
+#define MAX_GAPS			128
+#define MIN_SYNC			3			// sync nibbles left in a trimmed gap, the stream never loses framing
+#define CUT_WINDOW			4			// nibbles a packet may give back to end in a gap
+
+#define WOZ_HEADER_SIZE		12
+#define WOZ1_TRK_SIZE		6656
+#define WOZ1_BIT_COUNT		6648		// offset of bit count in a WOZ1 TRK
+#define WOZ_BLOCK_SIZE		512
+#define WOZ_NO_TRACK		0xFF
+
+// Track being built, framed; one per nibTrack() call, so the loader and main threads can both build
+typedef struct
+{
+	unsigned char value[MAX_NIBBLES];
+	unsigned char zeros[MAX_NIBBLES];		// leading zeros, longer runs read as noise anyway
+	unsigned char keep[MAX_NIBBLES];
+	unsigned int gapStart[MAX_GAPS];		// trimGaps()
+	unsigned int gapKept[MAX_GAPS];
+} NibFrame;
+
+static unsigned int frameBits(NibFrame *f, const unsigned char *bits, unsigned int bitCount);
+static unsigned int trimGaps(NibFrame *f, unsigned int n, unsigned int count);
+static unsigned int packTrack(NibFrame *f, unsigned char *track, unsigned int n);
+static void noiseTrack(unsigned char *track);
+static const unsigned char *wozChunk(const unsigned char *image, size_t size, const char *id, unsigned int *len);
+static const unsigned char *wozTrackBits(const unsigned char *image, size_t size, unsigned char trk, unsigned int *bitCount);
+static unsigned int le16(const unsigned char *p);
+static unsigned int le32(const unsigned char *p);
+
+//____________________
+int nibKind(const char *imagePath)
+{
+	// NIB_KIND_ of imagePath, 0 for a sector image
+	const char *ext;
+
+	ext = strrchr(imagePath, '.');
+	if (ext && strcmp(ext, ".nib") == 0)
+		return NIB_KIND_NIB;
+	if (ext && strcmp(ext, ".woz") == 0)
+		return NIB_KIND_WOZ;
+	return 0;
+}
+
+//____________________
+int nibCheck(const unsigned char *image, size_t size, unsigned char kind)
+{
+	// Returns 0 if nibTrack() can read the image
+	const unsigned char *info, *tmap;
+	unsigned int len;
+
+	if (kind == NIB_KIND_NIB)
+	{
+		if (size < NIB_IMAGE_SIZE)
+		{
+			printf("*** ERROR: .nib image is %zu bytes, expecting %d\n", size, NIB_IMAGE_SIZE);
+			return 1;
+		}
+		return 0;
+	}
+
+	if (size < WOZ_HEADER_SIZE || (memcmp(image, "WOZ1", 4) != 0 && memcmp(image, "WOZ2", 4) != 0) ||
+		memcmp(image + 4, "\xFF\x0A\x0D\x0A", 4) != 0)
+	{
+		printf("*** ERROR: not a WOZ image\n");
+		return 1;
+	}
+	info = wozChunk(image, size, "INFO", &len);
+	if (!info || len < 2 || info[1] != 1)
+	{
+		printf("*** ERROR: WOZ image is not a 5.25\" disk\n");
+		return 1;
+	}
+	tmap = wozChunk(image, size, "TMAP", &len);
+	if (!tmap || len < 160 || !wozChunk(image, size, "TRKS", &len))
+	{
+		printf("*** ERROR: WOZ image has no TMAP or TRKS\n");
+		return 1;
+	}
+	return 0;
+}
+
+//____________________
+unsigned int nibTrack(unsigned char *track, const unsigned char *image, size_t size, unsigned char kind, unsigned char trk)
+{
+	/*	Builds track trk of a checked image into track, GCR_TRACK_SIZE bytes
+		Returns the number of sync nibbles trimmed to make it fit
+		Any thread, the frame is on the stack
+	*/
+	NibFrame frame;
+	const unsigned char *bits;
+	unsigned int bitCount, n, i, total, trimmed, over, dropped;
+
+	if (kind == NIB_KIND_NIB)
+	{
+		bits = image + trk * NIB_TRACK_SIZE;
+		bitCount = NIB_TRACK_SIZE * 8;
+	}
+	else
+		bits = wozTrackBits(image, size, trk, &bitCount);
+
+	if (!bits || bitCount < 8)
+	{
+		noiseTrack(track);					// unformatted, the A2 reads noise
+		return 0;
+	}
+
+	n = frameBits(&frame, bits, bitCount);
+	memset(frame.keep, 1, n);
+
+	// A sync nibble is 8 bits or more, so excess / 8 drops cover the excess; one more
+	// per packet covers padding and cuts, and what is still left over after packing
+	for (i=0, total=0; i<n; i++)
+		total += frame.zeros[i] + 8;
+	trimmed = 0;
+	if (total > NUM_PACKETS * PACKET_BITS)
+		trimmed = trimGaps(&frame, n, (total - NUM_PACKETS * PACKET_BITS) / 8 + NUM_PACKETS);
+	over = packTrack(&frame, track, n);
+	while (over)
+	{
+		dropped = trimGaps(&frame, n, over + 8);
+		if (dropped == 0)
+			break;
+		trimmed += dropped;
+		over = packTrack(&frame, track, n);
+	}
+
+	if (over)
+		printf("*** trk= %d: %u nibbles do not fit the track buffer\n", trk, over);
+	return trimmed;
+}
+
+//____________________
+int nibWriteData(unsigned char *track, unsigned char packet, const unsigned char *dataNibbles, unsigned int *length)
+{
+	/*	A2 wrote 343 data nibbles after packet was sent: puts them in the data field
+		after the last address field PRU1 had sent; fields may straddle packets
+		Returns the offset in track of the first nibble patched, -1 if none; length
+		covers everything to the last one, packet ends in between included
+		Only finds byte-aligned fields, which .nib tracks always are
+	*/
+	unsigned short at[4 * PACKET_SIZE];				// stream byte -> track offset
+	unsigned int first, p, i, n, sent, addr, data;
+	const unsigned char *q;
+
+	if (packet >= NUM_PACKETS)
+		return -1;
+
+	// Packets before, this one and the two after, as one byte stream
+	first = packet ? packet - 1 : 0;
+	n = 0;
+	sent = 0;
+	for (p=first; p<first+4 && p<NUM_PACKETS; p++)
+	{
+		q = track + p * PACKET_SIZE;
+		for (i=0; i<PACKET_SIZE && q[i] != 0x00; i++)
+			at[n++] = p * PACKET_SIZE + i;
+		if (p == packet)
+			sent = n;
+	}
+
+	addr = n;
+	for (i=0; i+3<=sent; i++)
+	{
+		if (track[at[i]] == 0xD5 && track[at[i+1]] == 0xAA && track[at[i+2]] == 0x96)
+			addr = i + 3;
+	}
+	for (data=addr; data+3<=n; data++)
+	{
+		if (track[at[data]] == 0xD5 && track[at[data+1]] == 0xAA && track[at[data+2]] == 0xAD)
+			break;
+	}
+	data += 3;
+	if (data + 343 > n)
+		return -1;
+
+	for (i=0; i<343; i++)
+		track[at[data + i]] = dataNibbles[i];
+	*length = at[data + 342] + 1 - at[data];
+	return at[data];
+}
+
+//____________________
+static unsigned int frameBits(NibFrame *f, const unsigned char *bits, unsigned int bitCount)
+{
+	// Splits bits (msb first) into nibbles with their leading zeros, returns how many
+	unsigned int n, pos, zeros, window;
+
+	n = 0;
+	pos = 0;
+	while (n < MAX_NIBBLES)
+	{
+		zeros = 0;
+		while (pos < bitCount && (bits[pos >> 3] & (0x80 >> (pos & 7))) == 0)
+		{
+			zeros++;
+			pos++;
+		}
+		if (pos + 8 > bitCount)
+			break;
+
+		// 8 bits from pos, the next byte only when pos is not on a byte
+		window = bits[pos >> 3] << 8;
+		if (pos & 7)
+			window |= bits[(pos >> 3) + 1];
+		f->value[n] = window >> (8 - (pos & 7));
+		f->zeros[n] = zeros > 0xFF ? 0xFF : zeros;
+		pos += 8;
+		n++;
+	}
+	return n;
+}
+
+//____________________
+static unsigned int trimGaps(NibFrame *f, unsigned int n, unsigned int count)
+{
+	/*	Drops up to count more sync nibbles, always from the longest gap, never
+		leaving a gap shorter than MIN_SYNC. Returns the number dropped
+		A gap is a run of 0xFF ending in D5, the reserved first nibble of a
+		prologue; 0xFF runs inside a data field are data and stay
+	*/
+	unsigned int gaps, g, i, j, level, excess, keep, dropped;
+
+	gaps = 0;
+	for (i=0; i<n && gaps<MAX_GAPS; i=j)
+	{
+		if (f->value[i] != 0xFF)
+		{
+			j = i + 1;
+			continue;
+		}
+		f->gapStart[gaps] = i;
+		f->gapKept[gaps] = 0;
+		for (j=i; j<n && f->value[j] == 0xFF; j++)
+			f->gapKept[gaps] += f->keep[j];
+		if (j < n && f->value[j] == 0xD5)
+			gaps++;
+	}
+
+	// Lowest level, not under MIN_SYNC, that cutting every gap down to costs no more than count
+	level = MIN_SYNC;
+	for (g=0; g<gaps; g++)
+	{
+		if (f->gapKept[g] > level)
+			level = f->gapKept[g];
+	}
+	while (level > MIN_SYNC)
+	{
+		excess = 0;
+		for (g=0; g<gaps; g++)
+		{
+			if (f->gapKept[g] >= level)
+				excess += f->gapKept[g] - (level - 1);
+		}
+		if (excess > count)
+			break;
+		level--;
+	}
+
+	// Down to level, then one more from gaps at level while count allows
+	dropped = 0;
+	for (g=0; g<gaps; g++)
+	{
+		keep = f->gapKept[g] < level ? f->gapKept[g] : level;
+		dropped += f->gapKept[g] - keep;
+		f->gapKept[g] = keep;
+	}
+	for (g=0; g<gaps && dropped<count && level>MIN_SYNC; g++)
+	{
+		if (f->gapKept[g] == level)
+		{
+			f->gapKept[g]--;
+			dropped++;
+		}
+	}
+
+	// Keep the first gapKept of each gap, the prologue keeps its own zeros
+	for (g=0; g<gaps; g++)
+	{
+		for (i=f->gapStart[g], j=0; i<n && f->value[i] == 0xFF; i++)
+		{
+			if (!f->keep[i])
+				continue;
+			if (j < f->gapKept[g])
+				j++;
+			else
+				f->keep[i] = 0;
+		}
+	}
+	return dropped;
+}
+
+//____________________
+static unsigned int packTrack(NibFrame *f, unsigned char *track, unsigned int n)
+{
+	/*	Packs kept nibbles into up to NUM_PACKETS packets, msb first, zero padded
+		Returns the number of nibbles left over, 0 if the whole track fit
+	*/
+	unsigned char *p;
+	unsigned int packet, i, cut, bits, k, b, pos;
+
+	memset(track, 0x00, GCR_TRACK_SIZE);
+
+	i = 0;
+	for (packet=0; packet<NUM_PACKETS; packet++)
+	{
+		while (i < n && !f->keep[i])
+			i++;
+		if (i == n)
+			break;						// rest of the packets stay empty, end of track
+
+		// Whole nibbles that fit, then back up to the last cut inside a gap
+		bits = 0;
+		cut = 0;
+		for (k=i; k<n; k++)
+		{
+			if (!f->keep[k])
+				continue;
+			if (bits + f->zeros[k] + 8 > PACKET_BITS)
+				break;
+			bits += f->zeros[k] + 8;
+			if (f->value[k] == 0xFF && k + 1 < n && f->value[k+1] == 0xFF)
+				cut = k + 1;
+		}
+		if (k < n && cut > i && k - cut < CUT_WINDOW)
+			k = cut;
+
+		// Pack i..k-1; a 0x00 byte would end the packet, eight zero cells read as noise anyway
+		p = track + packet * PACKET_SIZE;
+		pos = 0;
+		for (; i<k; i++)
+		{
+			if (!f->keep[i])
+				continue;
+			pos += f->zeros[i];
+			p[pos >> 3] |= f->value[i] >> (pos & 7);
+			if (pos & 7)
+				p[(pos >> 3) + 1] |= f->value[i] << (8 - (pos & 7));
+			pos += 8;
+		}
+		for (b=0; b<(pos + 7) >> 3; b++)
+		{
+			if (p[b] == 0x00)
+				p[b] = 0x01;
+		}
+	}
+
+	for (k=0; i<n; i++)
+		k += f->keep[i];
+	return k;
+}
+
+//____________________
+static void noiseTrack(unsigned char *track)
+{
+	// No flux: full packets of pseudo-random bits
+	unsigned int packet, i, seed;
+
+	seed = 0x1234567;
+	for (packet=0; packet<NUM_PACKETS; packet++)
+	{
+		for (i=0; i<PACKET_SIZE-1; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			track[packet * PACKET_SIZE + i] = (seed >> 16) | 0x01;
+		}
+		track[packet * PACKET_SIZE + i] = 0x00;
+	}
+}
+
+//____________________
+static const unsigned char *wozChunk(const unsigned char *image, size_t size, const char *id, unsigned int *len)
+{
+	// Data of chunk id, NULL if the image does not have it
+	size_t pos;
+	unsigned int chunkLen;
+
+	pos = WOZ_HEADER_SIZE;
+	while (pos + 8 <= size)
+	{
+		chunkLen = le32(image + pos + 4);
+		if (chunkLen > size - pos - 8)
+			return NULL;
+		if (memcmp(image + pos, id, 4) == 0)
+		{
+			*len = chunkLen;
+			return image + pos + 8;
+		}
+		pos += 8 + chunkLen;
+	}
+	return NULL;
+}
+
+//____________________
+static const unsigned char *wozTrackBits(const unsigned char *image, size_t size, unsigned char trk, unsigned int *bitCount)
+{
+	// Bitstream of whole track trk, NULL if the disk has none there
+	const unsigned char *tmap, *trks;
+	unsigned int len, index, start;
+
+	tmap = wozChunk(image, size, "TMAP", &len);
+	trks = wozChunk(image, size, "TRKS", &len);
+	if (!tmap || !trks || trk >= NUM_TRACKS)
+		return NULL;
+	index = tmap[trk * 4];
+	if (index == WOZ_NO_TRACK)
+		return NULL;
+
+	if (image[3] == '1')
+	{
+		if ((index + 1) * WOZ1_TRK_SIZE > len)
+			return NULL;
+		*bitCount = le16(trks + index * WOZ1_TRK_SIZE + WOZ1_BIT_COUNT);
+		if (*bitCount > WOZ1_BIT_COUNT * 8)
+			return NULL;
+		return trks + index * WOZ1_TRK_SIZE;
+	}
+
+	// WOZ2: 160 TRK entries, bits in 512 byte blocks from the start of the file
+	if ((index + 1) * 8 > len)
+		return NULL;
+	start = le16(trks + index * 8) * WOZ_BLOCK_SIZE;
+	*bitCount = le32(trks + index * 8 + 4);
+	if (start == 0 || start + ((size_t) *bitCount + 7) / 8 > size)
+		return NULL;
+	return image + start;
+}
+
+//____________________
+static unsigned int le16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+//____________________
+static unsigned int le32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
@@ -0,0 +1,26 @@
+/*	Disk2Nib.h
+	Pre-nibblized images, sent to PRU1 without a GCR encode:
+		.nib	35 tracks of 6656 nibbles
+		.woz	WOZ1 or WOZ2 bitstreams, whole track t read through TMAP entry 4*t
+	A track is cut into up to 16 packets in the usual track buffer layout,
+	each ended by 0x00 like an encoded sector and cut inside a sync gap; an
+	empty packet (first byte 0x00) ends the track, so tracks vary in length
+	A track longer than the buffer loses sync nibbles from its longest gaps
+*/
+#ifndef _DISK2NIB_H_
+#define _DISK2NIB_H_
+
+#include <stddef.h>
+
+#define NIB_TRACK_SIZE		6656
+#define NIB_IMAGE_SIZE		(35 * NIB_TRACK_SIZE)
+
+#define NIB_KIND_NIB		1
+#define NIB_KIND_WOZ		2
+
+int nibKind(const char *imagePath);
+int nibCheck(const unsigned char *image, size_t size, unsigned char kind);
+unsigned int nibTrack(unsigned char *track, const unsigned char *image, size_t size, unsigned char kind, unsigned char trk);
+int nibWriteData(unsigned char *track, unsigned char packet, const unsigned char *dataNibbles, unsigned int *length);
+
+#endif /* _DISK2NIB_H_ */
@@ -0,0 +1,209 @@
+/*	Disk2Prefetch.c
+	Next track in the seek direction into the spare buffer, see Disk2Prefetch.h
+	Tracks go in the way stageTrack() puts them, through Disk2Upload, so a
+	hit leaves nothing to upload; the buffer stays unselected, PRU1 never
+	sends it, and writes to its track are patched into it too
+	Main thread only
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "Disk2Prefetch.h"
+#include "Disk2Mem.h"
+#include "Disk2Image.h"
+#include "Disk2Upload.h"
+#include "Disk2Metrics.h"
+#include "Disk2Trace.h"
+
+#define SEEK_COUNTS		(PREFETCH_SEEK_MS * (TRACE_HZ / 1000))	// IEP counts
+
+typedef struct
+{
+	unsigned char valid;
+	unsigned char drive;
+	unsigned char track;
+	unsigned char buffer;
+	unsigned long long ns;					// it took to put there
+} Ahead;
+
+static Ahead ahead;							// what the spare buffer holds
+static uint32_t seenStamp[NUM_DRIVES];		// last step of each drive, as of prefetchStep()
+static int8_t seenDirection[NUM_DRIVES];
+static PrefetchStats stats;
+
+static void prefetchTrack(unsigned char drive, unsigned char trk);
+static int freeBuffer(int sending, int avoid);
+static void waste(void);
+
+//____________________
+void prefetchInit(void)
+{
+	memset(&ahead, 0, sizeof(ahead));
+	memset(seenStamp, 0, sizeof(seenStamp));
+	memset(seenDirection, 0, sizeof(seenDirection));
+	memset(&stats, 0, sizeof(stats));
+}
+
+//____________________
+void prefetchStep(const Pru0Status *pru0)
+{
+	/*	After a poll that saw steps: for each drive whose head has stepped,
+		the track after the one it is on, the way it moved; and during a
+		seek, the one after that into the cache
+		Track is half track / 2, so that is the next track the head reaches,
+		whether it is now on a track or between two
+	*/
+	unsigned char drive, seeking;
+	int trk;
+
+	for (drive=0; drive<NUM_DRIVES; drive++)
+	{
+		if (pru0->stepStamp[drive] == seenStamp[drive] || pru0->direction[drive] == 0)
+			continue;
+
+		stats.steps++;
+		seeking = pru0->direction[drive] == seenDirection[drive] &&
+			pru0->stepStamp[drive] - seenStamp[drive] < SEEK_COUNTS;
+		seenStamp[drive] = pru0->stepStamp[drive];
+		seenDirection[drive] = pru0->direction[drive];
+
+		trk = (pru0->halfTrack[drive] >> 1) + pru0->direction[drive];
+		if (trk < 0 || trk >= NUM_TRACKS)
+			continue;
+		prefetchTrack(drive, trk);
+
+		trk += pru0->direction[drive];
+		if (seeking && trk >= 0 && trk < NUM_TRACKS && !imageTrackReady(drive, trk))
+		{
+			(void) imageTrack(drive, trk);
+			stats.warmed++;
+		}
+	}
+}
+
+//____________________
+int prefetchSpare(unsigned char drive, unsigned char trk, int sending)
+{
+	/*	Buffer stageTrack() should put trk of drive into: the one holding it
+		ahead, else a free one, the one ahead last; -1 if none is free
+		sending is the buffer PRU1 is sending, -1 if none
+	*/
+	int buffer;
+
+	if (ahead.valid && ahead.drive == drive && ahead.track == trk)
+		return ahead.buffer;
+	buffer = freeBuffer(sending, ahead.valid ? ahead.buffer : -1);
+	if (buffer < 0 && ahead.valid)
+		buffer = freeBuffer(sending, -1);
+	return buffer;
+}
+
+//____________________
+int prefetchTake(unsigned char drive, unsigned char trk, unsigned char buffer)
+{
+	/*	stageTrack() is selecting buffer for trk of drive
+		Returns 1 if buffer holds it ahead already, a hit, else 0
+		Either way buffer is no longer spare
+	*/
+	if (ahead.valid && ahead.buffer == buffer)
+	{
+		if (ahead.drive == drive && ahead.track == trk)
+		{
+			ahead.valid = 0;
+			stats.hits++;
+			return 1;
+		}
+		waste();
+	}
+	stats.misses++;
+	return 0;
+}
+
+//____________________
+int prefetchHolding(unsigned char drive, unsigned char trk)
+{
+	// Buffer holding trk of drive ahead, for writes to it; -1 if none does
+	return ahead.valid && ahead.drive == drive && ahead.track == trk ? ahead.buffer : -1;
+}
+
+//____________________
+void prefetchDrop(unsigned char drive)
+{
+	// drive has another image, what is ahead for it is stale
+	if (ahead.valid && ahead.drive == drive)
+		waste();
+}
+
+//____________________
+void prefetchGetStats(PrefetchStats *out)
+{
+	*out = stats;
+}
+
+//____________________
+void prefetchPrintStats(void)
+{
+	printf("Prefetch: %llu steps, %llu tracks ahead, %llu hits, %llu misses, %llu wasted, %llu encoded ahead",
+		stats.steps, stats.prefetches, stats.hits, stats.misses, stats.wasted, stats.warmed);
+	if (stats.noSpare)
+		printf(", %llu no spare", stats.noSpare);
+	if (stats.prefetches)
+		printf(", %.1f us each, %.1f ms wasted", (double) stats.ns / stats.prefetches / 1e3, stats.wastedNs / 1e6);
+	printf("\n");
+}
+
+//____________________
+static void prefetchTrack(unsigned char drive, unsigned char trk)
+{
+	// trk of drive into the spare buffer, unless it is there already
+	unsigned char sendDrive;
+	unsigned long long start;
+	int buffer;
+
+	if (ahead.valid && ahead.drive == drive && ahead.track == trk)
+		return;
+
+	// Whatever is ahead is being replaced, keep to its buffer
+	buffer = freeBuffer(mailboxSending(&sendDrive), -1);
+	if (ahead.valid)
+	{
+		buffer = ahead.buffer;
+		waste();
+	}
+	if (buffer < 0)
+	{
+		stats.noSpare++;
+		return;
+	}
+
+	start = metricsNowNs();
+	uploadTrack(buffer, imageTrack(drive, trk));	// encodes it if first visit
+	ahead.ns = metricsNowNs() - start;
+	ahead.drive = drive;
+	ahead.track = trk;
+	ahead.buffer = buffer;
+	ahead.valid = 1;
+	stats.prefetches++;
+	stats.ns += ahead.ns;
+}
+
+//____________________
+static int freeBuffer(int sending, int avoid)
+{
+	// A buffer neither drive has selected and PRU1 is not sending, other than avoid; -1 if none
+	unsigned char buffer;
+
+	for (buffer=0; buffer<TRACK_BUFS; buffer++)
+		if (buffer != mailboxSelected(0) && buffer != mailboxSelected(1) && (int) buffer != sending &&
+			(int) buffer != avoid)
+			return buffer;
+	return -1;
+}
+
+//____________________
+static void waste(void)
+{
+	ahead.valid = 0;
+	stats.wasted++;
+	stats.wastedNs += ahead.ns;
+}
@@ -0,0 +1,41 @@
+/*	Disk2Prefetch.h
+	Speculative track staging, driven by PRU0's step telemetry
+	PRU0 publishes every half track step with its direction, so Controller
+	knows where a seek is heading while the head is still between tracks:
+	the next track that way is uploaded into the spare track buffer, not
+	selected, and if the head gets there stageTrack() has only to select it
+	During a multi track seek, steps the same way less than PREFETCH_SEEK_MS
+	apart, the track after that is encoded into the cache as well
+	There is one spare buffer, so one prefetch at a time; it is wasted if the
+	buffer is taken for another track, or the image changes, first
+*/
+#ifndef _DISK2PREFETCH_H_
+#define _DISK2PREFETCH_H_
+
+#include "Disk2Mailbox.h"
+
+#define PREFETCH_SEEK_MS	20				// steps closer than this are one seek
+
+typedef struct
+{
+	unsigned long long steps;				// half track steps seen, either drive
+	unsigned long long prefetches;			// tracks uploaded ahead into the spare buffer
+	unsigned long long hits;				// tracks staged that were there already
+	unsigned long long misses;				// tracks staged that were not
+	unsigned long long wasted;				// prefetches overwritten or dropped unused
+	unsigned long long warmed;				// tracks encoded ahead during seeks
+	unsigned long long noSpare;				// steps with no buffer free to prefetch into
+	unsigned long long ns;					// time spent prefetching
+	unsigned long long wastedNs;			// of which on prefetches wasted
+} PrefetchStats;
+
+void prefetchInit(void);
+void prefetchStep(const Pru0Status *pru0);
+int prefetchSpare(unsigned char drive, unsigned char trk, int sending);
+int prefetchTake(unsigned char drive, unsigned char trk, unsigned char buffer);
+int prefetchHolding(unsigned char drive, unsigned char trk);
+void prefetchDrop(unsigned char drive);
+void prefetchGetStats(PrefetchStats *stats);
+void prefetchPrintStats(void);
+
+#endif /* _DISK2PREFETCH_H_ */
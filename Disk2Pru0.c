@@ -1,98 +1,274 @@
 /*	Disk2 Interface PRU0
-	Monitors Phase inputs and determines current track
+	Monitors Phase inputs and determines current track of the enabled drive
 	Modern OS, shared memory
 
+	Phases are sampled every 1 us; a change starts a PHASE_FILTER (20 us)
+	window on the IEP counter and counts once the new pattern has held that
+	long, so a step is known about 20 us after the A2 makes it. A pattern
+	that goes before its window is up is a glitch
+
 	Inputs:
 		P0		P9_31	R31_0
 		P1		P9_29	R31_1
 		P2		P9_30	R31_2
 		P3		P9_28	R31_3
-		EN-		P9_27	R31_5
+		EN1-	P9_27	R31_5
+		EN2-	P9_25	R31_7
 
 	Outputs:
 		None
 
 	Memory Locations shared with Controller:
-		Track number	0x300
+		Status block	0x300, seqlocked, see Disk2Mailbox.h
+			seq			odd while we update it
+			trackSeq	track changes so far
+			track[2]	current track of each drive
+			drive		drive last enabled
+			halfTrack[2], direction[2]	head position and which way it last stepped
+			stepSeq		half track steps so far
+			stepStamp[2]	IEP count of the phase edge that made the last step
+		Third track buffer	0x400, 16 * 374 bytes, written by Controller, sent by PRU1
+		Trace ring		0x1B80, see Disk2Trace.h: phase changes and glitches, track updates
+
+	Events to Controller:
+		System event 16 on each half track step and track change
+		Sets up the INTC for both PRUs: events 16-18 -> channel 2 -> host 2,
+		the ARM's PRU interrupt 0 (UIO evtout0)
+		Starts the IEP counter both PRUs stamp trace entries with, one count a cycle
+
+	Host build, -DPRU_EMU=0: see Disk2Emu.h, ./Emu runs it on a virtual clock
 
 	03/28/2020
 */
 #include <stdint.h>
+#ifdef PRU_EMU
+#include "Disk2Emu.h"					// host build on a virtual cycle clock, see Disk2Emu.c
+#else
 #include <pru_cfg.h>
+#include <pru_intc.h>
+#include <pru_iep.h>
 #include "resource_table_empty.h"
+#define PRU_LOCAL		0x00000			// start of our address space, the host build moves it
+#endif
 
 // First 0x200 bytes of PRU RAM are STACK & HEAP
 #define PRU0_DRAM		0x00000			// Offset to Data RAM
-volatile unsigned char *PRU0_RAM = (unsigned char *) PRU0_DRAM;
+volatile unsigned char *PRU0_RAM = (unsigned char *) (PRU_LOCAL + PRU0_DRAM);
 
 // Fixed PRU Memory Locations
-#define TRK_NUM_ADR		0x0300			// address of current track
+#define STATUS_ADR		0x0300			// status block, copy of Pru0Status in Disk2Mailbox.h
+#define TRACE_ADR		0x1B80			// copy of TraceRing in Disk2Trace.h
+#define TRACE_ENTRIES	128
+
+#define PHASE_FILTER	4000			// cycles, 20 us a phase pattern must hold
+#define PHASE_POLL		200				// cycles between samples, 1 us
+#define NO_PHASE		0x1F			// no pattern yet, any is a change
+
+typedef struct
+{
+	uint32_t seq;
+	uint32_t trackSeq;
+	uint8_t track[2];
+	uint8_t drive;
+	uint8_t unused;
+	uint8_t halfTrack[2];
+	int8_t direction[2];
+	uint32_t stepSeq;
+	uint32_t stepStamp[2];
+} Pru0Status;
+volatile Pru0Status *STATUS = (Pru0Status *) (PRU_LOCAL + STATUS_ADR);
+
+typedef struct
+{
+	uint32_t stamp;
+	uint8_t event;
+	uint8_t a;
+	uint16_t b;
+} TraceEntry;
+
+typedef struct
+{
+	uint32_t total;
+	uint32_t unused[3];
+	TraceEntry entries[TRACE_ENTRIES];
+} TraceRing;
+volatile TraceRing *TRACE = (TraceRing *) (PRU_LOCAL + TRACE_ADR);
+
+// Trace events, see Disk2Trace.h
+#define TRACE_PHASE			1
+#define TRACE_PHASE_GLITCH	2
+#define TRACE_TRACK			3
+
+// Events to Controller
+#define R31_VEC_VALID	(1<<5)			// write to R31 raises event 16 + R31[3:0]
+#define TRK_EVT			16				// PRU0: head stepped or track changed
+#define SECTOR_EVT		17				// PRU1: sector sent
+#define WRITE_EVT		18				// PRU1: write captured
+#define HOST_INT		2				// channel and host interrupt, ARM sees host 2 as evtout0
 
+#ifndef PRU_EMU
 volatile register uint32_t __R31;
+#endif
+
+void InitIntc(void);
+void InitIep(void);
+void Trace(unsigned char event, unsigned char a, uint16_t b);
 
 //____________________
 int main(int argc, char *argv[])
 {
-	unsigned char lastPhaseIn, newPhase1, newPhase2;
-	unsigned char track, phaseTrk, cogLocation;
-	uint32_t PHASE0, PHASE1, PHASE2, PHASE3, ENABLE;	// inputs
+	unsigned char lastPhaseIn, pending, newPhase;
+	unsigned char drive, track, phaseTrk[2], halfTrk, cogLocation, moved;
+	uint32_t PHASE0, PHASE1, PHASE2, PHASE3, ENABLE1, ENABLE2;	// inputs
+	uint32_t now, pendingAt;
 
 	// Set I/O constants
 	PHASE0 = 0x01<<0;
 	PHASE1 = 0x01<<1;
 	PHASE2 = 0x01<<2;
 	PHASE3 = 0x01<<3;
-	ENABLE = 0x01<<5;
+	ENABLE1 = 0x01<<5;
+	ENABLE2 = 0x01<<7;
 
 	// Clear SYSCFG[STANDBY_INIT] to enable OCP master port
 	CT_CFG.SYSCFG_bit.STANDBY_INIT = 0;
 
-	lastPhaseIn = 0x1F;				// to force a "new" phase report
+	InitIntc();
+	InitIep();
+
+	lastPhaseIn = NO_PHASE;			// to force a "new" phase report
+	pending = NO_PHASE;
+	pendingAt = 0;
 	track = 3;						// arbitrary
-	phaseTrk = 0;
+	phaseTrk[0] = phaseTrk[1] = 0;
 	cogLocation = 0;
+	drive = 0;
 
-	PRU0_RAM[TRK_NUM_ADR] = track;
+	if (STATUS->seq & 1)			// stopped mid-update last time
+		STATUS->seq++;
+	STATUS->seq++;
+	STATUS->track[0] = STATUS->track[1] = track;
+	STATUS->drive = drive;
+	STATUS->halfTrack[0] = STATUS->halfTrack[1] = 0;
+	STATUS->direction[0] = STATUS->direction[1] = 0;
+	STATUS->seq++;
 
 	while (1)
 	{
-		if ((__R31 & ENABLE) == 0)					// drive is enabled
+		// Phases go to both drives, only the enabled one's head moves
+		if ((__R31 & ENABLE1) == 0 || (__R31 & ENABLE2) == 0)
 		{
-			newPhase1 = __R31 & (PHASE0 | PHASE1 | PHASE2 | PHASE3);	// sample phase inputs
+			if (drive != ((__R31 & ENABLE1) != 0))
+			{
+				drive = (__R31 & ENABLE1) != 0;		// 0 = drive 1
+				track = STATUS->track[drive];
+				lastPhaseIn = pending = NO_PHASE;
+			}
 
-			// Wait and then sample again to avoid reacting to short glitches on P0
-			__delay_cycles(200000);					// 1 ms
+			newPhase = __R31 & (PHASE0 | PHASE1 | PHASE2 | PHASE3);	// sample phase inputs
+			now = CT_IEP.TMR_CNT;
 
-			newPhase2 = __R31 & (PHASE0 | PHASE1 | PHASE2 | PHASE3);
+			if (newPhase != pending)				// an edge, time it from here
+			{
+				if (pending != lastPhaseIn)			// one before it had not held
+					Trace(TRACE_PHASE_GLITCH, pending, newPhase);
+				pending = newPhase;
+				pendingAt = now;
+			}
 
-			if (newPhase1 == newPhase2)				// consider phase valid
+			else if (pending != lastPhaseIn && now - pendingAt >= PHASE_FILTER)	// consider phase valid
 			{
-				if (lastPhaseIn != newPhase1)		// any change?
+				lastPhaseIn = newPhase;				// update lastPhaseIn
+				halfTrk = phaseTrk[drive];
+
+				cogLocation = 1 << (phaseTrk[drive] % 4);
+
+				if (newPhase && !(cogLocation & newPhase))
 				{
-					lastPhaseIn = newPhase1;		//update lastPhaseIn
+					if (((cogLocation << 1) & newPhase) || ((cogLocation >> 3) & newPhase))
+					{
+						if (phaseTrk[drive] < 69)
+							phaseTrk[drive]++;
+					}
+					else if (((cogLocation >> 1) & newPhase) || ((cogLocation << 3) & newPhase))
+					{
+						if (phaseTrk[drive] > 0)
+							phaseTrk[drive]--;
+					}
 
-					cogLocation = 1 << (phaseTrk % 4);
+					track = phaseTrk[drive] >> 1;
+				}
+				Trace(TRACE_PHASE, newPhase, phaseTrk[drive] | (drive << 15));
 
-					if (newPhase1 && !(cogLocation & newPhase1))
+				moved = STATUS->track[drive] != track;
+				if (phaseTrk[drive] != halfTrk || moved)
+				{
+					STATUS->seq++;							// update head for Controller
+					if (phaseTrk[drive] != halfTrk)
 					{
-						if (((cogLocation << 1) & newPhase1) || ((cogLocation >> 3) & newPhase1))
-						{
-							if (phaseTrk < 69)
-								phaseTrk++;
-						}
-						else if (((cogLocation >> 1) & newPhase1) || ((cogLocation << 3) & newPhase1))
-						{
-							if (phaseTrk > 0)
-								phaseTrk--;
-						}
-
-						if (track != (phaseTrk>>1))
-							track = phaseTrk >> 1;
+						STATUS->halfTrack[drive] = phaseTrk[drive];
+						STATUS->direction[drive] = phaseTrk[drive] > halfTrk ? 1 : -1;
+						STATUS->stepStamp[drive] = pendingAt;
+						STATUS->stepSeq++;
 					}
-					PRU0_RAM[TRK_NUM_ADR] = track;	// update track for Controller
+					if (moved)
+					{
+						STATUS->track[drive] = track;
+						STATUS->drive = drive;
+						STATUS->trackSeq++;
+					}
+					STATUS->seq++;
+
+					__R31 = R31_VEC_VALID | (TRK_EVT - 16);	// and wake it up, it prefetches on a step
+					if (moved)
+						Trace(TRACE_TRACK, drive, track);
 				}
 			}
 		}
-		__delay_cycles(200000);						// 1 ms
+		__delay_cycles(PHASE_POLL);
 	}
 }
+
+//____________________
+void InitIntc(void)
+{
+	// Route our event and PRU1's to the ARM, see Disk2Event.h
+	CT_INTC.CMR4_bit.CH_MAP_16 = HOST_INT;
+	CT_INTC.CMR4_bit.CH_MAP_17 = HOST_INT;
+	CT_INTC.CMR4_bit.CH_MAP_18 = HOST_INT;
+	CT_INTC.HMR0_bit.HINT_MAP_2 = HOST_INT;
+
+	CT_INTC.SICR = TRK_EVT;					// clear anything pending
+	CT_INTC.SICR = SECTOR_EVT;
+	CT_INTC.SICR = WRITE_EVT;
+
+	CT_INTC.EISR = TRK_EVT;					// enable events
+	CT_INTC.EISR = SECTOR_EVT;
+	CT_INTC.EISR = WRITE_EVT;
+
+	CT_INTC.HIEISR = HOST_INT;				// enable host interrupt
+	CT_INTC.GER = 1;						// and interrupts globally
+}
+
+//____________________
+void InitIep(void)
+{
+	// Free-running, one count per 200 MHz cycle, wraps every 21 s
+	CT_IEP.TMR_GLB_CFG_bit.CNT_EN = 0;
+	CT_IEP.TMR_GLB_CFG_bit.DEFAULT_INC = 1;
+	CT_IEP.TMR_CNT = 0;
+	CT_IEP.TMR_GLB_CFG_bit.CNT_EN = 1;
+}
+
+//____________________
+void Trace(unsigned char event, unsigned char a, uint16_t b)
+{
+	// Entry first, then total, so ./Trace never reads one half filled
+	volatile TraceEntry *entry = &TRACE->entries[TRACE->total % TRACE_ENTRIES];
+
+	entry->stamp = CT_IEP.TMR_CNT;
+	entry->event = event;
+	entry->a = a;
+	entry->b = b;
+	TRACE->total++;
+}
@@ -6,7 +6,8 @@
 		without warning. Need to regularly check WREQ-.
 
 	Inputs:
-		EN-		P8_28	R31_10
+		EN1-	P8_28	R31_10
+		EN2-	P8_30	R31_11
 		WREQ-	P8_41	R31_4
 		WSIG	P8_39_	R31_6
 
@@ -16,61 +17,197 @@
 		TEST2	P8_29	R30_9
 
 	Memory Locations shared with Controller:
-		Track start		0x0300		 768
-		Track end		0x1A5F		6751
-
-		PRU -> Controller
-		0x1B00 = EN-
-		0x1B01 = current sector number
-		0x1B02 = no write (0), write occurred (1)
-
-		Controller -> PRU
-		0x1B07 = stop sending data to A2 (1)
-
-		Write data start	0x1C00
+		Three track buffers of 16 * 374 bytes, one for each drive's track and a spare
+		Track buffer 0	0x10000		shared RAM
+		Track buffer 1	0x11760		shared RAM
+		Track buffer 2	0x2400		PRU0's data RAM, 0x400 there
+		Each 374 byte slot holds one packet of bits, ended by 0x00
+		A packet starting with 0x00 ends the track, so .nib/.woz tracks can be
+		shorter than 16 packets
+
+		PRU -> Controller, status block 0x1B00, seqlocked, see Disk2Mailbox.h
+		seq is made odd, the fields updated, seq made even again; counters
+		only go up, Controller keeps the ones it saw last
+			seq, sectorSeq (sectors sent), writeSeq (writes captured)
+			edgeTotal (edges logged), stored on every edge outside the seqlock
+			sector, EN- of either drive, track buffer being sent and its drive
+
+		Controller -> PRU, command block 0x1B20
+			releaseSeq	send while sectorSeq is behind it
+			bufSel[2]	track buffer to send for each drive (0 to 2), picked up at sector boundary
+			stream		1 = rotate through the track without waiting for releaseSeq
+
+		Write slots			0x1B40, WRITE_SLOTS (2) of 16 bytes, write n in slot n % 2, 0x80 bytes reserved:
+			writeSeq, edgeStart (edgeTotal when it began), edgeCount,
+			ringStart (ring byte of the first edge),
+			track (PRU0's, read from its RAM), sector being sent, drive
+		WSIG edge ring		0x0400, 5632 bytes, cycles since the edge before in 16s
+		Trace ring			0x1BC0, see Disk2Trace.h: sector start and end, write start
+							and end, WSIG edges that look wrong; stamped with PRU0's IEP counter
+		A write is logged as raw edge times only; Controller recovers the bits
+		(Disk2Edge.c), so no cycle counting here. Writes queue up in the slots
+		and the ring, so back-to-back writes need nothing from Controller
+
+	Events to Controller (INTC set up by PRU0):
+		System event 17 after each sector sent, not when streaming
+		System event 18 after a write is captured
+
+	Drives: sends for whichever of EN1- and EN2- is low, from that drive's
+	buffer, so switching drives needs nothing from Controller
+
+	Streaming, every gap between packets is SECTOR_GAP cycles plus the same
+	few instructions, so rotation speed no longer follows Linux scheduling
+
+	Host build, -DPRU_EMU=1: see Disk2Emu.h, ./Emu runs it on a virtual clock
 
 	03/28/2020
 */
 #include <stdint.h>
+#ifdef PRU_EMU
+#include "Disk2Emu.h"					// host build on a virtual cycle clock, see Disk2Emu.c
+#else
 #include <pru_cfg.h>
+#include <pru_ctrl.h>
+#include <pru_iep.h>
 #include "resource_table_empty.h"
+#define PRU_LOCAL		0x00000			// start of our address space, the host build moves it
+#endif
 
 // First 0x200 bytes of PRU RAM are STACK & HEAP
 #define PRU0_DRAM		0x00000			// offset to Data RAM
-volatile unsigned char *PRU1_RAM = (unsigned char *) PRU0_DRAM;
+#define PRU_SHAREDMEM	0x10000			// offset to Shared RAM
+volatile unsigned char *PRU1_RAM = (unsigned char *) (PRU_LOCAL + PRU0_DRAM);
+volatile unsigned char *SHARED_RAM = (unsigned char *) (PRU_LOCAL + PRU_SHAREDMEM);
 
 // Fixed PRU Memory Locations
-#define TRACK_DATA_ADR		0x0300		// address of track start
-
-#define ENABLE_ADR			0x1B00		// EN- state
-#define SECTOR_ADR			0x1B01		// current sector number
-#define WRITE_ADR			0x1B02		// 1 = write occurred
-#define CONT_INT_ADR		0x1B07		// Controller interrupt, 1 = stop
+#define STATUS_ADR			0x1B00		// copy of Pru1Status in Disk2Mailbox.h
+#define COMMAND_ADR			0x1B20		// copy of Pru1Command
+#define WRITE_SLOT_ADR		0x1B40		// copies of WriteSlot
+#define WRITE_SLOTS			2			// as many data fields as the edge ring holds
+#define PRU0_STATUS_ADR		0x2300		// PRU0's status block, its RAM is at 0x2000 for us
+#define PRU0_TRACK_BUF_ADR	0x2400		// track buffer 2, in PRU0's RAM
+
+#define EDGE_RING_ADR		0x0400		// WSIG edge deltas
+#define EDGE_RING_SIZE		5632
+#define EDGE_UNIT_SHIFT		4			// deltas in 16 cycles
+#define EDGE_TIMEOUT		8000		// cycles, 40 us without an edge ends a write
+#define EDGE_SHORT			25			// 16 cycles, under half a bit cell
+#define TRACE_ADR			0x1BC0		// copy of TraceRing in Disk2Trace.h
+#define TRACE_ENTRIES		128
+
+volatile unsigned char *EDGE_RING = (unsigned char *) (PRU_LOCAL + EDGE_RING_ADR);
+
+typedef struct
+{
+	uint32_t seq;
+	uint32_t sectorSeq;
+	uint32_t writeSeq;
+	uint32_t edgeTotal;
+	uint8_t sector;
+	uint8_t enable;
+	uint8_t buffer;
+	uint8_t drive;
+} Pru1Status;
+
+typedef struct
+{
+	uint32_t writeSeq;
+	uint32_t edgeStart;
+	uint16_t edgeCount;
+	uint16_t ringStart;
+	uint8_t track;
+	uint8_t sector;
+	uint8_t drive;
+	uint8_t unused;
+} WriteSlot;
+
+typedef struct
+{
+	uint32_t releaseSeq;
+	uint8_t bufSel[2];
+	uint8_t stream;
+	uint8_t unused;
+} Pru1Command;
+
+volatile Pru1Status *STATUS = (Pru1Status *) (PRU_LOCAL + STATUS_ADR);
+volatile Pru1Command *COMMAND = (Pru1Command *) (PRU_LOCAL + COMMAND_ADR);
+volatile WriteSlot *WRITE_SLOT = (WriteSlot *) (PRU_LOCAL + WRITE_SLOT_ADR);
+volatile unsigned char *PRU0_TRACK = (unsigned char *) (PRU_LOCAL + PRU0_STATUS_ADR + 8);	// Pru0Status.track[2]
+
+typedef struct
+{
+	uint32_t stamp;
+	uint8_t event;
+	uint8_t a;
+	uint16_t b;
+} TraceEntry;
 
-#define WRITE_DATA_ADR		0x1C00		// address of first write byte
+typedef struct
+{
+	uint32_t total;
+	uint32_t unused[3];
+	TraceEntry entries[TRACE_ENTRIES];
+} TraceRing;
+volatile TraceRing *TRACE = (TraceRing *) (PRU_LOCAL + TRACE_ADR);
+
+// Trace events, see Disk2Trace.h
+#define TRACE_SECTOR_START	4
+#define TRACE_SECTOR_END	5
+#define TRACE_WRITE_START	6
+#define TRACE_WRITE_END		7
+#define TRACE_EDGE_LONG		8
+#define TRACE_EDGE_SHORT	9
+#define TRACE_EDGE_COUNT	10
+#define TRACE_END_WREQ		0
+#define TRACE_END_TIMEOUT	1
+#define TRACE_EDGE_MARKS	4			// edge anomalies traced per write
 
 #define NUM_SECTORS_TRACK	16			// sectors per track
 #define NUM_BYTES_SECTOR	0x0176		// 374, includes sync, prologue, data, everything
+#define NUM_BYTES_TRACK		0x1760		// 5984, one track buffer
+#define TRACK_BUFS			3
+#define NO_DRIVE			2			// neither EN- low
+#define SECTOR_GAP			2000		// cycles between packets, 10 us
+
+volatile unsigned char *TRACK_BUF[TRACK_BUFS] =
+{
+	(unsigned char *) (PRU_LOCAL + PRU_SHAREDMEM),
+	(unsigned char *) (PRU_LOCAL + PRU_SHAREDMEM + NUM_BYTES_TRACK),
+	(unsigned char *) (PRU_LOCAL + PRU0_TRACK_BUF_ADR)
+};
+
+// Events to Controller
+#define R31_VEC_VALID		(1<<5)		// write to R31 raises event 16 + R31[3:0]
+#define SECTOR_EVT			17			// sector sent
+#define WRITE_EVT			18			// write captured
 
+#ifndef PRU_EMU
 volatile register uint32_t __R30;
 volatile register uint32_t __R31;
+#endif
 
 // Globals
-uint32_t ENABLE, WREQ, WSIG;		// inputs
+uint32_t ENABLE1, ENABLE2, WREQ, WSIG;	// inputs
 uint32_t RDAT, TEST1, TEST2;		// outputs
+uint16_t edgeRingPos;				// next edge ring byte
 
-void SendSector(unsigned char sector);
-void HandleWrite(void);
-void InsertBit(signed char bit);
+unsigned int SendSector(unsigned char drive, unsigned char buffer, unsigned char sector);
+void HandleWrite(unsigned char drive, unsigned char sector);
+void SetEnable(unsigned char enable);
+unsigned char Released(void);
+unsigned char EnabledDrive(void);
+void Trace(unsigned char event, unsigned char a, uint16_t b);
 
 //____________________
 int main(int argc, char *argv[])
 {
 //	unsigned int i;
-	unsigned char sector;
+	unsigned char sector, buffer, drive;
+	unsigned int sent;
 
 	// Set I/O constants
-	ENABLE	= 0x1<<10;			// P8_28 input
+	ENABLE1	= 0x1<<10;			// P8_28 input
+	ENABLE2	= 0x1<<11;			// P8_30 input
 	WREQ	= 0x1<<4;			// P8_41 input
 	WSIG	= 0x1<<6;			// P8_39 input
 	RDAT	= 0x1<<7;			// P8_40 output
@@ -82,28 +219,55 @@ int main(int argc, char *argv[])
 
 	__R30 &= ~TEST1;			// TEST1 = 0
 	__R30 &= ~TEST2;			// TEST2 = 0
-
-	PRU1_RAM[WRITE_ADR] = 0;				// no write, yet
-
-	// Debug
-//	for (i=0; i<400; i++)
-//		PRU1_RAM[WRITE_DATA_ADR + i] = 0xFF;
+	__R30 |= RDAT;				// RDAT = 1, idle, or the first 1 bit makes no edge
+
+	if (STATUS->seq & 1)					// stopped mid-update last time
+		STATUS->seq++;
+	buffer = 0;
+	drive = 0;
+	STATUS->seq++;
+	STATUS->buffer = buffer;
+	STATUS->drive = drive;
+	STATUS->sectorSeq = COMMAND->releaseSeq;	// hold till Controller releases a sector
+	STATUS->seq++;
+	edgeRingPos = 0;
 
 	while (1)
 	{
-		if ((__R31 & ENABLE) == 0)			// A2 enables us
+		if (EnabledDrive() != NO_DRIVE)		// A2 enables us
 		{
-			PRU1_RAM[ENABLE_ADR] = 0;		// EN- = 0
+			SetEnable(0);					// EN- = 0
 
+			drive = EnabledDrive();
 			sector = 0;
-			while ((__R31 & ENABLE) == 0)
+			while (EnabledDrive() == drive)
 			{
-				if (PRU1_RAM[CONT_INT_ADR] == 0)	// Controller enables us
+				// Controller enables us, or lets us stream
+				if (Released())
 				{
-					__delay_cycles(2000);			// 10.0 us ???
-					SendSector(sector);
-
-					PRU1_RAM[SECTOR_ADR] = sector;	// tell Controller this sector sent
+					// Sector boundary, only place to switch track buffers
+					if (COMMAND->bufSel[drive] % TRACK_BUFS != buffer || STATUS->drive != drive)
+					{
+						buffer = COMMAND->bufSel[drive] % TRACK_BUFS;
+						STATUS->seq++;
+						STATUS->buffer = buffer;
+						STATUS->drive = drive;
+						STATUS->seq++;
+					}
+					if (TRACK_BUF[buffer][sector * NUM_BYTES_SECTOR] == 0x00)
+						sector = 0;					// past end of this track
+
+					__delay_cycles(SECTOR_GAP);
+					Trace(TRACE_SECTOR_START, sector, buffer | (drive << 8));
+					sent = SendSector(drive, buffer, sector);
+					Trace(TRACE_SECTOR_END, sector, sent);
+
+					STATUS->seq++;					// tell Controller this sector sent
+					STATUS->sector = sector;
+					STATUS->sectorSeq++;
+					STATUS->seq++;
+					if (COMMAND->stream == 0)
+						__R31 = R31_VEC_VALID | (SECTOR_EVT - 16);
 
 					sector++;
 					if (sector == 16)
@@ -113,13 +277,13 @@ int main(int argc, char *argv[])
 				}
 
 				else
-					while (PRU1_RAM[CONT_INT_ADR] == 1)	// wait here till Controller says go
+					while (!Released())				// wait here till Controller says go
 						__delay_cycles(200);			// 1.0 us ???
 			}
 		}
 		else
 		{
-			PRU1_RAM[ENABLE_ADR] = 1;		// EN- = 1
+			SetEnable(1);					// EN- = 1
 
 			__delay_cycles(200000);			// 1.0 ms
 		}
@@ -127,19 +291,23 @@ int main(int argc, char *argv[])
 }
 
 //____________________
-void SendSector(unsigned char sector)
+unsigned int SendSector(unsigned char drive, unsigned char buffer, unsigned char sector)
 {
-	// Outputs all data for one sector
+	/*	Outputs all data for one sector (packet) from track buffer 0, 1 or 2, up to its 0x00
+		Returns the number of bytes sent, fewer if the A2 started writing
+	*/
 	unsigned char byteInProgress, bitMask, sendDone;;
+	volatile unsigned char *track;
 	unsigned int sectorAdr;
 
 	// Set up parameters
-	sectorAdr = TRACK_DATA_ADR + sector * NUM_BYTES_SECTOR;
+	track = TRACK_BUF[buffer];
+	sectorAdr = sector * NUM_BYTES_SECTOR;
 	bitMask = 0x80;						// we send msb first
 	sendDone = 0;						// 1 = done
 	while (sendDone == 0)
 	{
-		byteInProgress = PRU1_RAM[sectorAdr];
+		byteInProgress = track[sectorAdr];
 		if (byteInProgress == 0x00)		// end of packet marker
 			sendDone = 1;
 
@@ -160,8 +328,9 @@ void SendSector(unsigned char sector)
 
 			if ((__R31 & WREQ) == 0)	// is A2 writing something this sectod?
 			{
-				HandleWrite();
-				return;
+				HandleWrite(drive, sector);
+				__R31 = R31_VEC_VALID | (WRITE_EVT - 16);	// write data ready
+				return sectorAdr - sector * NUM_BYTES_SECTOR;
 			}
 		}
 		else
@@ -169,141 +338,132 @@ void SendSector(unsigned char sector)
 
 		__delay_cycles(410);			// 2.05 us
 	}
+	return sectorAdr - sector * NUM_BYTES_SECTOR;
 }
 
 //____________________
-void HandleWrite(void)
+void HandleWrite(unsigned char drive, unsigned char sector)
 {
-	// WREQ- is 0
-	unsigned char edgeCnt, count, lastWSIG;
-
-	PRU1_RAM[WRITE_ADR] = 1;		// tell Controller
-
-	// Set up InsertBit()
-	InsertBit(-1);
-
-	__delay_cycles(4100);		// to get to 00 after first synch byte
-
-	// spin for n WSIG rising edges to get past synchs and garbage
-	for (edgeCnt=0; edgeCnt<13; edgeCnt++)			// [21]
-	{
-		while ((__R31 & WSIG) == 0);		// spin while WSIG = 0
-		__delay_cycles(200);				// 1 us
-		while ((__R31 & WSIG) == WSIG);		// spin while WSIG = 1
-		__delay_cycles(1);
-	}
+	/*	WREQ- is 0
+		Logs the cycles since the last WSIG edge at every edge into the edge
+		ring until WREQ- goes back to 1 or WSIG stops toggling, then fills
+		the write's slot; sync, bit cells and bytes are all left to Controller
+		A delta is measured from where the deltas before add up to, so the
+		16 cycle truncation does not build up
+		Gaps of 5 cells or more and edges under half a cell apart are traced,
+		the first TRACE_EDGE_MARKS of them, as is how the write ended
+	*/
+	volatile WriteSlot *slot;
+	uint32_t lastWSIG, now, lastEdge, delta, start, total;
+	uint16_t ringPos, count;
+	unsigned char marks, ending;
+
+	start = total = STATUS->edgeTotal;
+	ringPos = edgeRingPos;
+	count = 0;
+	marks = 0;
+	ending = TRACE_END_WREQ;
+	Trace(TRACE_WRITE_START, sector, drive);
+
+	// Cycle counter only runs up, restart it for every write
+	PRU1_CTRL.CTRL_bit.CTR_EN = 0;
+	PRU1_CTRL.CYCLE = 0;
+	PRU1_CTRL.CTRL_bit.CTR_EN = 1;
 
 	__R30 |= TEST1;		// TEST1 = 1
 
-	// Begin bit(s) detection
-	while (1)
+	lastWSIG = __R31 & WSIG;
+	lastEdge = 0;
+	while ((__R31 & WREQ) == 0)
 	{
-		count = 0;
-		lastWSIG = __R31 & WSIG;
-		while ((__R31 & WSIG) == lastWSIG)
-		{
-			count++;
-			if (count > 65)
-				return;
-
-			__delay_cycles(100);	// 0.5 us
-		}
-
-		// Convert count into bit(s)
-		if (count < 10)			// 1
-		{
-			InsertBit(1);
-		}
-		else if (count < 17)	// 01
-		{
-			InsertBit(0);
-			InsertBit(1);
-		}
-		else if (count < 24)	// 001
-		{
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(1);
-		}
-		else if (count < 31)	// 0001
-		{
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(1);
-		}
-		else if (count < 38)	// 0 0001
-		{
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(1);
-		}
-		else if (count < 45)	// 00 0001
-		{
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(1);
-		}
-		else if (count < 52)	// 000 0001
+		now = PRU1_CTRL.CYCLE;
+		if ((__R31 & WSIG) != lastWSIG)
 		{
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(1);
+			lastWSIG ^= WSIG;
+			delta = (now - lastEdge) >> EDGE_UNIT_SHIFT;
+			if (delta > 255)
+				delta = 255;
+			lastEdge += delta << EDGE_UNIT_SHIFT;
+			EDGE_RING[ringPos] = delta;
+			if (++ringPos == EDGE_RING_SIZE)
+				ringPos = 0;
+			STATUS->edgeTotal = ++total;			// Controller checks its copies against this
+			if (count != 0 && (delta == 255 || delta < EDGE_SHORT) && marks < TRACE_EDGE_MARKS)
+			{
+				Trace(delta == 255 ? TRACE_EDGE_LONG : TRACE_EDGE_SHORT, delta, count);
+				marks++;
+			}
+			if (count != 0xFFFF)
+				count++;
+			else if (marks < TRACE_EDGE_MARKS)
+			{
+				Trace(TRACE_EDGE_COUNT, 0, count);
+				marks = TRACE_EDGE_MARKS;
+			}
 		}
-		else					// 0000 0001
+		else if (now - lastEdge > EDGE_TIMEOUT)
 		{
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(0);
-			InsertBit(1);
+			ending = TRACE_END_TIMEOUT;
+			break;
 		}
 	}
+	Trace(TRACE_WRITE_END, ending, count);
+
+	// Slot first, claimed before it is filled, then tell Controller
+	slot = &WRITE_SLOT[(STATUS->writeSeq + 1) % WRITE_SLOTS];
+	slot->writeSeq = STATUS->writeSeq + 1;
+	slot->edgeStart = start;
+	slot->edgeCount = count;
+	slot->ringStart = edgeRingPos;
+	slot->track = PRU0_TRACK[drive];
+	slot->sector = sector;
+	slot->drive = drive;
+	edgeRingPos = ringPos;
+
+	STATUS->seq++;
+	STATUS->writeSeq++;
+	STATUS->seq++;
 }
 
 //____________________
-void InsertBit(signed char bit)
+void SetEnable(unsigned char enable)
 {
-	// Insert bit into byteInProcess and put in RAM when byte completed
-	// If bit = -1, reset parameters (start of packet)
-	static unsigned char bitCnt, byteInProcess;
-	static unsigned int writeAdr;
-
-	if (bit == -1)
+	// EN- into the status block, only when it changes
+	if (STATUS->enable != enable)
 	{
-		bitCnt  = 0;
-		byteInProcess = 0x00;
-		writeAdr = WRITE_DATA_ADR;
+		STATUS->seq++;
+		STATUS->enable = enable;
+		STATUS->seq++;
 	}
-	else
-	{
-		if (bit == 0)
-			byteInProcess &= 0xFE;	// clear LSB
-		else
-			byteInProcess |= 0x01;	// set LSB
+}
 
-		if (bitCnt == 7)
-		{
-			PRU1_RAM[writeAdr] = byteInProcess;
-			writeAdr++;
-			bitCnt = 0;
-		}
-		else
-		{
-			byteInProcess = byteInProcess<<1;	// shift bits left
-			bitCnt++;
-		}
-	}
+//____________________
+unsigned char EnabledDrive(void)
+{
+	// 0 or 1 for the drive whose EN- is low, the A2 enables one at a time
+	if ((__R31 & ENABLE1) == 0)
+		return 0;
+	if ((__R31 & ENABLE2) == 0)
+		return 1;
+	return NO_DRIVE;
+}
+
+//____________________
+unsigned char Released(void)
+{
+	// Controller lets the next sector go, or lets us stream
+	return COMMAND->stream == 1 || (int32_t) (COMMAND->releaseSeq - STATUS->sectorSeq) > 0;
+}
+
+//____________________
+void Trace(unsigned char event, unsigned char a, uint16_t b)
+{
+	// Entry first, then total, so ./Trace never reads one half filled
+	volatile TraceEntry *entry = &TRACE->entries[TRACE->total % TRACE_ENTRIES];
+
+	entry->stamp = CT_IEP.TMR_CNT;
+	entry->event = event;
+	entry->a = a;
+	entry->b = b;
+	TRACE->total++;
 }
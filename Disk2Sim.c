@@ -0,0 +1,208 @@
+/*	Disk2Sim.c
+	Stand-in for PRU0 and PRU1 so Controller can run off a BeagleBone
+	Shares a file-backed mapping with Controller (same layout as PRU memory):
+		./Sim -m /dev/shm/disk2.mem &
+		./Controller -m /dev/shm/disk2.mem -d ~/DiskImages
+
+	PRU0: steps the head of the enabled drive across the disk, a track every -s ms
+		in two half track steps, each published and woken up for as PRU0 does
+	PRU1: "sends" a sector every -r us, as far as Controller has released it
+		unless Controller -s asks it to stream, and rewrites the sector just sent every -w sectors
+	The A2 enables drive 1, or the other drive every -a ms
+	Both log into their trace rings as the PRUs do, for ./Trace -m <memfile>
+	Events go to Controller through the FIFO <memfile>.evt, or -e
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+
+#include "Disk2Mem.h"
+#include "Disk2Event.h"
+#include "Disk2Mailbox.h"
+#include "Disk2Trace.h"
+
+#define NUM_TRACKS			35
+#define NUM_SECTORS			16
+#define SMALL_NIBBLE_SIZE	374
+
+void simShutdown(int sig);
+unsigned long long nowUs(void);
+void trace(unsigned char *ringAdr, unsigned char event, unsigned char a, uint16_t b);
+
+static volatile sig_atomic_t running;
+
+//____________________
+int main(int argc, char *argv[])
+{
+	Pru1Command *command;
+	unsigned char sector, halfTrack[2], buffer, events, drive, *trace0, *trace1;
+	signed char stepDir[2];
+	unsigned int stepMs, sectorUs, writeEvery, driveMs;
+	unsigned long long nextStep, nextDrive, sectorsSent, writesSent, tracksStepped, driveSwitches;
+	const char *backing, *eventSpec;
+	char defaultEvents[256];
+	PruMem pruMem;
+	PruEvents pruEvents;
+	int opt;
+
+	backing		= "/dev/shm/disk2.mem";
+	stepMs		= 500;
+	sectorUs	= 12800;					// 374 bytes * 8 bits * 4 us, roughly
+	writeEvery	= 0;
+	driveMs		= 0;
+	eventSpec	= NULL;
+	while ((opt = getopt(argc, argv, "m:s:r:w:a:e:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'm':	backing = optarg;					break;
+			case 's':	stepMs = atoi(optarg);				break;
+			case 'r':	sectorUs = atoi(optarg);			break;
+			case 'w':	writeEvery = atoi(optarg);			break;
+			case 'a':	driveMs = atoi(optarg);				break;
+			case 'e':	eventSpec = optarg;					break;
+			default:
+				printf("Usage: %s [-m memfile] [-s stepMs] [-r sectorUs] [-w writeEverySectors] [-a driveMs] [-e fifo | poll]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (pruMemOpen(&pruMem, backing))
+		return EXIT_FAILURE;
+
+	command = mailboxCommand(pruMem.base);
+	trace0 = pruMem.base + PRU0_TRACE_ADR;
+	trace1 = pruMem.base + PRU1_DRAM + PRU1_TRACE_ADR;
+
+	if (eventSpec == NULL)
+	{
+		eventDefaultSpec(defaultEvents, sizeof(defaultEvents), backing);
+		eventSpec = defaultEvents;
+	}
+	if (eventOpen(&pruEvents, eventSpec, pruMem.base))
+		return EXIT_FAILURE;
+
+	(void) signal(SIGINT,  simShutdown);
+	(void) signal(SIGTERM, simShutdown);
+
+	halfTrack[0] = halfTrack[1] = 0;
+	stepDir[0] = stepDir[1] = 1;
+	drive = 0;
+	sector = 0;
+	sectorsSent = writesSent = tracksStepped = driveSwitches = 0;
+
+	mailboxSetEnable(pruMem.base, 0);		// a drive always enabled
+	mailboxSetTrack(pruMem.base, 1, 0);
+	mailboxSetTrack(pruMem.base, drive, 0);
+	nextStep = nowUs() + stepMs * 500ULL;
+	nextDrive = nowUs() + driveMs * 1000ULL;
+
+	printf("--- Sim running on %s\n", backing);
+
+	running = 1;
+	while (running)
+	{
+		// A2 enables the other drive, PRU1 picks it up at the next sector
+		if (driveMs && nowUs() >= nextDrive)
+		{
+			drive = !drive;
+			driveSwitches++;
+			nextDrive += driveMs * 1000ULL;
+		}
+
+		// PRU0: move the head of the enabled drive
+		if (stepMs && nowUs() >= nextStep)
+		{
+			if ((halfTrack[drive] == 2 * (NUM_TRACKS-1) && stepDir[drive] > 0) || (halfTrack[drive] == 0 && stepDir[drive] < 0))
+				stepDir[drive] = -stepDir[drive];
+			halfTrack[drive] += stepDir[drive];
+			mailboxSetStep(pruMem.base, drive, halfTrack[drive]);
+			eventSignal(&pruEvents, EVT_TRACK);
+			trace(trace0, TRACE_PHASE, 1 << (halfTrack[drive] % 4), halfTrack[drive] | (drive << 15));
+			if ((halfTrack[drive] % 2 == 0) == (stepDir[drive] > 0))	// track is half track / 2
+			{
+				trace(trace0, TRACE_TRACK, drive, halfTrack[drive] >> 1);
+				tracksStepped++;
+			}
+			nextStep += stepMs * 500ULL;
+		}
+
+		// PRU1: send one sector, then publish it
+		if (mailboxReleased(pruMem.base))
+		{
+			buffer = command->bufSel[drive] % TRACK_BUFS;	// switch track buffers at sector boundary
+			if (pruMem.base[TRACK_BUF_ADR(buffer) + sector * SMALL_NIBBLE_SIZE] == 0x00)
+				sector = 0;						// empty packet, end of a short track
+
+			trace(trace1, TRACE_SECTOR_START, sector, buffer | (drive << 8));
+			usleep(sectorUs);
+			trace(trace1, TRACE_SECTOR_END, sector, SMALL_NIBBLE_SIZE);
+
+			events = command->stream == 1 ? 0 : EVT_SECTOR;
+			if (writeEvery && (sectorsSent + 1) % writeEvery == 0)
+			{
+				// Rewrite the sector just sent, as the WSIG edges HandleWrite() logs
+				trace(trace1, TRACE_WRITE_START, sector, drive);
+				mailboxInjectWrite(pruMem.base, drive, pruMem.base + TRACK_BUF_ADR(buffer) + sector * SMALL_NIBBLE_SIZE,
+					sector);
+				trace(trace1, TRACE_WRITE_END, TRACE_END_WREQ,
+					mailboxSlots(pruMem.base)[mailboxPru1(pruMem.base)->writeSeq % WRITE_SLOTS].edgeCount);
+				events |= EVT_WRITE;
+				writesSent++;
+			}
+
+			mailboxSentSector(pruMem.base, drive, sector, buffer);
+			if (events)
+				eventSignal(&pruEvents, events);
+			sectorsSent++;
+
+			sector++;
+			if (sector == NUM_SECTORS)
+				sector = 0;
+		}
+		else
+			sched_yield();				// wait here till Controller says go
+	}
+
+	printf("\n--- Sim: %llu sectors, %llu writes, %llu head steps, %llu drive switches\n", sectorsSent, writesSent,
+		tracksStepped, driveSwitches);
+	eventClose(&pruEvents);
+	pruMemClose(&pruMem);
+	return EXIT_SUCCESS;
+}
+
+//____________________
+void simShutdown(int sig)
+{
+	running = 0;
+}
+
+//____________________
+unsigned long long nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+//____________________
+void trace(unsigned char *ringAdr, unsigned char event, unsigned char a, uint16_t b)
+{
+	// Trace entry the way Trace() in the firmware makes it, the clock standing in for the IEP counter
+	volatile TraceRing *ring = (volatile TraceRing *) ringAdr;
+	volatile TraceEntry *entry = &ring->entries[ring->total % TRACE_ENTRIES];
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	entry->stamp = (ts.tv_sec * 1000000000ULL + ts.tv_nsec) / (1000000000 / TRACE_HZ);
+	entry->event = event;
+	entry->a = a;
+	entry->b = b;
+	__sync_synchronize();
+	ring->total++;
+}
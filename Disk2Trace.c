@@ -0,0 +1,312 @@
+/*	Disk2Trace.c
+	Drains and decodes the PRU trace rings, see Disk2Trace.h
+		./Trace						what the rings hold now, then timing summary
+		./Trace -f					follow, every 100 ms till ^C
+		./Trace -q					summary only
+		./Trace -m <memfile>		against Sim instead of /dev/mem
+	Times are us from the first entry drained, both PRUs on the one IEP clock
+	Derived from pairs of entries:
+		sector	send time, bit cell (send time / bits), gap since the sector before
+		write	time WREQ- was low, mean time between WSIG edges
+	Controller need not be running, nothing here writes PRU memory
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include "Disk2Mem.h"
+#include "Disk2Trace.h"
+
+#define FOLLOW_US		100000
+#define MAX_DRAINED		(2 * TRACE_ENTRIES)
+
+typedef struct
+{
+	unsigned long long stamp;			// IEP counts, unwrapped
+	unsigned char pru;
+	TraceEntry entry;
+} Drained;
+
+typedef struct
+{
+	unsigned long long n;
+	double min, max, sum;
+} Summary;
+
+typedef struct
+{
+	volatile TraceRing *ring;
+	uint32_t seen;						// entries drained so far
+	unsigned long long last;			// stamp of the last one, unwrapped
+	unsigned char started;				// 1 = last is valid
+} Reader;
+
+void traceShutdown(int sig);
+unsigned int drainRing(Reader *reader, unsigned char pru, Drained *out, unsigned int max);
+void decode(const Drained *d, unsigned char quiet);
+void add(Summary *s, double value);
+void printSummary(const char *name, const Summary *s, const char *unit);
+int byStamp(const void *a, const void *b);
+
+static volatile sig_atomic_t running;
+static unsigned long long firstStamp, lost;
+static unsigned char haveFirst;
+static unsigned long long sectorStart, sectorEnd, writeStart;	// last ones seen, 0 = none or not to be timed
+static Summary bitCell, sectorGap, sectorTime, writeTime, edgeTime;
+static unsigned long long phaseGlitches, trackUpdates, timeouts, longGaps, shortEdges, countFull;
+
+//____________________
+int main(int argc, char *argv[])
+{
+	Reader readers[2];
+	Drained drained[MAX_DRAINED];
+	const char *backing;
+	unsigned char follow, quiet, pru;
+	unsigned int i, n;
+	PruMem pruMem;
+	int opt;
+
+	backing = PRU_MEM_DEVMEM;
+	follow = quiet = 0;
+	while ((opt = getopt(argc, argv, "m:fq")) != -1)
+	{
+		switch (opt)
+		{
+			case 'm':	backing = optarg;	break;
+			case 'f':	follow = 1;			break;
+			case 'q':	quiet = 1;			break;
+			default:
+				printf("Usage: %s [-m /dev/mem | memfile] [-f] [-q]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (pruMemOpen(&pruMem, backing))
+		return EXIT_FAILURE;
+
+	memset(readers, 0, sizeof(readers));
+	readers[0].ring = (volatile TraceRing *) (pruMem.base + PRU0_TRACE_ADR);
+	readers[1].ring = (volatile TraceRing *) (pruMem.base + PRU1_DRAM + PRU1_TRACE_ADR);
+	for (pru=0; pru<2; pru++)			// what the rings still hold, older entries are gone
+	{
+		readers[pru].seen = readers[pru].ring->total;
+		readers[pru].seen -= readers[pru].seen < TRACE_ENTRIES ? readers[pru].seen : TRACE_ENTRIES;
+	}
+
+	(void) signal(SIGINT, traceShutdown);
+	running = 1;
+	do
+	{
+		n = drainRing(&readers[0], 0, drained, MAX_DRAINED);
+		n += drainRing(&readers[1], 1, drained + n, MAX_DRAINED - n);
+		qsort(drained, n, sizeof(Drained), byStamp);
+		for (i=0; i<n; i++)
+			decode(&drained[i], quiet);
+		fflush(stdout);
+		if (follow)
+			usleep(FOLLOW_US);
+	} while (follow && running);
+
+	printf("--- Trace summary\n");
+	printSummary("sector send", &sectorTime, "us");
+	printSummary("bit cell", &bitCell, "us");
+	printSummary("sector gap", &sectorGap, "us");
+	printSummary("write", &writeTime, "us");
+	printSummary("WSIG edge to edge", &edgeTime, "us");
+	printf("  %llu track updates, %llu phase glitches, %llu writes timed out, %llu long gaps, %llu short edges, "
+		"%llu edge counts full, %llu entries lost\n", trackUpdates, phaseGlitches, timeouts, longGaps, shortEdges,
+		countFull, lost);
+
+	pruMemClose(&pruMem);
+	return EXIT_SUCCESS;
+}
+
+//____________________
+void traceShutdown(int sig)
+{
+	running = 0;
+}
+
+//____________________
+unsigned int drainRing(Reader *reader, unsigned char pru, Drained *out, unsigned int max)
+{
+	/*	Entries the PRU wrote since the last drain, oldest first, as far as max
+		Those it wrote over while we copied are dropped and counted lost
+	*/
+	TraceEntry copy[TRACE_ENTRIES];
+	uint32_t total, first;
+	unsigned int n, i, kept;
+
+	total = reader->ring->total;
+	__sync_synchronize();
+	if (total - reader->seen > TRACE_ENTRIES)
+	{
+		lost += total - reader->seen - TRACE_ENTRIES;
+		reader->seen = total - TRACE_ENTRIES;
+		sectorStart = sectorEnd = writeStart = 0;	// don't pair across the hole
+	}
+	n = total - reader->seen;
+	if (n > max)
+		n = max;
+	for (i=0; i<n; i++)
+		memcpy(&copy[i], (const void *) &reader->ring->entries[(reader->seen + i) % TRACE_ENTRIES], sizeof(TraceEntry));
+	__sync_synchronize();
+
+	// Entries before total - TRACE_ENTRIES may have been written again meanwhile
+	first = reader->ring->total - TRACE_ENTRIES;
+	kept = 0;
+	for (i=0; i<n; i++)
+	{
+		if ((int32_t) (reader->seen + i - first) < 0)
+		{
+			lost++;
+			sectorStart = sectorEnd = writeStart = 0;
+			continue;
+		}
+		if (!reader->started)
+		{
+			reader->last = copy[i].stamp;
+			reader->started = 1;
+		}
+		reader->last += (uint32_t) (copy[i].stamp - (uint32_t) reader->last);	// unwrap, entries < 21 s apart
+		out[kept].stamp = reader->last;
+		out[kept].pru = pru;
+		out[kept].entry = copy[i];
+		kept++;
+	}
+	reader->seen += n;
+	return kept;
+}
+
+//____________________
+void decode(const Drained *d, unsigned char quiet)
+{
+	// Prints one entry and folds it into the summary
+	const TraceEntry *e = &d->entry;
+	double us, span;
+
+	if (!haveFirst)
+	{
+		firstStamp = d->stamp;
+		haveFirst = 1;
+	}
+	us = (double) (d->stamp - firstStamp) * 1e6 / TRACE_HZ;
+	if (!quiet)
+		printf("%14.3f  PRU%d  ", us, d->pru);
+
+	switch (e->event)
+	{
+		case TRACE_PHASE:
+			if (!quiet)
+				printf("phase        %X  half track %d  drive %d\n", e->a, e->b & 0x7FFF, (e->b >> 15) + 1);
+			break;
+
+		case TRACE_PHASE_GLITCH:
+			phaseGlitches++;
+			if (!quiet)
+				printf("phase glitch %X then %X\n", e->a, e->b);
+			break;
+
+		case TRACE_TRACK:
+			trackUpdates++;
+			if (!quiet)
+				printf("track        %d  drive %d\n", e->b, e->a + 1);
+			break;
+
+		case TRACE_SECTOR_START:
+			if (sectorEnd)
+				add(&sectorGap, (double) (d->stamp - sectorEnd) * 1e6 / TRACE_HZ);
+			sectorStart = d->stamp;
+			if (!quiet)
+				printf("sector start %d  buffer %d  drive %d\n", e->a, e->b & 0xFF, (e->b >> 8) + 1);
+			break;
+
+		case TRACE_SECTOR_END:
+			span = sectorStart ? (double) (d->stamp - sectorStart) * 1e6 / TRACE_HZ : 0;
+			if (sectorStart)
+			{
+				add(&sectorTime, span);
+				if (e->b)
+					add(&bitCell, span / (e->b * 8));
+			}
+			sectorEnd = d->stamp;
+			if (!quiet)
+				printf("sector end   %d  %d bytes  %.1f us  %.3f us/bit\n", e->a, e->b, span, e->b ? span / (e->b * 8) : 0);
+			break;
+
+		case TRACE_WRITE_START:
+			writeStart = d->stamp;
+			sectorStart = 0;					// sector send time would include the write
+			if (!quiet)
+				printf("write start  sector %d  drive %d\n", e->a, e->b + 1);
+			break;
+
+		case TRACE_WRITE_END:
+			span = writeStart ? (double) (d->stamp - writeStart) * 1e6 / TRACE_HZ : 0;
+			if (writeStart)
+			{
+				add(&writeTime, span);
+				if (e->b > 1)
+					add(&edgeTime, span / e->b);
+			}
+			if (e->a == TRACE_END_TIMEOUT)
+				timeouts++;
+			if (!quiet)
+				printf("write end    %s  %d edges  %.1f us\n", e->a == TRACE_END_TIMEOUT ? "timeout" : "WREQ-", e->b, span);
+			break;
+
+		case TRACE_EDGE_LONG:
+			longGaps++;
+			if (!quiet)
+				printf("edge         %d  5 bit cells or more after the one before\n", e->b);
+			break;
+
+		case TRACE_EDGE_SHORT:
+			shortEdges++;
+			if (!quiet)
+				printf("edge         %d  %.2f us after the one before\n", e->b, e->a * 16 * 1e6 / TRACE_HZ);
+			break;
+
+		case TRACE_EDGE_COUNT:
+			countFull++;
+			if (!quiet)
+				printf("edge count   full at %d\n", e->b);
+			break;
+
+		default:
+			if (!quiet)
+				printf("*** unknown event %d  %d  %d\n", e->event, e->a, e->b);
+	}
+}
+
+//____________________
+void add(Summary *s, double value)
+{
+	if (s->n == 0 || value < s->min)
+		s->min = value;
+	if (s->n == 0 || value > s->max)
+		s->max = value;
+	s->sum += value;
+	s->n++;
+}
+
+//____________________
+void printSummary(const char *name, const Summary *s, const char *unit)
+{
+	if (s->n == 0)
+		printf("  %-18s none\n", name);
+	else
+		printf("  %-18s %8llu  min %10.3f  mean %10.3f  max %10.3f %s\n", name, s->n, s->min, s->sum / s->n, s->max, unit);
+}
+
+//____________________
+int byStamp(const void *a, const void *b)
+{
+	const Drained *x = a, *y = b;
+
+	if (x->stamp != y->stamp)
+		return x->stamp < y->stamp ? -1 : 1;
+	return x->pru - y->pru;
+}
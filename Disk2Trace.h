@@ -0,0 +1,51 @@
+/*	Disk2Trace.h
+	PRU event trace rings, drained by ./Trace
+	Each PRU logs what it does into a ring in its own data RAM, PRU0_TRACE_ADR
+	and PRU1_TRACE_ADR in Disk2Mem.h, stamped with the IEP counter both PRUs
+	share (PRU0 starts it at one count per 200 MHz cycle, it wraps every 21 s)
+	The PRU fills entry total % TRACE_ENTRIES then moves total on; a reader
+	copies the entries it has not seen and keeps those total has not come
+	round to since, the way Controller reads the edge ring
+	Layouts are naturally aligned, Disk2Pru0.c and Disk2Pru1.c carry copies
+*/
+#ifndef _DISK2TRACE_H_
+#define _DISK2TRACE_H_
+
+#include <stdint.h>
+
+#define TRACE_ENTRIES		128			// power of 2, 8 bytes each
+#define TRACE_HZ			200000000	// IEP counts
+
+// Events					   a						b
+#define TRACE_PHASE			1		// phases P3..P0		half track, drive in bit 15
+#define TRACE_PHASE_GLITCH	2		// phases not held 20 us	phases that came instead
+#define TRACE_TRACK			3		// drive				track
+#define TRACE_SECTOR_START	4		// sector				buffer, drive in bit 8
+#define TRACE_SECTOR_END	5		// sector				bytes sent
+#define TRACE_WRITE_START	6		// sector				drive
+#define TRACE_WRITE_END		7		// TRACE_END_			edges logged
+#define TRACE_EDGE_LONG		8		// 255					edge number, gap of 5 bit cells or more
+#define TRACE_EDGE_SHORT	9		// delta, 16 cycles		edge number, under half a bit cell
+#define TRACE_EDGE_COUNT	10		// 0					0xFFFF, edge count stopped
+
+#define TRACE_END_WREQ		0		// WREQ- went back to 1
+#define TRACE_END_TIMEOUT	1		// no WSIG edge for EDGE_TIMEOUT cycles
+
+#define TRACE_EDGE_MARKS	4		// edge anomalies traced per write, at most
+
+typedef struct
+{
+	uint32_t stamp;					// IEP count
+	uint8_t event;					// TRACE_
+	uint8_t a;
+	uint16_t b;
+} TraceEntry;
+
+typedef struct
+{
+	uint32_t total;					// entries written so far
+	uint32_t unused[3];
+	TraceEntry entries[TRACE_ENTRIES];
+} TraceRing;
+
+#endif /* _DISK2TRACE_H_ */
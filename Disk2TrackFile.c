@@ -0,0 +1,282 @@
+/*	Disk2TrackFile.c
+	Encoded image files, see Disk2TrackFile.h
+	Layout: header, then NUM_TRACKS * GCR_TRACK_SIZE bytes of tracks in order
+	Saved under a temporary name and renamed, so a reader never sees half a file
+	A hit touches its file; past TRACK_FILE_LIMIT files a save removes the
+	least recently used, so those of images since changed by writes go in time
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "Disk2TrackFile.h"
+#include "Disk2Gcr.h"
+
+#define TRACK_FILE_MAGIC	"D2TRK01"
+#define NUM_TRACKS			35
+#define TRACK_FILE_LIMIT	256					// about 53 MB of them
+
+typedef struct
+{
+	char magic[8];
+	uint32_t encoder;					// GCR_ENCODER_VERSION
+	uint32_t skew;						// TRACK_FILE_
+	uint64_t contentHash;				// of the raw image, trackFileHash()
+	uint64_t dataHash;					// of the tracks that follow
+	uint32_t trackSize;
+	uint32_t tracks;
+} TrackFileHeader;
+
+typedef struct
+{
+	time_t used;						// mtime, the last save or hit
+	char name[32];						// <hash>-dos.trk or -prodos.trk
+} TrackFileEntry;
+
+static char trackDir[256];				// "" = no track files
+static TrackFileStats stats;
+
+static unsigned long long hashTracks(unsigned char **tracks);
+static void prune(void);
+static int compareUsed(const void *a, const void *b);
+
+//____________________
+void trackFileInit(const char *dir)
+{
+	// dir is created if needed; NULL or "" turns track files off
+	trackDir[0] = '\0';
+	if (dir == NULL || dir[0] == '\0')
+		return;
+	if (mkdir(dir, 0755) == -1)
+	{
+		struct stat st;
+
+		if (stat(dir, &st) == -1 || !S_ISDIR(st.st_mode))
+		{
+			printf("*** ERROR: no track file directory %s\n", dir);
+			return;
+		}
+	}
+	snprintf(trackDir, sizeof(trackDir), "%s", dir);
+}
+
+//____________________
+int trackFileEnabled(void)
+{
+	return trackDir[0] != '\0';
+}
+
+//____________________
+unsigned long long trackFileHash(const unsigned char *data, size_t size)
+{
+	/*	64-bit hash, 8 bytes per step (multiply and xor-shift per word)
+		Quick enough to run on every image load
+	*/
+	unsigned long long h, w;
+	size_t i;
+
+	h = 0x9E3779B97F4A7C15ULL ^ size;
+	for (i=0; i+8<=size; i+=8)
+	{
+		memcpy(&w, data + i, 8);
+		w *= 0xBF58476D1CE4E5B9ULL;
+		w ^= w >> 31;
+		h = (h ^ w) * 0x94D049BB133111EBULL;
+		h ^= h >> 29;
+	}
+	for (; i<size; i++)
+		h = (h ^ data[i]) * 0x100000001B3ULL;
+	return h ^ (h >> 32);
+}
+
+//____________________
+int trackFileLoad(unsigned long long hash, unsigned char skew, unsigned char **tracks)
+{
+	/*	Reads the 35 encoded tracks of the image with this content hash and skew
+		into tracks[0..34], GCR_TRACK_SIZE bytes each
+		Returns 0 on a hit; otherwise the caller encodes and calls trackFileSave()
+	*/
+	TrackFileHeader header;
+	char path[300];
+	unsigned int trk;
+	FILE *fd;
+
+	if (trackDir[0] == '\0')
+		return 1;
+
+	trackFilePath(path, sizeof(path), hash, skew);
+	fd = fopen(path, "rb");
+	if (!fd)
+	{
+		stats.misses++;
+		return 1;
+	}
+
+	if (fread(&header, sizeof(header), 1, fd) != 1 || memcmp(header.magic, TRACK_FILE_MAGIC, 8) != 0 ||
+		header.encoder != GCR_ENCODER_VERSION || header.skew != skew || header.contentHash != hash ||
+		header.trackSize != GCR_TRACK_SIZE || header.tracks != NUM_TRACKS)
+	{
+		fclose(fd);
+		stats.stale++;
+		return 1;
+	}
+
+	for (trk=0; trk<NUM_TRACKS; trk++)
+	{
+		if (fread(tracks[trk], GCR_TRACK_SIZE, 1, fd) != 1)
+			break;
+	}
+	fclose(fd);
+
+	if (trk != NUM_TRACKS || hashTracks(tracks) != header.dataHash)
+	{
+		stats.stale++;
+		return 1;
+	}
+	utimensat(AT_FDCWD, path, NULL, 0);			// recently used, prune() keeps it
+	stats.hits++;
+	return 0;
+}
+
+//____________________
+int trackFileSave(unsigned long long hash, unsigned char skew, unsigned char **tracks)
+{
+	// Writes (or rewrites a stale) track file, returns 0 on success
+	TrackFileHeader header;
+	char path[300], tmpPath[310];
+	unsigned int trk;
+	FILE *fd;
+	int error;
+
+	if (trackDir[0] == '\0')
+		return 1;
+
+	trackFilePath(path, sizeof(path), hash, skew);
+	snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+	fd = fopen(tmpPath, "wb");
+	if (!fd)
+		return 1;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACK_FILE_MAGIC, 8);
+	header.encoder		= GCR_ENCODER_VERSION;
+	header.skew			= skew;
+	header.contentHash	= hash;
+	header.dataHash		= hashTracks(tracks);
+	header.trackSize	= GCR_TRACK_SIZE;
+	header.tracks		= NUM_TRACKS;
+
+	error = fwrite(&header, sizeof(header), 1, fd) != 1;
+	for (trk=0; trk<NUM_TRACKS && !error; trk++)
+		error = fwrite(tracks[trk], GCR_TRACK_SIZE, 1, fd) != 1;
+	if (fclose(fd) != 0)
+		error = 1;
+
+	if (error || rename(tmpPath, path) != 0)
+	{
+		unlink(tmpPath);
+		return 1;
+	}
+	stats.saved++;
+	prune();
+	return 0;
+}
+
+//____________________
+void trackFileGetStats(TrackFileStats *out)
+{
+	*out = stats;
+}
+
+//____________________
+void trackFilePrintStats(void)
+{
+	if (trackDir[0] == '\0')
+		return;
+	printf("Track files: %llu hits, %llu misses, %llu stale, %llu saved, %llu pruned\n",
+		stats.hits, stats.misses, stats.stale, stats.saved, stats.pruned);
+}
+
+//____________________
+void trackFilePath(char *path, size_t len, unsigned long long hash, unsigned char skew)
+{
+	snprintf(path, len, "%s/%016llx-%s.trk", trackDir, hash, skew == TRACK_FILE_DOS ? "dos" : "prodos");
+}
+
+//____________________
+static unsigned long long hashTracks(unsigned char **tracks)
+{
+	unsigned long long h;
+	unsigned int trk;
+
+	h = 0;
+	for (trk=0; trk<NUM_TRACKS; trk++)
+		h = h * 31 + trackFileHash(tracks[trk], GCR_TRACK_SIZE);
+	return h;
+}
+
+//____________________
+static void prune(void)
+{
+	/*	Removes the least recently used track files past TRACK_FILE_LIMIT
+		Content hashes give no link from an image to its old file, so age is
+		what tells files no image has any more from those still wanted
+	*/
+	TrackFileEntry *entries, *more;
+	unsigned int count, room, i;
+	struct dirent *de;
+	struct stat st;
+	size_t len;
+	DIR *dir;
+
+	dir = opendir(trackDir);
+	if (!dir)
+		return;
+	entries = NULL;
+	count = room = 0;
+	while ((de = readdir(dir)) != NULL)
+	{
+		len = strlen(de->d_name);
+		if (len < 4 || len >= sizeof(entries->name) || strcmp(de->d_name + len - 4, ".trk") != 0)
+			continue;
+		if (fstatat(dirfd(dir), de->d_name, &st, 0) == -1 || !S_ISREG(st.st_mode))
+			continue;
+		if (count == room)
+		{
+			room = room ? 2 * room : TRACK_FILE_LIMIT + 16;
+			more = realloc(entries, room * sizeof(TrackFileEntry));
+			if (!more)
+				break;
+			entries = more;
+		}
+		entries[count].used = st.st_mtime;
+		strcpy(entries[count].name, de->d_name);
+		count++;
+	}
+
+	if (count > TRACK_FILE_LIMIT)
+	{
+		qsort(entries, count, sizeof(TrackFileEntry), compareUsed);
+		for (i=0; i<count-TRACK_FILE_LIMIT; i++)
+		{
+			if (unlinkat(dirfd(dir), entries[i].name, 0) == 0)
+				stats.pruned++;
+		}
+	}
+	closedir(dir);
+	free(entries);
+}
+
+//____________________
+static int compareUsed(const void *a, const void *b)
+{
+	// Oldest first
+	time_t ua = ((const TrackFileEntry *) a)->used, ub = ((const TrackFileEntry *) b)->used;
+
+	return ua < ub ? -1 : ua > ub;
+}
@@ -0,0 +1,35 @@
+/*	Disk2TrackFile.h
+	On-disk cache of encoded images: all 35 tracks in the 16 * 374 byte layout
+	PRU1 sends, so the first load of an image after boot needs no GCR work
+	One file per image contents and skew, <dir>/<content hash>-dos.trk or -prodos.trk
+	A file whose header does not match (encoder version, hash, skew, size) or
+	whose data fails its checksum is stale and gets rebuilt
+	At most TRACK_FILE_LIMIT files are kept, the least recently used go
+*/
+#ifndef _DISK2TRACKFILE_H_
+#define _DISK2TRACKFILE_H_
+
+#include <stddef.h>
+
+#define TRACK_FILE_DOS		0
+#define TRACK_FILE_PRODOS	1
+
+typedef struct
+{
+	unsigned long long hits;
+	unsigned long long misses;			// no file
+	unsigned long long stale;			// file there, but not usable
+	unsigned long long saved;
+	unsigned long long pruned;			// least recently used, removed to stay under the limit
+} TrackFileStats;
+
+void trackFileInit(const char *dir);
+int trackFileEnabled(void);
+void trackFilePath(char *path, size_t len, unsigned long long hash, unsigned char skew);
+unsigned long long trackFileHash(const unsigned char *data, size_t size);
+int trackFileLoad(unsigned long long hash, unsigned char skew, unsigned char **tracks);
+int trackFileSave(unsigned long long hash, unsigned char skew, unsigned char **tracks);
+void trackFileGetStats(TrackFileStats *stats);
+void trackFilePrintStats(void);
+
+#endif /* _DISK2TRACKFILE_H_ */
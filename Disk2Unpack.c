@@ -0,0 +1,705 @@
+/*	Disk2Unpack.c
+	Packed images as a stream, see Disk2Unpack.h
+	gzip goes through zlib; 2IMG is a header in front of the image; NuFX
+	threads are stored, or 4 KB chunks RLE'd then LZW'd, ShrinkIt style:
+		LZW/1	CRC, volume, RLE delimiter; each chunk: RLE length, LZW flag,
+				codes; the table starts over every chunk
+		LZW/2	volume, RLE delimiter; each chunk: RLE length | 0x8000 if LZW,
+				then the chunk's length if LZW, codes; the table carries on
+				across chunks until code 0x100 or a chunk stored without LZW
+	Codes are 9 to 12 bits, low bit first, the width set by the next table
+	entry + 1; an RLE length of 4096 means no RLE. LZW/1's CRC is not checked,
+	a chunk that does not come out at 4096 bytes is an error
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "Disk2Unpack.h"
+
+#define TWOIMG_HEADER		64
+#define TWOIMG_DOS			0				// image formats in a 2IMG header
+#define TWOIMG_PRODOS		1
+#define TWOIMG_NIB			2
+
+#define NUFX_MASTER			48				// master header bytes
+#define NUFX_RECORD			128				// longest record header read, attributes only
+#define NUFX_THREADS		16				// most threads in a record looked at
+#define NUFX_CHUNK			4096
+#define NUFX_STORED			0				// thread formats
+#define NUFX_LZW1			2
+#define NUFX_LZW2			3
+#define NUFX_DATA			2				// thread class
+#define NUFX_FILENAME		3
+#define NUFX_FORK			0				// data thread kinds
+#define NUFX_DISK			1
+
+#define LZW_CLEAR			0x100
+#define LZW_FIRST			0x101
+#define LZW_TABLE			0x1000
+
+struct Unpack
+{
+	int fd;
+	unsigned char kind;						// UNPACK_
+	char name[256];							// of the image inside
+	size_t size;							// of the image inside
+	size_t left;							// of it not yet read
+	unsigned char in[UNPACK_INPUT];			// file, read ahead
+	size_t inPos, inEnd;
+
+	z_stream zs;							// gzip
+	unsigned char zsOpen;
+
+	unsigned char format;					// NuFX thread, NUFX_
+	unsigned char delimiter;				// RLE
+	unsigned long long threadLeft;			// compressed bytes of the thread not yet read
+	unsigned int chunkUsed;					// of this chunk's, so far
+	unsigned char chunk[NUFX_CHUNK];		// expanded, being handed out
+	unsigned int chunkPos;
+	unsigned char rle[NUFX_CHUNK];			// LZW output, before RLE is undone
+
+	uint16_t prefix[LZW_TABLE];
+	unsigned char suffix[LZW_TABLE];
+	unsigned char stack[LZW_TABLE];
+	unsigned int entry;						// next free table entry
+	unsigned int oldCode;
+	unsigned char finalChar;
+	unsigned char first;					// 1 = next code starts a fresh table
+	uint32_t bits;							// read, not yet used
+	unsigned int bitCount;
+};
+
+static int openGzip(Unpack *u, const char *imagePath);
+static int open2mg(Unpack *u, const char *imagePath);
+static int openNufx(Unpack *u);
+static int startThread(Unpack *u, const unsigned char *thread);
+static long readGzip(Unpack *u, unsigned char *out, size_t n);
+static long readNufx(Unpack *u, unsigned char *out, size_t n);
+static int nextChunk(Unpack *u);
+static int badChunk(Unpack *u);
+static int lzwExpand(Unpack *u, unsigned char *out, unsigned int length);
+static int fileByte(Unpack *u);
+static size_t fileRead(Unpack *u, unsigned char *buf, size_t n);
+static int fileSkip(Unpack *u, unsigned long long n);
+static int threadByte(Unpack *u);
+static int imageName(const char *name);
+static void baseName(char *name, size_t size, const char *path, const char *ext, const char *newExt);
+static unsigned int le16(const unsigned char *p);
+static unsigned long le32(const unsigned char *p);
+
+//____________________
+int unpackKind(const char *imagePath)
+{
+	// UNPACK_ of imagePath by its extension, 0 for a plain image
+	const char *ext;
+
+	ext = strrchr(imagePath, '.');
+	if (ext && strcmp(ext, ".gz") == 0)
+		return UNPACK_GZIP;
+	if (ext && (strcmp(ext, ".2mg") == 0 || strcmp(ext, ".2img") == 0))
+		return UNPACK_2MG;
+	if (ext && (strcmp(ext, ".shk") == 0 || strcmp(ext, ".sdk") == 0))
+		return UNPACK_NUFX;
+	return 0;
+}
+
+//____________________
+Unpack *unpackOpen(const char *imagePath)
+{
+	/*	Opens a packed image and reads up to where the image inside starts
+		Returns NULL, saying why, if it is not one this can read
+	*/
+	Unpack *u;
+	int failed;
+
+	u = calloc(1, sizeof(Unpack));
+	if (!u)
+	{
+		printf("*** ERROR: out of memory unpacking %s\n", imagePath);
+		return NULL;
+	}
+	u->kind = unpackKind(imagePath);
+	u->fd = open(imagePath, O_RDONLY);
+	if (u->fd == -1)
+	{
+		printf("\n*** Problem opening disk image\n");
+		free(u);
+		return NULL;
+	}
+
+	switch (u->kind)
+	{
+		case UNPACK_GZIP:	failed = openGzip(u, imagePath);	break;
+		case UNPACK_2MG:	failed = open2mg(u, imagePath);		break;
+		case UNPACK_NUFX:	failed = openNufx(u);				break;
+		default:			failed = 1;							break;
+	}
+	if (failed)
+	{
+		printf("*** ERROR: could not unpack %s\n", imagePath);
+		unpackClose(u);
+		return NULL;
+	}
+	if (u->size == 0 || u->size > UNPACK_MAX_SIZE)
+	{
+		printf("*** ERROR: %s holds an image of %zu bytes\n", imagePath, u->size);
+		unpackClose(u);
+		return NULL;
+	}
+	u->left = u->size;
+	return u;
+}
+
+//____________________
+const char *unpackName(const Unpack *u)
+{
+	return u->name;
+}
+
+//____________________
+size_t unpackSize(const Unpack *u)
+{
+	return u->size;
+}
+
+//____________________
+long unpackRead(Unpack *u, unsigned char *out, size_t n)
+{
+	/*	Next n bytes of the image into out
+		Returns how many, fewer only past the end of the image, or -1 if the
+		file is bad or ends before the image does
+	*/
+	long got;
+
+	if (n > u->left)
+		n = u->left;
+	if (n == 0)
+		return 0;
+
+	switch (u->kind)
+	{
+		case UNPACK_GZIP:	got = readGzip(u, out, n);				break;
+		case UNPACK_2MG:	got = fileRead(u, out, n);				break;
+		default:			got = readNufx(u, out, n);				break;
+	}
+	if (got >= 0 && got < (long) n)
+	{
+		printf("*** ERROR: image cut short, %zu bytes missing\n", u->left - got);
+		return -1;
+	}
+	if (got > 0)
+		u->left -= got;
+	return got;
+}
+
+//____________________
+void unpackClose(Unpack *u)
+{
+	if (!u)
+		return;
+	if (u->zsOpen)
+		inflateEnd(&u->zs);
+	close(u->fd);
+	free(u);
+}
+
+//____________________
+static int openGzip(Unpack *u, const char *imagePath)
+{
+	// Image size from the gzip trailer, name without .gz
+	unsigned char trailer[4];
+	struct stat st;
+
+	if (fstat(u->fd, &st) == -1 || st.st_size < 18 || pread(u->fd, trailer, 4, st.st_size - 4) != 4)
+		return 1;
+	u->size = le32(trailer);
+	baseName(u->name, sizeof(u->name), imagePath, ".gz", "");
+
+	if (inflateInit2(&u->zs, 16 + MAX_WBITS) != Z_OK)	// 16 = gzip header and trailer
+		return 1;
+	u->zsOpen = 1;
+	return 0;
+}
+
+//____________________
+static int open2mg(Unpack *u, const char *imagePath)
+{
+	// Header checked and skipped, up to the data
+	static const char *ext[3] = { ".dsk", ".po", ".nib" };
+	unsigned char header[TWOIMG_HEADER];
+	unsigned long format, offset, length;
+
+	if (fileRead(u, header, TWOIMG_HEADER) != TWOIMG_HEADER || memcmp(header, "2IMG", 4) != 0)
+	{
+		printf("*** ERROR: no 2IMG header\n");
+		return 1;
+	}
+	format = le32(header + 12);
+	offset = le32(header + 24);
+	length = le32(header + 28);
+	if (format > TWOIMG_NIB || offset < TWOIMG_HEADER)
+	{
+		printf("*** ERROR: 2IMG format %lu, data at %lu\n", format, offset);
+		return 1;
+	}
+	if (length == 0)						// some ProDOS order images only give blocks
+		length = le32(header + 20) * 512;
+
+	u->size = length;
+	baseName(u->name, sizeof(u->name), imagePath, strrchr(imagePath, '.'), ext[format]);
+	return fileSkip(u, offset - TWOIMG_HEADER);
+}
+
+//____________________
+static int openNufx(Unpack *u)
+{
+	/*	Walks the records to the first disk image thread, or data fork of a
+		.dsk/.po/.nib/.woz file, skipping all else, and starts reading it
+	*/
+	static const unsigned char masterId[6] = { 0x4E, 0xF5, 0x46, 0xE9, 0x6C, 0xE5 };	// "NuFile"
+	static const unsigned char recordId[4] = { 0x4E, 0xF5, 0x46, 0xD8 };				// "NuFX"
+	unsigned char master[NUFX_MASTER], header[NUFX_RECORD], threads[NUFX_THREADS][16];
+	unsigned long records, r, count, t, blocks;
+	unsigned int attribCount, nameLength, length;
+	unsigned char *thread;
+	char recordName[256], *ext;
+
+	if (fileRead(u, master, NUFX_MASTER) != NUFX_MASTER || memcmp(master, masterId, 6) != 0)
+	{
+		printf("*** ERROR: not a NuFX archive\n");
+		return 1;
+	}
+	records = le32(master + 8);
+
+	for (r=0; r<records; r++)
+	{
+		if (fileRead(u, header, 8) != 8 || memcmp(header, recordId, 4) != 0)
+			break;
+		attribCount = le16(header + 6);
+		if (attribCount < 58 || attribCount > NUFX_RECORD || fileRead(u, header + 8, attribCount - 8) != attribCount - 8)
+			break;
+		count = le32(header + 10);
+		blocks = le32(header + 26) * le16(header + 30);		// disk image: extra type blocks of storage type bytes
+
+		// Old style name in the header, a filename thread replaces it
+		nameLength = le16(header + attribCount - 2);
+		length = nameLength < sizeof(recordName) ? nameLength : 0;
+		if (fileRead(u, (unsigned char *) recordName, length) != length || fileSkip(u, nameLength - length))
+			break;
+		recordName[length] = '\0';
+
+		if (count > NUFX_THREADS)
+		{
+			printf("*** ERROR: NuFX record with %lu threads\n", count);
+			return 1;
+		}
+		if (fileRead(u, threads[0], count * 16) != count * 16)
+			break;
+
+		for (t=0; t<count; t++)
+		{
+			thread = threads[t];
+			if (le16(thread) == NUFX_FILENAME)
+			{
+				length = le32(thread + 8) < sizeof(recordName) ? le32(thread + 8) : sizeof(recordName) - 1;
+				if (le32(thread + 12) < length || fileRead(u, (unsigned char *) recordName, length) != length)
+					return 1;
+				recordName[length] = '\0';
+				if (fileSkip(u, le32(thread + 12) - length))
+					return 1;
+				continue;
+			}
+
+			if (le16(thread) == NUFX_DATA && le16(thread + 4) == NUFX_DISK)
+			{
+				u->size = le32(thread + 8) ? le32(thread + 8) : blocks;
+				baseName(u->name, sizeof(u->name), recordName, "", ".po");
+				return startThread(u, thread);
+			}
+			if (le16(thread) == NUFX_DATA && le16(thread + 4) == NUFX_FORK && imageName(recordName))
+			{
+				u->size = le32(thread + 8);
+				baseName(u->name, sizeof(u->name), recordName, "", "");
+				for (ext=strrchr(u->name, '.'); *ext; ext++)		// ProDOS names are upper case
+					*ext = tolower((unsigned char) *ext);
+				return startThread(u, thread);
+			}
+			if (fileSkip(u, le32(thread + 12)))
+				return 1;
+		}
+	}
+	printf("*** ERROR: no disk image in the NuFX archive\n");
+	return 1;
+}
+
+//____________________
+static int startThread(Unpack *u, const unsigned char *thread)
+{
+	// Reads up to the thread's first chunk
+	unsigned char header[4];
+	unsigned int i, length;
+	int b;
+
+	u->format = le16(thread + 2);
+	u->threadLeft = le32(thread + 12);
+	u->chunkPos = NUFX_CHUNK;
+	if (u->format == NUFX_STORED)
+		return 0;
+	if (u->format != NUFX_LZW1 && u->format != NUFX_LZW2)
+	{
+		printf("*** ERROR: NuFX thread format %d, only stored, LZW/1 and LZW/2 are read\n", u->format);
+		return 1;
+	}
+
+	length = u->format == NUFX_LZW1 ? 4 : 2;				// [CRC,] volume, RLE delimiter
+	for (i=0; i<length; i++)
+	{
+		if ((b = threadByte(u)) < 0)
+			return 1;
+		header[i] = b;
+	}
+	u->delimiter = header[length - 1];
+	u->entry = LZW_FIRST;
+	u->first = 1;
+	return 0;
+}
+
+//____________________
+static long readGzip(Unpack *u, unsigned char *out, size_t n)
+{
+	int ret;
+
+	u->zs.next_out = out;
+	u->zs.avail_out = n;
+	while (u->zs.avail_out)
+	{
+		if (u->zs.avail_in == 0)
+		{
+			u->inEnd = read(u->fd, u->in, UNPACK_INPUT);
+			if ((ssize_t) u->inEnd <= 0)
+				break;
+			u->zs.next_in = u->in;
+			u->zs.avail_in = u->inEnd;
+		}
+		ret = inflate(&u->zs, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END)
+			break;
+		if (ret != Z_OK)
+		{
+			printf("*** ERROR: gzip data bad: %s\n", u->zs.msg ? u->zs.msg : "?");
+			return -1;
+		}
+	}
+	return n - u->zs.avail_out;
+}
+
+//____________________
+static long readNufx(Unpack *u, unsigned char *out, size_t n)
+{
+	// Stored: straight from the file; LZW: out of the chunk, the next expanded as needed
+	size_t got, length;
+
+	if (u->format == NUFX_STORED)
+	{
+		if (n > u->threadLeft)
+			n = u->threadLeft;
+		got = fileRead(u, out, n);
+		u->threadLeft -= got;
+		return got;
+	}
+
+	for (got=0; got<n; got+=length)
+	{
+		if (u->chunkPos == NUFX_CHUNK && nextChunk(u))
+			return -1;
+		length = NUFX_CHUNK - u->chunkPos;
+		if (length > n - got)
+			length = n - got;
+		memcpy(out + got, u->chunk + u->chunkPos, length);
+		u->chunkPos += length;
+	}
+	return got;
+}
+
+//____________________
+static int nextChunk(Unpack *u)
+{
+	// Next 4 KB of the thread into chunk, returns 0 on success
+	unsigned int rleLength, lzwLength, lzw, i, o, run;
+	unsigned char *rle;
+	int b0, b1, b2;
+
+	b0 = threadByte(u);
+	b1 = threadByte(u);
+	if (b0 < 0 || b1 < 0)
+		return badChunk(u);
+	rleLength = b0 | b1 << 8;
+	lzwLength = 0;
+	if (u->format == NUFX_LZW1)
+	{
+		if ((b2 = threadByte(u)) < 0)
+			return badChunk(u);
+		lzw = b2;
+	}
+	else
+	{
+		lzw = rleLength & 0x8000;
+		rleLength &= 0x1FFF;
+		if (lzw)
+		{
+			b0 = threadByte(u);
+			b1 = threadByte(u);
+			if (b0 < 0 || b1 < 0)
+				return badChunk(u);
+			lzwLength = b0 | b1 << 8;			// the whole chunk, these 4 bytes included
+		}
+	}
+	if (rleLength > NUFX_CHUNK)
+		return badChunk(u);
+
+	// A chunk RLE did not shrink is the data itself
+	rle = rleLength == NUFX_CHUNK ? u->chunk : u->rle;
+	if (lzw)
+	{
+		if (u->format == NUFX_LZW1)
+		{
+			u->entry = LZW_FIRST;
+			u->first = 1;
+		}
+		u->chunkUsed = 0;
+		if (lzwExpand(u, rle, rleLength))
+			return badChunk(u);
+		for (i=u->chunkUsed+4; i<lzwLength; i++)	// LZW/2: whatever follows the codes
+			if (threadByte(u) < 0)
+				return badChunk(u);
+	}
+	else
+	{
+		u->entry = LZW_FIRST;					// LZW/2 starts over after a chunk without LZW
+		u->first = 1;
+		for (i=0; i<rleLength; i++)
+		{
+			if ((b0 = threadByte(u)) < 0)
+				return badChunk(u);
+			rle[i] = b0;
+		}
+	}
+
+	// delimiter, byte, count - 1 is count of byte
+	if (rle != u->chunk)
+	{
+		for (i=o=0; i<rleLength; i++)
+		{
+			if (rle[i] != u->delimiter)
+			{
+				if (o == NUFX_CHUNK)
+					return badChunk(u);
+				u->chunk[o++] = rle[i];
+				continue;
+			}
+			if (i + 2 >= rleLength)
+				return badChunk(u);
+			run = rle[i + 2] + 1;
+			if (o + run > NUFX_CHUNK)
+				return badChunk(u);
+			memset(u->chunk + o, rle[i + 1], run);
+			o += run;
+			i += 2;
+		}
+		if (o != NUFX_CHUNK)
+			return badChunk(u);
+	}
+	u->chunkPos = 0;
+	return 0;
+}
+
+//____________________
+static int badChunk(Unpack *u)
+{
+	printf("*** ERROR: NuFX chunk bad, %llu bytes of the thread left\n", u->threadLeft);
+	return 1;
+}
+
+//____________________
+static int lzwExpand(Unpack *u, unsigned char *out, unsigned int length)
+{
+	// length bytes out of the LZW codes of one chunk, which start on a byte; returns 0 on success
+	unsigned int n, code, ptr, depth, width;
+	int b;
+
+	u->bits = 0;
+	u->bitCount = 0;
+	n = 0;
+	while (n < length)
+	{
+		width = u->entry + 1 < 0x200 ? 9 : u->entry + 1 < 0x400 ? 10 : u->entry + 1 < 0x800 ? 11 : 12;
+		while (u->bitCount < width)
+		{
+			if ((b = threadByte(u)) < 0)
+				return 1;
+			u->bits |= (uint32_t) b << u->bitCount;
+			u->bitCount += 8;
+		}
+		code = u->bits & ((1 << width) - 1);
+		u->bits >>= width;
+		u->bitCount -= width;
+
+		if (u->format == NUFX_LZW2 && code == LZW_CLEAR)
+		{
+			u->entry = LZW_FIRST;
+			u->first = 1;
+			continue;
+		}
+		if (u->first)
+		{
+			if (code > 0xFF)
+				return 1;
+			out[n++] = code;
+			u->oldCode = code;
+			u->finalChar = code;
+			u->first = 0;
+			continue;
+		}
+
+		// String for code, last byte first; the code being defined is old string + its first byte
+		depth = 0;
+		ptr = code;
+		if (code >= u->entry)
+		{
+			if (code > u->entry)
+				return 1;
+			u->stack[depth++] = u->finalChar;
+			ptr = u->oldCode;
+		}
+		while (ptr > 0xFF)
+		{
+			if (depth == LZW_TABLE - 1)
+				return 1;
+			u->stack[depth++] = u->suffix[ptr];
+			ptr = u->prefix[ptr];
+		}
+		u->finalChar = ptr;
+		if (n + 1 + depth > length)
+			return 1;
+		out[n++] = ptr;
+		while (depth)
+			out[n++] = u->stack[--depth];
+
+		if (u->entry < LZW_TABLE)
+		{
+			u->prefix[u->entry] = u->oldCode;
+			u->suffix[u->entry] = u->finalChar;
+			u->entry++;
+		}
+		u->oldCode = code;
+	}
+	return 0;
+}
+
+//____________________
+static int fileByte(Unpack *u)
+{
+	// Next byte of the file, -1 at its end
+	ssize_t got;
+
+	if (u->inPos == u->inEnd)
+	{
+		got = read(u->fd, u->in, UNPACK_INPUT);
+		if (got <= 0)
+			return -1;
+		u->inPos = 0;
+		u->inEnd = got;
+	}
+	return u->in[u->inPos++];
+}
+
+//____________________
+static size_t fileRead(Unpack *u, unsigned char *buf, size_t n)
+{
+	// n bytes of the file, what is read ahead first, the rest straight into buf; returns how many
+	size_t got;
+	ssize_t r;
+
+	got = u->inEnd - u->inPos < n ? u->inEnd - u->inPos : n;
+	memcpy(buf, u->in + u->inPos, got);
+	u->inPos += got;
+	while (got < n)
+	{
+		r = read(u->fd, buf + got, n - got);
+		if (r <= 0)
+			break;
+		got += r;
+	}
+	return got;
+}
+
+//____________________
+static int fileSkip(Unpack *u, unsigned long long n)
+{
+	// Past n bytes of the file, returns 0 on success
+	size_t buffered;
+
+	buffered = u->inEnd - u->inPos < n ? u->inEnd - u->inPos : n;
+	u->inPos += buffered;
+	n -= buffered;
+	return n && lseek(u->fd, n, SEEK_CUR) == (off_t) -1;
+}
+
+//____________________
+static int threadByte(Unpack *u)
+{
+	// Next byte of the thread's compressed data, -1 at its end
+	if (u->threadLeft == 0)
+		return -1;
+	u->threadLeft--;
+	u->chunkUsed++;
+	return fileByte(u);
+}
+
+//____________________
+static int imageName(const char *name)
+{
+	// 1 if name is a .dsk, .po, .nib or .woz file
+	const char *ext;
+
+	ext = strrchr(name, '.');
+	return ext && (strcasecmp(ext, ".dsk") == 0 || strcasecmp(ext, ".po") == 0 ||
+		strcasecmp(ext, ".nib") == 0 || strcasecmp(ext, ".woz") == 0);
+}
+
+//____________________
+static void baseName(char *name, size_t size, const char *path, const char *ext, const char *newExt)
+{
+	// File name of path, ext cut from its end if there, newExt added; NuFX names may use : as well
+	const char *start, *sep;
+	size_t length;
+
+	start = path;
+	for (sep=path; *sep; sep++)
+		if (*sep == '/' || *sep == ':')
+			start = sep + 1;
+	length = strlen(start);
+	if (ext && length >= strlen(ext) && strcmp(start + length - strlen(ext), ext) == 0)
+		length -= strlen(ext);
+	snprintf(name, size, "%.*s%s", (int) length, start, newExt);
+}
+
+//____________________
+static unsigned int le16(const unsigned char *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+//____________________
+static unsigned long le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned long) p[3] << 24;
+}
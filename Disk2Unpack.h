@@ -0,0 +1,35 @@
+/*	Disk2Unpack.h
+	Images packed in another file, read as a stream:
+		.gz			gzip around a .dsk, .po, .nib or .woz, e.g. Choplifter.dsk.gz
+		.2mg		2IMG header, then DOS or ProDOS order sectors or .nib nibbles
+		.shk .sdk	NuFX (ShrinkIt) archive: the first disk image in it, or the
+					first .dsk/.po/.nib/.woz file; stored, LZW/1 or LZW/2
+	unpackRead() hands the image out a piece at a time, through one small
+	input buffer and, for NuFX, one 4 KB chunk, so Disk2Image encodes each
+	track as it comes in; neither the file nor the image is copied whole
+	unpackName() is the packed image's own name, .dsk, .po, .nib or .woz,
+	which says its sector order or kind the way a plain file's name does;
+	NuFX disk images are always ProDOS order
+*/
+#ifndef _DISK2UNPACK_H_
+#define _DISK2UNPACK_H_
+
+#include <stddef.h>
+
+#define UNPACK_GZIP			1
+#define UNPACK_2MG			2
+#define UNPACK_NUFX			3
+
+#define UNPACK_INPUT		16384			// bytes read from the file at a time
+#define UNPACK_MAX_SIZE		(8 << 20)		// largest image inside, .woz included
+
+typedef struct Unpack Unpack;
+
+int unpackKind(const char *imagePath);
+Unpack *unpackOpen(const char *imagePath);
+const char *unpackName(const Unpack *unpack);
+size_t unpackSize(const Unpack *unpack);
+long unpackRead(Unpack *unpack, unsigned char *out, size_t n);
+void unpackClose(Unpack *unpack);
+
+#endif /* _DISK2UNPACK_H_ */
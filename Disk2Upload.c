@@ -0,0 +1,124 @@
+/*	Disk2Upload.c
+	Differential, word-wide upload of encoded tracks to PRU memory
+	Through the O_SYNC /dev/mem mapping every store is its own uncached bus
+	write, so: aligned 32-bit stores only, and only words whose value the
+	shadow says differs from what the PRU buffer already holds
+	Nothing but Controller writes the track buffers, so the shadow stays true
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "Disk2Upload.h"
+#include "Disk2Mem.h"
+
+#define NUM_WORDS	(TRACK_BUF_SIZE / 4)
+
+static volatile uint32_t *pruBuffer[TRACK_BUFS];
+static uint32_t shadow[TRACK_BUFS][NUM_WORDS];
+static unsigned char shadowValid[TRACK_BUFS];	// 0 until first full upload
+static UploadStats stats;
+
+static unsigned long long nowNs(void);
+
+//____________________
+void uploadInit(unsigned char *pru)
+{
+	// The TRACK_BUF_ADR() buffers of PRU memory at pru, all 32-bit aligned
+	unsigned char buffer;
+
+	for (buffer=0; buffer<TRACK_BUFS; buffer++)
+	{
+		pruBuffer[buffer] = (volatile uint32_t *) (pru + TRACK_BUF_ADR(buffer));
+		shadowValid[buffer] = 0;
+	}
+	memset(&stats, 0, sizeof(stats));
+}
+
+//____________________
+unsigned int uploadTrack(unsigned char buffer, const unsigned char *trackData)
+{
+	/*	Makes PRU track buffer hold trackData (TRACK_BUF_SIZE bytes)
+		Returns number of bytes written to PRU memory
+	*/
+	volatile uint32_t *dst = pruBuffer[buffer];
+	uint32_t *copy = shadow[buffer];
+	uint32_t word;
+	unsigned long long start, elapsed;
+	unsigned int i, written;
+
+	start = nowNs();
+	written = 0;
+	for (i=0; i<NUM_WORDS; i++)
+	{
+		memcpy(&word, trackData + 4*i, 4);		// trackData need not be aligned
+		if (!shadowValid[buffer] || word != copy[i])
+		{
+			dst[i] = word;
+			copy[i] = word;
+			written += 4;
+		}
+	}
+	shadowValid[buffer] = 1;
+	elapsed = nowNs() - start;
+
+	stats.uploads++;
+	stats.bytes += written;
+	stats.skipped += TRACK_BUF_SIZE - written;
+	stats.ns += elapsed;
+	stats.lastNs = elapsed;
+	stats.lastBytes = written;
+	if (elapsed > stats.maxNs)
+		stats.maxNs = elapsed;
+	return written;
+}
+
+//____________________
+void uploadRange(unsigned char buffer, unsigned int offset, const unsigned char *data, unsigned int length)
+{
+	/*	Patches length bytes at offset in PRU track buffer, e.g. a sector written by the A2
+		Whole words around the range are rewritten from the shadow
+	*/
+	volatile uint32_t *dst = pruBuffer[buffer];
+	uint32_t *copy = shadow[buffer];
+	unsigned int i, first, last;
+
+	if (!shadowValid[buffer] || length == 0 || offset + length > TRACK_BUF_SIZE)
+		return;
+
+	memcpy((unsigned char *) copy + offset, data, length);
+	first = offset / 4;
+	last = (offset + length - 1) / 4;
+	for (i=first; i<=last; i++)
+		dst[i] = copy[i];
+	stats.patchBytes += 4 * (last - first + 1);
+}
+
+//____________________
+void uploadGetStats(UploadStats *out)
+{
+	*out = stats;
+}
+
+//____________________
+void uploadPrintStats(void)
+{
+	if (stats.uploads == 0)
+	{
+		printf("Upload: no tracks\n");
+		return;
+	}
+	printf("Upload: %llu tracks, %llu KB written, %llu KB skipped, avg %u bytes %.1f us, max %.1f us, %llu KB patched\n",
+		stats.uploads, stats.bytes / 1024, stats.skipped / 1024,
+		(unsigned int) (stats.bytes / stats.uploads), stats.ns / 1000.0 / stats.uploads, stats.maxNs / 1000.0, stats.patchBytes / 1024);
+}
+
+//____________________
+static unsigned long long nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
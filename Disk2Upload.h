@@ -0,0 +1,27 @@
+/*	Disk2Upload.h
+	Copies encoded tracks into the PRU track buffers
+	Keeps a shadow of what each buffer holds and writes only the 32-bit
+	words that differ, so a return to a recently held track costs little
+*/
+#ifndef _DISK2UPLOAD_H_
+#define _DISK2UPLOAD_H_
+
+typedef struct
+{
+	unsigned long long uploads;				// uploadTrack() calls
+	unsigned long long bytes;				// bytes written to PRU memory by uploadTrack()
+	unsigned long long skipped;				// bytes already there, not written
+	unsigned long long patchBytes;			// bytes written by uploadRange()
+	unsigned long long ns;					// total time in uploadTrack()
+	unsigned long long maxNs;
+	unsigned long long lastNs;
+	unsigned int lastBytes;
+} UploadStats;
+
+void uploadInit(unsigned char *pru);
+unsigned int uploadTrack(unsigned char buffer, const unsigned char *trackData);
+void uploadRange(unsigned char buffer, unsigned int offset, const unsigned char *data, unsigned int length);
+void uploadGetStats(UploadStats *stats);
+void uploadPrintStats(void);
+
+#endif /* _DISK2UPLOAD_H_ */
@@ -8,8 +8,10 @@ echo Setting up PRU pins...
 # P1		P9_29
 # P2		P9_30
 # P3		P9_28
-# EN-		P9_27
-# EN-		P8_28
+# EN1-		P9_27	PRU0
+# EN2-		P9_25	PRU0
+# EN1-		P8_28	PRU1
+# EN2-		P8_30	PRU1
 # WREQ-		P8_41
 # WSIG		P8_39
 config-pin P9_31 pruin
@@ -17,7 +19,9 @@ config-pin P9_29 pruin
 config-pin P9_30 pruin
 config-pin P9_28 pruin
 config-pin P9_27 pruin
+config-pin P9_25 pruin
 config-pin P8_28 pruin
+config-pin P8_30 pruin
 config-pin P8_41 pruin
 config-pin P8_39 pruin
 